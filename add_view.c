@@ -26,7 +26,8 @@ typedef struct attributes {
  
 static Attributes attributes;
 static char *desc_query = "select distinct description from attributes";
-static char *cat_query = "select distinct category from attributes";
+static char *cat_query = "SELECT c.name FROM categories c WHERE EXISTS "\
+                         "(SELECT 1 FROM attributes a WHERE a.category_id = c.id)";
 
 /* prototypes */
 void set_add(GtkWidget* button);
@@ -54,7 +55,7 @@ static void submit_new_item (GtkWidget *widget, Attributes *attributes)
     const gchar *track_hist = gtk_combo_box_get_active_id (attributes->track_history);
 
     int m,d,y;
-    int in_use = desc_already_in_use (description);
+    int in_use = desc_already_in_use (app_db (), description);
 
     int valid_date = parse_and_validate_user_date_str (date_str, &m, &d,&y);
 
@@ -72,13 +73,13 @@ static void submit_new_item (GtkWidget *widget, Attributes *attributes)
         int add_success = 1;
         int up_success = 1;
 
-        add_success = add_attributes (description, category, frequency, 
-                                      freq_type, track_hist);
+        add_success = add_attributes (app_db (), description, category,
+                                      frequency, freq_type, track_hist);
         if (add_success < 0)
             error_dialog (widget, DATABASE_ADD_FAIL);
 
         if (add_success == 1) {
-            up_success = add_upcoming (description, sql_date_str, category);
+            up_success = add_upcoming (app_db (), description, sql_date_str);
             if (up_success < 0)
                 error_dialog (widget, DATABASE_ADD_UPCOMING_FAIL);
         }
@@ -170,7 +171,8 @@ static GtkWidget *make_add_view_box(void)
     gtk_entry_set_completion (GTK_ENTRY (desc), desc_completion);
     g_object_unref (desc_completion);
 
-    GtkTreeModel * desc_completion_model = create_completion_model_from_db (desc_query);
+    GtkTreeModel * desc_completion_model =
+        create_completion_model_from_db (app_db (), desc_query);
 
     if (desc_completion_model == NULL) {
         fprintf (stderr, MEM_FAIL_IN "add_view.c 2\n");
@@ -263,7 +265,8 @@ static GtkWidget *make_add_view_box(void)
     gtk_entry_set_completion (GTK_ENTRY (category), completion);
     g_object_unref (completion);
 
-    GtkTreeModel * completion_model = create_completion_model_from_db (cat_query);
+    GtkTreeModel * completion_model =
+        create_completion_model_from_db (app_db (), cat_query);
     gtk_entry_completion_set_model (completion, completion_model);
     g_object_unref (completion_model);
 
@@ -377,7 +380,8 @@ static void reset_completion (GtkEntry *entry, char *entry_query)
     */
     
 
-    GtkTreeModel * entry_completion_model = create_completion_model_from_db (entry_query);
+    GtkTreeModel * entry_completion_model =
+        create_completion_model_from_db (app_db (), entry_query);
 
     if (entry_completion_model == NULL) {
         fprintf (stderr, MEM_FAIL_IN "add_view.c 5\n");
@@ -6,37 +6,77 @@
 #include <stdlib.h>
 #include <gtk/gtk.h>
 
+#include "category_filter.h"
 #include "dates.h"
 #include "helpers.h"
 #include "main_enum.h"
+#include "prefetch.h"
+#include "query_cache.h"
 #include "setup.h"
 #include "sql_db.h"
+#include "tag_filter.h"
 
 #include <glib-object.h>
 
 
-/* Since this view is loaded with two queries we keep a reference to them in 
+/* Since this view is loaded with a range of days we keep a reference to it in
  * this struct so that when the user modifies the view it can be successfully
  * re-loaded to reflect their changes. */
 typedef struct view_data {
     char *range_desc;
-    char *ahead_query;
-    char *back_query;
+    int   start_day;
+    int   end_day;
     GtkListStore *ahead_model;
     GtkListStore *back_model;
+    GCancellable *loading;   /* set while the panes load, see load_panes */
 } ViewData;
     
 static ViewData capsule;
 
+/* What load_ahead_in_thread and load_back_in_thread load, and where it goes
+ * once both are done. panes is a weak pointer so it turns NULL if the view
+ * is left before then. */
+typedef struct pane_load {
+    int start_day;
+    int end_day;
+    int category_id;    /* see category_filter.c, 0 for every item */
+    Tag_set *tags;      /* see tag_filter.c, NULL for every item */
+    GtkWidget *panes;
+    GtkTreeModel *ahead;
+    GtkTreeModel *back;
+    /* state of the HistPager of the back pane after its first page */
+    char last_date[11];
+    int last_id;
+    int done;
+    int pending;        /* pane loads still running, see panes_loaded */
+    int failed;         /* 1 if one of them failed */
+    int cancelled;      /* 1 if one of them was cancelled */
+    int generation;     /* db_write_generation () when they started */
+} Pane_load;
+
 /* prototypes */
-void set_ahead_back (GtkWidget *widget, char *ahead_query, char *back_query,
+void set_ahead_back (GtkWidget *widget, int start_day, int end_day,
         char* range_desc);
 
 /* These are used to setup the widgets for the view and connect callbacks */
-static GtkWidget *make_ahead_back_view_box (char *ahead_query, char *back_query,
-        char *range_desc);
-static GtkWidget *make_connected_ahead_box (char *ahead_query);
-static GtkWidget *make_connected_back_box (char *back_query);
+static GtkWidget *make_ahead_back_view_box (char *range_desc,
+        GtkWidget **panes);
+static GtkWidget *make_connected_ahead_box (GtkTreeModel *model);
+static GtkWidget *make_connected_back_box (GtkTreeModel *model,
+        HistPager *pager);
+
+/* load the panes off the main thread so leaving the view never waits */
+static void load_panes (GtkWidget *panes, int start_day, int end_day);
+static void start_pane_load (Pane_load *load, GTaskThreadFunc load_pane);
+static void load_ahead_in_thread (GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void load_back_in_thread (GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void panes_loaded (GObject *source_object, GAsyncResult *result,
+        gpointer user_data);
+static void fill_panes (GtkWidget *panes, Pane_load *load);
+static void free_pane_load (Pane_load *load);
+static void stop_loading (void);
 
 /* add_upcoming_columns is used for upcoming items */ 
 static void add_upcoming_columns (GtkTreeView *treeview);
@@ -53,6 +93,7 @@ static void snooze_and_reload_view (GtkWidget *button, ViewData *capsule);
 /* these functions are used to facilitate transitions back and to main */
 static void go_back (GtkWidget *button);
 static void go_main (GtkWidget *button);
+static void reload_view (GtkWidget *widget);
 /* end prototypes */
 
 
@@ -62,13 +103,21 @@ static void go_main (GtkWidget *button);
  * Uses the helper function make_ahead_back_view_box to create the ahead_back_view
  * and sets it in the toplevel window 
  *
- * If either ahead_query or back_query is NULL that part of the view
- * will be ignored. It should not occur that both are NULL 
+ * Both parts of the view cover start_day to end_day (inclusive), the back
+ * part is loaded a page at a time as the user scrolls. The view is shown
+ * right away with a loading label, see load_panes.
  */
-void set_ahead_back (GtkWidget *widget, char *ahead_query, char *back_query, char *range_desc)
+void set_ahead_back (GtkWidget *widget, int start_day, int end_day,
+        char *range_desc)
 {
     GtkWidget *window;
     GtkWidget *child;
+    GtkWidget *box,
+              *panes;
+
+    /* a reload drops whatever the view was still loading */
+    stop_loading ();
+
     window = gtk_widget_get_toplevel (widget);
     child = gtk_bin_get_child (GTK_BIN (window));
     if (child != NULL) {
@@ -77,51 +126,51 @@ void set_ahead_back (GtkWidget *widget, char *ahead_query, char *back_query, cha
 
     /* set the capsules to facilitate re-loading the view */ 
     
-    capsule.ahead_query = ahead_query;
-    capsule.back_query  = back_query;
-    capsule.range_desc = range_desc;
-
-    GtkWidget *box;
+    capsule.start_day   = start_day;
+    capsule.end_day     = end_day;
+    capsule.range_desc  = range_desc;
+    capsule.ahead_model = NULL;
+    capsule.back_model  = NULL;
 
-    box = make_ahead_back_view_box (ahead_query, back_query, range_desc);
+    box = make_ahead_back_view_box (range_desc, &panes);
 
     gtk_container_add (GTK_CONTAINER (window), box);
 
     gtk_widget_show_all (window);
+
+    load_panes (panes, start_day, end_day);
 }
 
 /*
  * FUNC make_ahead_back_view_box
  *   Helper function to set_ahead_back
- * Creates the ahead_back UI
+ * Creates the ahead_back UI, panes is set to the box the ahead and back
+ * parts go in once loaded
  */
-static GtkWidget *make_ahead_back_view_box (char *ahead_query, char *back_query,
-        char *range_desc)
+static GtkWidget *make_ahead_back_view_box (char *range_desc,
+        GtkWidget **panes)
 {
     GtkWidget *box,
-              *box_ahead,
-              *box_back,
-              *label;
+              *heading,
+              *label,
+              *filter,
+              *tags;
 
     box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
 
-
+    heading = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 10);
     label = gtk_label_new (range_desc);
-    gtk_box_pack_start (GTK_BOX (box), label, FALSE, FALSE, 0);
+    gtk_box_set_center_widget (GTK_BOX (heading), label);
+    filter = make_category_filter (reload_view);
+    gtk_box_pack_end (GTK_BOX (heading), filter, FALSE, FALSE, 10);
+    tags = make_tag_filter (reload_view);
+    gtk_box_pack_end (GTK_BOX (heading), tags, FALSE, FALSE, 0);
+    gtk_box_pack_start (GTK_BOX (box), heading, FALSE, FALSE, 0);
     
-    box_ahead = make_connected_ahead_box (ahead_query);
-    box_back  = make_connected_back_box (back_query);
-
-    if (box_ahead != NULL)
-        gtk_box_pack_start (GTK_BOX (box), box_ahead, TRUE, TRUE, 10);
-    if (box_back != NULL)
-        gtk_box_pack_start (GTK_BOX (box), box_back, TRUE, TRUE, 10);
-    if (box_ahead == NULL && box_back == NULL) {
-        GtkWidget *label = gtk_label_new (NO_ITEMS_IN_RANGE);
-        gtk_box_pack_start (GTK_BOX (box), label, FALSE, FALSE, 10);
-    }
-        
-
+    *panes = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+    label = gtk_label_new (LOADING_ITEMS);
+    gtk_box_pack_start (GTK_BOX (*panes), label, FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (box), *panes, TRUE, TRUE, 0);
         
     /* Buttons for the whole view */
     GtkWidget *button_box,
@@ -157,6 +206,278 @@ static GtkWidget *make_ahead_back_view_box (char *ahead_query, char *back_query,
     return box;
 }
 
+/*
+ * FUNC load_panes
+ *   Helper function to set_ahead_back
+ * Fills panes with the ahead and back parts of the view. Models that are at
+ * hand (prefetched or cached) are used as is. The rest are loaded off the
+ * main thread, each pane by a task of its own (load_ahead_in_thread,
+ * load_back_in_thread) over a connection of its own, so both load at the
+ * same time; capsule.loading can interrupt them at any point. Only every
+ * item is prefetched and cached, the items under a category are always
+ * loaded. The items with the tags picked are due index entries checked
+ * against the tag filter, so that pane needs no thread.
+ */
+static void load_panes (GtkWidget *panes, int start_day, int end_day)
+{
+    Query_cache *cache = routine_db_query_cache (app_db ());
+    Pane_load *load;
+
+    load = malloc (sizeof (Pane_load));
+    if (load == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "ahead_back_view.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+
+    load->start_day   = start_day;
+    load->end_day     = end_day;
+    load->category_id = category_filter_get ();
+    load->tags        = tag_filter_eval ();
+    load->panes       = panes;
+    load->ahead       = NULL;
+    load->back        = NULL;
+    g_object_add_weak_pointer (G_OBJECT (panes), (gpointer *) &load->panes);
+
+    /* the default look ahead may have been loaded while the main view sat
+     * idle (see prefetch.c) */
+    if (load->category_id == 0 && load->tags == NULL) {
+        load->ahead = prefetch_take_upcoming (start_day, end_day);
+        if (load->ahead == NULL)
+            load->ahead = create_upcoming_model_indexed (app_db (), start_day,
+                                                         end_day, NULL);
+        load->back = (GtkTreeModel *) query_cache_lookup (cache,
+                CACHED_HISTORY, start_day, end_day, load->last_date,
+                &load->last_id, &load->done);
+    }
+    else if (load->category_id == 0)
+        load->ahead = create_upcoming_model_indexed (app_db (), start_day,
+                                                     end_day, load->tags);
+
+    if (load->ahead != NULL && load->back != NULL) {
+        fill_panes (panes, load);
+        free_pane_load (load);
+        return;
+    }
+
+    load->pending    = (load->ahead == NULL) + (load->back == NULL);
+    load->failed     = 0;
+    load->cancelled  = 0;
+    load->generation = db_write_generation (app_db ());
+
+    capsule.loading = g_cancellable_new ();
+
+    if (load->ahead == NULL)
+        start_pane_load (load, load_ahead_in_thread);
+    if (load->back == NULL)
+        start_pane_load (load, load_back_in_thread);
+}
+
+/*
+ * FUNC start_pane_load
+ *   Helper function to load_panes
+ * Runs load_pane on a thread of the GTask pool, interrupted by
+ * capsule.loading. panes_loaded is called with load once it returns.
+ */
+static void start_pane_load (Pane_load *load, GTaskThreadFunc load_pane)
+{
+    GTask *task = g_task_new (NULL, capsule.loading, panes_loaded, load);
+
+    g_task_set_task_data (task, load, NULL);
+    g_task_run_in_thread (task, load_pane);
+    g_object_unref (task);
+}
+
+/*
+ * FUNC load_ahead_in_thread
+ *   Worker thread. Loads the ahead pane over a View_db of its own, stopping
+ * as soon as cancellable is cancelled.
+ */
+static void load_ahead_in_thread (GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable)
+{
+    Pane_load *load = task_data;
+    View_db *vdb = open_view_db (app_db (), cancellable);
+
+    if (vdb != NULL) {
+        load->ahead = create_upcoming_model_on (vdb->conn, load->start_day,
+                                                load->end_day,
+                                                load->category_id,
+                                                load->tags);
+        close_view_db (vdb);
+    }
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    g_task_return_boolean (task, load->ahead != NULL);
+}
+
+/*
+ * FUNC load_back_in_thread
+ *   Worker thread. Loads the first page of the back pane over a View_db of
+ * its own, stopping as soon as cancellable is cancelled.
+ */
+static void load_back_in_thread (GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable)
+{
+    Pane_load *load = task_data;
+    View_db *vdb = open_view_db (app_db (), cancellable);
+
+    if (vdb != NULL) {
+        load->back = create_hist_range_model_on (app_db (), vdb->conn,
+                                                 load->start_day,
+                                                 load->end_day,
+                                                 load->category_id,
+                                                 load->tags,
+                                                 load->last_date,
+                                                 &load->last_id, &load->done);
+        close_view_db (vdb);
+    }
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    g_task_return_boolean (task, load->back != NULL);
+}
+
+/*
+ * FUNC panes_loaded
+ *   Called on the main thread as each pane load returns, user_data is their
+ * Pane_load. Once the last is in the panes are filled (and cached unless
+ * the db was written meanwhile); work that was cancelled, or whose view is
+ * gone, is dropped along with load.
+ */
+static void panes_loaded (GObject *source_object, GAsyncResult *result,
+        gpointer user_data)
+{
+    GTask *task = G_TASK (result);
+    Pane_load *load = user_data;
+    GError *error = NULL;
+
+    if (!g_task_propagate_boolean (task, &error)) {
+        if (error != NULL) {
+            load->cancelled = 1;
+            g_error_free (error);
+        }
+        else
+            load->failed = 1;
+    }
+
+    if (--load->pending > 0)
+        return;
+
+    /* cancelled, capsule.loading was already dropped */
+    if (load->cancelled) {
+        free_pane_load (load);
+        return;
+    }
+
+    if (capsule.loading == g_task_get_cancellable (task))
+        g_clear_object (&capsule.loading);
+
+    if (load->panes == NULL) {
+        free_pane_load (load);
+        return;
+    }
+
+    if (load->failed) {
+        fprintf(stderr, DATABASE_ERROR_FATAL);
+        exit(EXIT_FAILURE);
+    }
+
+    /* a write since the loads started may have missed their rows, and the
+     * triggers had no entry to drop yet, so the cache only gets rows that
+     * are still current */
+    if (load->category_id == 0 && load->tags == NULL &&
+        load->generation == db_write_generation (app_db ())) {
+        Query_cache *cache = routine_db_query_cache (app_db ());
+
+        query_cache_store (cache, CACHED_UPCOMING, load->start_day,
+                           load->end_day, GTK_LIST_STORE (load->ahead), NULL,
+                           0, 1);
+        query_cache_store (cache, CACHED_HISTORY, load->start_day,
+                           load->end_day, GTK_LIST_STORE (load->back),
+                           load->last_date, load->last_id, load->done);
+    }
+
+    fill_panes (load->panes, load);
+    free_pane_load (load);
+}
+
+/*
+ * FUNC fill_panes
+ *   Replaces the loading label in panes with the ahead and back parts made
+ * from the models in load, which are handed over to the views
+ */
+static void fill_panes (GtkWidget *panes, Pane_load *load)
+{
+    GtkWidget *box_ahead,
+              *box_back;
+    GList *children, *child;
+    HistPager *pager;
+
+    children = gtk_container_get_children (GTK_CONTAINER (panes));
+    for (child = children; child != NULL; child = child->next)
+        gtk_widget_destroy (GTK_WIDGET (child->data));
+    g_list_free (children);
+
+    pager = hist_pager_new_for_range_from (app_db (), load->start_day,
+                                           load->end_day, load->category_id,
+                                           load->tags, load->last_date,
+                                           load->last_id, load->done);
+    if (pager == NULL) {
+        fprintf(stderr, DATABASE_ERROR_FATAL);
+        exit(EXIT_FAILURE);
+    }
+
+    box_ahead = make_connected_ahead_box (load->ahead);
+    box_back  = make_connected_back_box (load->back, pager);
+    load->ahead = NULL;
+    load->back  = NULL;
+
+    if (box_ahead != NULL)
+        gtk_box_pack_start (GTK_BOX (panes), box_ahead, TRUE, TRUE, 10);
+    if (box_back != NULL)
+        gtk_box_pack_start (GTK_BOX (panes), box_back, TRUE, TRUE, 10);
+    if (box_ahead == NULL && box_back == NULL) {
+        GtkWidget *label = gtk_label_new (NO_ITEMS_IN_RANGE);
+        gtk_box_pack_start (GTK_BOX (panes), label, FALSE, FALSE, 10);
+    }
+
+    gtk_widget_show_all (panes);
+}
+
+/*
+ * FUNC free_pane_load
+ *   Drops the models left in load and frees it
+ */
+static void free_pane_load (Pane_load *load)
+{
+    if (load->panes != NULL)
+        g_object_remove_weak_pointer (G_OBJECT (load->panes),
+                                      (gpointer *) &load->panes);
+    if (load->ahead != NULL)
+        g_object_unref (load->ahead);
+    if (load->back != NULL)
+        g_object_unref (load->back);
+    tag_set_free (load->tags);
+    free (load);
+}
+
+/*
+ * FUNC stop_loading
+ *   Cancels the panes still loading, if any. The worker's query is
+ * interrupted and everything it made is freed once it returns.
+ */
+static void stop_loading (void)
+{
+    if (capsule.loading == NULL)
+        return;
+
+    g_cancellable_cancel (capsule.loading);
+    g_clear_object (&capsule.loading);
+}
+
 /*
  * FUNC add_upcoming_columns
  *   Used to add columns to the upcoming due items TreeView
@@ -317,29 +638,24 @@ add_hist_columns (GtkTreeView *treeview)
 
 /* 
  * FUNC make_connected_ahead_box
- *   Helper function to make_ahead_back_view_box
- * Creates the box that holds items with due dates in the range selected
+ *   Helper function to fill_panes
+ * Creates the box that holds the items of model, those with due dates in the
+ * range. Takes over the reference to model.
  * Connects the appropriate callbacks
  */
-static GtkWidget *make_connected_ahead_box (char *ahead_query)
+static GtkWidget *make_connected_ahead_box (GtkTreeModel *model)
                                      
 {
-    int count;
     GtkWidget *box,
               *label,
               *sw,
               *treeview;
-    GtkTreeModel *model;
              
 
-    /* initilize dates */
-    count = count_rows_from_query (ahead_query);
-    if (count < 0) {
-        fprintf(stderr, DATABASE_ERROR_FATAL);
-        exit(EXIT_FAILURE);
-    }
-    if (count == 0)
+    if (gtk_tree_model_iter_n_children (model, NULL) == 0) {
+        g_object_unref (model);
         return NULL;
+    }
 
     /* The box that holds the whole view */
     box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 10);
@@ -363,12 +679,6 @@ static GtkWidget *make_connected_ahead_box (char *ahead_query)
 
     gtk_box_pack_start (GTK_BOX (box), sw, TRUE, TRUE, 0);
 
-    model = create_main_model_from_db (ahead_query);
-    if (model == NULL) {
-        fprintf(stderr, FATAL_ERROR);
-        exit(EXIT_FAILURE);
-    }
-
     treeview = gtk_tree_view_new_with_model (model);
 
     GtkTreeModel *tmodel;
@@ -435,29 +745,28 @@ static GtkWidget *make_connected_ahead_box (char *ahead_query)
 
 /* 
  * FUNC make_conected_back_box
- *   Helper function to make_ahead_back_view_box
+ *   Helper function to fill_panes
  * Creates the box that holds the items that have been completed in the date
  * range the user selected
+ * model holds the first page of history, pager loads the rest as the user
+ * scrolls down. Takes over both.
  * Connects the appropriate callbacks
  */
-static GtkWidget *make_connected_back_box (char *back_query)
+static GtkWidget *make_connected_back_box (GtkTreeModel *model,
+        HistPager *pager)
                                      
 {
-    int count;
     GtkWidget *box,
               *label,
               *sw,
               *treeview;
-    GtkTreeModel *model;
              
 
-    count = count_rows_from_query (back_query);
-    if (count < 0) {
-        fprintf(stderr, DATABASE_ERROR_FATAL);
-        exit(EXIT_FAILURE);
-    }
-    if (count == 0)
+    if (gtk_tree_model_iter_n_children (model, NULL) == 0) {
+        hist_pager_free (pager);
+        g_object_unref (model);
         return NULL;
+    }
 
     /* The box that holds the whole view */
     box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 10);
@@ -479,12 +788,6 @@ static GtkWidget *make_connected_back_box (char *back_query)
 
     gtk_box_pack_start (GTK_BOX (box), sw, TRUE, TRUE, 0);
 
-    model = create_main_model_from_db (back_query);
-    if (model == NULL) {
-        fprintf(stderr, FATAL_ERROR);
-        exit(EXIT_FAILURE);
-    }
-
     treeview = gtk_tree_view_new_with_model (model);
 
     GtkTreeModel *tmodel;
@@ -498,6 +801,9 @@ static GtkWidget *make_connected_back_box (char *back_query)
 
     gtk_container_add (GTK_CONTAINER (sw), treeview);
 
+    /* sw now owns the pager */
+    hist_pager_attach (sw, pager);
+
     add_hist_columns (GTK_TREE_VIEW (treeview));
 
     /* buttons for the range...*/
@@ -556,8 +862,7 @@ static GtkWidget *make_connected_back_box (char *back_query)
  */
 static void go_back (GtkWidget *button)
 {
-    free (capsule.ahead_query);
-    free (capsule.back_query);
+    stop_loading ();
     free (capsule.range_desc);
     set_look_select (button);
 }
@@ -568,12 +873,21 @@ static void go_back (GtkWidget *button)
  */
 static void go_main (GtkWidget *button)
 {
-    free (capsule.ahead_query);
-    free (capsule.back_query);
+    stop_loading ();
     free (capsule.range_desc);
     set_main (button);
 }
 
+/*
+ * FUNC reload_view
+ *   Loads the same range again once the category filter changed
+ */
+static void reload_view (GtkWidget *widget)
+{
+    set_ahead_back (widget, capsule.start_day, capsule.end_day,
+                    capsule.range_desc);
+}
+
 
 /*
  * FUNC remove_hist_and_reload_view 
@@ -584,8 +898,8 @@ static void remove_hist_and_reload_view (GtkWidget *button, ViewData *capsule)
 {
     GtkListStore *store = capsule->back_model;
     
-    remove_selected_historical_entries (button, store);
-    set_ahead_back (button, capsule->ahead_query, capsule->back_query, 
+    remove_selected_historical_entries (app_db (), button, store);
+    set_ahead_back (button, capsule->start_day, capsule->end_day,
             capsule->range_desc);
 }
 
@@ -598,8 +912,8 @@ static void change_hist_and_reload_view (GtkWidget *button, ViewData *capsule)
 {
     GtkListStore *store = capsule->back_model;
     
-    change_hist_on_selected (button, store);
-    set_ahead_back (button, capsule->ahead_query, capsule->back_query,
+    change_hist_on_selected (app_db (), button, store);
+    set_ahead_back (button, capsule->start_day, capsule->end_day,
             capsule->range_desc);
 }
 
@@ -611,8 +925,8 @@ static void change_hist_and_reload_view (GtkWidget *button, ViewData *capsule)
 static void complete_and_reload_view (GtkWidget *button, ViewData *capsule)
 {
     GtkListStore *store = capsule->ahead_model;
-    complete_selected_items (button, store);
-    set_ahead_back (button, capsule->ahead_query, capsule->back_query,
+    complete_selected_items (app_db (), button, store);
+    set_ahead_back (button, capsule->start_day, capsule->end_day,
             capsule->range_desc);
 }
 
@@ -624,7 +938,7 @@ static void complete_and_reload_view (GtkWidget *button, ViewData *capsule)
 static void snooze_and_reload_view (GtkWidget *button, ViewData *capsule)
 {
     GtkListStore *store = capsule->ahead_model;
-    snooze_selected_items (button, store);
-    set_ahead_back (button, capsule->ahead_query, capsule->back_query,
+    snooze_selected_items (app_db (), button, store);
+    set_ahead_back (button, capsule->start_day, capsule->end_day,
             capsule->range_desc);
 }
@@ -0,0 +1,214 @@
+/*******************************************************************************
+ * archive.c
+ * Keeps history down to the last history_hot_days (see config.c) of
+ * completions. Older ones are moved to a db of their own, attached to the
+ * main connection as "archive", with the same columns and ids as history.
+ * Queries of a range that starts after the end day of the archive (the day
+ * of its newest completion, kept with each RoutineDb) never touch it, the
+ * others read both (see the _ARCHIVED queries in sql_db.c).
+ *
+ * The latest completion of every item stays in history however old it is,
+ * so the due dates, item_stats' last completion and the due_dirty triggers
+ * (see schema.c) only ever need history. So does the highest id, so the ids
+ * history hands out next are never ones already in the archive.
+ *
+ * item_stats only counts what is in history, get_item_stats adds the rest.
+ * A completion in the archive that is edited is moved back first (see
+ * unarchive_entry in sql_db.c). Triggers cannot write to another db, so
+ * purge_items deletes the archived completions of an item itself.
+ ******************************************************************************/
+#include <stdio.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h> /* needed because we make use of "sql_db.h" */
+
+#include "archive.h"
+#include "config.h"
+#include "dates.h"
+#include "setup.h"
+#include "sql_db.h"
+
+/* The completions of history archive_old_history moves, those before the
+ * day ?1 but for the latest of each item and the highest id */
+#define ARCHIVABLE \
+    "FROM main.history h WHERE h.date < DATE(?1 + " JULIAN_DAY_0 ") "\
+    "AND h.id < (SELECT MAX(id) FROM main.history) "\
+    "AND h.date < IFNULL((SELECT s.last_date FROM main.item_stats s "\
+    "    WHERE s.item_id = h.item_id), '~')"
+
+static const char *archive_schema[] = {
+    "CREATE TABLE IF NOT EXISTS archive.history (description text, "
+    "    date text, category text, item_id integer, id INTEGER PRIMARY KEY)",
+    "CREATE INDEX IF NOT EXISTS archive.history_item "
+    "    ON history (item_id, date)",
+    "CREATE INDEX IF NOT EXISTS archive.history_date ON history (date)"
+};
+
+#define NUM_ARCHIVE_SCHEMA \
+    (sizeof (archive_schema) / sizeof (archive_schema[0]))
+
+/* prototypes */
+int archive_attach (sqlite3 *db, const char *path, int *end_day);
+int archive_attach_reader (sqlite3 *conn, const char *path);
+int archive_old_history (sqlite3 *db, int today, int limit, int *end_day);
+
+static int attach (sqlite3 *conn, const char *path);
+static int read_end_day (sqlite3 *db, int *end_day);
+static int move_archivable (sqlite3 *db, const char *query, int before_day,
+                            int limit);
+/* end prototypes */
+
+/*
+ * FUNC archive_attach
+ *   Attaches the archive at path to a main connection, making its table if
+ * it is not there yet, and reads its end day (0 if it is empty) into
+ * end_day
+ * Returns the sqlite3 status code of the operation
+ */
+int archive_attach (sqlite3 *db, const char *path, int *end_day)
+{
+    int rc = attach (db, path);
+
+    for (size_t i = 0; rc == SQLITE_OK && i < NUM_ARCHIVE_SCHEMA; i++)
+        rc = sqlite3_exec (db, archive_schema[i], NULL, NULL, NULL);
+
+    if (rc == SQLITE_OK)
+        rc = read_end_day (db, end_day);
+
+    return rc;
+}
+
+/*
+ * FUNC archive_attach_reader
+ *   Attaches the archive to a read only connection. Done even while nothing
+ * has been archived, the upkeep may move completions there while the
+ * connection is kept (see open_view_db in sql_db.c)
+ * Returns the sqlite3 status code of the operation
+ */
+int archive_attach_reader (sqlite3 *conn, const char *path)
+{
+    return attach (conn, path);
+}
+
+/*
+ * FUNC archive_old_history
+ *   Moves up to limit of what is older than history_hot_days before today
+ * from history to the archive, lowest ids first, and updates end_day. The
+ * space it took goes back with the next incremental vacuum (see vacuum_some
+ * in maintenance.c). Run by the upkeep of the db a batch at a time, see
+ * archive_some in maintenance.c
+ *
+ * A COMMIT that writes both files is not atomic in WAL mode, so the move
+ * is two commits of one file each: the copy to the archive, then the delete
+ * from history of only the rows the archive has. A crash in between leaves
+ * the rows in both until the next run, which copies nothing new (the copy
+ * ignores ids already there) and deletes them.
+ * Returns the number of completions moved (less than limit once there are
+ * none left), -1 on error
+ */
+int archive_old_history (sqlite3 *db, int today, int limit, int *end_day)
+{
+    int before_day = today - config_get ()->history_hot_days;
+    int moved;
+
+    if (move_archivable (db, "INSERT OR IGNORE INTO archive.history "
+                             "(description, date, category, item_id, id) "
+                             "SELECT h.description, h.date, h.category, "
+                             "h.item_id, h.id " ARCHIVABLE " "
+                             "ORDER BY h.id LIMIT ?2", before_day, limit) < 0)
+        return -1;
+
+    moved = move_archivable (db, "DELETE FROM main.history WHERE id IN "
+                                 "(SELECT h.id " ARCHIVABLE " "
+                                 "AND h.id IN (SELECT id FROM archive.history) "
+                                 "ORDER BY h.id LIMIT ?2)", before_day, limit);
+
+    if (moved > 0)
+        read_end_day (db, end_day);
+
+    return moved;
+}
+
+/*
+ * FUNC attach
+ *   Helper function to archive_attach and archive_attach_reader
+ * Attaches the archive at path (see config_archive_path) to conn as
+ * "archive"
+ * Returns the sqlite3 status code of the operation
+ */
+static int attach (sqlite3 *conn, const char *path)
+{
+    sqlite3_stmt *res;
+
+    int rc = sqlite3_prepare_v2 (conn, "ATTACH DATABASE ? AS archive", -1,
+                                 &res, 0);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text (res, 1, path, -1, SQLITE_STATIC);
+        rc = sqlite3_step (res);
+        rc = (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+    }
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_OK)
+        log_db_error(rc);
+
+    return rc;
+}
+
+/*
+ * FUNC read_end_day
+ *   Sets end_day to the day of the newest completion in the archive attached
+ * to db, 0 if there is none
+ * Returns the sqlite3 status code of the operation
+ */
+static int read_end_day (sqlite3 *db, int *end_day)
+{
+    sqlite3_stmt *res;
+
+    int rc = sqlite3_prepare_v2 (db, "SELECT IFNULL(CAST(julianday(MAX(date)) "
+                                     "- " JULIAN_DAY_0 " AS integer), 0) "
+                                     "FROM archive.history", -1, &res, 0);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_step (res);
+        if (rc == SQLITE_ROW) {
+            *end_day = sqlite3_column_int (res, 0);
+            rc = SQLITE_OK;
+        }
+    }
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_OK)
+        log_db_error(rc);
+
+    return rc;
+}
+
+/*
+ * FUNC move_archivable
+ *   Helper function to archive_old_history
+ * Runs query, a write to up to limit of the ARCHIVABLE rows, for the day
+ * before_day
+ * Returns the number of rows written, -1 on error
+ */
+static int move_archivable (sqlite3 *db, const char *query, int before_day,
+                            int limit)
+{
+    sqlite3_stmt *res;
+
+    int rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    sqlite3_bind_int (res, 1, before_day);
+    sqlite3_bind_int (res, 2, limit);
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    return sqlite3_changes (db);
+}
@@ -0,0 +1,24 @@
+/*******************************************************************************
+ * archive.h
+ * Header for the archive db, where completions older than history_hot_days
+ * are moved so the history every view reads stays small.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+
+/* Attaches the archive at path (see config_archive_path) to db (a main
+ * connection) as "archive", making it if there is none, and sets end_day to
+ * the day of its newest completion, 0 if it is empty. A range starting after
+ * it is all in history. Returns a sqlite3 status code */
+int archive_attach (sqlite3 *db, const char *path, int *end_day);
+
+/* Attaches the archive at path to conn (a read only connection, see
+ * open_reader_db), once archive_attach has made it, returns a sqlite3 status
+ * code */
+int archive_attach_reader (sqlite3 *conn, const char *path);
+
+/* Moves up to limit of the completions older than history_hot_days before
+ * today out of history and updates end_day, returns how many were moved
+ * (less than limit once there are none left), -1 on error */
+int archive_old_history (sqlite3 *db, int today, int limit, int *end_day);
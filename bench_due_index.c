@@ -0,0 +1,229 @@
+/*******************************************************************************
+ * bench_due_index.c
+ * Times the queries behind the main view and the default look ahead on the
+ * upcoming table against the same queries answered by due_index.c.
+ *
+ * Usage: bench [number of items]      (1000000 if not given)
+ * Builds BENCH_DB the first time (remove it to change the number of items).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "dates.h"
+#include "due_index.h"
+
+#define BENCH_DB "bench_due_index.db"
+#define DEFAULT_ITEMS 1000000
+#define RUNS 20
+
+/* same query as UPCOMING_RANGE in sql_db.c */
+#define RANGE_QUERY \
+    "SELECT description, date, category, item_id, 0 FROM upcoming "\
+    "WHERE date >= DATE(?1 + " JULIAN_DAY_0 ") "\
+    "AND date <= DATE(?2 + " JULIAN_DAY_0 ")"
+
+/* due dates spread from a month overdue to five years out */
+#define FILL_QUERY \
+    "INSERT INTO upcoming (description, date, category, item_id) "\
+    "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n "\
+    "    WHERE i < ?1) "\
+    "SELECT 'item ' || i, "\
+    "    DATE(julianday('now', 'localtime') - 30 + abs(random()) % 1855), "\
+    "    'category ' || (i % 50), i FROM n"
+
+/* prototypes */
+static double now_ms (void);
+static int make_bench_db (sqlite3 *db, int n_items);
+static int count_sql (sqlite3 *db, int start_day, int end_day);
+static int count_index (Due_index *index, int start_day, int end_day);
+static void run (sqlite3 *db, Due_index *index, const char *name,
+                 int start_day, int end_day);
+/* end prototypes */
+
+int main (int argc, char *argv[])
+{
+    sqlite3 *db;
+    Due_index *index;
+    double started;
+    int agree;
+    int n_items = (argc > 1) ? atoi (argv[1]) : DEFAULT_ITEMS;
+    int today = get_current_day ();
+
+    if (sqlite3_open (BENCH_DB, &db) != SQLITE_OK) {
+        fprintf (stderr, "Error: could not open %s\n", BENCH_DB);
+        return EXIT_FAILURE;
+    }
+
+    if (make_bench_db (db, n_items) < 0) {
+        fprintf (stderr, "Error: %s\n", sqlite3_errmsg (db));
+        sqlite3_close (db);
+        return EXIT_FAILURE;
+    }
+
+    started = now_ms ();
+    if (due_index_init (db, &index) != SQLITE_OK) {
+        fprintf (stderr, "Error: %s\n", sqlite3_errmsg (db));
+        due_index_close (index);
+        sqlite3_close (db);
+        return EXIT_FAILURE;
+    }
+    printf ("due index loaded in %.1f ms\n\n", now_ms () - started);
+
+    printf ("%-22s %10s %12s %12s\n", "query", "rows", "sql ms", "index ms");
+    run (db, index, "main view (<= today)", 1, today);
+    run (db, index, "look ahead 1 week", today + 1, today + 7);
+    run (db, index, "look ahead 1 year", today + 1, today + 365);
+
+    /* writes go through the triggers, the index has to agree after them */
+    sqlite3_exec (db, "BEGIN;"
+                      "UPDATE upcoming SET date = DATE(date, '+1 day') "
+                      "    WHERE item_id % 1000 = 0;"
+                      "DELETE FROM upcoming WHERE item_id % 1000 = 1;"
+                      "INSERT INTO upcoming (description, date, category, "
+                      "    item_id) SELECT description || ' copy', date, "
+                      "    category, item_id + 10000000 FROM upcoming "
+                      "    WHERE item_id % 1000 = 2;"
+                      "COMMIT;", NULL, NULL, NULL);
+    agree = count_sql (db, 1, today + 365) ==
+            count_index (index, 1, today + 365);
+    printf ("\nafter writes, index agrees with sql: %s\n", agree ? "yes" : "NO");
+
+    due_index_close (index);
+    sqlite3_close (db);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * FUNC now_ms
+ *   Monotonic time in milliseconds
+ */
+static double now_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * FUNC make_bench_db
+ *   Creates and fills upcoming with n_items unless it is already there.
+ * A db made before it had upcoming_date gets it here
+ * Returns 1 on success and -1 on error
+ */
+static int make_bench_db (sqlite3 *db, int n_items)
+{
+    sqlite3_stmt *res;
+    int rc;
+
+    /* just the columns due_index.c reads, and the index of version 5 in
+     * schema.c so the queries run as they would on a real db */
+    rc = sqlite3_exec (db, "CREATE TABLE IF NOT EXISTS upcoming "
+                           "(description text, date text, category text, "
+                           "item_id integer);"
+                           "CREATE INDEX IF NOT EXISTS upcoming_date "
+                           "ON upcoming (date);"
+                           "CREATE TABLE IF NOT EXISTS attributes "
+                           "(id INTEGER PRIMARY KEY, category_id integer);"
+                           "CREATE TABLE IF NOT EXISTS categories "
+                           "(id INTEGER PRIMARY KEY, name text)",
+                           NULL, NULL, NULL);
+    if (rc != SQLITE_OK)
+        return -1;
+
+    rc = sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM upcoming", -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return -1;
+    rc = (sqlite3_step (res) == SQLITE_ROW) ? sqlite3_column_int (res, 0) : -1;
+    sqlite3_finalize (res);
+    if (rc != 0)
+        return (rc > 0) ? 1 : -1;
+
+    printf ("filling %s with %d items...\n", BENCH_DB, n_items);
+
+    rc = sqlite3_prepare_v2 (db, FILL_QUERY, -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return -1;
+    sqlite3_bind_int (res, 1, n_items);
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
+
+    return (rc == SQLITE_DONE) ? 1 : -1;
+}
+
+/*
+ * FUNC count_sql
+ *   Runs the range query and reads every column of every row, like
+ * append_main_rows does
+ * Returns the number of rows
+ */
+static int count_sql (sqlite3 *db, int start_day, int end_day)
+{
+    sqlite3_stmt *res;
+    int rows = 0;
+
+    sqlite3_prepare_v2 (db, RANGE_QUERY, -1, &res, 0);
+    sqlite3_bind_int (res, 1, start_day);
+    sqlite3_bind_int (res, 2, end_day);
+
+    while (sqlite3_step (res) == SQLITE_ROW) {
+        const unsigned char * volatile text;
+        text = sqlite3_column_text (res, 0);
+        text = sqlite3_column_text (res, 1);
+        text = sqlite3_column_text (res, 2);
+        (void) text;
+        sqlite3_column_int (res, 3);
+        rows++;
+    }
+
+    sqlite3_finalize (res);
+    return rows;
+}
+
+/*
+ * FUNC count_index
+ *   Same as count_sql through due_index_slice
+ */
+static int count_index (Due_index *index, int start_day, int end_day)
+{
+    const Due_entry *first;
+    const char * volatile text;
+    int rows = due_index_slice (index, start_day, 0, end_day, &first);
+    int i;
+
+    for (i = 0; i < rows; i++) {
+        text = first[i].description;
+        text = due_index_category (index, first[i].category_id);
+    }
+    (void) text;
+
+    return rows;
+}
+
+/*
+ * FUNC run
+ *   Times RUNS of both ways of answering a range and prints the average
+ */
+static void run (sqlite3 *db, Due_index *index, const char *name,
+                 int start_day, int end_day)
+{
+    double started, sql_ms, index_ms;
+    int sql_rows = 0, index_rows = 0;
+    int i;
+
+    started = now_ms ();
+    for (i = 0; i < RUNS; i++)
+        sql_rows = count_sql (db, start_day, end_day);
+    sql_ms = (now_ms () - started) / RUNS;
+
+    started = now_ms ();
+    for (i = 0; i < RUNS; i++)
+        index_rows = count_index (index, start_day, end_day);
+    index_ms = (now_ms () - started) / RUNS;
+
+    printf ("%-22s %10d %12.3f %12.3f%s\n", name, sql_rows, sql_ms, index_ms,
+            sql_rows == index_rows ? "" : "  (rows differ!)");
+}
@@ -0,0 +1,519 @@
+/*******************************************************************************
+ * bulk_view.c
+ * Creates the bulk_view, which moves the due dates, changes the frequency
+ * or purges every upcoming item matching a rule (category, due date range
+ * and/or frequency) at once, or renames a category, and its callbacks.
+ *
+ ******************************************************************************/
+#include <gtk/gtk.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "dates.h"
+#include "helpers.h"
+#include "setup.h"
+#include "sql_db.h"
+
+#define MAX_SHIFT_DAYS 365 /* same reach as look_select_view */
+#define MAX_FREQ 365
+
+typedef struct rule_widgets {
+    /* which items */
+    GtkEntry      *category;  /* blank for any */
+    GtkEntry      *from;      /* blank for no bound */
+    GtkEntry      *to;
+    GtkSpinButton *freq;
+    GtkComboBox   *freq_type; /* "any" for any frequency */
+    /* what to do with them */
+    GtkSpinButton *shift_days;
+    GtkSpinButton *new_freq;
+    GtkComboBox   *new_freq_type;
+    GtkEntry      *new_category;
+} Rule_widgets;
+
+static Rule_widgets rule_widgets;
+
+/* prototypes */
+void set_bulk_view (GtkWidget *widget);
+
+/* helper for set_bulk_view */
+static GtkWidget *make_bulk_view_box (void);
+
+/* helpers for building bulk_view */
+static GtkWidget *make_freq_type_combo (int with_any);
+static void build_rule_rows (GtkWidget *box);
+static GtkWidget *build_shift_row (GtkWidget *box);
+static GtkWidget *build_freq_row (GtkWidget *box);
+static GtkWidget *build_rename_row (GtkWidget *box);
+static GtkWidget *build_purge_row (GtkWidget *box);
+
+/* callbacks */
+static void shift_matching (GtkWidget *button);
+static void change_freq_of_matching (GtkWidget *button);
+static void rename_matching_category (GtkWidget *button);
+static void purge_matching (GtkWidget *button);
+
+/* reading the rule and confirming the edit */
+static int read_rule (GtkWidget *button, Bulk_rule *rule);
+static int read_day (GtkWidget *button, GtkEntry *entry, int *day);
+static int confirm_bulk_edit (GtkWidget *button, const Bulk_rule *rule,
+                              const char *confirm);
+/* end prototypes */
+
+/*
+ * FUNC make_freq_type_combo
+ *   Makes a combo box of the frequency types, with "any" first if with_any
+ */
+static GtkWidget *make_freq_type_combo (int with_any)
+{
+    GtkWidget *combo = gtk_combo_box_text_new ();
+
+    if (with_any)
+        gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (combo), "any", ANY);
+    gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (combo), "days", DAYS);
+    gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (combo), "weeks", WEEKS);
+    gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (combo), "months", MONTHS);
+    gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (combo), "years", YEARS);
+    gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (combo), "no_repeat",
+                               NO_REPEAT);
+    gtk_combo_box_set_active_id (GTK_COMBO_BOX (combo),
+                                 with_any ? "any" : "days");
+
+    return combo;
+}
+
+/*
+ * FUNC build_rule_rows
+ *   Builds the rows where the user picks the items to change
+ * Does NOT setup the callbacks
+ */
+static void build_rule_rows (GtkWidget *box)
+{
+    GtkWidget *grid,
+              *heading,
+              *category_label,
+              *category,
+              *from_label,
+              *from,
+              *to_label,
+              *to,
+              *freq_label,
+              *freq,
+              *freq_type;
+    GtkAdjustment *adjustment;
+
+    grid = gtk_grid_new ();
+    gtk_grid_set_row_spacing (GTK_GRID (grid), 10);
+    gtk_grid_set_column_spacing (GTK_GRID (grid), 10);
+
+    heading = gtk_label_new (BULK_EDIT_HEADING);
+    gtk_label_set_xalign (GTK_LABEL (heading), 0);
+
+    category_label = gtk_label_new (CATEGORY);
+    category = gtk_entry_new ();
+    gtk_entry_set_max_length (GTK_ENTRY (category), CATEGORY_LIMIT - 1);
+    gtk_entry_set_placeholder_text (GTK_ENTRY (category), ANY);
+
+    from_label = gtk_label_new (DUE_FROM);
+    from = gtk_entry_new ();
+    gtk_entry_set_placeholder_text (GTK_ENTRY (from), DATE_FRMT_EXPLAIN);
+    to_label = gtk_label_new (TO);
+    to = gtk_entry_new ();
+    gtk_entry_set_placeholder_text (GTK_ENTRY (to), DATE_FRMT_EXPLAIN);
+
+    freq_label = gtk_label_new (REPEAT_EVERY);
+    adjustment = gtk_adjustment_new (1, 1, MAX_FREQ, 1, 5, 0);
+    freq = gtk_spin_button_new (adjustment, 1.0, 0);
+    freq_type = make_freq_type_combo (1);
+
+    gtk_grid_attach (GTK_GRID (grid), heading, 0, 0, 4, 1);
+    gtk_grid_attach (GTK_GRID (grid), category_label, 0, 1, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), category, 1, 1, 3, 1);
+    gtk_grid_attach (GTK_GRID (grid), from_label, 0, 2, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), from, 1, 2, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), to_label, 2, 2, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), to, 3, 2, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), freq_label, 0, 3, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), freq, 1, 3, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), freq_type, 2, 3, 2, 1);
+
+    rule_widgets.category  = GTK_ENTRY (category);
+    rule_widgets.from      = GTK_ENTRY (from);
+    rule_widgets.to        = GTK_ENTRY (to);
+    rule_widgets.freq      = GTK_SPIN_BUTTON (freq);
+    rule_widgets.freq_type = GTK_COMBO_BOX (freq_type);
+
+    gtk_box_pack_start (GTK_BOX (box), grid, FALSE, FALSE, 10);
+}
+
+/*
+ * FUNC build_shift_row
+ *   Builds the row for moving the due dates of the matching items
+ * Does NOT setup the callbacks
+ *
+ * Returns : the button that needs a callback attached to it
+ */
+static GtkWidget *build_shift_row (GtkWidget *box)
+{
+    GtkWidget     *row;
+    GtkWidget     *label;
+    GtkAdjustment *adjustment;
+    GtkWidget     *days;
+    GtkWidget     *units;
+    GtkWidget     *button;
+
+    row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+
+    label = gtk_label_new (MOVE_DUE_DATES_BY);
+    adjustment = gtk_adjustment_new (14, -MAX_SHIFT_DAYS, MAX_SHIFT_DAYS,
+                                     1, 7, 0);
+    days = gtk_spin_button_new (adjustment, 1.0, 0);
+    units = gtk_label_new (DAYS);
+    button = gtk_button_new_with_label (MOVE);
+
+    rule_widgets.shift_days = GTK_SPIN_BUTTON (days);
+
+    gtk_box_pack_start (GTK_BOX (row), label, FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (row), days, FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (row), units, FALSE, FALSE, 10);
+    gtk_box_pack_end (GTK_BOX (row), button, FALSE, FALSE, 10);
+
+    gtk_box_pack_start (GTK_BOX (box), row, FALSE, FALSE, 10);
+
+    return button;
+}
+
+/*
+ * FUNC build_freq_row
+ *   Builds the row for changing the frequency of the matching items
+ * Does NOT setup the callbacks
+ *
+ * Returns : the button that needs a callback attached to it
+ */
+static GtkWidget *build_freq_row (GtkWidget *box)
+{
+    GtkWidget     *row;
+    GtkWidget     *label;
+    GtkAdjustment *adjustment;
+    GtkWidget     *freq;
+    GtkWidget     *freq_type;
+    GtkWidget     *button;
+
+    row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+
+    label = gtk_label_new (EVERY);
+    adjustment = gtk_adjustment_new (1, 1, MAX_FREQ, 1, 5, 0);
+    freq = gtk_spin_button_new (adjustment, 1.0, 0);
+    freq_type = make_freq_type_combo (0);
+    button = gtk_button_new_with_label (CHANGE_FREQ);
+
+    rule_widgets.new_freq      = GTK_SPIN_BUTTON (freq);
+    rule_widgets.new_freq_type = GTK_COMBO_BOX (freq_type);
+
+    gtk_box_pack_start (GTK_BOX (row), label, FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (row), freq, FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (row), freq_type, FALSE, FALSE, 10);
+    gtk_box_pack_end (GTK_BOX (row), button, FALSE, FALSE, 10);
+
+    gtk_box_pack_start (GTK_BOX (box), row, FALSE, FALSE, 10);
+
+    return button;
+}
+
+/*
+ * FUNC build_rename_row
+ *   Builds the row for renaming the category picked in the rule rows
+ * Does NOT setup the callbacks
+ *
+ * Returns : the button that needs a callback attached to it
+ */
+static GtkWidget *build_rename_row (GtkWidget *box)
+{
+    GtkWidget *row;
+    GtkWidget *label;
+    GtkWidget *new_category;
+    GtkWidget *button;
+
+    row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+
+    label = gtk_label_new (RENAME_CATEGORY_TO);
+    new_category = gtk_entry_new ();
+    gtk_entry_set_max_length (GTK_ENTRY (new_category), CATEGORY_LIMIT - 1);
+    button = gtk_button_new_with_label (RENAME);
+
+    rule_widgets.new_category = GTK_ENTRY (new_category);
+
+    gtk_box_pack_start (GTK_BOX (row), label, FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (row), new_category, TRUE, TRUE, 10);
+    gtk_box_pack_end (GTK_BOX (row), button, FALSE, FALSE, 10);
+
+    gtk_box_pack_start (GTK_BOX (box), row, FALSE, FALSE, 10);
+
+    return button;
+}
+
+/*
+ * FUNC build_purge_row
+ *   Builds the row for purging the matching items
+ * Does NOT setup the callbacks
+ *
+ * Returns : the button that needs a callback attached to it
+ */
+static GtkWidget *build_purge_row (GtkWidget *box)
+{
+    GtkWidget *row;
+    GtkWidget *label;
+    GtkWidget *button;
+
+    row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+
+    label = gtk_label_new (PURGE_MATCHING);
+    button = gtk_button_new_with_label (PURGE);
+
+    gtk_box_pack_start (GTK_BOX (row), label, FALSE, FALSE, 10);
+    gtk_box_pack_end (GTK_BOX (row), button, FALSE, FALSE, 10);
+
+    gtk_box_pack_start (GTK_BOX (box), row, FALSE, FALSE, 10);
+
+    return button;
+}
+
+/*
+ * FUNC make_bulk_view_box
+ *   Helper function to set_bulk_view
+ * Sets up the UI and attaches the callbacks
+ */
+static GtkWidget *make_bulk_view_box (void)
+{
+    GtkWidget *box;
+    box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+
+    build_rule_rows (box);
+
+    GtkWidget *shift = build_shift_row (box);
+    GtkWidget *change_freq = build_freq_row (box);
+    GtkWidget *rename = build_rename_row (box);
+    GtkWidget *purge = build_purge_row (box);
+
+    GtkWidget *row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+    GtkWidget *back = gtk_button_new_with_label (BACK);
+    gtk_box_pack_start (GTK_BOX (row), back, FALSE, FALSE, 10);
+    gtk_box_pack_end (GTK_BOX (box), row, FALSE, FALSE, 10);
+
+    g_signal_connect (G_OBJECT (back), "clicked",
+            G_CALLBACK (set_edit_select_view), NULL);
+    g_signal_connect (G_OBJECT (shift), "clicked",
+            G_CALLBACK (shift_matching), NULL);
+    g_signal_connect (G_OBJECT (change_freq), "clicked",
+            G_CALLBACK (change_freq_of_matching), NULL);
+    g_signal_connect (G_OBJECT (rename), "clicked",
+            G_CALLBACK (rename_matching_category), NULL);
+    g_signal_connect (G_OBJECT (purge), "clicked",
+            G_CALLBACK (purge_matching), NULL);
+
+    return box;
+}
+
+/*
+ * FUNC set_bulk_view
+ *   Removes the child widget from the toplevel window. Replaces it with the
+ * widget necessary for the bulk_view
+ */
+void set_bulk_view (GtkWidget *widget)
+{
+    GtkWidget *window;
+    GtkWidget *child;
+    window = gtk_widget_get_toplevel (widget);
+    child = gtk_bin_get_child (GTK_BIN (window));
+    if (child != NULL) {
+        gtk_widget_destroy (child);
+    }
+
+    GtkWidget *box = make_bulk_view_box ();
+
+    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (box));
+
+    gtk_widget_show_all (window);
+}
+
+/*
+ * FUNC shift_matching
+ *   Moves the due dates of the items matching the rule by the days chosen,
+ * once the user has seen how many that is
+ */
+static void shift_matching (GtkWidget *button)
+{
+    Bulk_rule rule;
+
+    if (read_rule (button, &rule) < 0 ||
+        confirm_bulk_edit (button, &rule, BULK_EDIT_CONFIRM) < 0)
+        return;
+
+    int days = gtk_spin_button_get_value_as_int (rule_widgets.shift_days);
+
+    if (shift_by_rule (app_db (), &rule, days) < 0)
+        error_dialog (button, DATABASE_SNOOZE_FAIL);
+    else
+        success_dialog (button, SUCCESS);
+}
+
+/*
+ * FUNC change_freq_of_matching
+ *   Changes the frequency of the items matching the rule, once the user has
+ * seen how many that is
+ */
+static void change_freq_of_matching (GtkWidget *button)
+{
+    Bulk_rule rule;
+
+    if (read_rule (button, &rule) < 0 ||
+        confirm_bulk_edit (button, &rule, BULK_EDIT_CONFIRM) < 0)
+        return;
+
+    int freq = gtk_spin_button_get_value_as_int (rule_widgets.new_freq);
+    const char *freq_type =
+        gtk_combo_box_get_active_id (rule_widgets.new_freq_type);
+
+    if (change_frequency_by_rule (app_db (), &rule, freq, freq_type) < 0)
+        error_dialog (button, DATABASE_FREQ_FAIL);
+    else
+        success_dialog (button, SUCCESS);
+}
+
+/*
+ * FUNC rename_matching_category
+ *   Renames the category typed in the rule rows for every item in it,
+ * merging it into the new name if that is a category already. The other
+ * criteria do not apply, a category is renamed whole.
+ */
+static void rename_matching_category (GtkWidget *button)
+{
+    const char *category = gtk_entry_get_text (rule_widgets.category);
+    const char *new_category = gtk_entry_get_text (rule_widgets.new_category);
+
+    if (category[0] == '\0' || new_category[0] == '\0') {
+        error_dialog (button, NO_SUCH_CATEGORY);
+        return;
+    }
+
+    if (check_for_apostrophes (new_category)) {
+        error_dialog (button, CANNOT_HAVE_APOSTROPHES);
+        return;
+    }
+
+    int rc = rename_category (app_db (), category, new_category);
+    if (rc < 0)
+        error_dialog (button, DATABASE_FAILED_TO_CHANGE_CATEGORY);
+    else if (rc == 0)
+        error_dialog (button, NO_SUCH_CATEGORY);
+    else {
+        gtk_entry_set_text (rule_widgets.category, new_category);
+        gtk_entry_set_text (rule_widgets.new_category, "");
+        success_dialog (button, SUCCESS);
+    }
+}
+
+/*
+ * FUNC purge_matching
+ *   Removes the items matching the rule, with all their history, once the
+ * user has seen how many that is
+ */
+static void purge_matching (GtkWidget *button)
+{
+    Bulk_rule rule;
+
+    if (read_rule (button, &rule) < 0 ||
+        confirm_bulk_edit (button, &rule, BULK_PURGE_CONFIRM) < 0)
+        return;
+
+    if (purge_by_rule (app_db (), &rule) < 0)
+        error_dialog (button, DATABASE_PURGE_ITEM_FAIL);
+    else
+        success_dialog (button, SUCCESS);
+}
+
+/*
+ * FUNC read_rule
+ *   Fills rule from the widgets. The strings in rule belong to the widgets.
+ * Returns 1 on success, -1 if the user has to fix something (already told)
+ */
+static int read_rule (GtkWidget *button, Bulk_rule *rule)
+{
+    const char *category = gtk_entry_get_text (rule_widgets.category);
+    const char *freq_type = gtk_combo_box_get_active_id (rule_widgets.freq_type);
+
+    rule->category  = (category[0] != '\0') ? category : NULL;
+    rule->freq_type = (strcmp (freq_type, "any") != 0) ? freq_type : NULL;
+    rule->freq      = gtk_spin_button_get_value_as_int (rule_widgets.freq);
+
+    if (read_day (button, rule_widgets.from, &rule->from_day) < 0 ||
+        read_day (button, rule_widgets.to, &rule->to_day) < 0)
+        return -1;
+
+    if (rule->from_day != 0 && rule->to_day != 0 &&
+        rule->from_day > rule->to_day) {
+        error_dialog (button, START_BEFORE_END);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * FUNC read_day
+ *   Helper function to read_rule
+ * Sets day to the day number of the date in entry, 0 if it is blank
+ * Returns 1 on success, -1 if the date is not valid (the user is told)
+ */
+static int read_day (GtkWidget *button, GtkEntry *entry, int *day)
+{
+    const char *text = gtk_entry_get_text (entry);
+
+    *day = 0;
+    if (text[0] == '\0')
+        return 1;
+
+    *day = day_from_user_date_str (text);
+    if (*day == 0) {
+        error_dialog (button, INVALID_DATE\
+                              DATE_FRMT_EXPLAIN);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * FUNC confirm_bulk_edit
+ *   Tells the user how many items rule matches (nothing is changed to find
+ * out) with confirm, a format taking the count, and asks to go ahead
+ * Returns 1 if the user said yes, -1 otherwise
+ */
+static int confirm_bulk_edit (GtkWidget *button, const Bulk_rule *rule,
+                              const char *confirm)
+{
+    GtkWidget *dialog,
+              *window;
+    int count = count_by_rule (app_db (), rule);
+
+    if (count < 0) {
+        error_dialog (button, DATABASE_ERROR);
+        return -1;
+    }
+    if (count == 0) {
+        error_dialog (button, NO_ITEMS_MATCH);
+        return -1;
+    }
+
+    window = gtk_widget_get_toplevel (button);
+    dialog = gtk_message_dialog_new (GTK_WINDOW (window),
+            GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+            GTK_MESSAGE_INFO,
+            GTK_BUTTONS_OK_CANCEL,
+            confirm, count);
+
+    int response = gtk_dialog_run (GTK_DIALOG (dialog));
+    gtk_widget_destroy (dialog);
+
+    return (response == GTK_RESPONSE_OK) ? 1 : -1;
+}
@@ -0,0 +1,161 @@
+/*******************************************************************************
+ * category_filter.c
+ * Keeps the category (see version 7 in schema.c) the main, ahead/back and
+ * edit/search views are narrowed down to, and makes the combo box each of
+ * them picks it with.
+ *
+ * The filter lasts while the program runs, so moving between views keeps
+ * it. The combo box lists the categories in tree order, each indented under
+ * the one it is in and followed by the number of items due in it and under
+ * it, all counted by create_category_counts_model in one query.
+ ******************************************************************************/
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "category_filter.h"
+#include "setup.h"
+#include "sql_db.h"
+
+/* spaces a category is indented by per level */
+#define INDENT 4
+
+/* 0 for every item */
+static int filter_category_id = 0;
+
+/* prototypes */
+int category_filter_get (void);
+GtkWidget *make_category_filter (Category_filter_reload reload);
+
+static void show_category (GtkCellLayout *layout, GtkCellRenderer *renderer,
+                           GtkTreeModel *model, GtkTreeIter *iter,
+                           gpointer data);
+static void pick_category (GtkComboBox *combo, gpointer reload);
+/* end prototypes */
+
+/*
+ * FUNC category_filter_get
+ *   Returns the id of the category the views are narrowed down to, 0 for
+ * none
+ */
+int category_filter_get (void)
+{
+    return filter_category_id;
+}
+
+/*
+ * FUNC make_category_filter
+ *   Makes the combo box of the categories, "all categories" first, set to
+ * the current filter. If that category is gone (renamed into another) the
+ * filter goes back to every item.
+ */
+GtkWidget *make_category_filter (Category_filter_reload reload)
+{
+    GtkWidget *combo;
+    GtkCellRenderer *renderer;
+    GtkListStore *store;
+    GtkTreeIter iter;
+    gboolean valid;
+    int active = 0;
+    int row;
+
+    store = GTK_LIST_STORE (create_category_counts_model (app_db ()));
+    if (store == NULL) {
+        /* the views work without the filter, just offer "all" */
+        fprintf (stderr, DATABASE_CATEGORY_COUNTS_FAIL);
+        store = gtk_list_store_new (NUM_CATEGORY_COLUMNS, G_TYPE_INT,
+                                    G_TYPE_STRING, G_TYPE_INT, G_TYPE_INT);
+    }
+
+    gtk_list_store_insert_with_values (store, NULL, 0,
+                                       CATEGORY_COLUMN_ID,    0,
+                                       CATEGORY_COLUMN_NAME,  ALL_CATEGORIES,
+                                       CATEGORY_COLUMN_DEPTH, 0,
+                                       CATEGORY_COLUMN_DUE,   -1,
+                                       -1);
+
+    /* find the row of the current filter */
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (store), &iter);
+    for (row = 0; valid; row++) {
+        int id;
+        gtk_tree_model_get (GTK_TREE_MODEL (store), &iter,
+                            CATEGORY_COLUMN_ID, &id, -1);
+        if (id == filter_category_id)
+            active = row;
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (store), &iter);
+    }
+    if (active == 0)
+        filter_category_id = 0;
+
+    combo = gtk_combo_box_new_with_model (GTK_TREE_MODEL (store));
+    g_object_unref (store);
+
+    renderer = gtk_cell_renderer_text_new ();
+    gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (combo), renderer, TRUE);
+    gtk_cell_layout_set_cell_data_func (GTK_CELL_LAYOUT (combo), renderer,
+                                        show_category, NULL, NULL);
+
+    gtk_combo_box_set_active (GTK_COMBO_BOX (combo), active);
+
+    g_signal_connect (G_OBJECT (combo), "changed",
+            G_CALLBACK (pick_category), reload);
+
+    return combo;
+}
+
+/*
+ * FUNC show_category
+ *   Cell data function of the combo box. Shows the last part of the path of
+ * a category, indented by its depth, and the number of items due under it.
+ */
+static void show_category (GtkCellLayout *layout, GtkCellRenderer *renderer,
+                           GtkTreeModel *model, GtkTreeIter *iter,
+                           gpointer data)
+{
+    char *name;
+    char *text;
+    const char *last;
+    int depth;
+    int due;
+
+    gtk_tree_model_get (model, iter,
+                        CATEGORY_COLUMN_NAME,  &name,
+                        CATEGORY_COLUMN_DEPTH, &depth,
+                        CATEGORY_COLUMN_DUE,   &due,
+                        -1);
+
+    last = strrchr (name, CATEGORY_SEPARATOR);
+    last = (last != NULL) ? last + 1 : name;
+
+    if (due < 0)
+        text = g_strdup (last);
+    else
+        text = g_strdup_printf ("%*s%s (%d)", depth * INDENT, "", last, due);
+
+    g_object_set (renderer, "text", text, NULL);
+
+    g_free (text);
+    g_free (name);
+}
+
+/*
+ * FUNC pick_category
+ *   Callback for the "changed" signal of the combo box. Sets the filter to
+ * the category picked and sets the view up again.
+ */
+static void pick_category (GtkComboBox *combo, gpointer reload)
+{
+    GtkTreeIter iter;
+    int id;
+
+    if (!gtk_combo_box_get_active_iter (combo, &iter))
+        return;
+
+    gtk_tree_model_get (gtk_combo_box_get_model (combo), &iter,
+                        CATEGORY_COLUMN_ID, &id, -1);
+    if (id == filter_category_id)
+        return;
+
+    filter_category_id = id;
+    ((Category_filter_reload) reload) (GTK_WIDGET (combo));
+}
@@ -0,0 +1,20 @@
+/*******************************************************************************
+ * category_filter.h
+ * Header for the category the main, ahead/back and edit/search views are
+ * narrowed down to, and the combo box picking it.
+ *
+ ******************************************************************************/
+
+#include <gtk/gtk.h>
+
+/* Sets up a view again, called with the combo box once the filter changed */
+typedef void (*Category_filter_reload) (GtkWidget *widget);
+
+/* Id of the category the views show the items under (its own and those of
+ * every category below it), 0 for every item */
+int category_filter_get (void);
+
+/* A combo box of the categories with items, each with how many are due in
+ * it and under it, showing the current filter. Picking another category
+ * sets the filter and calls reload */
+GtkWidget *make_category_filter (Category_filter_reload reload);
@@ -0,0 +1,262 @@
+/*******************************************************************************
+ * check_tag_set.c
+ * Checks the sets of tag_set.c against a plain bitmap of the same ids, for
+ * sets whose containers cross from array to bitmap form and back: past
+ * TAG_SET_ARRAY_MAX (4096) ids on an add, under half of it on a remove, and
+ * the results of and / or / and_not that land on either side.
+ *
+ * Usage: check_tag_set      (prints what failed, exits 1 if anything did)
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tag_set.h"
+
+/* containers covered, ids run from 1 to MAX_ID */
+#define N_CONTAINERS 4
+#define MAX_ID (N_CONTAINERS * 65536 - 1)
+
+/* the array form holds up to this many ids, see tag_set.c */
+#define ARRAY_MAX 4096
+
+/* ids in each container of the sets combined, from a few (an array) to most
+ * of it (a bitmap), with a container at the threshold itself */
+static const int fills[][N_CONTAINERS] = {
+    {   50,  3000, ARRAY_MAX, 30000},
+    { 5000,    10, ARRAY_MAX + 1, 60000},
+    {    0, 40000,  2047,  2049},
+    {65535, 65535,     1,     0}
+};
+#define N_FILLS (sizeof (fills) / sizeof (fills[0]))
+
+/* A set and the same ids in a plain bitmap */
+typedef struct checked_set {
+    Tag_set *set;
+    unsigned char *plain;   /* 1 for every id in set */
+} Checked_set;
+
+static int failures = 0;
+
+/* prototypes */
+static Checked_set new_checked_set (const int *fill);
+static void free_checked_set (Checked_set *c);
+static void check_same (const char *what, const Tag_set *set,
+                        const unsigned char *plain);
+static void check_combinations (const Checked_set *a, const Checked_set *b,
+                                int i, int j);
+static void check_removals (void);
+/* end prototypes */
+
+int main (void)
+{
+    Checked_set sets[N_FILLS];
+
+    /* the same sets every run */
+    srand (12345);
+
+    for (int i = 0; i < N_FILLS; i++) {
+        sets[i] = new_checked_set (fills[i]);
+        check_same ("add", sets[i].set, sets[i].plain);
+    }
+
+    for (int i = 0; i < N_FILLS; i++) {
+        for (int j = 0; j < N_FILLS; j++)
+            check_combinations (&sets[i], &sets[j], i, j);
+    }
+
+    check_removals ();
+
+    for (int i = 0; i < N_FILLS; i++)
+        free_checked_set (&sets[i]);
+
+    if (failures > 0) {
+        printf ("tag_set: %d checks FAILED\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf ("tag_set: all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/*
+ * FUNC new_checked_set
+ *   Makes a set with fill[k] random ids in container k (added in random
+ * order, so array inserts land anywhere), and its plain bitmap
+ */
+static Checked_set new_checked_set (const int *fill)
+{
+    Checked_set c;
+
+    c.set = tag_set_new ();
+    c.plain = calloc (MAX_ID + 1, 1);
+    if (c.plain == NULL) {
+        fprintf (stderr, "Error: out of memory\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (int k = 0; k < N_CONTAINERS; k++) {
+        int added = 0;
+
+        while (added < fill[k]) {
+            int id = k * 65536 + rand () % 65536;
+
+            /* ids are positive */
+            if (id == 0 || c.plain[id])
+                continue;
+            c.plain[id] = 1;
+            tag_set_add (c.set, id);
+            added++;
+        }
+    }
+
+    return c;
+}
+
+/*
+ * FUNC free_checked_set
+ *   Frees both halves of c
+ */
+static void free_checked_set (Checked_set *c)
+{
+    tag_set_free (c->set);
+    free (c->plain);
+}
+
+/*
+ * FUNC check_same
+ *   Counts a failure, printed with what, unless set holds the ids of plain
+ * and nothing else
+ */
+static void check_same (const char *what, const Tag_set *set,
+                        const unsigned char *plain)
+{
+    int count = 0;
+
+    for (int id = 1; id <= MAX_ID; id++) {
+        count += plain[id];
+        if (tag_set_has (set, id) != plain[id]) {
+            printf ("%s: id %d is %s\n", what, id,
+                    plain[id] ? "missing" : "there but should not be");
+            failures++;
+            return;
+        }
+    }
+
+    if (tag_set_count (set) != count) {
+        printf ("%s: count %d, should be %d\n", what, tag_set_count (set),
+                count);
+        failures++;
+    }
+}
+
+/*
+ * FUNC check_combinations
+ *   Checks and, or and and_not of a and b (fills i and j) against the same
+ * on their bitmaps
+ */
+static void check_combinations (const Checked_set *a, const Checked_set *b,
+                                int i, int j)
+{
+    unsigned char *plain = malloc (MAX_ID + 1);
+    Tag_set *result;
+    char what[64];
+
+    if (plain == NULL) {
+        fprintf (stderr, "Error: out of memory\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (int id = 0; id <= MAX_ID; id++)
+        plain[id] = a->plain[id] & b->plain[id];
+    result = tag_set_and (a->set, b->set);
+    snprintf (what, sizeof (what), "and of %d and %d", i, j);
+    check_same (what, result, plain);
+    tag_set_free (result);
+
+    for (int id = 0; id <= MAX_ID; id++)
+        plain[id] = a->plain[id] | b->plain[id];
+    result = tag_set_or (a->set, b->set);
+    snprintf (what, sizeof (what), "or of %d and %d", i, j);
+    check_same (what, result, plain);
+    tag_set_free (result);
+
+    for (int id = 0; id <= MAX_ID; id++)
+        plain[id] = a->plain[id] & !b->plain[id];
+    result = tag_set_and_not (a->set, b->set);
+    snprintf (what, sizeof (what), "and_not of %d and %d", i, j);
+    check_same (what, result, plain);
+    tag_set_free (result);
+
+    free (plain);
+}
+
+/*
+ * FUNC check_removals
+ *   Grows one container past ARRAY_MAX and empties it again in random
+ * order, checking the set on either side of each threshold, and that a
+ * copy taken in bitmap form is left as it was
+ */
+static void check_removals (void)
+{
+    const int empty[N_CONTAINERS] = {0, 0, 0, 0};
+    Checked_set c = new_checked_set (empty);
+    Tag_set *copy;
+    int *ids;
+    int n = ARRAY_MAX + 100;
+    char what[64];
+
+    ids = malloc (n * sizeof (int));
+    if (ids == NULL) {
+        fprintf (stderr, "Error: out of memory\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* n distinct ids of container 1 */
+    for (int k = 0; k < n; k++) {
+        ids[k] = 65536 + k * 13 % 65536;
+        c.plain[ids[k]] = 1;
+        tag_set_add (c.set, ids[k]);
+        if (k + 1 == ARRAY_MAX || k + 1 == ARRAY_MAX + 1) {
+            snprintf (what, sizeof (what), "add up to %d", k + 1);
+            check_same (what, c.set, c.plain);
+        }
+    }
+    check_same ("add up to the end", c.set, c.plain);
+
+    /* a copy keeps the bitmap form it was taken in */
+    copy = tag_set_copy (c.set);
+
+    /* shuffled, so the bitmap loses ids from anywhere */
+    for (int k = n - 1; k > 0; k--) {
+        int other = rand () % (k + 1);
+        int id = ids[k];
+
+        ids[k] = ids[other];
+        ids[other] = id;
+    }
+
+    for (int k = 0; k < n; k++) {
+        int left = n - k - 1;
+
+        c.plain[ids[k]] = 0;
+        tag_set_remove (c.set, ids[k]);
+        /* removing an id that is gone changes nothing */
+        tag_set_remove (c.set, ids[k]);
+
+        if (left == ARRAY_MAX || left == ARRAY_MAX / 2 ||
+            left == ARRAY_MAX / 2 - 1 || left == 1 || left == 0) {
+            snprintf (what, sizeof (what), "remove down to %d", left);
+            check_same (what, c.set, c.plain);
+        }
+    }
+
+    /* the copy still has every id, the emptied set none */
+    for (int k = 0; k < n; k++)
+        c.plain[ids[k]] = 1;
+    check_same ("copy after removals", copy, c.plain);
+
+    tag_set_free (copy);
+    free (ids);
+    free_checked_set (&c);
+}
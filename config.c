@@ -0,0 +1,392 @@
+/*******************************************************************************
+ * config.c
+ * Settings that used to be compiled in. They are read once at start up, each
+ * from (last one wins):
+ *   - the default below
+ *   - the config file, $ROUTINE_CONFIG or else routine/routine.conf in the
+ *     user's config dir (ie: ~/.config), keys in a [routine] group:
+ *
+ *         [routine]
+ *         database=/var/lib/routine/db_routine
+ *         cache_size=-16000
+ *         journal_mode=WAL
+ *         synchronous=NORMAL
+ *
+ *   - the environment variable named next to the key in settings[]
+ *
+ * sites lists the dbs of other sites shown together in the every site view
+ * (see federation.c), ie: sites=Workshop=/srv/workshop/db_routine;Depot=...
+ *
+ * The archive and the snapshot default to files named after the db. A db of
+ * ":memory:" starts empty (see migrate_db) and is gone when the program
+ * quits, there is no snapshot for it.
+ ******************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "config.h"
+#include "setup.h"
+
+#define CONFIG_ENV "ROUTINE_CONFIG"
+#define CONFIG_DIR "routine"
+#define CONFIG_FILE "routine.conf"
+#define CONFIG_GROUP "routine"
+
+#define MEMORY_NAME ":memory:"
+
+/* What a MEMORY_NAME db (or archive) is opened as, so the reader connections
+ * (see open_reader_db) see the same one. A shared cache locks tables, not the
+ * file: a reader can get SQLITE_LOCKED, which no busy timeout waits out */
+#define MEMORY_DATABASE "file:routine_memory?mode=memory&cache=shared"
+#define MEMORY_ARCHIVE "file:routine_memory_archive?mode=memory&cache=shared"
+
+enum {
+    SETTING_TEXT,
+    SETTING_INT,
+    SETTING_INT64
+};
+
+/* A key of the config file */
+typedef struct setting {
+    const char *key;
+    const char *env;             /* overrides the config file */
+    int type;
+    size_t offset;               /* of the field in Routine_config */
+    gint64 min;                  /* range of a SETTING_INT(64) */
+    gint64 max;
+    const char *const *choices;  /* the values a SETTING_TEXT may take (any
+                                  * case), NULL for any */
+} Setting;
+
+/* in the order of PRAGMA synchronous' numbers */
+static const char *const synchronous_choices[] = {
+    "OFF", "NORMAL", "FULL", "EXTRA", NULL
+};
+
+static const char *const journal_mode_choices[] = {
+    "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF", NULL
+};
+
+static const Setting settings[] = {
+    {"database", "ROUTINE_DATABASE", SETTING_TEXT,
+     offsetof (Routine_config, database), 0, 0, NULL},
+    {"archive_database", "ROUTINE_ARCHIVE_DATABASE", SETTING_TEXT,
+     offsetof (Routine_config, archive_database), 0, 0, NULL},
+    {"snapshot_file", "ROUTINE_SNAPSHOT_FILE", SETTING_TEXT,
+     offsetof (Routine_config, snapshot_file), 0, 0, NULL},
+    {"history_hot_days", "ROUTINE_HISTORY_HOT_DAYS", SETTING_INT,
+     offsetof (Routine_config, history_hot_days), 0, G_MAXINT, NULL},
+    {"cache_size", "ROUTINE_CACHE_SIZE", SETTING_INT,
+     offsetof (Routine_config, cache_size), G_MININT, G_MAXINT, NULL},
+    {"mmap_size", "ROUTINE_MMAP_SIZE", SETTING_INT64,
+     offsetof (Routine_config, mmap_size), 0, G_MAXINT64, NULL},
+    {"synchronous", "ROUTINE_SYNCHRONOUS", SETTING_TEXT,
+     offsetof (Routine_config, synchronous), 0, 0, synchronous_choices},
+    {"journal_mode", "ROUTINE_JOURNAL_MODE", SETTING_TEXT,
+     offsetof (Routine_config, journal_mode), 0, 0, journal_mode_choices},
+    {"soft_heap_limit", "ROUTINE_SOFT_HEAP_LIMIT", SETTING_INT64,
+     offsetof (Routine_config, soft_heap_limit), 0, G_MAXINT64, NULL},
+    {"sites", "ROUTINE_SITES", SETTING_TEXT,
+     offsetof (Routine_config, sites), 0, 0, NULL}
+};
+
+#define NUM_SETTINGS (sizeof (settings) / sizeof (settings[0]))
+
+/* NULL text is left to SQLite, or for the files named after the db. What is
+ * read replaces it and is kept until the program quits */
+static Routine_config config = {
+    "db_routine",   /* database */
+    NULL,           /* archive_database, database "_archive" */
+    NULL,           /* snapshot_file, database ".snapshot" */
+    730,            /* history_hot_days, two years */
+    -2000,          /* cache_size, SQLite's own default of 2000 KiB */
+    0,              /* mmap_size */
+    NULL,           /* synchronous */
+    NULL,           /* journal_mode */
+    0,              /* soft_heap_limit */
+    NULL            /* sites */
+};
+
+/* prototypes */
+void config_load (void);
+const Routine_config *config_get (void);
+int config_open (const char *path, sqlite3 **conn, int flags);
+char *config_archive_path (const char *path);
+void config_report (sqlite3 *db);
+
+static int set_setting (const Setting *setting, const char *value,
+                        const char *source);
+static void name_files_after_db (void);
+static const char *open_name (const char *path, const char *memory_uri);
+static gint64 read_pragma_int64 (sqlite3 *db, const char *pragma);
+static char *read_pragma_text (sqlite3 *db, const char *pragma);
+/* end prototypes */
+
+/*
+ * FUNC config_load
+ *   Reads the config file and then the environment into config, and sets
+ * the soft heap limit, which is for the whole process
+ */
+void config_load (void)
+{
+    GKeyFile *file = g_key_file_new ();
+    GError *error = NULL;
+    char *path;
+
+    if (g_getenv (CONFIG_ENV) != NULL)
+        path = g_strdup (g_getenv (CONFIG_ENV));
+    else
+        path = g_build_filename (g_get_user_config_dir (), CONFIG_DIR,
+                                 CONFIG_FILE, NULL);
+
+    /* no config file is fine, everything has a default */
+    if (!g_key_file_load_from_file (file, path, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            fprintf (stderr, CONFIG_FILE_FAIL, path, error->message);
+        g_clear_error (&error);
+    }
+
+    for (size_t i = 0; i < NUM_SETTINGS; i++) {
+        char *value = g_key_file_get_string (file, CONFIG_GROUP,
+                                             settings[i].key, NULL);
+        if (value != NULL)
+            set_setting (&settings[i], g_strstrip (value), path);
+        g_free (value);
+
+        const char *env = g_getenv (settings[i].env);
+        if (env != NULL)
+            set_setting (&settings[i], env, settings[i].env);
+    }
+
+    g_key_file_free (file);
+    g_free (path);
+
+    name_files_after_db ();
+
+    /* an empty list is no list */
+    if (config.sites != NULL && config.sites[0] == '\0')
+        config.sites = NULL;
+
+    if (config.soft_heap_limit > 0)
+        sqlite3_soft_heap_limit64 (config.soft_heap_limit);
+}
+
+/*
+ * FUNC config_get
+ *   The settings in effect
+ */
+const Routine_config *config_get (void)
+{
+    return &config;
+}
+
+/*
+ * FUNC config_open
+ *   Opens the db at path (ie: config.database) with flags and sets the
+ * connection up: cache and mmap size, synchronous and, on a connection that
+ * can write, the journal mode (it is kept in the db file, a read only
+ * connection cannot change it)
+ * Returns the sqlite3 status code of the operation
+ */
+int config_open (const char *path, sqlite3 **conn, int flags)
+{
+    char *pragmas;
+
+    int rc = sqlite3_open_v2 (open_name (path, MEMORY_DATABASE), conn,
+                              flags | SQLITE_OPEN_URI, NULL);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    pragmas = g_strdup_printf ("PRAGMA cache_size = %d;"
+                               "PRAGMA mmap_size = %" G_GINT64_FORMAT ";",
+                               config.cache_size, config.mmap_size);
+    rc = sqlite3_exec (*conn, pragmas, NULL, NULL, NULL);
+    g_free (pragmas);
+
+    /* both are one of the choices in settings[], safe to paste in */
+    if (rc == SQLITE_OK && config.synchronous != NULL) {
+        pragmas = g_strconcat ("PRAGMA synchronous = ", config.synchronous,
+                               NULL);
+        rc = sqlite3_exec (*conn, pragmas, NULL, NULL, NULL);
+        g_free (pragmas);
+    }
+
+    /* another process using the db can keep it from changing, the db then
+     * works in the mode it had (config_report shows which) */
+    if (rc == SQLITE_OK && config.journal_mode != NULL &&
+        (flags & SQLITE_OPEN_READWRITE)) {
+        pragmas = g_strconcat ("PRAGMA journal_mode = ", config.journal_mode,
+                               NULL);
+        sqlite3_exec (*conn, pragmas, NULL, NULL, NULL);
+        g_free (pragmas);
+    }
+
+    return rc;
+}
+
+/*
+ * FUNC config_archive_path
+ *   The name to attach the archive of the db at path by: archive_database
+ * for config.database, else the file next to path named as
+ * name_files_after_db would
+ * Returns the name, free with g_free
+ */
+char *config_archive_path (const char *path)
+{
+    if (strcmp (path, config.database) == 0)
+        return g_strdup (open_name (config.archive_database, MEMORY_ARCHIVE));
+
+    if (strcmp (path, MEMORY_NAME) == 0)
+        return g_strdup (MEMORY_ARCHIVE);
+
+    return g_strconcat (path, "_archive", NULL);
+}
+
+/*
+ * FUNC config_report
+ *   Logs the settings in effect on db, as SQLite has them. The journal mode
+ * in particular may not be the one asked for, ie: a db in memory only has
+ * MEMORY or OFF.
+ */
+void config_report (sqlite3 *db)
+{
+    gint64 synchronous = read_pragma_int64 (db, "PRAGMA synchronous");
+    char *journal_mode = read_pragma_text (db, "PRAGMA journal_mode");
+
+    g_message (CONFIG_REPORT, config.database, config.archive_database,
+               (config.snapshot_file != NULL) ? config.snapshot_file : "-",
+               config.history_hot_days,
+               read_pragma_int64 (db, "PRAGMA cache_size"),
+               read_pragma_int64 (db, "PRAGMA mmap_size"),
+               (synchronous >= 0 && synchronous < 4) ?
+                   synchronous_choices[synchronous] : "?",
+               (journal_mode != NULL) ? journal_mode : "?",
+               (gint64) sqlite3_soft_heap_limit64 (-1),
+               (config.sites != NULL) ? config.sites : "-");
+
+    g_free (journal_mode);
+}
+
+/*
+ * FUNC set_setting
+ *   Helper function to config_load
+ * Sets the field of setting in config to value, read from source (the config
+ * file or an environment variable), if it is a valid one
+ * Returns 1 on success and -1 if value was not valid
+ */
+static int set_setting (const Setting *setting, const char *value,
+                        const char *source)
+{
+    void *field = (char *) &config + setting->offset;
+    gint64 number;
+    char *end;
+
+    switch (setting->type) {
+    case SETTING_TEXT:
+        if (setting->choices == NULL) {
+            *(char **) field = g_strdup (value);
+            return 1;
+        }
+
+        /* the choice as spelled in the table, never value itself */
+        for (int i = 0; setting->choices[i] != NULL; i++) {
+            if (g_ascii_strcasecmp (value, setting->choices[i]) == 0) {
+                *(const char **) field = setting->choices[i];
+                return 1;
+            }
+        }
+        break;
+
+    case SETTING_INT:
+    case SETTING_INT64:
+        errno = 0;
+        number = g_ascii_strtoll (value, &end, 10);
+        if (errno != 0 || end == value || *end != '\0' ||
+            number < setting->min || number > setting->max)
+            break;
+
+        if (setting->type == SETTING_INT)
+            *(int *) field = (int) number;
+        else
+            *(gint64 *) field = number;
+        return 1;
+    }
+
+    fprintf (stderr, CONFIG_BAD_VALUE, value, setting->key, source);
+    return -1;
+}
+
+/*
+ * FUNC name_files_after_db
+ *   Helper function to config_load
+ * Gives the archive and snapshot that were not set names next to the db. A
+ * db in memory gets an archive in memory and no snapshot, and so does an
+ * empty snapshot_file.
+ */
+static void name_files_after_db (void)
+{
+    int in_memory = strcmp (config.database, MEMORY_NAME) == 0;
+
+    if (config.archive_database == NULL)
+        config.archive_database = in_memory ?
+            MEMORY_NAME : g_strconcat (config.database, "_archive", NULL);
+
+    if (config.snapshot_file == NULL && !in_memory)
+        config.snapshot_file = g_strconcat (config.database, ".snapshot",
+                                            NULL);
+    else if (config.snapshot_file != NULL && config.snapshot_file[0] == '\0')
+        config.snapshot_file = NULL;
+}
+
+/*
+ * FUNC open_name
+ *   Helper function to config_open and config_archive_path
+ * Returns the name path is opened by, memory_uri if it is MEMORY_NAME
+ */
+static const char *open_name (const char *path, const char *memory_uri)
+{
+    return (strcmp (path, MEMORY_NAME) == 0) ? memory_uri : path;
+}
+
+/*
+ * FUNC read_pragma_int64
+ *   Helper function to config_report
+ * Returns the number pragma reads on db, -1 on error
+ */
+static gint64 read_pragma_int64 (sqlite3 *db, const char *pragma)
+{
+    sqlite3_stmt *res;
+    gint64 value = -1;
+
+    if (sqlite3_prepare_v2 (db, pragma, -1, &res, 0) == SQLITE_OK &&
+        sqlite3_step (res) == SQLITE_ROW)
+        value = sqlite3_column_int64 (res, 0);
+    sqlite3_finalize (res);
+
+    return value;
+}
+
+/*
+ * FUNC read_pragma_text
+ *   Helper function to config_report
+ * Returns the text pragma reads on db in capitals (free with g_free), NULL
+ * on error
+ */
+static char *read_pragma_text (sqlite3 *db, const char *pragma)
+{
+    sqlite3_stmt *res;
+    char *value = NULL;
+
+    if (sqlite3_prepare_v2 (db, pragma, -1, &res, 0) == SQLITE_OK &&
+        sqlite3_step (res) == SQLITE_ROW &&
+        sqlite3_column_text (res, 0) != NULL)
+        value = g_ascii_strup ((const char *) sqlite3_column_text (res, 0),
+                               -1);
+    sqlite3_finalize (res);
+
+    return value;
+}
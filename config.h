@@ -0,0 +1,42 @@
+/*******************************************************************************
+ * config.h
+ * Header for the settings read at start up from the config file and the
+ * environment: where the db and the files next to it are, and how SQLite
+ * is tuned.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+
+/* The settings in effect, see config.c for the keys that set them */
+typedef struct routine_config {
+    char *database;         /* the db, ":memory:" for an empty one in memory */
+    char *archive_database; /* see archive.c */
+    char *snapshot_file;    /* see snapshot.c, NULL for none */
+    int history_hot_days;   /* see archive.c */
+    int cache_size;         /* PRAGMA cache_size, pages or -KiB */
+    gint64 mmap_size;       /* PRAGMA mmap_size, bytes, 0 for none */
+    char *synchronous;      /* PRAGMA synchronous */
+    char *journal_mode;     /* PRAGMA journal_mode */
+    gint64 soft_heap_limit; /* sqlite3_soft_heap_limit64, 0 for none */
+    char *sites;            /* see federation.c, NULL for none */
+} Routine_config;
+
+/* Reads the config file then the environment, once before anything else
+ * touches the db. Bad values are reported and left at the default */
+void config_load (void);
+
+/* The settings config_load read */
+const Routine_config *config_get (void);
+
+/* Opens the db at path with flags (SQLITE_OPEN_READWRITE or
+ * SQLITE_OPEN_READONLY) and applies the settings to the connection, returns
+ * a sqlite3 status code. Close *conn with sqlite3_close even on error */
+int config_open (const char *path, sqlite3 **conn, int flags);
+
+/* The file to attach as the archive of the db at path, see archive.c. Free
+ * with g_free */
+char *config_archive_path (const char *path);
+
+/* Logs the settings in effect on db (the main connection) */
+void config_report (sqlite3 *db);
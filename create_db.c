@@ -10,18 +10,23 @@ void print_code(int rc)
     printf("%s\n", err_msg);
 }
 
-int main(void)
+/* Usage: create [path of the db]      (db_routine if not given) */
+int main(int argc, char *argv[])
 {
     char *errMessage;
     int rc;
     sqlite3 *db;
     sqlite3_stmt *res;
-    sqlite3_open_v2(DB, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
+    const char *path = (argc > 1) ? argv[1] : DB;
+    sqlite3_open_v2(path, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to create database\nexiting...\n");
         exit (EXIT_FAILURE);
     }
 
+    /* lets purges shrink the file, has to come before the first table */
+    sqlite3_exec(db, "PRAGMA auto_vacuum = INCREMENTAL", NULL, NULL, NULL);
+
     rc = sqlite3_exec(db, "CREATE TABLE upcoming (description text, date text, category text)", NULL, NULL, &errMessage);
     const char * message = sqlite3_errstr(rc);
     printf("%s\n", message);
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <gtk/gtk.h> /* needed because we make use of "setup.h" */
 
@@ -17,6 +18,9 @@
 
 #define SQL_FRMT_STR "%d-%02d-%02d" /* Note: SQL format is  year, month, day */
 
+/* Day number of 1970-01-01, days are counted with 0001-01-01 as day 1 */
+#define DAY_OF_UNIX_EPOCH 719163
+
 static int num_days_in_months_of_non_leap_year[13] = 
 {0,31,28,31,30,31,30,31,31,30,31,30,31};
 
@@ -31,6 +35,15 @@ char *make_date_str_sql_frmt(int m, int d, int y);
 int parse_and_validate_user_date_str (char* date_str, int *month, int *day, int *year);
 char * get_current_date_str_in_user_frmt (void);
 char *convert_date_str_from_sql_to_user_frmt (const char *sql_date_str);
+
+int day_from_mdy (int m, int d, int y);
+void mdy_from_day (int day, int *m, int *d, int *y);
+int day_from_sql_date_str (const char *sql_date_str);
+int day_from_user_date_str (const char *date_str);
+int get_current_day (void);
+int day_add_months (int day, int months);
+char *convert_day_to_user_frmt (int day);
+int next_due_day (int day, int freq, const char *freq_type);
 /* end prototypes */
 
 /*
@@ -283,8 +296,9 @@ char * get_current_date_str_in_user_frmt (void)
     /* get the current date */
     time_t mytime;
     mytime = time(NULL);
+    struct tm now; /* localtime_r since the prefetch thread calls this too */
     struct tm *current_time;
-    current_time = localtime(&mytime);
+    current_time = localtime_r(&mytime, &now);
     int month,day,year;
     month = current_time->tm_mon + 1;     // since months range from [0,11]
     day   = current_time->tm_mday;
@@ -334,3 +348,146 @@ char *convert_date_str_from_sql_to_user_frmt (const char *sql_date_str)
     int res = sprintf(date_str, DATE_FRMT_STR, k1,k2,k3);
     return date_str;
 }
+
+/*
+ * FUNC day_from_mdy
+ *   Converts a calendar date into a day number, counting 0001-01-01 as day 1.
+ * Day numbers are what the tree models and the db layer use as keys so that
+ * dates do not have to be re-parsed from strings.
+ *
+ * Note: algorithm is the civil calendar conversion of H. Hinnant
+ */
+int day_from_mdy (int m, int d, int y)
+{
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;                                   /* [0, 399]    */
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;  /* [0, 365]    */
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;           /* [0, 146096] */
+    return era * 146097 + doe - 719468 + DAY_OF_UNIX_EPOCH;
+}
+
+/*
+ * FUNC mdy_from_day
+ *   Inverse of day_from_mdy, stores the month, day and year of day in the
+ * int* provided by the caller
+ */
+void mdy_from_day (int day, int *m, int *d, int *y)
+{
+    int z = day - DAY_OF_UNIX_EPOCH + 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    int doy = doe - (365*yoe + yoe/4 - yoe/100);
+    int mp  = (5*doy + 2)/153;
+
+    *d = doy - (153*mp + 2)/5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+/*
+ * FUNC day_from_sql_date_str
+ *   Converts a SQL formatted date string to a day number
+ * Returns 0 if the string could not be read
+ */
+int day_from_sql_date_str (const char *sql_date_str)
+{
+    int m,d,y;
+    if (sql_date_str == NULL)
+        return 0;
+    if (sscanf(sql_date_str, SQL_FRMT_STR, &y, &m, &d) != 3)
+        return 0;
+    return day_from_mdy (m, d, y);
+}
+
+/*
+ * FUNC day_from_user_date_str
+ *   Validates a date string in user format and converts it to a day number
+ * Returns 0 if the date is not valid (valid dates are always >= 1)
+ */
+int day_from_user_date_str (const char *date_str)
+{
+    int m,d,y;
+    if (!parse_and_validate_user_date_str ((char *) date_str, &m, &d, &y))
+        return 0;
+    return day_from_mdy (m, d, y);
+}
+
+/*
+ * FUNC get_current_day
+ *   Returns the day number of the current (local) date
+ */
+int get_current_day (void)
+{
+    time_t mytime = time(NULL);
+    struct tm now;
+    struct tm *current_time = localtime_r(&mytime, &now);
+    return day_from_mdy (current_time->tm_mon + 1,
+                         current_time->tm_mday,
+                         current_time->tm_year + 1900);
+}
+
+/*
+ * FUNC day_add_months
+ *   Returns the day number months months after day (before if negative).
+ * Like DATE(..., '+N months') in SQLite a day of month past the end of the 
+ * new month rolls over into the next, ie: 1/31 + 1 month is 3/3 (or 3/2)
+ */
+int day_add_months (int day, int months)
+{
+    int m,d,y;
+    mdy_from_day (day, &m, &d, &y);
+
+    /* work with months counted from 0 so / and % can normalize */
+    int total = y * 12 + (m - 1) + months;
+    y = total / 12;
+    m = total % 12 + 1;
+
+    return day_from_mdy (m, 1, y) + d - 1;
+}
+
+/*
+ * FUNC convert_day_to_user_frmt
+ *   Renders a day number as a date string in "user format"
+ * NOTE: USES MALLOC will have to be FREED
+ */
+char *convert_day_to_user_frmt (int day)
+{
+    int m,d,y;
+    mdy_from_day (day, &m, &d, &y);
+    char *date_str = malloc (sizeof (char) * DATE_STR_LIMIT);
+    if (date_str == NULL) {
+        return NULL;
+    }
+
+    /* convert mdy to user format */
+    int seq[3] = {m, d, y};
+    mdy_to_user_frmt(seq);
+
+    sprintf(date_str, DATE_FRMT_STR, seq[0], seq[1], seq[2]);
+    return date_str;
+}
+
+/*
+ * FUNC next_due_day
+ *   Returns the day an item with frequency freq freq_type is next due if it
+ * was completed on day (see add_view.c for the freq_type values).
+ * Returns 0 for "no_repeat", an unknown freq_type or a freq below 1.
+ */
+int next_due_day (int day, int freq, const char *freq_type)
+{
+    if (freq < 1)
+        return 0;
+
+    if (strcmp (freq_type, "days") == 0)
+        return day + freq;
+    if (strcmp (freq_type, "weeks") == 0)
+        return day + 7 * freq;
+    if (strcmp (freq_type, "months") == 0)
+        return day_add_months (day, freq);
+    if (strcmp (freq_type, "years") == 0)
+        return day_add_months (day, 12 * freq);
+
+    return 0;
+}
@@ -16,3 +16,21 @@ char *make_date_str_sql_frmt(int m, int d, int y);
 char *convert_date_str_from_sql_to_user_frmt (const char *sql_date_str);
 
 char *make_date_str_sql_frmt(int m, int d, int y);
+
+/* Julian day of day number 0, for SQL. Adding it to a bound day number gives
+ * a value that DATE() understands */
+#define JULIAN_DAY_0 "1721424.5"
+
+/* Day numbers count 0001-01-01 as day 1, so 0 is never a valid day */
+int day_from_mdy (int m, int d, int y);
+void mdy_from_day (int day, int *m, int *d, int *y);
+int day_from_sql_date_str (const char *sql_date_str);
+/* returns 0 if date_str is not a valid date */
+int day_from_user_date_str (const char *date_str);
+int get_current_day (void);
+int day_add_months (int day, int months);
+/* returns 0 if the item does not repeat */
+int next_due_day (int day, int freq, const char *freq_type);
+
+/* NOTE: USES MALLOC NEEDS TO BE FREED! */
+char *convert_day_to_user_frmt (int day);
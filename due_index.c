@@ -0,0 +1,628 @@
+/*******************************************************************************
+ * due_index.c
+ * Keeps every row of upcoming in one array sorted by (day, item_id), so the
+ * look ahead ("due from a to b") is a binary search and a contiguous slice
+ * of memory instead of a walk of upcoming_date and a row lookup for each
+ * item.
+ *
+ * The array is loaded once by due_index_init and then kept current by temp
+ * triggers on the connection calling due_index_changed, much like
+ * query_cache.c. Each connection (see RoutineDb in sql_db.c) has an index of
+ * its own, handed to the SQL functions as their user data. It is marked
+ * stale, and loaded again the next time it is used, when:
+ *   - a transaction is rolled back, since the triggers may have fired for
+ *     rows that are no longer there (sql_db.c calls due_index_invalidate
+ *     from the rollback hook of the connection)
+ *   - PRAGMA data_version moves, ie: another connection committed
+ *   - a trigger reports a row the index does not have
+ *   - due_index_invalidate is called ahead of a bulk edit (see sql_db.c)
+ *
+ * Entries hold the category id of their item. The names are kept in a table
+ * of their own, so renaming a category touches one name and not the entries.
+ *
+ * Only the thread using the connection may use its index (the triggers fire
+ * on that connection).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "dates.h"
+#include "due_index.h"
+#include "setup.h"
+
+/* entries allocated on the first load of an empty table */
+#define DUE_INDEX_MIN_CAPACITY 64
+
+/* category names allocated on the first load */
+#define DUE_INDEX_MIN_NAMES 16
+
+struct due_index {
+    Due_entry *entries;
+    int n_entries;
+    int capacity;
+    int stale;
+    sqlite3 *db;
+    sqlite3_stmt *data_version_stmt;
+    sqlite3_int64 loaded_version;
+
+    /* category names by id, NULL where there is no such category */
+    char **names;
+    int n_names;
+};
+
+/* Every write to the columns of upcoming kept here calls due_index_changed
+ * with the item id and date of the old row and the item id, date, description
+ * and category id of the new one (NULL where there is no such row). Writes to
+ * urgency alone (see refresh_urgency in sql_db.c) do not. Moving an item to
+ * another category calls due_index_recategorized, and any write to
+ * categories due_index_named */
+static const char *index_triggers[] = {
+    "CREATE TEMP TRIGGER IF NOT EXISTS due_index_insert "\
+    "AFTER INSERT ON main.upcoming BEGIN "\
+    "    SELECT due_index_changed(NULL, NULL, new.item_id, new.date, "\
+    "        new.description, (SELECT category_id FROM main.attributes "\
+    "        WHERE id = new.item_id)); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS due_index_update "\
+    "AFTER UPDATE OF item_id, date, description "\
+    "ON main.upcoming BEGIN "\
+    "    SELECT due_index_changed(old.item_id, old.date, new.item_id, "\
+    "        new.date, new.description, (SELECT category_id "\
+    "        FROM main.attributes WHERE id = new.item_id)); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS due_index_delete "\
+    "AFTER DELETE ON main.upcoming BEGIN "\
+    "    SELECT due_index_changed(old.item_id, old.date, NULL, NULL, "\
+    "                             NULL, NULL); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS due_index_recategorize "\
+    "AFTER UPDATE OF category_id ON main.attributes BEGIN "\
+    "    SELECT due_index_recategorized(new.id, new.category_id); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS due_index_category_insert "\
+    "AFTER INSERT ON main.categories BEGIN "\
+    "    SELECT due_index_named(new.id, new.name); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS due_index_category_update "\
+    "AFTER UPDATE OF name ON main.categories BEGIN "\
+    "    SELECT due_index_named(new.id, new.name); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS due_index_category_delete "\
+    "AFTER DELETE ON main.categories BEGIN "\
+    "    SELECT due_index_named(old.id, NULL); "\
+    "END"
+};
+
+/* prototypes */
+int due_index_init (sqlite3 *db, Due_index **index);
+void due_index_close (Due_index *index);
+const char *due_index_category (Due_index *index, int category_id);
+void due_index_invalidate (Due_index *index);
+int due_index_slice (Due_index *index, int day, int item_id, int end_day,
+                     const Due_entry **first);
+
+/* helpers */
+static int load_index (Due_index *index);
+static int load_names (Due_index *index);
+static void clear_index (Due_index *index);
+static void clear_names (Due_index *index);
+static void set_name (Due_index *index, int category_id, const char *name);
+static int lower_bound (Due_index *index, int day, int item_id);
+static void insert_entry (Due_index *index, int day, int item_id,
+                          const char *description, int category_id);
+static int remove_entry (Due_index *index, int day, int item_id);
+static void make_room (Due_index *index);
+static char *copy_text (const char *text);
+static int compare_entries (const void *a, const void *b);
+static void due_index_changed (sqlite3_context *ctx, int argc,
+                               sqlite3_value **argv);
+static void due_index_recategorized (sqlite3_context *ctx, int argc,
+                                     sqlite3_value **argv);
+static void due_index_named (sqlite3_context *ctx, int argc,
+                             sqlite3_value **argv);
+static sqlite3_int64 current_data_version (Due_index *index);
+/* end prototypes */
+
+/*
+ * FUNC due_index_init
+ *   Makes the index of db: registers due_index_changed,
+ * due_index_recategorized and due_index_named on db, creates the temp
+ * triggers that call them and loads the index.
+ *
+ * Returns a sqlite3 status code. *index is set even on error, free it with
+ * due_index_close
+ */
+int due_index_init (sqlite3 *db, Due_index **index)
+{
+    Due_index *new_index;
+    int rc;
+    size_t i;
+
+    new_index = calloc (1, sizeof (Due_index));
+    if (new_index == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "due_index.c 4\n");
+        exit (EXIT_FAILURE);
+    }
+    new_index->db = db;
+    new_index->stale = 1;
+    new_index->loaded_version = -1;
+    *index = new_index;
+
+    rc = sqlite3_create_function (db, "due_index_changed", 6, SQLITE_UTF8,
+                                  new_index, due_index_changed, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "due_index_recategorized", 2,
+                                      SQLITE_UTF8, new_index,
+                                      due_index_recategorized, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "due_index_named", 2, SQLITE_UTF8,
+                                      new_index, due_index_named, NULL, NULL);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    for (i = 0; i < sizeof (index_triggers) / sizeof (char *); i++) {
+        rc = sqlite3_exec (db, index_triggers[i], NULL, NULL, NULL);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    rc = sqlite3_prepare_v3 (db, "PRAGMA data_version", -1,
+                             SQLITE_PREPARE_PERSISTENT,
+                             &new_index->data_version_stmt, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    return load_index (new_index);
+}
+
+/*
+ * FUNC due_index_close
+ *   Frees the index and finalizes its statement. The connection has to be
+ * closed next, its triggers would call into the freed index.
+ */
+void due_index_close (Due_index *index)
+{
+    if (index == NULL)
+        return;
+
+    clear_index (index);
+    free (index->entries);
+    clear_names (index);
+    free (index->names);
+
+    sqlite3_finalize (index->data_version_stmt);
+    free (index);
+}
+
+/*
+ * FUNC due_index_category
+ *   Looks up the name of a category in the table loaded with the index
+ */
+const char *due_index_category (Due_index *index, int category_id)
+{
+    if (category_id <= 0 || category_id >= index->n_names ||
+        index->names[category_id] == NULL)
+        return "";
+
+    return index->names[category_id];
+}
+
+/*
+ * FUNC due_index_invalidate
+ *   Marks the index stale, so the triggers leave it alone and it is loaded
+ * whole the next time it is used. Cheaper than a memmove for every row
+ * when one statement writes a large part of upcoming, and needed after a
+ * rollback.
+ */
+void due_index_invalidate (Due_index *index)
+{
+    if (index != NULL)
+        index->stale = 1;
+}
+
+/*
+ * FUNC due_index_slice
+ *   Finds the entries from (day, item_id) up to the end of end_day, loading
+ * the index again first if it went stale. Item ids start at 1, so item_id 0
+ * starts at the first entry of day.
+ *
+ * Returns the number of entries, -1 on error
+ */
+int due_index_slice (Due_index *index, int day, int item_id, int end_day,
+                     const Due_entry **first)
+{
+    int from, to;
+
+    if (index == NULL)
+        return -1;
+
+    if ((index->stale ||
+         current_data_version (index) != index->loaded_version) &&
+        load_index (index) != SQLITE_OK)
+        return -1;
+
+    from = lower_bound (index, day, item_id);
+    to   = lower_bound (index, end_day + 1, 0);
+
+    *first = index->entries + from;
+    return (to > from) ? to - from : 0;
+}
+
+/*
+ * FUNC load_index
+ *   Reads all of upcoming into entries and sorts it
+ * Returns a sqlite3 status code, the index stays stale on error
+ */
+static int load_index (Due_index *index)
+{
+    sqlite3_stmt *res;
+    int rc;
+
+    char *query = "SELECT u.date, u.item_id, u.description, a.category_id "\
+                  "FROM upcoming u LEFT JOIN attributes a ON a.id = u.item_id "\
+                  "WHERE u.item_id IS NOT NULL";
+
+    clear_index (index);
+    index->stale = 1;
+
+    rc = load_names (index);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    rc = sqlite3_prepare_v2 (index->db, query, -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    index->loaded_version = current_data_version (index);
+
+    while ((rc = sqlite3_step (res)) == SQLITE_ROW) {
+        Due_entry *entry;
+        int day = day_from_sql_date_str (
+                        (const char *) sqlite3_column_text (res, 0));
+        if (day <= 0)
+            continue;
+
+        make_room (index);
+        entry = &index->entries[index->n_entries];
+        entry->day         = day;
+        entry->item_id     = sqlite3_column_int (res, 1);
+        entry->description =
+            copy_text ((const char *) sqlite3_column_text (res, 2));
+        entry->category_id = sqlite3_column_int (res, 3);
+        index->n_entries++;
+    }
+
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_DONE) {
+        clear_index (index);
+        return rc;
+    }
+
+    qsort (index->entries, index->n_entries, sizeof (Due_entry),
+           compare_entries);
+    index->stale = 0;
+
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC load_names
+ *   Helper function to load_index
+ * Reads all of categories into names
+ * Returns a sqlite3 status code
+ */
+static int load_names (Due_index *index)
+{
+    sqlite3_stmt *res;
+    int rc;
+
+    clear_names (index);
+
+    rc = sqlite3_prepare_v2 (index->db, "SELECT id, name FROM categories",
+                             -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    while ((rc = sqlite3_step (res)) == SQLITE_ROW)
+        set_name (index, sqlite3_column_int (res, 0),
+                  (const char *) sqlite3_column_text (res, 1));
+
+    sqlite3_finalize (res);
+
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+/*
+ * FUNC clear_index
+ *   Frees the strings of every entry, keeps the array for the next load
+ */
+static void clear_index (Due_index *index)
+{
+    int i;
+
+    for (i = 0; i < index->n_entries; i++)
+        free (index->entries[i].description);
+    index->n_entries = 0;
+}
+
+/*
+ * FUNC clear_names
+ *   Frees every category name, keeps the array for the next load
+ */
+static void clear_names (Due_index *index)
+{
+    int i;
+
+    for (i = 0; i < index->n_names; i++) {
+        free (index->names[i]);
+        index->names[i] = NULL;
+    }
+}
+
+/*
+ * FUNC set_name
+ *   Sets the name of category_id, NULL for none, growing names to fit.
+ * Category ids are rowids handed out in order, so names stays small.
+ */
+static void set_name (Due_index *index, int category_id, const char *name)
+{
+    if (category_id <= 0)
+        return;
+
+    if (category_id >= index->n_names) {
+        int new_size = (index->n_names > 0) ? index->n_names
+                                            : DUE_INDEX_MIN_NAMES;
+        char **grown;
+
+        while (new_size <= category_id)
+            new_size *= 2;
+
+        grown = realloc (index->names, new_size * sizeof (char *));
+        if (grown == NULL) {
+            fprintf (stderr, MEM_FAIL_IN "due_index.c 3\n");
+            exit (EXIT_FAILURE);
+        }
+        memset (grown + index->n_names, 0,
+                (new_size - index->n_names) * sizeof (char *));
+
+        index->names = grown;
+        index->n_names = new_size;
+    }
+
+    free (index->names[category_id]);
+    index->names[category_id] = (name != NULL) ? copy_text (name) : NULL;
+}
+
+/*
+ * FUNC lower_bound
+ *   Returns the position of the first entry at or after (day, item_id),
+ * n_entries if there is none
+ */
+static int lower_bound (Due_index *index, int day, int item_id)
+{
+    const Due_entry *entries = index->entries;
+    int lo = 0,
+        hi = index->n_entries;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (entries[mid].day < day ||
+            (entries[mid].day == day && entries[mid].item_id < item_id))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * FUNC insert_entry
+ *   Inserts a row into entries, keeping it sorted
+ */
+static void insert_entry (Due_index *index, int day, int item_id,
+                          const char *description, int category_id)
+{
+    int pos = lower_bound (index, day, item_id);
+    Due_entry *entries;
+
+    make_room (index);
+    entries = index->entries;
+    memmove (&entries[pos + 1], &entries[pos],
+             (index->n_entries - pos) * sizeof (Due_entry));
+
+    entries[pos].day         = day;
+    entries[pos].item_id     = item_id;
+    entries[pos].description = copy_text (description);
+    entries[pos].category_id = category_id;
+    index->n_entries++;
+}
+
+/*
+ * FUNC remove_entry
+ *   Removes the entry (day, item_id)
+ * Returns 1 on success, -1 if there is no such entry
+ */
+static int remove_entry (Due_index *index, int day, int item_id)
+{
+    int pos = lower_bound (index, day, item_id);
+    Due_entry *entries = index->entries;
+
+    if (pos == index->n_entries || entries[pos].day != day ||
+        entries[pos].item_id != item_id)
+        return -1;
+
+    free (entries[pos].description);
+    memmove (&entries[pos], &entries[pos + 1],
+             (index->n_entries - pos - 1) * sizeof (Due_entry));
+    index->n_entries--;
+
+    return 1;
+}
+
+/*
+ * FUNC make_room
+ *   Makes sure entries has room for one more, doubling it if not
+ */
+static void make_room (Due_index *index)
+{
+    Due_entry *grown;
+    int new_capacity;
+
+    if (index->n_entries < index->capacity)
+        return;
+
+    new_capacity = (index->capacity > 0) ? index->capacity * 2
+                                         : DUE_INDEX_MIN_CAPACITY;
+    grown = realloc (index->entries, new_capacity * sizeof (Due_entry));
+    if (grown == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "due_index.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+
+    index->entries = grown;
+    index->capacity = new_capacity;
+}
+
+/*
+ * FUNC copy_text
+ *   Copies a text column, NULL is copied as ""
+ * NOTE: USES MALLOC
+ */
+static char *copy_text (const char *text)
+{
+    char *copy = strdup (text != NULL ? text : "");
+    if (copy == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "due_index.c 2\n");
+        exit (EXIT_FAILURE);
+    }
+    return copy;
+}
+
+/*
+ * FUNC compare_entries
+ *   qsort comparison by (day, item_id)
+ */
+static int compare_entries (const void *a, const void *b)
+{
+    const Due_entry *x = a,
+                    *y = b;
+
+    if (x->day != y->day)
+        return (x->day < y->day) ? -1 : 1;
+    if (x->item_id != y->item_id)
+        return (x->item_id < y->item_id) ? -1 : 1;
+    return 0;
+}
+
+/*
+ * FUNC due_index_changed
+ *   SQL function due_index_changed(old_item_id, old_date, new_item_id,
+ * new_date, new_description, new_category_id) called by the temp triggers.
+ * Removes the old row and inserts the new one, rows without an item id or a
+ * readable date are not in the index. Does nothing while the index is
+ * stale, it is loaded whole the next time it is used.
+ */
+static void due_index_changed (sqlite3_context *ctx, int argc,
+                               sqlite3_value **argv)
+{
+    Due_index *index = sqlite3_user_data (ctx);
+
+    sqlite3_result_null (ctx);
+
+    if (index->stale)
+        return;
+
+    if (sqlite3_value_type (argv[0]) != SQLITE_NULL) {
+        int day = day_from_sql_date_str (
+                        (const char *) sqlite3_value_text (argv[1]));
+        if (day > 0 &&
+            remove_entry (index, day, sqlite3_value_int (argv[0])) < 0) {
+            index->stale = 1;
+            return;
+        }
+    }
+
+    if (sqlite3_value_type (argv[2]) != SQLITE_NULL) {
+        int day = day_from_sql_date_str (
+                        (const char *) sqlite3_value_text (argv[3]));
+        if (day > 0)
+            insert_entry (index, day, sqlite3_value_int (argv[2]),
+                          (const char *) sqlite3_value_text (argv[4]),
+                          sqlite3_value_int (argv[5]));
+    }
+}
+
+/*
+ * FUNC due_index_recategorized
+ *   SQL function due_index_recategorized(item_id, category_id) called by the
+ * temp triggers. Items are not indexed by id, so this walks every entry; it
+ * is meant for one item at a time (sql_db.c drops the index before moving a
+ * whole category).
+ */
+static void due_index_recategorized (sqlite3_context *ctx, int argc,
+                                     sqlite3_value **argv)
+{
+    Due_index *index = sqlite3_user_data (ctx);
+    int item_id = sqlite3_value_int (argv[0]);
+    int category_id = sqlite3_value_int (argv[1]);
+    int i;
+
+    sqlite3_result_null (ctx);
+
+    if (index->stale)
+        return;
+
+    for (i = 0; i < index->n_entries; i++)
+        if (index->entries[i].item_id == item_id)
+            index->entries[i].category_id = category_id;
+}
+
+/*
+ * FUNC due_index_named
+ *   SQL function due_index_named(category_id, name) called by the temp
+ * triggers, name is NULL for a category deleted
+ */
+static void due_index_named (sqlite3_context *ctx, int argc,
+                             sqlite3_value **argv)
+{
+    Due_index *index = sqlite3_user_data (ctx);
+
+    sqlite3_result_null (ctx);
+
+    if (index->stale)
+        return;
+
+    set_name (index, sqlite3_value_int (argv[0]),
+              (const char *) sqlite3_value_text (argv[1]));
+}
+
+/*
+ * FUNC current_data_version
+ *   Reads PRAGMA data_version, see query_cache.c
+ * Returns -1 on error
+ */
+static sqlite3_int64 current_data_version (Due_index *index)
+{
+    sqlite3_int64 version = -1;
+
+    if (index->data_version_stmt == NULL)
+        return -1;
+
+    if (sqlite3_step (index->data_version_stmt) == SQLITE_ROW)
+        version = sqlite3_column_int64 (index->data_version_stmt, 0);
+    sqlite3_reset (index->data_version_stmt);
+
+    return version;
+}
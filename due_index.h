@@ -0,0 +1,42 @@
+/*******************************************************************************
+ * due_index.h
+ * Header for the in memory index of upcoming due dates, sorted by
+ * (day, item_id), that answers "what is due from day a to day b" without
+ * going to the db.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+
+/* One row of upcoming */
+typedef struct due_entry {
+    int   day;
+    int   item_id;
+    char *description;
+    int   category_id;  /* of the item, see due_index_category */
+} Due_entry;
+
+/* The index of one connection */
+typedef struct due_index Due_index;
+
+/* Loads an index of db into *index and keeps it current through temp
+ * triggers on db, returns a sqlite3 status code. *index is set even on
+ * error */
+int due_index_init (sqlite3 *db, Due_index **index);
+
+/* Frees the index, before db is closed */
+void due_index_close (Due_index *index);
+
+/* Name of the category with id category_id, "" if there is none. Valid until
+ * the next write to categories */
+const char *due_index_category (Due_index *index, int category_id);
+
+/* Drops the index until it is next used, for writes to many rows at once
+ * and after a rollback */
+void due_index_invalidate (Due_index *index);
+
+/* Sets first to the first entry at or after (day, item_id) and returns how
+ * many follow, in order, up to and including end_day. The entries stay valid
+ * until the next write to upcoming. Returns -1 if the index cannot be used */
+int due_index_slice (Due_index *index, int day, int item_id, int end_day,
+                     const Due_entry **first);
@@ -6,13 +6,28 @@
 #include <gtk/gtk.h>
 #include <stdlib.h>
 
+#include "category_filter.h"
+#include "prefetch.h"
 #include "setup.h" 
 #include "sql_db.h"
+#include "tag_filter.h"
 
 
 #define NUMBER_OF_TYPES 5
 #define IDX_OF_NO_REPEAT 4
 
+/* Rows of create_attributes_model, with or without a category to be
+ * under. The categories under ?1 are one range of category_tree. The id
+ * is only read to check the item against the tag filter */
+#define ATTRIBUTES_SELECT \
+    "SELECT a.description, c.name, a.freq, a.freq_type, a.track_history, "\
+    "a.id "\
+    "FROM attributes a LEFT JOIN categories c ON c.id = a.category_id "
+#define ATTRIBUTES_UNDER \
+    "WHERE a.category_id IN (SELECT descendant FROM category_tree "\
+    "    WHERE ancestor = ?1) "
+#define ATTRIBUTES_ORDER "ORDER BY a.description"
+
 /* these arrays are used to construct the model. They are necessary for 
  * language translation issues */
 static char *indexer[NUMBER_OF_TYPES] = {"days", "weeks", "months", "years", 
@@ -39,8 +54,9 @@ static GtkWidget *make_edit_select_view_box (void);
 
 static GtkWidget *make_connected_button_box (GtkTreeModel *model);
 
-/* FIXME should this be in sql_db.c it is accessding the db */
-static GtkTreeModel *create_attributes_model (void);
+/* takes db so that prefetch.c can build it on its own connection */
+GtkTreeModel *create_attributes_model (sqlite3 *db, int category_id,
+                                       const Tag_set *tags);
 
 /* USES MALLOC WILL NEED TO USE FREE */
 static char *make_repeat_string (int freq, const char *freq_type);
@@ -297,28 +313,39 @@ static char *make_repeat_string (int freq, const char *freq_type)
 
 /*
  * FUNC create_attributes_model
- *   Creates the data model for the TreeView of the view
+ *   Creates the data model for the TreeView of the view, reading through db
+ * Only the items under the category category_id are in it, unless it is 0,
+ * and only those in tags, unless it is NULL
+ * Does not touch anything but db, tags and the new model, so it can also
+ * run on the prefetch thread (see prefetch.c)
+ *
+ * Returns NULL on error
  */
-static GtkTreeModel *create_attributes_model (void)
+GtkTreeModel *create_attributes_model (sqlite3 *db, int category_id,
+                                       const Tag_set *tags)
 {
     /* for sql queries */
     int count;
     int rc;
-    sqlite3 *db = access_db ();
     sqlite3_stmt *res;
-    char * query = "SELECT * FROM ATTRIBUTES ORDER BY description";
+    const char *query = (category_id > 0) ?
+            ATTRIBUTES_SELECT ATTRIBUTES_UNDER ATTRIBUTES_ORDER :
+            ATTRIBUTES_SELECT ATTRIBUTES_ORDER;
 
     rc = sqlite3_prepare (db, query, -1, &res, 0);
+    if (rc == SQLITE_OK && category_id > 0)
+        rc = sqlite3_bind_int (res, 1, category_id);
 
     if (rc != SQLITE_OK) {
-        fprintf (stderr, DATABASE_ATTRIBUTES_MODEL_FAIL);
-        exit (EXIT_FAILURE);
+        log_db_error(rc);
+        sqlite3_finalize (res);
+        return NULL;
     }
 
     count = count_rows_of_res(db,res);
     if (count < 0) {
-        fprintf (stderr, DATABASE_ATTRIBUTES_MODEL_FAIL);
-        exit (EXIT_FAILURE);
+        sqlite3_finalize (res);
+        return NULL;
     }
 
     GtkListStore *store;
@@ -347,6 +374,11 @@ static GtkTreeModel *create_attributes_model (void)
         freq_type   = sqlite3_column_text (res,3);
         is_tracked  = sqlite3_column_int  (res,4);
 
+        if (tags != NULL && !tag_set_has (tags, sqlite3_column_int (res,5))) {
+            rc = sqlite3_step (res);
+            continue;
+        }
+
         /* Note memory allocation failures handled in make_repeat_string */
         char *repeat = make_repeat_string (freq, freq_type);
         char *track = (is_tracked == 1) ? YES : NO;
@@ -363,7 +395,7 @@ static GtkTreeModel *create_attributes_model (void)
         rc = sqlite3_step (res);
     }
 
-    if (count > 0) {
+    if (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (store), NULL) > 0) {
         set_first_as_selected (store);
     }
 
@@ -426,26 +458,32 @@ static void select_item_wrapper (GtkWidget *button, GtkTreeModel *model)
 /*
  * FUNC make_connected_button_box
  *   Helper function to make_edit_select_view_box
- * Makes row that holds the back and select buttons AND connects the callbacks
+ * Makes row that holds the back, bulk edit and select buttons AND connects
+ * the callbacks
  */
 static GtkWidget *make_connected_button_box (GtkTreeModel *model)
 {
     GtkWidget *row,
               *spacer,
               *back,
+              *bulk,
               *select;
 
     row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
     back = gtk_button_new_with_label (BACK);
+    bulk = gtk_button_new_with_label (BULK_EDIT);
     select = gtk_button_new_with_label (SELECT);
     spacer = gtk_label_new ("       ");
 
     gtk_box_pack_start (GTK_BOX (row), back, FALSE, FALSE, 20);
     gtk_box_pack_start (GTK_BOX (row), spacer, TRUE, TRUE, 10);
+    gtk_box_pack_start (GTK_BOX (row), bulk, FALSE, FALSE, 20);
     gtk_box_pack_start (GTK_BOX (row), select, FALSE, FALSE, 20);
 
     g_signal_connect (G_OBJECT (back), "clicked",
             G_CALLBACK (set_main), NULL);
+    g_signal_connect (G_OBJECT (bulk), "clicked",
+            G_CALLBACK (set_bulk_view), NULL);
     g_signal_connect (G_OBJECT (select), "clicked",
             G_CALLBACK (select_item_wrapper), model);
 
@@ -461,15 +499,36 @@ static GtkWidget *make_connected_button_box (GtkTreeModel *model)
 static GtkWidget *make_edit_select_view_box (void)
 {
     GtkWidget *box,
+              *filters,
+              *filter,
+              *tags_filter,
               *bottom_row;
     GtkTreeModel *tmodel;
 
     /* Box to hold the edit_select_view */
     box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
 
-
-    GtkTreeModel *model;
-    model = create_attributes_model ();
+    filters = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 10);
+    filter = make_category_filter (set_edit_select_view);
+    tags_filter = make_tag_filter (set_edit_select_view);
+    gtk_box_pack_start (GTK_BOX (filters), filter, TRUE, TRUE, 0);
+    gtk_box_pack_start (GTK_BOX (filters), tags_filter, TRUE, TRUE, 0);
+    gtk_box_pack_start (GTK_BOX (box), filters, FALSE, FALSE, 10);
+
+    /* only every item is prefetched */
+    int category_id = category_filter_get ();
+    Tag_set *tags = tag_filter_eval ();
+    GtkTreeModel *model = NULL;
+    if (category_id == 0 && tags == NULL)
+        model = prefetch_take_attributes ();
+    if (model == NULL)
+        model = create_attributes_model (routine_db_conn (app_db ()),
+                                         category_id, tags);
+    tag_set_free (tags);
+    if (model == NULL) {
+        fprintf (stderr, DATABASE_ATTRIBUTES_MODEL_FAIL);
+        exit (EXIT_FAILURE);
+    }
 
     GtkWidget *sw,
               *treeview;
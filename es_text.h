@@ -32,7 +32,7 @@
 // NOTE: these are not currently being used 
 #define DESC_LIMIT 101
 #define FREQ_TYPE_LIMIT 7
-#define CATEGORY_LIMIT 21
+#define CATEGORY_LIMIT 61
 
 /******* For init.c *******/
 #define FATAL_DB_ERROR_NO_ACCESS "Error fatal: no puede acceder a la base de datos"
@@ -40,6 +40,12 @@
 /******* For main_view.c *******/
 
 #define TODAY_VIEW_HEADING "Cosas para hoy"
+#define ROWS_LOADED "%d tareas cargadas..."
+#define ALL_CATEGORIES "Todas las categorías"
+#define TAG_FILTER_HINT "Filtrar por etiquetas"
+#define TAG_FILTER_TOOLTIP "Nombres de etiquetas unidos con AND, OR y NOT, por ejemplo\ncrew A AND quarterly AND NOT outdoor\nPulse intro para filtrar, vacíelo para ver todas las tareas."
+#define NO_SUCH_TAG "Ninguna tarea ha tenido nunca una de esas etiquetas."
+#define TAG_FILTER_INVALID "Una los nombres de etiquetas con AND, OR y NOT (en mayúsculas)\ny cierre cada paréntesis."
 
 #define DESCRIPTION "Descripción"
 
@@ -57,6 +63,8 @@
 
 #define LOOK_AHEAD_OR_BACK "adelante / atrás"
 
+#define EVERY_SITE "todos los sitios"
+
 #define SNOOZE "cambiar fecha"
 
 #define MARK_COMPLETED "completar"
@@ -118,6 +126,8 @@
 
 #define MONTH "mes"
 
+#define AT_EVERY_SITE "en todos los sitios"
+
 // Uses BACK
 // Uses MONTHS
 // Uses INVALID_DATE
@@ -134,12 +144,37 @@
 #define NO_ITEMS_IN_RANGE "No hay elementos para mostrar en el rango seleccionado"
 #define ITEMS_DUE_IN_RANGE "Tareas con vencimiento en el rango seleccionado"
 #define ITEMS_COMPLETED_IN_RANGE "Tareas completados en el rango seleccionado"
+#define LOADING_ITEMS "Cargando tareas..."
+
+/******* For use in sites_view.c *******/
+#define SITE "Sitio"
+#define DUE_AT_EVERY_SITE "Pendientes en todos los sitios"
+#define SITES_FAIL "No se pudo abrir la base de datos de todos los sitios."
+// Uses ITEMS_DUE_IN_RANGE, ITEMS_COMPLETED_IN_RANGE
 
 /******* For use in edit_select_view.c *******/
 #define SELECT "escoger"
 #define REPEAT_EVERY "Se repite cada"
+#define BULK_EDIT "editar en grupo"
 // Uses TRACK_HISTORY
 
+/******* For use in bulk_view.c *******/
+#define BULK_EDIT_HEADING "Cambiar todas las tareas pendientes que cumplan:"
+#define ANY "cualquiera"
+#define DUE_FROM "Vencen desde"
+#define MOVE_DUE_DATES_BY "Mover sus fechas de vencimiento"
+#define MOVE "mover"
+#define NO_ITEMS_MATCH "Ninguna tarea pendiente cumple."
+#define BULK_EDIT_CONFIRM "Se cambiarán %d tareas. ¿Continuar?"
+#define RENAME_CATEGORY_TO "Cambiar el nombre de la categoría a"
+#define RENAME "renombrar"
+#define NO_SUCH_CATEGORY "Escribe el nombre de una categoría existente y un nuevo nombre\nque no esté ni por encima ni por debajo de ella."
+#define PURGE_MATCHING "Eliminarlas con todo su historial"
+#define PURGE "purgar"
+#define BULK_PURGE_CONFIRM "Se eliminarán permanentemente %d tareas con todo su historial. ¿Continuar?"
+// Uses CATEGORY, TO, REPEAT_EVERY, EVERY, CHANGE_FREQ, START_BEFORE_END
+// Uses CANNOT_HAVE_APOSTROPHES, DATABASE_PURGE_ITEM_FAIL
+
 /******* For use in selected_view.c *******/
 #define UPDATE_COMPLETED "Actualización completada"
 #define UPDATE_ATTRIBUTES "Actualizar atributos"
@@ -149,11 +184,16 @@
 #define EVERY "Cada"
 #define CHANGE_FREQ "cambiar la frecuencia"
 #define CHANGE_CATEGORY "cambiar la categoría"
+#define TAGS "Etiquetas"
+#define CHANGE_TAGS "cambiar las etiquetas"
+#define TAGS_INVALID "Separe las etiquetas con comas. Una etiqueta no puede tener\nparéntesis ni AND, OR o NOT como palabra."
 #define REMOVE_FROM_UPCOMING "eliminar la fecha de vencimiento"
 #define REMOVE_AND_DELETE_HIST "Eliminar tarea y eliminar historial"
 #define PURGE_WARN "Estás seguro/segura que quieres elimiar todo la información de la tarea?"
 #define PERMANENTLY_REMOVE "Eliminar permanentemente la tarea y el historial"
 #define PURGE_ITEM "purgar tarea"
+#define COMPLETED_TIMES "Completado %d veces, la última el %s"
+#define ON_AVERAGE_EVERY ", aproximadamente cada %.1f días"
 
 /******* For error handling and success *******/
 #define FATAL_ERROR "Error fatal encontrado."
@@ -179,6 +219,23 @@
 #define DATABASE_PURGE_ITEM_FAIL "ERROR: Al intentar eliminar el elemento ocurrió un error.\nLa base de datos puede está seriamente dañada.\nPor favor solucionar antes de continuar."
 #define DATABASE_ATTRIBUTES_MODEL_FAIL "Fatal Error: No se pudieron obtener los datos de elemento"
 #define DATABASE_MARK_COMPLETE_FAIL "Error al marcar el elemento íntegro."
+#define DATABASE_MIGRATION_FAIL "Error: No se pudo actualizar la base de datos a la versión %d del esquema.\n"
+#define DATABASE_LOAD_HIST_PAGE_FAIL "Error: No se pudo cargar más historial."
+#define DATABASE_CATEGORY_COUNTS_FAIL "Error: No se pudieron contar las tareas pendientes de cada categoría.\n"
+#define DATABASE_TAGS_FAIL "Error: No se pudieron cambiar las etiquetas del elemento."
+#define DATABASE_GET_TAGS_FAIL "Error: No se pudieron cargar las etiquetas del elemento.\n"
+#define DATABASE_TAG_INDEX_FAIL "Error: No se pudo cargar el índice de etiquetas, los filtros de etiquetas están desactivados.\n"
+#define DATABASE_VACUUM_FAIL "Error: No se pudo preparar la base de datos para reducirse tras purgar.\n"
+#define DATABASE_VACUUM_DONE "Base de datos: %" G_GINT64_FORMAT " bytes antes, %" G_GINT64_FORMAT " después, se reduce tras purgar"
+#define DATABASE_ARCHIVE_FAIL "Error: No se pudieron archivar las terminaciones antiguas, el historial se mantiene como está.\n"
+#define FEDERATION_SITE_OLD "Error: La base de datos del sitio %s está en otra versión del esquema que este programa, se omite hasta que se actualice el programa allí.\n"
+#define FEDERATION_LOAD_FAIL "Error: No se pudieron cargar las tareas del sitio %s.\n"
+#define PREFETCH_STATS "Precarga: %d aciertos, %d fallos"
+#define MAINTENANCE_STATS "Mantenimiento: %d -> %d páginas (%d -> %d libres), %d terminaciones archivadas, consulta de la vista principal %.2f -> %.2f ms, paso más largo %.2f ms"
+#define MAINTENANCE_GAVE_UP "Mantenimiento: detenido en el paso %d, %s"
+#define CONFIG_FILE_FAIL "Error: No se pudo leer el archivo de configuración %s (%s), se usan los valores predeterminados.\n"
+#define CONFIG_BAD_VALUE "Error: Se ignora \"%s\" para %s (de %s), no es un valor válido.\n"
+#define CONFIG_REPORT "Configuración: base de datos %s, archivo %s, instantánea %s, historial de %d días, cache_size %" G_GINT64_FORMAT ", mmap_size %" G_GINT64_FORMAT ", synchronous %s, journal_mode %s, límite de memoria %" G_GINT64_FORMAT ", sitios %s"
 
 
 /******* For memory allocation error handling *******/
@@ -0,0 +1,432 @@
+/*******************************************************************************
+ * federation.c
+ * Reads the dbs of several sites (ie: a workshop, a depot and the main
+ * office, each running its own copy of the program) as one, for the every
+ * site view (see sites_view.c). The sites setting (see config.c) lists them
+ * as name=path pairs separated by ';', a path alone is named after its file.
+ *
+ * Each site is a RoutineDb of its own, opened read only: a path and a pool
+ * of read only connections (see routine_db_open_readonly), so opening the
+ * sites reads nothing. A site is never upgraded or otherwise written, the
+ * copy of the program running there does that; one at another schema
+ * version is reported and left out of the load.
+ *
+ * A load reads every site at once: a worker thread hands the sites to a
+ * GThreadPool with a thread for each, and every site is read over a View_db
+ * of its own, so a load takes about as long as the slowest site rather than
+ * all of them. The rows of each site come in date order and are merged into
+ * one model in date order (merge_by_day), the name of the site in
+ * COLUMN_SITE.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "federation.h"
+#include "main_enum.h"
+#include "schema.h"
+#include "setup.h"
+#include "sql_db.h"
+
+#define NUM_MERGED_COLUMNS (COLUMN_SITE + 1)
+
+/* A site of the sites setting */
+typedef struct site {
+    char      *name;
+    RoutineDb *rdb;     /* read only, see routine_db_open_readonly */
+} Site;
+
+struct federation {
+    Site   *sites;
+    int    n_sites;
+    GMutex lock;        /* guards running */
+    GCond  idle;        /* signalled when running drops */
+    int    running;     /* loads reading the sites */
+};
+
+/* What one site of a load reads and what it loaded, NULL if it failed */
+typedef struct site_load {
+    const Site   *site;
+    GCancellable *cancellable;
+    int          start_day;
+    int          end_day;
+    int          with_back;
+    GtkTreeModel *ahead;
+    GtkTreeModel *back;
+} Site_load;
+
+/* A load of every site, see federation_load_async */
+typedef struct federation_load {
+    Federation   *fed;
+    Site_load    *site_loads;   /* one for each site, in the order listed */
+    GtkTreeModel *ahead;        /* merged */
+    GtkTreeModel *back;
+} Federation_load;
+
+/* prototypes */
+int federation_open (const char *sites, Federation **fed);
+void federation_close (Federation *fed);
+void federation_load_async (Federation *fed, int start_day, int end_day,
+                            int with_back, GCancellable *cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data);
+int federation_load_finish (GAsyncResult *result, GtkTreeModel **ahead,
+                            GtkTreeModel **back);
+
+static void load_in_thread (GTask *task, gpointer source_object,
+                            gpointer task_data, GCancellable *cancellable);
+static void load_site (gpointer data, gpointer unused);
+static GtkTreeModel *merge_by_day (Federation_load *load, int back);
+static void free_federation_load (Federation_load *load);
+/* end prototypes */
+
+/*
+ * FUNC federation_open
+ *   Sets up every site in sites, in the order listed, for the loads to
+ * read. No db is opened until then, on the threads of the load.
+ * Returns the sqlite3 status code of the operation, SQLITE_ERROR if sites
+ * lists none
+ * NOTE: USES MALLOC, CLOSE WITH federation_close
+ */
+int federation_open (const char *sites, Federation **fed)
+{
+    char **entries = g_strsplit (sites, ";", -1);
+    int rc = SQLITE_OK;
+
+    Federation *new_fed = calloc (1, sizeof (Federation));
+    if (new_fed == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "federation.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+    *fed = new_fed;
+
+    g_mutex_init (&new_fed->lock);
+    g_cond_init (&new_fed->idle);
+
+    new_fed->sites = calloc (g_strv_length (entries) + 1, sizeof (Site));
+    if (new_fed->sites == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "federation.c 2\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (int i = 0; entries[i] != NULL; i++) {
+        char *entry = g_strstrip (entries[i]);
+        char *path = strchr (entry, '=');
+        Site *site = &new_fed->sites[new_fed->n_sites];
+
+        /* ie: after the last ';' */
+        if (entry[0] == '\0')
+            continue;
+
+        if (path != NULL) {
+            *path++ = '\0';
+            path = g_strstrip (path);
+            site->name = g_strdup (g_strstrip (entry));
+        }
+        else {
+            path = entry;
+            site->name = g_path_get_basename (path);
+        }
+
+        site->rdb = routine_db_open_readonly (path);
+        new_fed->n_sites++;
+    }
+
+    g_strfreev (entries);
+
+    if (new_fed->n_sites == 0)
+        rc = SQLITE_ERROR;
+
+    return rc;
+}
+
+/*
+ * FUNC federation_close
+ *   Waits out the loads still reading the sites (cancel them first), then
+ * closes the db of every site and frees fed. NULL is fine.
+ */
+void federation_close (Federation *fed)
+{
+    if (fed == NULL)
+        return;
+
+    g_mutex_lock (&fed->lock);
+    while (fed->running > 0)
+        g_cond_wait (&fed->idle, &fed->lock);
+    g_mutex_unlock (&fed->lock);
+
+    for (int i = 0; i < fed->n_sites; i++) {
+        routine_db_close (fed->sites[i].rdb);
+        g_free (fed->sites[i].name);
+    }
+
+    g_mutex_clear (&fed->lock);
+    g_cond_clear (&fed->idle);
+    free (fed->sites);
+    free (fed);
+}
+
+/*
+ * FUNC federation_load_async
+ *   Starts loading every site on a worker thread (load_in_thread), callback
+ * is called on the main thread once it is done. Cancelling cancellable
+ * interrupts the queries of every site.
+ * NOTE: USES MALLOC
+ */
+void federation_load_async (Federation *fed, int start_day, int end_day,
+                            int with_back, GCancellable *cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data)
+{
+    Federation_load *load;
+    GTask *task;
+
+    load = calloc (1, sizeof (Federation_load));
+    if (load == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "federation.c 3\n");
+        exit (EXIT_FAILURE);
+    }
+
+    load->fed = fed;
+    load->site_loads = calloc (fed->n_sites, sizeof (Site_load));
+    if (load->site_loads == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "federation.c 4\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < fed->n_sites; i++) {
+        load->site_loads[i].site        = &fed->sites[i];
+        load->site_loads[i].cancellable = cancellable;
+        load->site_loads[i].start_day   = start_day;
+        load->site_loads[i].end_day     = end_day;
+        load->site_loads[i].with_back   = with_back;
+    }
+
+    g_mutex_lock (&fed->lock);
+    fed->running++;
+    g_mutex_unlock (&fed->lock);
+
+    task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_task_data (task, load, (GDestroyNotify) free_federation_load);
+    g_task_run_in_thread (task, load_in_thread);
+    g_object_unref (task);
+}
+
+/*
+ * FUNC federation_load_finish
+ *   Hands the models of a load over to the callback of
+ * federation_load_async, ahead and back are set to NULL unless it succeeded
+ * Returns 1 on success, 0 if the load was cancelled and -1 on error
+ */
+int federation_load_finish (GAsyncResult *result, GtkTreeModel **ahead,
+                            GtkTreeModel **back)
+{
+    GTask *task = G_TASK (result);
+    Federation_load *load = g_task_get_task_data (task);
+    GError *error = NULL;
+
+    *ahead = NULL;
+    *back = NULL;
+
+    if (!g_task_propagate_boolean (task, &error)) {
+        if (error == NULL)
+            return -1;
+
+        g_error_free (error);
+        return 0;
+    }
+
+    *ahead = load->ahead;
+    *back = load->back;
+    load->ahead = NULL;
+    load->back = NULL;
+
+    return 1;
+}
+
+/*
+ * FUNC load_in_thread
+ *   Worker thread. Loads every site at once, one thread of a pool each, and
+ * merges what they loaded once the last is done.
+ */
+static void load_in_thread (GTask *task, gpointer source_object,
+                            gpointer task_data, GCancellable *cancellable)
+{
+    Federation_load *load = task_data;
+    Federation *fed = load->fed;
+    GThreadPool *pool;
+    int ok = 1;
+
+    /* freeing the pool waits for every site pushed to it */
+    pool = g_thread_pool_new (load_site, NULL, fed->n_sites, FALSE, NULL);
+    for (int i = 0; i < fed->n_sites; i++)
+        g_thread_pool_push (pool, &load->site_loads[i], NULL);
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+    for (int i = 0; i < fed->n_sites; i++) {
+        if (load->site_loads[i].ahead == NULL ||
+            (load->site_loads[i].with_back && load->site_loads[i].back == NULL))
+            ok = 0;
+    }
+
+    if (ok && !g_cancellable_is_cancelled (cancellable)) {
+        load->ahead = merge_by_day (load, 0);
+        if (load->site_loads[0].with_back)
+            load->back = merge_by_day (load, 1);
+    }
+
+    /* the names of the sites were the last read of fed */
+    g_mutex_lock (&fed->lock);
+    fed->running--;
+    g_cond_broadcast (&fed->idle);
+    g_mutex_unlock (&fed->lock);
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    g_task_return_boolean (task, ok);
+}
+
+/*
+ * FUNC load_site
+ *   Thread of the pool of load_in_thread. Loads the items of one site over
+ * a View_db of its own, data is its Site_load. A site at another schema
+ * version than this program is not read, it gets no rows.
+ */
+static void load_site (gpointer data, gpointer unused)
+{
+    Site_load *site_load = data;
+    View_db *vdb = open_view_db (site_load->site->rdb, site_load->cancellable);
+    int current = (vdb != NULL) ? schema_is_current (vdb->conn) : -1;
+
+    if (current == 0) {
+        fprintf (stderr, FEDERATION_SITE_OLD, site_load->site->name);
+        site_load->ahead = GTK_TREE_MODEL (new_main_store ());
+        if (site_load->with_back)
+            site_load->back = GTK_TREE_MODEL (new_main_store ());
+    }
+    else if (current > 0) {
+        site_load->ahead =
+            create_upcoming_model_by_date_on (vdb->conn, site_load->start_day,
+                                              site_load->end_day);
+        if (site_load->ahead != NULL && site_load->with_back)
+            site_load->back =
+                create_hist_range_model_all_on (site_load->site->rdb,
+                                                vdb->conn,
+                                                site_load->start_day,
+                                                site_load->end_day);
+    }
+
+    if (vdb != NULL)
+        close_view_db (vdb);
+
+    if ((site_load->ahead == NULL ||
+         (site_load->with_back && site_load->back == NULL)) &&
+        !g_cancellable_is_cancelled (site_load->cancellable))
+        fprintf (stderr, FEDERATION_LOAD_FAIL, site_load->site->name);
+}
+
+/*
+ * FUNC merge_by_day
+ *   Helper function to load_in_thread
+ * Merges the models every site loaded, the back ones if back is not 0, into
+ * one in date order: each in date order already, the row taken next is the
+ * earliest at the front of any site (the site listed first on a tie). There
+ * are a handful of sites, the fronts are simply compared in turn.
+ * Returns the merged model, the columns of new_main_store and COLUMN_SITE
+ * NOTE: USES MALLOC
+ */
+static GtkTreeModel *merge_by_day (Federation_load *load, int back)
+{
+    int n_sites = load->fed->n_sites;
+    GType types[NUM_MERGED_COLUMNS];
+    gint columns[NUM_MERGED_COLUMNS];
+    GValue values[NUM_MERGED_COLUMNS];
+    GtkListStore *merged;
+
+    GtkTreeModel **models = malloc (n_sites * sizeof (GtkTreeModel *));
+    GtkTreeIter *fronts = malloc (n_sites * sizeof (GtkTreeIter));
+    int *front_days = malloc (n_sites * sizeof (int));
+    int *more = malloc (n_sites * sizeof (int));
+    if (models == NULL || fronts == NULL || front_days == NULL ||
+        more == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "federation.c 5\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n_sites; i++) {
+        models[i] = back ? load->site_loads[i].back : load->site_loads[i].ahead;
+        more[i] = gtk_tree_model_get_iter_first (models[i], &fronts[i]);
+        if (more[i])
+            gtk_tree_model_get (models[i], &fronts[i],
+                                COLUMN_DAY_UNEDITABLE, &front_days[i], -1);
+    }
+
+    for (int c = 0; c < NUM_COLUMNS; c++) {
+        types[c] = gtk_tree_model_get_column_type (models[0], c);
+        columns[c] = c;
+    }
+    types[COLUMN_SITE] = G_TYPE_STRING;
+    columns[COLUMN_SITE] = COLUMN_SITE;
+
+    merged = gtk_list_store_newv (NUM_MERGED_COLUMNS, types);
+
+    for (;;) {
+        int first = -1;
+
+        for (int i = 0; i < n_sites; i++) {
+            if (more[i] && (first < 0 || front_days[i] < front_days[first]))
+                first = i;
+        }
+        if (first < 0)
+            break;
+
+        memset (values, 0, sizeof (values));
+        for (int c = 0; c < NUM_COLUMNS; c++)
+            gtk_tree_model_get_value (models[first], &fronts[first], c,
+                                      &values[c]);
+        g_value_init (&values[COLUMN_SITE], G_TYPE_STRING);
+        g_value_set_string (&values[COLUMN_SITE],
+                            load->site_loads[first].site->name);
+
+        gtk_list_store_insert_with_valuesv (merged, NULL, -1, columns, values,
+                                            NUM_MERGED_COLUMNS);
+
+        for (int c = 0; c < NUM_MERGED_COLUMNS; c++)
+            g_value_unset (&values[c]);
+
+        more[first] = gtk_tree_model_iter_next (models[first], &fronts[first]);
+        if (more[first])
+            gtk_tree_model_get (models[first], &fronts[first],
+                                COLUMN_DAY_UNEDITABLE, &front_days[first], -1);
+    }
+
+    free (models);
+    free (fronts);
+    free (front_days);
+    free (more);
+
+    return GTK_TREE_MODEL (merged);
+}
+
+/*
+ * FUNC free_federation_load
+ *   Drops the models left in load and frees it
+ */
+static void free_federation_load (Federation_load *load)
+{
+    for (int i = 0; i < load->fed->n_sites; i++) {
+        if (load->site_loads[i].ahead != NULL)
+            g_object_unref (load->site_loads[i].ahead);
+        if (load->site_loads[i].back != NULL)
+            g_object_unref (load->site_loads[i].back);
+    }
+
+    if (load->ahead != NULL)
+        g_object_unref (load->ahead);
+    if (load->back != NULL)
+        g_object_unref (load->back);
+
+    free (load->site_loads);
+    free (load);
+}
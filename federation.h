@@ -0,0 +1,34 @@
+/*******************************************************************************
+ * federation.h
+ * Header for the dbs of several sites read as one: each site is loaded on a
+ * thread of its own and the results merged by date, with a site column.
+ *
+ ******************************************************************************/
+
+#include <gtk/gtk.h>
+
+/* The column of a merged model holding the name of the site of the row,
+ * after those of main_enum.h */
+#define COLUMN_SITE NUM_COLUMNS
+
+/* The dbs of the sites listed in the sites setting, see federation_open */
+typedef struct federation Federation;
+
+/* Sets up every site in sites (see config.c) to be read by the loads, which
+ * open their dbs read only, returns a sqlite3 status code. *fed is set even
+ * on error, close it with federation_close */
+int federation_open (const char *sites, Federation **fed);
+void federation_close (Federation *fed);
+
+/* Loads the items due from start_day to end_day at every site and, if
+ * with_back, those completed in that range, each site on a thread of its
+ * own. callback gets them on the main thread, see federation_load_finish */
+void federation_load_async (Federation *fed, int start_day, int end_day,
+                            int with_back, GCancellable *cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data);
+
+/* The models the load made, soonest or oldest first with a COLUMN_SITE
+ * (*back is NULL without with_back), the caller owns them. Returns 1 on
+ * success, 0 if it was cancelled and -1 on error */
+int federation_load_finish (GAsyncResult *result, GtkTreeModel **ahead,
+                            GtkTreeModel **back);
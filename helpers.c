@@ -5,6 +5,7 @@
  ******************************************************************************/
 #include <gtk/gtk.h>
 
+#include "dates.h"
 #include "main_enum.h"
 #include "setup.h"
 
@@ -125,6 +126,7 @@ void mouse_over (GtkWidget *widget)
 /*
  * FUNC cell_edited
  *   For when text in treeview is edited.
+ * Edits to COLUMN_DATE_ENTRY also set COLUMN_DAY_ENTRY
  *
  * Note: Borrowed from gtk3-demo code
  */
@@ -150,6 +152,15 @@ cell_edited (GtkCellRendererText *cell,        // Renderer for the cell edited
     gtk_list_store_set (GTK_LIST_STORE (model), &iter, column,
                         tmp, -1);
 
+    /* Dates entered by the user are validated once, here, so that the 
+     * functions acting on the selected rows can use the day number directly.
+     * A day of 0 marks the entry as invalid */
+    if (column == COLUMN_DATE_ENTRY) {
+        gtk_list_store_set (GTK_LIST_STORE (model), &iter,
+                            COLUMN_DAY_ENTRY, day_from_user_date_str (tmp),
+                            -1);
+    }
+
     gtk_tree_path_free (path);
 
     free (tmp);
@@ -2,10 +2,68 @@
  * init.c 
  * Establishes the db connection and starts the program 
  ******************************************************************************/
+#include <string.h>
 #include <gtk/gtk.h>
+#include "config.h"
+#include "dates.h"
+#include "federation.h"
+#include "prefetch.h"
+#include "row_feed.h"
+#include "schema.h"
 #include "setup.h"
+#include "snapshot.h"
 #include "sql_db.h"
 
+/* What db_opened needs to know, and whether the db was opened */
+typedef struct start_up {
+    GtkWidget *window;
+    int from_snapshot;  /* 1 if the main view was painted from the snapshot */
+    int rebuild;        /* 1 if --rebuild-due-dates was passed */
+    int db_state;       /* 0 not opened yet, 1 open, -1 failed to open */
+} Start_up;
+
+/* The db every view works on, opened by open_db_in_thread */
+static RoutineDb *app_rdb = NULL;
+
+/*
+ * FUNC app_db
+ *   The db the views work on, NULL until db_opened, see open_db_in_thread
+ */
+RoutineDb *app_db (void)
+{
+    return app_rdb;
+}
+
+/* The dbs of the other sites, opened the first time they are looked at */
+static Federation *app_fed = NULL;
+static int fed_state = 0;   /* 0 not opened yet, 1 open, -1 none or failed */
+
+/*
+ * FUNC app_federation
+ *   The dbs of the sites in the sites setting (see federation.c), opened on
+ * the first call
+ * Returns NULL if there are none or they failed to open
+ */
+Federation *app_federation (void)
+{
+    const char *sites = config_get ()->sites;
+
+    if (fed_state == 0) {
+        fed_state = -1;
+        if (sites != NULL) {
+            if (federation_open (sites, &app_fed) == SQLITE_OK) {
+                fed_state = 1;
+            }
+            else {
+                federation_close (app_fed);
+                app_fed = NULL;
+            }
+        }
+    }
+
+    return app_fed;
+}
+
 /* 
  * FUNC clear_all_and_quit 
  *   Used to destroy the main window and its children.
@@ -21,21 +79,124 @@ static void clear_all_and_quit (GtkWidget *window)
     gtk_main_quit ();
 }
 
+/*
+ * FUNC open_db_in_thread
+ *   Worker thread started by main. Opens (and if need be upgrades) the db,
+ * which loads the due and tag indexes, and rebuilds the due dates if asked
+ * to (task_data is 1 for --rebuild-due-dates). Nothing else uses the db
+ * until db_opened hands it to the main thread.
+ * Returns the RoutineDb through task, NULL if it could not be opened
+ */
+static void open_db_in_thread (GTask *task, gpointer source_object,
+                               gpointer task_data, GCancellable *cancellable)
+{
+    RoutineDb *rdb;
+
+    if (routine_db_open (NULL, &rdb) != SQLITE_OK) {
+        routine_db_close (rdb);
+        g_task_return_pointer (task, NULL, NULL);
+        return;
+    }
+
+    config_report (routine_db_conn (rdb));
+
+    if (GPOINTER_TO_INT (task_data)) {
+        if (rebuild_due_dates (rdb) < 0)
+            fprintf (stderr, DATABASE_UPDATE_DUE_DATE_FAIL "\n");
+    }
+
+    g_task_return_pointer (task, rdb, NULL);
+}
+
+/*
+ * FUNC db_opened
+ *   Called on the main thread once open_db_in_thread returns. Makes the db
+ * the one of the views, then either checks the main view painted from the
+ * snapshot against it or sets the main view up from scratch.
+ */
+static void db_opened (GObject *source_object, GAsyncResult *result,
+                       gpointer user_data)
+{
+    Start_up *start_up = user_data;
+
+    app_rdb = g_task_propagate_pointer (G_TASK (result), NULL);
+
+    /* display error if something goes wrong (opening or upgrading the db) */
+    if (app_rdb == NULL) {
+        start_up->db_state = -1;
+
+        GtkWidget *child = gtk_bin_get_child (GTK_BIN (start_up->window));
+        if (child != NULL)
+            gtk_widget_destroy (child);
+
+        GtkWidget *fatal_error_label;
+        fatal_error_label = gtk_label_new (FATAL_DB_ERROR_NO_ACCESS);
+        gtk_container_add (GTK_CONTAINER (start_up->window), fatal_error_label);
+
+        gtk_widget_show_all (start_up->window);
+        return;
+    }
+
+    start_up->db_state = 1;
+
+    /* statistics, old completions and free pages are seen to when idle, see
+     * maintenance.c */
+    routine_db_start_upkeep (app_rdb);
+
+    /* If database connection good, run main program */
+
+    if (start_up->from_snapshot)
+        check_main_snapshot ();
+    else
+        set_main (start_up->window); // sets up the main_view
+}
+
+/*
+ * FUNC incremental_vacuum_only
+ *   Run instead of the application for --incremental-vacuum: opens the db,
+ * rebuilds it so purges can shrink it (see use_incremental_vacuum in
+ * schema.c) and closes it again. The rebuild rewrites the whole file, so it
+ * is done with no window waiting on it.
+ * Returns the exit status
+ */
+static int incremental_vacuum_only (void)
+{
+    RoutineDb *rdb;
+    int ok = 0;
+
+    if (routine_db_open (NULL, &rdb) == SQLITE_OK)
+        ok = use_incremental_vacuum (routine_db_conn (rdb)) > 0;
+    else
+        fprintf (stderr, FATAL_DB_ERROR_NO_ACCESS);
+
+    routine_db_close (rdb);
+
+    return ok ? 0 : 1;
+}
 
 /*
  * FUNC main(int argc, char *argv[]
  *   Sets ups and launches the application
  *
  * Inputs command line arguments and count of arguments
+ *
+ * Passing --rebuild-due-dates re-derives the due date of every tracked item
+ * from its latest completion before the main view is shown. Passing
+ * --incremental-vacuum only rebuilds the db so purges can shrink it.
  */
 int main (int argc, char *argv[])
 {
 
     GtkWidget *window;
-    int rc;
 
     gtk_init (&argc, &argv);
 
+    /* where the db is and how SQLite is tuned, see config.c */
+    config_load ();
+
+    if (argc > 1 && strcmp (argv[1], "--incremental-vacuum") == 0)
+        return incremental_vacuum_only ();
+
     /* set up the main window */
     window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
     gtk_container_set_border_width (GTK_CONTAINER (window), 10);
@@ -70,28 +231,55 @@ int main (int argc, char *argv[])
     gtk_window_add_accel_group ( GTK_WINDOW (window), accel_group);
 
 
-    /* Connect to database */ 
-    rc = init_db ();
-
-    /* display error if something goes wrong */
-    if (rc == SQLITE_CANTOPEN) {
-        GtkWidget *fatal_error_label;
-        fatal_error_label = gtk_label_new (FATAL_DB_ERROR_NO_ACCESS);
-        gtk_container_add (GTK_CONTAINER (window), fatal_error_label);
+    Start_up start_up = {window, 0, 0, 0};
+    start_up.rebuild = argc > 1 && strcmp (argv[1], "--rebuild-due-dates") == 0;
 
+    /* Paint the main view as the last run left it before the db is touched,
+     * so the first frame does not wait on opening the db or the due query */
+    GtkTreeModel *snapshot = snapshot_load ();
+    if (snapshot != NULL) {
+        set_main_from_snapshot (window, snapshot);
+        start_up.from_snapshot = 1;
+    }
+    else {
         gtk_widget_show_all (window);
+    }
 
-        gtk_main ();
+    /* the db opens on a worker thread while the first frame is up, the views
+     * get it in db_opened */
+    GTask *task = g_task_new (NULL, NULL, db_opened, &start_up);
+    g_task_set_task_data (task, GINT_TO_POINTER (start_up.rebuild), NULL);
+    g_task_run_in_thread (task, open_db_in_thread);
+    g_object_unref (task);
+
+    gtk_main ();
+
+    if (start_up.db_state < 0)
         exit (1);
+    if (start_up.db_state == 0)
+        return 0;
+
+    /* shown with G_MESSAGES_DEBUG=all */
+    int hits, misses;
+    prefetch_stats (&hits, &misses);
+    g_debug (PREFETCH_STATS, hits, misses);
+
+    /* leave a snapshot of the first screenful of the main view for the next
+     * start, if it cannot be written the next start just waits on the db */
+    GtkTreeModel *model = create_urgent_model (app_rdb, ROW_FEED_FIRST_ROWS);
+    if (model != NULL) {
+        snapshot_save (model);
+        g_object_unref (model);
     }
-    
-    /* If database connection good, run main program */
-    
-    set_main (window); // sets up the main_view
 
-    gtk_main ();
+    /* waits out a load of the sites still running */
+    federation_close (app_fed);
+
+    /* and a prefetch, its worker reads app_rdb */
+    prefetch_cancel_and_wait ();
 
-    rc = close_db (); // If db fails to close close_db will log the error
+    // If db fails to close routine_db_close will log the error
+    routine_db_close (app_rdb);
 
     return 0;
 }
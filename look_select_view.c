@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "config.h"
 #include "dates.h"
 #include "helpers.h"
 #include "setup.h" 
@@ -22,6 +23,8 @@ typedef struct selection {
     /* for use with specific date range selection */
     GtkTextBuffer *start;
     GtkTextBuffer *end;
+    /* look at every site (see sites_view.c), NULL without other sites */
+    GtkToggleButton *every_site;
 } Selection;
 
 static Selection selection;
@@ -45,18 +48,16 @@ static GtkWidget *build_custom_date_range_row
 /* parses the Selection struct to process the user's selection */
 static void parse_selection (GtkWidget *button, gchar *split);
 
-/* Uses malloc will need to be freed */
-static char *make_query_from_to (char *tabel, char *sql_start_date, char *sql_end_date);
-
-/* Uses malloc will need to be freed */
-static char *make_query_simple (char *table, const char *direction, 
-                         int qty, const char *units);
+/* day numbers of the first and last day covered by a simple selection */
+static void make_range_simple (const char *direction, int qty, 
+                         const char *units, int *start_day, int *end_day);
 /* end prototypes */
 
 /*
  * FUNC build_last_row
  *   Builds the last row of look_select_view
  * The last row contains a button to allow the user to go back to the main_view
+ * and, if there are other sites, a check to look at every site
  */
 static GtkWidget *build_last_row (GtkWidget *box)
 {
@@ -67,6 +68,13 @@ static GtkWidget *build_last_row (GtkWidget *box)
 
     gtk_box_pack_start (GTK_BOX (row), back, FALSE, FALSE, 10);
 
+    selection.every_site = NULL;
+    if (config_get ()->sites != NULL) {
+        GtkWidget *every_site = gtk_check_button_new_with_label (AT_EVERY_SITE);
+        gtk_box_pack_end (GTK_BOX (row), every_site, FALSE, FALSE, 10);
+        selection.every_site = GTK_TOGGLE_BUTTON (every_site);
+    }
+
     gtk_box_pack_start (GTK_BOX (box), row, FALSE, FALSE, 10);
 
     return back;
@@ -258,15 +266,16 @@ void set_look_select (GtkWidget *widget)
 /* 
  * FUNC parse_selection
  *   parses the selection input by the user and hands it off to set_ahead_back
+ * (or set_sites_view if every site is checked)
  * to take the user to the approprate view
  * 
  * Split is NOT null if parsing a from - to date range 
  */
 static void parse_selection (GtkWidget *button, gchar *split)
 {
-    char *ahead_query,
-         *back_query,
-         *range_desc;
+    char *range_desc;
+    int start_day,
+        end_day;
 
     /* For processing from to queries */
     if (split != NULL) {
@@ -285,35 +294,17 @@ static void parse_selection (GtkWidget *button, gchar *split)
         
         
         if (valid_start_date && valid_end_date) {
-            char *sql_s_date = make_date_str_sql_frmt (m,d,y);
-            char *sql_e_date = make_date_str_sql_frmt (m2,d2,y2);
+            start_day = day_from_mdy (m,d,y);
+            end_day   = day_from_mdy (m2,d2,y2);
 
             /* Check that start_date <= end_date */
-            int check_input;
-            check_input = strcmp(sql_s_date, sql_e_date);
-            if (check_input > 0) {
+            if (start_day > end_day) {
                 error_dialog (button, START_BEFORE_END);
-                free (sql_s_date);
-                free (sql_e_date);
                 g_free (start_date);
                 g_free (end_date);
                 return;
             }
 
-            /* construct SQL query here and submit to constructor */
-            ahead_query = make_query_from_to ("upcoming",
-                                                    sql_s_date, 
-                                                    sql_e_date);
-
-            back_query = make_query_from_to ("history",
-                                                   sql_s_date,
-                                                   sql_e_date);
-
-            if (ahead_query == NULL || back_query == NULL) {
-                fprintf (stderr, MEM_FAIL_IN "look_select_view.c 3\n");
-                exit (EXIT_FAILURE);
-            }
-
             /* +3 is for spaces +1 is for NULL byte, however DATE_STR_LIMIT
              * already includes an extra byte, so we have more than we need */
             int size = strlen(FROM) + strlen(TO) + 2*DATE_STR_LIMIT + 3 + 1; 
@@ -329,8 +320,6 @@ static void parse_selection (GtkWidget *button, gchar *split)
                                                 TO,
                                                 end_date);
 
-            free (sql_s_date);
-            free (sql_e_date);
             g_free (start_date);
             g_free (end_date);
 
@@ -353,17 +342,7 @@ static void parse_selection (GtkWidget *button, gchar *split)
         gint qty = gtk_spin_button_get_value_as_int (selection.qty);
         const gchar *units;
         units = gtk_combo_box_get_active_id (selection.units);
-        ahead_query = make_query_simple ("upcoming", 
-                                               direction, 
-                                               qty, units); 
-        back_query = make_query_simple ("history",
-                                               direction,
-                                               qty, units);
-
-        if (ahead_query == NULL || back_query == NULL) {
-            fprintf (stderr, MEM_FAIL_IN "look_select_view.c 5\n");
-            exit (EXIT_FAILURE);
-        }
+        make_range_simple (direction, qty, units, &start_day, &end_day);
 
         /* make description of range string here
          * format : ahead 1 day, back 2 weeks, etc */
@@ -400,80 +379,39 @@ static void parse_selection (GtkWidget *button, gchar *split)
 
     }
 
-    set_ahead_back (button, ahead_query, back_query, range_desc);
+    if (selection.every_site != NULL &&
+        gtk_toggle_button_get_active (selection.every_site))
+        set_sites_view (button, start_day, end_day, range_desc);
+    else
+        set_ahead_back (button, start_day, end_day, range_desc);
 }
 
 /* 
- * FUNC make_query_from_to
- *   Creates an SQL query for custom date range input by the user 
- * Ultimately this is handed off the set_ahead_back
- *
- * Returns NULL is memory allocation fails.
- *
- * NOTE: CALLS MALLOC WILL NEED TO BE FREED LATER
+ * FUNC make_range_simple
+ *   Finds the first and last day covered by the users input from the 
+ * simple_row. Today itself is left out in either direction.
  */
-static char *make_query_from_to (char *table, char *sql_start_date, char *sql_end_date)
+static void make_range_simple (const char *direction, int qty, 
+        const char *units, int *start_day, int *end_day)
 {
-    char *buffer;
-    char *format = "SELECT * FROM %s WHERE date >= '%s' AND date <= '%s'";
-    /* -6 is to remove chars from thre instances of %s in format */
-    int len = strlen(format) - 6 + strlen(table);
-    /* Add in the length of the date strings plus 1 for '\0' */
-    len = len + 2 * strlen(sql_start_date) + 1;
-    buffer = malloc (sizeof (char) * len );
-    if (buffer == NULL) {
-        return NULL;
-    }
-    int status = sprintf (buffer, format, table, sql_start_date, sql_end_date);
-    if (status != len - 1) {
-        free (buffer);
-        return NULL;
-    }
-    return buffer;
-}
-
-/* 
- * FUNC make_query_simple
- *   Parses the users input from the simple_row to make an SQL query
- * Ultimately handed off to set_ahead_back
- *
- * Returns NULL is memory allocation fails.
- *
- * NOTE: CALLS MALLOC WILL NEED TO BE FREED LATER
- */
-static char *make_query_simple (char *table, const char *direction, 
-        int qty, const char *units)
-{
-    char d = (strcmp (direction,"ahead") == 0) ? '+' : '-';
-    int actual_qty = (strcmp(units,"weeks") == 0) ? 7*qty : qty; 
-    const char *actual_units = (strcmp(units,"weeks")==0) ? "days" : units;
-
-    char *format;
-    if (d == '+') {
-        format = "SELECT * FROM %s WHERE date >= DATE('now','localtime','+1 "
-            "days') AND date <= DATE('now','localtime', '+%d %s')";
+    int today = get_current_day ();
+    int sign = (strcmp (direction,"ahead") == 0) ? 1 : -1;
+    int far_day;
+
+    if (strcmp (units, "months") == 0)
+        far_day = day_add_months (today, sign * qty);
+    else if (strcmp (units, "weeks") == 0)
+        far_day = today + sign * 7 * qty;
+    else
+        far_day = today + sign * qty;
+
+    /* today itself is never part of the range */
+    if (sign > 0) {
+        *start_day = today + 1;
+        *end_day   = far_day;
     }
     else {
-        format = "SELECT * FROM %s WHERE date <= DATE('now','localtime','-1 "
-            "days') AND date >= DATE('now','localtime', '-%d %s')"; 
-    }
-
-    /* -6 for %s %d %s in format  +1 for '\0' */
-    int len = strlen(format) - 6 + strlen(table) + (actual_qty / 10 + 1) + 
-               strlen(actual_units) + 1;
-
-    char *query = malloc (sizeof (char) * len); 
-
-    if (query == NULL) {
-        return NULL;
+        *start_day = far_day;
+        *end_day   = today - 1;
     }
-
-    int res = sprintf (query, format, table, actual_qty, actual_units);
-
-    if (res != len - 1) {
-        free (query);
-        return NULL;
-    }
-
-    return query;
 }
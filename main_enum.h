@@ -5,7 +5,10 @@ enum
     COLUMN_DATE_ENTRY,  /* Date column 1 */
     COLUMN_CATEGORY,
     COLUMN_DATE_UNEDITABLE, /* Date column 2 */
+    COLUMN_ITEM_ID,     /* id of the item in attributes */
+    COLUMN_ENTRY_ID,    /* id of the history entry, 0 for upcoming rows */
+    COLUMN_DAY_ENTRY,   /* day number of date column 1, 0 if not valid */
+    COLUMN_DAY_UNEDITABLE, /* day number of date column 2 */
     NUM_COLUMNS
 
 };
-
@@ -8,48 +8,67 @@
 #include <string.h>
 #include <sqlite3.h>
 
+#include "category_filter.h"
+#include "config.h"
 #include "dates.h"
 #include "helpers.h"
 #include "main_enum.h"
+#include "prefetch.h"
+#include "row_feed.h"
 #include "setup.h"
+#include "snapshot.h"
 #include "sql_db.h"
+#include "tag_filter.h"
+
+/* While the main view painted from the snapshot (see snapshot.c) is being
+ * checked against the db, its box (insensitive until then) and store */
+static GtkWidget *snapshot_box = NULL;
+static GtkListStore *snapshot_store = NULL;
 
 /* prototypes */
 void set_main (GtkWidget *widget);
+void set_main_from_snapshot (GtkWidget *widget, GtkTreeModel *model);
+void check_main_snapshot (void);
 
-static GtkWidget *make_main_view_box ();
+static GtkWidget *make_main_view_box (GtkTreeModel *model,
+                                      UpcomingCursor *rest);
+static void add_filters (GtkWidget *box);
+static void show_main_view_box (GtkWidget *widget, GtkWidget *box);
 
 static void add_columns (GtkTreeView *treeview);
 
 static void act_on_selected (GtkWidget *button, GtkListStore *store);
+static void show_every_site (GtkWidget *button);
 /* end of prototypes */
 
 
-/* 
+/*
  * FUNC act_on_selected
  *   Walks through the GtkListStore and takes actions on selected items.
  * Actions handled are MARK_COMPLETED or SNOOZE functionality
  *
- * Input: GtkWidget *button : the button pressed 
+ * Input: GtkWidget *button : the button pressed
  *        GtkListStore *store : the data to be processed
  *
- * Note: Modified from GTK tutorial 
+ * Note: Modified from GTK tutorial
  */
 static void act_on_selected (GtkWidget *button, GtkListStore *store)
 {
   GList *rr_list = NULL;    /* list of GtkTreeRowReferences to remove */
   GList *node;              /* used to walk through rr_list           */
-  gchar *description;       /* description of item that was selected  */
-  gchar *date_str;          /* date entered for action                */
-  gchar *category;          /* category for the item selected         */
+  gint item_id;             /* id of item that was selected           */
+  gint day;                 /* day entered for action, 0 if invalid   */
   const gchar* button_name; /* name of the button pressed             */
 
-  /* Get the name of the button that was pressed 
+  /* the rows still to come are read off the connection about to be written */
+  row_feed_finish (GTK_TREE_MODEL (store));
+
+  /* Get the name of the button that was pressed
    * (button will determine what actions to take */
   button_name = gtk_button_get_label (GTK_BUTTON (button));
 
-  /* Aggregate all the items that were selected 
-   * (these are the items that will be acted on 
+  /* Aggregate all the items that were selected
+   * (these are the items that will be acted on
    * WARNING: gtk_tree_model_foreach is deprecated as of version 4.1*/
   gtk_tree_model_foreach(GTK_TREE_MODEL(store),
                          (GtkTreeModelForeachFunc) collect_selected,
@@ -69,42 +88,15 @@ static void act_on_selected (GtkWidget *button, GtkListStore *store)
           if (gtk_tree_model_get_iter(GTK_TREE_MODEL(store), &iter, path)) {
             gtk_tree_model_get (GTK_TREE_MODEL (store),
                                 &iter,
-                                COLUMN_DESCRIPTION, &description,
-                                COLUMN_DATE_ENTRY, &date_str,
-                                COLUMN_CATEGORY, &category,
+                                COLUMN_ITEM_ID, &item_id,
+                                COLUMN_DAY_ENTRY, &day,
                                 -1);
-            int stat,m,d,y;
-            stat = parse_and_validate_user_date_str ((char*) date_str, &m, &d, &y);
 
-            if (stat == 0) {
+            /* the date was validated by cell_edited when it was entered */
+            if (day == 0) {
                 error_dialog (button, INVALID_DATE\
                                        DATE_FRMT_EXPLAIN);
-                /* Free resources before continuing */
                 gtk_tree_path_free(path);
-                free (description);
-                free (date_str);
-                free (category);
-                continue;
-            }
-
-            char *sql_date = make_date_str_sql_frmt (m,d,y);
-            if (sql_date == NULL) {
-                fprintf (stderr, MEM_FAIL_IN "main_view.c 1\n");
-                exit (EXIT_FAILURE);
-            }
-
-            int is_tracked = get_tracking_from_db ((char *) description);
-
-            if (is_tracked < 0) {
-                error_dialog (button, DATABASE_FAILED_TO_GET_TRACKING);
-
-                /* Free resources before continuing */
-                free (sql_date);
-                gtk_tree_path_free(path);
-                free (description);
-                free (date_str);
-                free (category);
-
                 continue;
             }
 
@@ -113,56 +105,42 @@ static void act_on_selected (GtkWidget *button, GtkListStore *store)
                 int hist_success = 1;
                 int update_success = 1;
 
+                int is_tracked = get_tracking_from_db (app_db (), item_id);
+
+                if (is_tracked < 0) {
+                    error_dialog (button, DATABASE_FAILED_TO_GET_TRACKING);
+                    gtk_tree_path_free(path);
+                    continue;
+                }
+
                 if (is_tracked == 1)
-                    hist_success = add_history (description, sql_date, category);
+                    hist_success = add_history (app_db (), item_id, day);
                 if (hist_success < 0) {
                     error_dialog (button, DATABASE_MARK_COMPLETE_FAIL);
-
-                    free (description);
-                    free (date_str);
-                    free (category);
-                    free (sql_date);
                     gtk_tree_path_free(path);
-
                     continue;
                 }
 
-                update_success = update_due_date (description, sql_date);
+                update_success = update_due_date (app_db (), item_id, day);
 
                 if (update_success < 0) {
                     error_dialog (button, DATABASE_UPDATE_DUE_DATE_FAIL);
-
-                    free (description);
-                    free (date_str);
-                    free (category);
-                    free (sql_date);
                     gtk_tree_path_free(path);
-
                     continue;
                 }
-                
+
             }
             else {
                 int push_back_success = 1;
-                push_back_success = push_back_upcoming (description, sql_date);
+                push_back_success = push_back_upcoming (app_db (), item_id,
+                                                        day);
                 if (push_back_success < 0) {
                     error_dialog (button, DATABASE_SNOOZE_FAIL);
-
-                    free (description);
-                    free (date_str);
-                    free (category);
-                    free (sql_date);
                     gtk_tree_path_free(path);
-
                     continue;
                 }
             }
 
-            free (description);
-            free (date_str);
-            free (category);
-            free (sql_date);
-            
             gtk_list_store_remove(store, &iter);
           }
 
@@ -250,22 +228,31 @@ static void add_columns (GtkTreeView *treeview)
  * FUNC make_main_view_box
  *   Helper function to set_main
  * Creates all the widgets and sets all the callbacks needed for the main_view
+ * showing model, takes over the reference to model
+ * If rest is not NULL the rows it holds are added to model while idle
+ * (see row_feed.c), the view owns rest
+ * The filters are left to add_filters, they need the db.
  */
-static GtkWidget *make_main_view_box ()
+static GtkWidget *make_main_view_box (GtkTreeModel *model,
+                                      UpcomingCursor *rest)
 {
 
     GtkWidget *box,
+              *heading,
               *label,
               *sw,
-              *treeview;
-    GtkTreeModel *model;
+              *treeview,
+              *progress;
     box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 10);
+    heading = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 10);
     label = gtk_label_new (TODAY_VIEW_HEADING);
+    gtk_box_set_center_widget (GTK_BOX (heading), label);
     gtk_box_pack_start (GTK_BOX (box),
-                        label,
+                        heading,
                         FALSE,
                         FALSE,
                         10);
+    g_object_set_data (G_OBJECT (box), "heading", heading);
 
     /* set up scrolled window */
     sw = gtk_scrolled_window_new (NULL, NULL);
@@ -277,14 +264,6 @@ static GtkWidget *make_main_view_box ()
     /* add to box */
     gtk_box_pack_start (GTK_BOX (box), sw, TRUE, TRUE, 0);
 
-    char *query = "SELECT * FROM upcoming WHERE date <= DATE('now','localtime')";
-
-    model = create_main_model_from_db (query);
-    if (model == NULL) {
-        fprintf(stderr, FATAL_ERROR);
-        exit(EXIT_FAILURE);
-    }
-
     /* create tree view */
     treeview = gtk_tree_view_new_with_model (model);
     gtk_tree_view_set_search_column (GTK_TREE_VIEW (treeview),
@@ -299,6 +278,20 @@ static GtkWidget *make_main_view_box ()
     /* add columns to the tree view */
     add_columns (GTK_TREE_VIEW (treeview));
 
+    /* only shown while the rest of the rows load */
+    progress = gtk_progress_bar_new ();
+    gtk_widget_set_no_show_all (progress, TRUE);
+    gtk_box_pack_start (GTK_BOX (box), progress, FALSE, FALSE, 0);
+
+    /* for check_main_snapshot to feed the rest of the rows through */
+    g_object_set_data (G_OBJECT (box), "treeview", treeview);
+    g_object_set_data (G_OBJECT (box), "progress", progress);
+
+    if (rest != NULL)
+        row_feed_start (GTK_TREE_VIEW (treeview), progress,
+                        (Row_feed_load) upcoming_cursor_load, rest,
+                        (GDestroyNotify) upcoming_cursor_free);
+
     /* add buttons to the bottom of the view */
     GtkWidget *button_box;
     button_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 10);
@@ -326,6 +319,15 @@ static GtkWidget *make_main_view_box ()
     gtk_box_pack_start (GTK_BOX (button_box), edit_search_button,TRUE, FALSE, 0);
     gtk_box_pack_start (GTK_BOX (button_box), look_ahead_or_back_button, TRUE, FALSE, 0);
 
+    /* only with other sites to look at, see federation.c */
+    if (config_get ()->sites != NULL) {
+        GtkWidget *every_site_button = gtk_button_new_with_label (EVERY_SITE);
+        gtk_box_pack_start (GTK_BOX (button_box), every_site_button, TRUE,
+                            FALSE, 0);
+        g_signal_connect (G_OBJECT (every_site_button), "clicked",
+                G_CALLBACK (show_every_site), NULL);
+    }
+
     gtk_box_pack_start (GTK_BOX (button_box), snooze_button, TRUE, FALSE, 0);
     gtk_box_pack_start (GTK_BOX (button_box), mark_completed_button, TRUE, FALSE, 0);
     
@@ -356,6 +358,33 @@ static GtkWidget *make_main_view_box ()
     return box;
 }
 
+/*
+ * FUNC show_every_site
+ *   Sends the user to the items due at every site, see sites_view.c
+ */
+static void show_every_site (GtkWidget *button)
+{
+    set_sites_view (button, 0, get_current_day (), NULL);
+}
+
+/*
+ * FUNC add_filters
+ *   Adds the combo box of the category filter (see category_filter.c) and
+ * the entry of the tag filter (see tag_filter.c) to the heading of box, a
+ * box made by make_main_view_box
+ */
+static void add_filters (GtkWidget *box)
+{
+    GtkWidget *heading = g_object_get_data (G_OBJECT (box), "heading");
+    GtkWidget *filter = make_category_filter (set_main);
+    GtkWidget *tags = make_tag_filter (set_main);
+
+    gtk_box_pack_end (GTK_BOX (heading), filter, FALSE, FALSE, 10);
+    gtk_box_pack_end (GTK_BOX (heading), tags, FALSE, FALSE, 0);
+    gtk_widget_show (filter);
+    gtk_widget_show (tags);
+}
+
 /* 
  * FUNC set_main
  *   Removes the current child of the toplevel window.
@@ -363,6 +392,108 @@ static GtkWidget *make_main_view_box ()
  * to the toplevel window
  */
 void set_main (GtkWidget *widget)
+{
+    GtkTreeModel *model;
+    UpcomingCursor *rest;
+    GtkWidget *box;
+    Tag_set *tags = tag_filter_eval ();
+
+    /* everything due today or overdue under the category and with the tags
+     * picked, most urgent first. A screenful is shown right away, a long
+     * backlog fills in while idle */
+    model = create_urgent_model_head (app_db (), ROW_FEED_FIRST_ROWS,
+                                      category_filter_get (), tags, &rest);
+    tag_set_free (tags);
+    if (model == NULL) {
+        fprintf(stderr, FATAL_ERROR);
+        exit(EXIT_FAILURE);
+    }
+
+    box = make_main_view_box (model, rest);
+    add_filters (box);
+    show_main_view_box (widget, box);
+
+    /* load the views the user is likely to go to next while this one sits
+     * idle */
+    prefetch_when_idle ();
+}
+
+/*
+ * FUNC set_main_from_snapshot
+ *   Shows the main_view with model, loaded from the snapshot of the last run
+ * before the db is opened. The view stays insensitive until
+ * check_main_snapshot has brought it in line with the db.
+ */
+void set_main_from_snapshot (GtkWidget *widget, GtkTreeModel *model)
+{
+    snapshot_store = GTK_LIST_STORE (model);
+    snapshot_box = make_main_view_box (model, NULL);
+    g_object_add_weak_pointer (G_OBJECT (snapshot_box),
+                               (gpointer *) &snapshot_box);
+
+    gtk_widget_set_sensitive (snapshot_box, FALSE);
+
+    show_main_view_box (widget, snapshot_box);
+}
+
+/*
+ * FUNC check_main_snapshot
+ *   Patches the view set by set_main_from_snapshot to match the db and makes
+ * it sensitive. Only a screenful is patched, the snapshot holds no more (see
+ * snapshot_save), the rest of the rows are then added while idle as set_main
+ * does. If the db could not be read the view is set up the usual way
+ * instead. Needs app_db to be open.
+ */
+void check_main_snapshot (void)
+{
+    GtkTreeModel *model;
+    UpcomingCursor *rest;
+    Tag_set *tags;
+
+    /* the window was closed meanwhile */
+    if (snapshot_box == NULL)
+        return;
+
+    g_object_remove_weak_pointer (G_OBJECT (snapshot_box),
+                                  (gpointer *) &snapshot_box);
+
+    tags = tag_filter_eval ();
+    model = create_urgent_model_head (app_db (), ROW_FEED_FIRST_ROWS,
+                                      category_filter_get (), tags, &rest);
+    tag_set_free (tags);
+
+    if (model == NULL || snapshot_patch (snapshot_store, model) < 0) {
+        if (rest != NULL)
+            upcoming_cursor_free (rest);
+        set_main (snapshot_box);
+    }
+    else {
+        if (rest != NULL) {
+            GtkWidget *treeview = g_object_get_data (G_OBJECT (snapshot_box),
+                                                     "treeview");
+            GtkWidget *progress = g_object_get_data (G_OBJECT (snapshot_box),
+                                                     "progress");
+            row_feed_start (GTK_TREE_VIEW (treeview), progress,
+                            (Row_feed_load) upcoming_cursor_load, rest,
+                            (GDestroyNotify) upcoming_cursor_free);
+        }
+        add_filters (snapshot_box);
+        gtk_widget_set_sensitive (snapshot_box, TRUE);
+        prefetch_when_idle ();
+    }
+
+    if (model != NULL)
+        g_object_unref (model);
+
+    snapshot_box = NULL;
+    snapshot_store = NULL;
+}
+
+/*
+ * FUNC show_main_view_box
+ *   Replaces the current child of the toplevel window of widget with box
+ */
+static void show_main_view_box (GtkWidget *widget, GtkWidget *box)
 {
     GtkWidget *window;
     window = gtk_widget_get_toplevel (widget);
@@ -372,8 +503,6 @@ void set_main (GtkWidget *widget)
         gtk_widget_destroy (child);
     }
 
-    GtkWidget *box = make_main_view_box ();
-
     gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (box));
 
     gtk_widget_show_all (window);
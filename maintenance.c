@@ -0,0 +1,458 @@
+/*******************************************************************************
+ * maintenance.c
+ * Keeps the db in shape without the user waiting on it. A while after start
+ * up, and every hour after, a run goes through these steps on the main
+ * thread, one per idle callback at low priority:
+ *   - measure: page counts, and the time the main view query takes
+ *   - archive: moves completions past history_hot_days to the archive (see
+ *     archive.c) MAINTENANCE_ARCHIVE_ROWS at a time, if the db has one
+ *   - optimize: ANALYZE for the tables PRAGMA optimize finds missing or out
+ *     of date statistics for, held to a sample by PRAGMA analysis_limit, one
+ *     table at a time
+ *   - vacuum: gives free pages back (see use_incremental_vacuum in schema.c)
+ *     a few at a time, over as many callbacks as it takes
+ *   - checkpoint: a passive WAL checkpoint, nothing to do outside WAL mode
+ *   - report: measures again and logs both with g_debug (shown with
+ *     G_MESSAGES_DEBUG=all)
+ *
+ * No step starts more work once MAINTENANCE_BUDGET_MS have gone by. The
+ * smallest pieces are not split further, so a step can overrun it by one of
+ * them: an ANALYZE of one table (kept short by analysis_limit), a batch of
+ * MAINTENANCE_ARCHIVE_ROWS or MAINTENANCE_VACUUM_PAGES, or the probe query.
+ * Steps run with no busy timeout: one that would wait on another connection
+ * ends the run and the next one tries again. While a view holds a
+ * transaction open the run waits MAINTENANCE_RETRY_MS at a time.
+ ******************************************************************************/
+#include <stdio.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "archive.h"
+#include "dates.h"
+#include "maintenance.h"
+#include "setup.h"
+
+/* main thread time a step may take */
+#define MAINTENANCE_BUDGET_MS 4
+
+/* the first run waits for start up and the first views to settle */
+#define MAINTENANCE_FIRST_RUN_S 60
+#define MAINTENANCE_INTERVAL_S 3600
+
+/* wait for a transaction of the views to end, see run_step */
+#define MAINTENANCE_RETRY_MS 500
+
+/* rows ANALYZE samples per index, see PRAGMA analysis_limit */
+#define MAINTENANCE_ANALYSIS_LIMIT "400"
+/* completions moved per batch, see archive_some */
+/* completions moved per transaction, see archive_some */
+#define MAINTENANCE_ARCHIVE_ROWS 200
+
+/* pages given back per PRAGMA incremental_vacuum */
+#define MAINTENANCE_VACUUM_PAGES "32"
+
+/* 0x10000 has PRAGMA optimize look at every table, not just those the
+ * connection used (older SQLite ignores it), 0x00001 has it return the
+ * ANALYZE statements it would run rather than run them, see optimize_some */
+#define MAINTENANCE_OPTIMIZE "PRAGMA optimize(0x10003)"
+
+/* the first batch of the main view, see URGENT_ITEMS in sql_db.c */
+#define MAINTENANCE_PROBE \
+    "SELECT item_id, description, date FROM upcoming "\
+    "WHERE urgency IS NOT NULL ORDER BY urgency DESC, date LIMIT 100"
+
+enum {
+    STEP_MEASURE,
+    STEP_ARCHIVE,
+    STEP_OPTIMIZE,
+    STEP_VACUUM,
+    STEP_CHECKPOINT,
+    STEP_REPORT,
+    NUM_STEPS
+};
+
+/* What a run found, for the report */
+typedef struct maintenance_run {
+    int    step;
+    int    pages_before;
+    int    free_before;
+    double probe_before_ms;
+    double longest_step_ms;
+    int    archived;        /* completions moved to the archive */
+    int    auto_vacuum;     /* PRAGMA auto_vacuum, 2 is INCREMENTAL */
+    GPtrArray *analyze;     /* ANALYZE statements left, NULL until listed */
+} Maintenance_run;
+
+/* The upkeep of one db, see maintenance_start */
+struct maintenance {
+    sqlite3         *db;
+    int             busy_timeout;
+    int             *archive_end_day;   /* NULL if there is no archive */
+    guint           timer_id;
+    guint           idle_id;
+    Maintenance_run run;
+};
+
+/* prototypes */
+Maintenance *maintenance_start (sqlite3 *db, int busy_timeout_ms,
+                                int *archive_end_day);
+void maintenance_stop (Maintenance *m);
+
+static gboolean start_run (gpointer data);
+static gboolean resume_run (gpointer data);
+static gboolean run_step (gpointer data);
+static int do_step (Maintenance *m, gint64 deadline);
+static int archive_some (Maintenance *m, gint64 deadline);
+static int optimize_some (Maintenance *m, gint64 deadline);
+static int vacuum_some (Maintenance *m, gint64 deadline);
+static int read_pragma_int (Maintenance *m, const char *pragma);
+static double time_probe (Maintenance *m);
+static void end_run (Maintenance *m);
+/* end prototypes */
+
+/*
+ * FUNC maintenance_start
+ *   Schedules the first run
+ * Returns the upkeep, for maintenance_stop
+ */
+Maintenance *maintenance_start (sqlite3 *db, int busy_timeout_ms,
+                                int *archive_end_day)
+{
+    Maintenance *m = g_new0 (Maintenance, 1);
+
+    m->db = db;
+    m->busy_timeout = busy_timeout_ms;
+    m->archive_end_day = archive_end_day;
+
+    sqlite3_exec (db, "PRAGMA analysis_limit = " MAINTENANCE_ANALYSIS_LIMIT,
+                  NULL, NULL, NULL);
+
+    m->timer_id = g_timeout_add_seconds (MAINTENANCE_FIRST_RUN_S, start_run,
+                                         m);
+    return m;
+}
+
+/*
+ * FUNC maintenance_stop
+ *   Removes the timer and any run under way, then frees m (NULL is fine)
+ */
+void maintenance_stop (Maintenance *m)
+{
+    if (m == NULL)
+        return;
+
+    if (m->timer_id != 0)
+        g_source_remove (m->timer_id);
+    if (m->idle_id != 0)
+        g_source_remove (m->idle_id);
+    if (m->run.analyze != NULL)
+        g_ptr_array_free (m->run.analyze, TRUE);
+
+    g_free (m);
+}
+
+/*
+ * FUNC start_run
+ *   Timer callback. Starts a run, its steps go at idle priority so anything
+ * the user does comes first.
+ */
+static gboolean start_run (gpointer data)
+{
+    Maintenance *m = data;
+
+    m->timer_id = 0;
+
+    m->run.step = STEP_MEASURE;
+    m->run.longest_step_ms = 0;
+    m->run.archived = 0;
+    m->idle_id = g_idle_add_full (G_PRIORITY_LOW, run_step, m, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * FUNC resume_run
+ *   Timer callback. Carries on with a run that was waiting on a transaction
+ * (see run_step).
+ */
+static gboolean resume_run (gpointer data)
+{
+    Maintenance *m = data;
+
+    m->timer_id = 0;
+    m->idle_id = g_idle_add_full (G_PRIORITY_LOW, run_step, m, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * FUNC run_step
+ *   Idle callback. Runs (some of) the step the run is at.
+ */
+static gboolean run_step (gpointer data)
+{
+    Maintenance *m = data;
+    gint64 started = g_get_monotonic_time ();
+    double took;
+    int rc;
+
+    /* never in the middle of a transaction of the views. Checking again
+     * at idle would spin for as long as it is open (ie: a dialog is up) */
+    if (!sqlite3_get_autocommit (m->db)) {
+        m->idle_id = 0;
+        m->timer_id = g_timeout_add (MAINTENANCE_RETRY_MS, resume_run, m);
+        return G_SOURCE_REMOVE;
+    }
+
+    sqlite3_busy_timeout (m->db, 0);
+    rc = do_step (m, started + MAINTENANCE_BUDGET_MS * 1000);
+    sqlite3_busy_timeout (m->db, m->busy_timeout);
+
+    took = (g_get_monotonic_time () - started) / 1000.0;
+    if (took > m->run.longest_step_ms)
+        m->run.longest_step_ms = took;
+
+    if (rc < 0) {
+        g_debug (MAINTENANCE_GAVE_UP, m->run.step, sqlite3_errmsg (m->db));
+        end_run (m);
+        return G_SOURCE_REMOVE;
+    }
+
+    /* 0 is for more of the same step */
+    if (rc > 0 && ++m->run.step == NUM_STEPS) {
+        end_run (m);
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * FUNC do_step
+ *   Helper function to run_step
+ * Runs the step the run is at, starting no more work after deadline (in
+ * g_get_monotonic_time)
+ * Returns 1 once the step is done, 0 if it has more to do, -1 on error
+ */
+static int do_step (Maintenance *m, gint64 deadline)
+{
+    int pages;
+    int free_pages;
+    double probe_ms;
+
+    switch (m->run.step) {
+    case STEP_MEASURE:
+        m->run.pages_before = read_pragma_int (m, "PRAGMA page_count");
+        m->run.free_before = read_pragma_int (m, "PRAGMA freelist_count");
+        m->run.probe_before_ms = time_probe (m);
+        m->run.auto_vacuum = read_pragma_int (m, "PRAGMA auto_vacuum");
+        return (m->run.pages_before < 0 || m->run.free_before < 0 ||
+                m->run.probe_before_ms < 0 ||
+                m->run.auto_vacuum < 0) ? -1 : 1;
+
+    case STEP_ARCHIVE:
+        return archive_some (m, deadline);
+
+    case STEP_OPTIMIZE:
+        return optimize_some (m, deadline);
+
+    case STEP_VACUUM:
+        return vacuum_some (m, deadline);
+
+    case STEP_CHECKPOINT:
+        return (sqlite3_wal_checkpoint_v2 (m->db, NULL,
+                                           SQLITE_CHECKPOINT_PASSIVE,
+                                           NULL, NULL) == SQLITE_OK) ? 1 : -1;
+
+    case STEP_REPORT:
+        pages = read_pragma_int (m, "PRAGMA page_count");
+        free_pages = read_pragma_int (m, "PRAGMA freelist_count");
+        probe_ms = time_probe (m);
+        g_debug (MAINTENANCE_STATS, m->run.pages_before, pages,
+                 m->run.free_before, free_pages, m->run.archived,
+                 m->run.probe_before_ms, probe_ms, m->run.longest_step_ms);
+        return 1;
+    }
+
+    return -1;
+}
+
+/*
+ * FUNC archive_some
+ *   Helper function to do_step
+ * Moves MAINTENANCE_ARCHIVE_ROWS old completions to the archive at a time,
+ * see archive_old_history, until there are none left or
+ * deadline has passed. The vacuum step after gives their space back.
+ * Returns 1 once there are none left, 0 if there are, -1 on error
+ */
+static int archive_some (Maintenance *m, gint64 deadline)
+{
+    int today = get_current_day ();
+    int moved;
+
+    if (m->archive_end_day == NULL)
+        return 1;
+
+    while (g_get_monotonic_time () < deadline) {
+        moved = archive_old_history (m->db, today, MAINTENANCE_ARCHIVE_ROWS,
+                                     m->archive_end_day);
+        if (moved < 0)
+            return -1;
+
+        m->run.archived += moved;
+        if (moved < MAINTENANCE_ARCHIVE_ROWS)
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * FUNC optimize_some
+ *   Helper function to do_step
+ * Lists the ANALYZE statements PRAGMA optimize would run on the first call,
+ * then runs them one at a time until there are none left or deadline has
+ * passed
+ * Returns 1 once there are none left, 0 if there are, -1 on error
+ */
+static int optimize_some (Maintenance *m, gint64 deadline)
+{
+    GPtrArray *analyze = m->run.analyze;
+    sqlite3_stmt *res;
+    int rc;
+
+    if (analyze == NULL) {
+        rc = sqlite3_prepare_v2 (m->db, MAINTENANCE_OPTIMIZE, -1, &res, 0);
+        if (rc != SQLITE_OK)
+            return -1;
+
+        analyze = g_ptr_array_new_with_free_func (g_free);
+        while ((rc = sqlite3_step (res)) == SQLITE_ROW)
+            g_ptr_array_add (analyze,
+                    g_strdup ((const char *) sqlite3_column_text (res, 0)));
+        sqlite3_finalize (res);
+
+        if (rc != SQLITE_DONE) {
+            g_ptr_array_free (analyze, TRUE);
+            return -1;
+        }
+
+        m->run.analyze = analyze;
+    }
+
+    /* run from the end, the order does not matter */
+    while (analyze->len > 0 && g_get_monotonic_time () < deadline) {
+        rc = sqlite3_exec (m->db, g_ptr_array_index (analyze,
+                                                     analyze->len - 1),
+                           NULL, NULL, NULL);
+        if (rc != SQLITE_OK)
+            return -1;
+
+        g_ptr_array_remove_index (analyze, analyze->len - 1);
+    }
+
+    if (analyze->len > 0)
+        return 0;
+
+    g_ptr_array_free (analyze, TRUE);
+    m->run.analyze = NULL;
+    return 1;
+}
+
+/*
+ * FUNC vacuum_some
+ *   Helper function to do_step
+ * Gives MAINTENANCE_VACUUM_PAGES free pages back at a time until there are
+ * none left or deadline has passed. Nothing to do unless the db is in
+ * incremental auto_vacuum mode (see use_incremental_vacuum in schema.c),
+ * PRAGMA incremental_vacuum frees nothing otherwise
+ * Returns 1 once there are none left (or a batch gave none back), 0 if
+ * there are, -1 on error
+ */
+static int vacuum_some (Maintenance *m, gint64 deadline)
+{
+    int free_pages;
+
+    if (m->run.auto_vacuum != 2)
+        return 1;
+
+    free_pages = read_pragma_int (m, "PRAGMA freelist_count");
+
+    while (free_pages > 0 && g_get_monotonic_time () < deadline) {
+        int before = free_pages;
+        int rc = sqlite3_exec (m->db, "PRAGMA incremental_vacuum("
+                               MAINTENANCE_VACUUM_PAGES ")", NULL, NULL, NULL);
+        if (rc != SQLITE_OK)
+            return -1;
+
+        free_pages = read_pragma_int (m, "PRAGMA freelist_count");
+
+        /* never spin on pages that will not go */
+        if (free_pages == before)
+            return 1;
+    }
+
+    if (free_pages < 0)
+        return -1;
+
+    return (free_pages == 0) ? 1 : 0;
+}
+
+/*
+ * FUNC read_pragma_int
+ *   Runs pragma, one returning a number
+ * Returns the number, -1 on error
+ */
+static int read_pragma_int (Maintenance *m, const char *pragma)
+{
+    sqlite3_stmt *res;
+    int value = -1;
+
+    if (sqlite3_prepare_v2 (m->db, pragma, -1, &res, 0) == SQLITE_OK &&
+        sqlite3_step (res) == SQLITE_ROW)
+        value = sqlite3_column_int (res, 0);
+    sqlite3_finalize (res);
+
+    return value;
+}
+
+/*
+ * FUNC time_probe
+ *   Times MAINTENANCE_PROBE, reading every row, to see what the statistics
+ * did for the main view
+ * Returns the time in milliseconds, -1 on error
+ */
+static double time_probe (Maintenance *m)
+{
+    gint64 started = g_get_monotonic_time ();
+    sqlite3_stmt *res;
+    int rc;
+
+    rc = sqlite3_prepare_v2 (m->db, MAINTENANCE_PROBE, -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return -1;
+
+    while ((rc = sqlite3_step (res)) == SQLITE_ROW)
+        sqlite3_column_text (res, 1);
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_DONE)
+        return -1;
+
+    return (g_get_monotonic_time () - started) / 1000.0;
+}
+
+/*
+ * FUNC end_run
+ *   Schedules the next run
+ */
+static void end_run (Maintenance *m)
+{
+    if (m->run.analyze != NULL) {
+        g_ptr_array_free (m->run.analyze, TRUE);
+        m->run.analyze = NULL;
+    }
+
+    m->idle_id = 0;
+    m->timer_id = g_timeout_add_seconds (MAINTENANCE_INTERVAL_S, start_run, m);
+}
@@ -0,0 +1,23 @@
+/*******************************************************************************
+ * maintenance.h
+ * Header for the upkeep of the db (statistics for the query planner, giving
+ * free pages back, checkpoints) run a step at a time when the program is
+ * idle.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+
+/* The upkeep of one db, see maintenance_start */
+typedef struct maintenance Maintenance;
+
+/* Runs the upkeep of db (a main connection) a while after start up and
+ * every hour after. busy_timeout_ms is the busy timeout db is kept at, the
+ * steps run with none so they never wait on another connection. If
+ * archive_end_day is not NULL the archive is attached to db, old completions
+ * are moved there and archive_end_day kept up to date (see archive.c) */
+Maintenance *maintenance_start (sqlite3 *db, int busy_timeout_ms,
+                                int *archive_end_day);
+
+/* Stops any upkeep running or scheduled and frees m, before db is closed */
+void maintenance_stop (Maintenance *m);
@@ -0,0 +1,289 @@
+/*******************************************************************************
+ * prefetch.c
+ * Loads the models of the views the user is likely to open next from the
+ * main view (edit_select_view's attributes and the default look ahead of
+ * look_select_view) on a worker thread, so they can be handed over right away
+ * when the user gets there.
+ *
+ * The worker reads over a View_db of its own (see open_view_db) and only
+ * builds GtkListStores that no other thread can see until they are handed
+ * over in prefetch_done, on the main thread. prefetch_cancel_and_wait stops
+ * it before the db is closed.
+ *
+ * What was prefetched is only handed over if the main connection has not
+ * written anything since the prefetch started (see db_write_generation).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "dates.h"
+#include "prefetch.h"
+#include "setup.h"
+#include "sql_db.h"
+
+/* look_select_view starts out on "ahead 1 week", ie: the next 7 days */
+#define DEFAULT_AHEAD_DAYS 7
+
+typedef struct prefetched {
+    RoutineDb *rdb;            /* read by the worker */
+    int generation;            /* db_write_generation () when started */
+    int today;                 /* day the models were made on */
+    int ahead_start;
+    int ahead_end;
+    GtkTreeModel *attributes;  /* NULL once taken, or if loading failed */
+    GtkTreeModel *ahead;
+} Prefetched;
+
+static Prefetched *ready = NULL;  /* results waiting for a view */
+static int running = 0;
+static int hits = 0;
+static int misses = 0;
+
+/* The worker under way, for prefetch_cancel_and_wait. in_thread is 1 from
+ * start_prefetch until the worker is done with the db, unlike running, which
+ * only drops in prefetch_done on the main loop */
+static GCancellable *loading = NULL;
+static GMutex worker_lock;
+static GCond worker_done;
+static int in_thread = 0;
+
+/* prototypes */
+void prefetch_when_idle (void);
+GtkTreeModel *prefetch_take_attributes (void);
+GtkTreeModel *prefetch_take_upcoming (int start_day, int end_day);
+void prefetch_stats (int *hit_count, int *miss_count);
+void prefetch_cancel_and_wait (void);
+
+/* helpers */
+static gboolean start_prefetch (gpointer data);
+static void prefetch_in_thread (GTask *task, gpointer source_object,
+                                gpointer task_data, GCancellable *cancellable);
+static void prefetch_done (GObject *source_object, GAsyncResult *result,
+                           gpointer user_data);
+static int still_good (Prefetched *prefetched);
+static void free_prefetched (Prefetched *prefetched);
+/* end prototypes */
+
+/*
+ * FUNC prefetch_when_idle
+ *   Schedules start_prefetch for when the main loop has nothing else to do,
+ * called every time the main view is set up
+ */
+void prefetch_when_idle (void)
+{
+    if (running)
+        return;
+
+    g_idle_add (start_prefetch, NULL);
+}
+
+/*
+ * FUNC start_prefetch
+ *   Idle callback. Runs prefetch_in_thread on a worker thread unless the
+ * results already waiting are still good.
+ */
+static gboolean start_prefetch (gpointer data)
+{
+    Prefetched *prefetched;
+    GTask *task;
+
+    if (running || (ready != NULL && still_good (ready) &&
+                    ready->attributes != NULL && ready->ahead != NULL))
+        return G_SOURCE_REMOVE;
+
+    prefetched = malloc (sizeof (Prefetched));
+    if (prefetched == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "prefetch.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+
+    prefetched->rdb         = app_db ();
+    prefetched->generation  = db_write_generation (prefetched->rdb);
+    prefetched->today       = get_current_day ();
+    prefetched->ahead_start = prefetched->today + 1;
+    prefetched->ahead_end   = prefetched->today + DEFAULT_AHEAD_DAYS;
+    prefetched->attributes  = NULL;
+    prefetched->ahead       = NULL;
+
+    running = 1;
+
+    g_mutex_lock (&worker_lock);
+    in_thread = 1;
+    g_mutex_unlock (&worker_lock);
+
+    if (loading != NULL)
+        g_object_unref (loading);
+    loading = g_cancellable_new ();
+
+    task = g_task_new (NULL, loading, prefetch_done, NULL);
+    g_task_set_task_data (task, prefetched, (GDestroyNotify) free_prefetched);
+    g_task_run_in_thread (task, prefetch_in_thread);
+    g_object_unref (task);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * FUNC prefetch_in_thread
+ *   Worker thread. Loads both models over a View_db of its own, a model
+ * that fails to load is left NULL. Cancelling interrupts the queries.
+ */
+static void prefetch_in_thread (GTask *task, gpointer source_object,
+                                gpointer task_data, GCancellable *cancellable)
+{
+    Prefetched *prefetched = task_data;
+    View_db *vdb = NULL;
+
+    if (!g_cancellable_is_cancelled (cancellable))
+        vdb = open_view_db (prefetched->rdb, cancellable);
+
+    if (vdb != NULL) {
+        prefetched->attributes = create_attributes_model (vdb->conn, 0, NULL);
+        prefetched->ahead = create_upcoming_model_on (vdb->conn,
+                                                      prefetched->ahead_start,
+                                                      prefetched->ahead_end,
+                                                      0, NULL);
+        close_view_db (vdb);
+    }
+
+    /* nothing of the db is touched past here */
+    g_mutex_lock (&worker_lock);
+    in_thread = 0;
+    g_cond_broadcast (&worker_done);
+    g_mutex_unlock (&worker_lock);
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    g_task_return_boolean (task, vdb != NULL);
+}
+
+/*
+ * FUNC prefetch_done
+ *   Called on the main thread once prefetch_in_thread returns. Keeps the
+ * results if nothing was written meanwhile.
+ */
+static void prefetch_done (GObject *source_object, GAsyncResult *result,
+                           gpointer user_data)
+{
+    GTask *task = G_TASK (result);
+    Prefetched *prefetched = g_task_get_task_data (task);
+
+    running = 0;
+
+    if (!g_task_propagate_boolean (task, NULL) || !still_good (prefetched))
+        return;
+
+    /* take the models out of the task data, it is freed with the task */
+    if (ready == NULL) {
+        ready = malloc (sizeof (Prefetched));
+        if (ready == NULL) {
+            fprintf (stderr, MEM_FAIL_IN "prefetch.c 2\n");
+            exit (EXIT_FAILURE);
+        }
+        ready->attributes = NULL;
+        ready->ahead = NULL;
+    }
+
+    if (ready->attributes != NULL)
+        g_object_unref (ready->attributes);
+    if (ready->ahead != NULL)
+        g_object_unref (ready->ahead);
+
+    *ready = *prefetched;
+    prefetched->attributes = NULL;
+    prefetched->ahead = NULL;
+}
+
+/*
+ * FUNC prefetch_take_attributes
+ *   Hands over the prefetched model for edit_select_view
+ * Returns NULL on a miss
+ */
+GtkTreeModel *prefetch_take_attributes (void)
+{
+    GtkTreeModel *model;
+
+    if (ready == NULL || ready->attributes == NULL || !still_good (ready)) {
+        misses++;
+        return NULL;
+    }
+
+    hits++;
+    model = ready->attributes;
+    ready->attributes = NULL;
+    return model;
+}
+
+/*
+ * FUNC prefetch_take_upcoming
+ *   Hands over the prefetched upcoming items from start_day to end_day
+ * Returns NULL on a miss, which includes asking for another range
+ */
+GtkTreeModel *prefetch_take_upcoming (int start_day, int end_day)
+{
+    GtkTreeModel *model;
+
+    if (ready == NULL || ready->ahead == NULL || !still_good (ready) ||
+        ready->ahead_start != start_day || ready->ahead_end != end_day) {
+        misses++;
+        return NULL;
+    }
+
+    hits++;
+    model = ready->ahead;
+    ready->ahead = NULL;
+    return model;
+}
+
+/*
+ * FUNC prefetch_stats
+ *   Gives the number of prefetch hits and misses so far
+ */
+void prefetch_stats (int *hit_count, int *miss_count)
+{
+    *hit_count = hits;
+    *miss_count = misses;
+}
+
+/*
+ * FUNC prefetch_cancel_and_wait
+ *   Stops a prefetch under way and waits until its worker is done with the
+ * db, before the db is closed. The main loop need not be running.
+ */
+void prefetch_cancel_and_wait (void)
+{
+    if (loading != NULL)
+        g_cancellable_cancel (loading);
+
+    g_mutex_lock (&worker_lock);
+    while (in_thread)
+        g_cond_wait (&worker_done, &worker_lock);
+    g_mutex_unlock (&worker_lock);
+}
+
+/*
+ * FUNC still_good
+ *   Returns 1 if prefetched was made today and the db has not been written to
+ * since it was started, 0 if not
+ */
+static int still_good (Prefetched *prefetched)
+{
+    return prefetched->generation == db_write_generation (app_db ()) &&
+           prefetched->today == get_current_day ();
+}
+
+/*
+ * FUNC free_prefetched
+ *   Drops the models left in prefetched and frees it
+ */
+static void free_prefetched (Prefetched *prefetched)
+{
+    if (prefetched->attributes != NULL)
+        g_object_unref (prefetched->attributes);
+    if (prefetched->ahead != NULL)
+        g_object_unref (prefetched->ahead);
+    free (prefetched);
+}
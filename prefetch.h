@@ -0,0 +1,23 @@
+/*******************************************************************************
+ * prefetch.h
+ * Header for loading the models of the views the user is likely to open next
+ * while the main view sits idle.
+ *
+ ******************************************************************************/
+
+#include <gtk/gtk.h>
+
+/* Starts a prefetch once the main loop is idle, unless one is running or
+ * what was prefetched is still good */
+void prefetch_when_idle (void);
+
+/* Hand over what was prefetched, NULL (a miss) if it is not ready or the db
+ * was written to since. The caller owns the model returned */
+GtkTreeModel *prefetch_take_attributes (void);
+GtkTreeModel *prefetch_take_upcoming (int start_day, int end_day);
+
+/* Number of takes that were served (hits) and not (misses) */
+void prefetch_stats (int *hit_count, int *miss_count);
+
+/* Stops a prefetch under way and waits for it, before the db is closed */
+void prefetch_cancel_and_wait (void);
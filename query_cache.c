@@ -0,0 +1,390 @@
+/*******************************************************************************
+ * query_cache.c
+ * Keeps the rows of recently shown ranges (the main view and both panes of
+ * ahead_back_view) so that going back and forth between views, or reloading
+ * after a complete or snooze that did not touch the range, does not run the
+ * query again. Each connection (see RoutineDb in sql_db.c) has a cache of its
+ * own.
+ *
+ * An entry is keyed by table and (start_day, end_day). It is dropped when:
+ *   - a row of its table with a date inside the range is inserted, updated
+ *     or deleted on this connection (temp triggers calling range_changed)
+ *   - the category shown on its rows changes, ie: an item is moved to
+ *     another category or a category is renamed
+ *   - PRAGMA data_version moves, ie: another connection committed, since we
+ *     cannot tell which dates that touched
+ *   - the day changes, since the rows carry today's date for editing
+ *   - the archived history of an item is purged (see purge_items in
+ *     sql_db.c), triggers cannot watch the archive
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "dates.h"
+#include "query_cache.h"
+#include "setup.h"
+
+/* number of ranges kept, the least recently used is replaced */
+#define QUERY_CACHE_SIZE 16
+
+typedef struct cached_range {
+    GtkListStore *rows;       /* NULL if the slot is free */
+    int table;
+    int start_day;
+    int end_day;
+    int made_on;              /* day number the entry was made */
+    sqlite3_int64 data_version;
+    unsigned long last_used;
+    /* state of a HistPager after the first page, for CACHED_HISTORY */
+    char last_date[11];
+    int last_id;
+    int done;
+} Cached_range;
+
+struct query_cache {
+    Cached_range entries[QUERY_CACHE_SIZE];
+    unsigned long use_clock;
+    sqlite3_stmt *data_version_stmt;
+};
+
+/* Every write to upcoming or history calls range_changed with the table and
+ * the dates of the old and new row. Category changes pass '' for a date,
+ * which drops the whole table */
+static const char *invalidate_triggers[] = {
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_upcoming_insert "\
+    "AFTER INSERT ON main.upcoming BEGIN "\
+    "    SELECT range_changed(0, new.date, NULL); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_upcoming_update "\
+    "AFTER UPDATE ON main.upcoming BEGIN "\
+    "    SELECT range_changed(0, old.date, new.date); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_upcoming_delete "\
+    "AFTER DELETE ON main.upcoming BEGIN "\
+    "    SELECT range_changed(0, old.date, NULL); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_history_insert "\
+    "AFTER INSERT ON main.history BEGIN "\
+    "    SELECT range_changed(1, new.date, NULL); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_history_update "\
+    "AFTER UPDATE ON main.history BEGIN "\
+    "    SELECT range_changed(1, old.date, new.date); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_history_delete "\
+    "AFTER DELETE ON main.history BEGIN "\
+    "    SELECT range_changed(1, old.date, NULL); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_item_recategorize "\
+    "AFTER UPDATE OF category_id ON main.attributes BEGIN "\
+    "    SELECT range_changed(0, (SELECT date FROM main.upcoming "\
+    "                             WHERE item_id = new.id), NULL); "\
+    "    SELECT range_changed(1, '', NULL); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS cache_category_rename "\
+    "AFTER UPDATE OF name ON main.categories BEGIN "\
+    "    SELECT range_changed(0, '', NULL); "\
+    "    SELECT range_changed(1, '', NULL); "\
+    "END"
+};
+
+/* prototypes */
+int query_cache_init (sqlite3 *db, Query_cache **cache);
+void query_cache_close (Query_cache *cache);
+GtkListStore *query_cache_lookup (Query_cache *cache, int table,
+                                  int start_day, int end_day,
+                                  char *last_date, int *last_id, int *done);
+void query_cache_store (Query_cache *cache, int table, int start_day,
+                        int end_day, GtkListStore *store,
+                        const char *last_date, int last_id, int done);
+void query_cache_drop_table (Query_cache *cache, int table);
+
+/* helpers */
+static void drop_entry (Cached_range *entry);
+static void drop_overlapping (Query_cache *cache, int table, int day);
+static void range_changed (sqlite3_context *ctx, int argc, sqlite3_value **argv);
+static sqlite3_int64 current_data_version (Query_cache *cache);
+static GtkListStore *copy_store (GtkListStore *src);
+/* end prototypes */
+
+/*
+ * FUNC query_cache_init
+ *   Registers range_changed on db and creates the temp triggers that call it.
+ * Temp triggers live only as long as the connection so nothing is added to
+ * the db file.
+ *
+ * Returns a sqlite3 status code. *cache is set even on error, free it with
+ * query_cache_close
+ */
+int query_cache_init (sqlite3 *db, Query_cache **cache)
+{
+    Query_cache *new_cache;
+    int rc;
+    size_t i;
+
+    new_cache = calloc (1, sizeof (Query_cache));
+    if (new_cache == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "query_cache.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+    *cache = new_cache;
+
+    rc = sqlite3_create_function (db, "range_changed", 3, SQLITE_UTF8,
+                                  new_cache, range_changed, NULL, NULL);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    for (i = 0; i < sizeof (invalidate_triggers) / sizeof (char *); i++) {
+        rc = sqlite3_exec (db, invalidate_triggers[i], NULL, NULL, NULL);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    return sqlite3_prepare_v3 (db, "PRAGMA data_version", -1,
+                               SQLITE_PREPARE_PERSISTENT,
+                               &new_cache->data_version_stmt, 0);
+}
+
+/*
+ * FUNC query_cache_close
+ *   Drops every entry, finalizes the data_version statement and frees the
+ * cache
+ */
+void query_cache_close (Query_cache *cache)
+{
+    int i;
+
+    if (cache == NULL)
+        return;
+
+    for (i = 0; i < QUERY_CACHE_SIZE; i++)
+        drop_entry (&cache->entries[i]);
+
+    sqlite3_finalize (cache->data_version_stmt);
+    free (cache);
+}
+
+/*
+ * FUNC query_cache_lookup
+ *   Looks for the rows of table from start_day to end_day.
+ * On a hit returns a copy the caller owns (so selections and edits made in the
+ * view never reach the cache) and fills in the pager state if asked for.
+ *
+ * Returns NULL on a miss
+ */
+GtkListStore *query_cache_lookup (Query_cache *cache, int table,
+                                  int start_day, int end_day,
+                                  char *last_date, int *last_id, int *done)
+{
+    int i;
+    int today = get_current_day ();
+    sqlite3_int64 version = current_data_version (cache);
+
+    for (i = 0; i < QUERY_CACHE_SIZE; i++) {
+        Cached_range *entry = &cache->entries[i];
+
+        if (entry->rows == NULL || entry->table != table ||
+            entry->start_day != start_day || entry->end_day != end_day)
+            continue;
+
+        if (entry->made_on != today || entry->data_version != version) {
+            drop_entry (entry);
+            return NULL;
+        }
+
+        entry->last_used = ++cache->use_clock;
+
+        if (last_date != NULL)
+            snprintf (last_date, 11, "%s", entry->last_date);
+        if (last_id != NULL)
+            *last_id = entry->last_id;
+        if (done != NULL)
+            *done = entry->done;
+
+        return copy_store (entry->rows);
+    }
+
+    return NULL;
+}
+
+/*
+ * FUNC query_cache_store
+ *   Keeps a copy of store as the rows of table from start_day to end_day,
+ * replacing the least recently used entry if the cache is full.
+ * Nothing is kept if data_version cannot be read.
+ */
+void query_cache_store (Query_cache *cache, int table, int start_day,
+                        int end_day, GtkListStore *store,
+                        const char *last_date, int last_id, int done)
+{
+    int i;
+    Cached_range *slot = &cache->entries[0];
+    sqlite3_int64 version = current_data_version (cache);
+
+    if (version < 0)
+        return;
+
+    for (i = 0; i < QUERY_CACHE_SIZE; i++) {
+        Cached_range *entry = &cache->entries[i];
+
+        if (entry->rows != NULL && entry->table == table &&
+            entry->start_day == start_day && entry->end_day == end_day) {
+            slot = entry;
+            break;
+        }
+        if (entry->rows == NULL ||
+            (slot->rows != NULL && entry->last_used < slot->last_used))
+            slot = entry;
+    }
+
+    drop_entry (slot);
+
+    slot->rows         = copy_store (store);
+    slot->table        = table;
+    slot->start_day    = start_day;
+    slot->end_day      = end_day;
+    slot->made_on      = get_current_day ();
+    slot->data_version = version;
+    slot->last_used    = ++cache->use_clock;
+    snprintf (slot->last_date, sizeof (slot->last_date), "%s",
+              last_date != NULL ? last_date : "");
+    slot->last_id      = last_id;
+    slot->done         = done;
+}
+
+/*
+ * FUNC query_cache_drop_table
+ *   Drops every entry of table, for writes the triggers do not see
+ */
+void query_cache_drop_table (Query_cache *cache, int table)
+{
+    int i;
+
+    for (i = 0; i < QUERY_CACHE_SIZE; i++)
+        if (cache->entries[i].table == table)
+            drop_entry (&cache->entries[i]);
+}
+
+/*
+ * FUNC drop_entry
+ *   Frees the rows of entry and marks its slot free
+ */
+static void drop_entry (Cached_range *entry)
+{
+    if (entry->rows != NULL)
+        g_object_unref (entry->rows);
+    entry->rows = NULL;
+}
+
+/*
+ * FUNC drop_overlapping
+ *   Drops the entries of table whose range holds day
+ */
+static void drop_overlapping (Query_cache *cache, int table, int day)
+{
+    int i;
+
+    for (i = 0; i < QUERY_CACHE_SIZE; i++) {
+        Cached_range *entry = &cache->entries[i];
+
+        if (entry->rows != NULL && entry->table == table &&
+            entry->start_day <= day && day <= entry->end_day)
+            drop_entry (entry);
+    }
+}
+
+/*
+ * FUNC range_changed
+ *   SQL function range_changed(table, date, date) called by the temp
+ * triggers. Drops the entries of table holding either date, NULL dates are
+ * skipped. A date that cannot be read drops every entry of the table.
+ */
+static void range_changed (sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+    Query_cache *cache = sqlite3_user_data (ctx);
+    int table = sqlite3_value_int (argv[0]);
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        const char *date = (const char *) sqlite3_value_text (argv[i]);
+        int day;
+
+        if (date == NULL)
+            continue;
+
+        day = day_from_sql_date_str (date);
+        if (day > 0) {
+            drop_overlapping (cache, table, day);
+        }
+        else {
+            query_cache_drop_table (cache, table);
+        }
+    }
+
+    sqlite3_result_null (ctx);
+}
+
+/*
+ * FUNC current_data_version
+ *   Reads PRAGMA data_version, which changes whenever another connection
+ * commits to the db
+ * Returns -1 on error
+ */
+static sqlite3_int64 current_data_version (Query_cache *cache)
+{
+    sqlite3_int64 version = -1;
+
+    if (cache->data_version_stmt == NULL)
+        return -1;
+
+    if (sqlite3_step (cache->data_version_stmt) == SQLITE_ROW)
+        version = sqlite3_column_int64 (cache->data_version_stmt, 0);
+    sqlite3_reset (cache->data_version_stmt);
+
+    return version;
+}
+
+/*
+ * FUNC copy_store
+ *   Makes a new GtkListStore with the same columns and rows as src
+ */
+static GtkListStore *copy_store (GtkListStore *src)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL (src);
+    gint n_columns = gtk_tree_model_get_n_columns (model);
+    GType *types = g_new (GType, n_columns);
+    GtkListStore *dst;
+    GtkTreeIter from, to;
+    gboolean valid;
+    gint i;
+
+    for (i = 0; i < n_columns; i++)
+        types[i] = gtk_tree_model_get_column_type (model, i);
+
+    dst = gtk_list_store_newv (n_columns, types);
+    g_free (types);
+
+    valid = gtk_tree_model_get_iter_first (model, &from);
+    while (valid) {
+        gtk_list_store_append (dst, &to);
+        for (i = 0; i < n_columns; i++) {
+            GValue value = G_VALUE_INIT;
+            gtk_tree_model_get_value (model, &from, i, &value);
+            gtk_list_store_set_value (dst, &to, i, &value);
+            g_value_unset (&value);
+        }
+        valid = gtk_tree_model_iter_next (model, &from);
+    }
+
+    return dst;
+}
@@ -0,0 +1,42 @@
+/*******************************************************************************
+ * query_cache.h
+ * Header for the cache of range query results shown in the main and
+ * ahead_back views.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+/* Tables whose ranges are cached */
+enum {
+    CACHED_UPCOMING = 0,
+    CACHED_HISTORY
+};
+
+/* The cache of one connection */
+typedef struct query_cache Query_cache;
+
+/* Makes the cache of db in *cache and installs the temp triggers that
+ * invalidate entries on writes to db, returns a sqlite3 status code. *cache
+ * is set even on error */
+int query_cache_init (sqlite3 *db, Query_cache **cache);
+
+/* Drops every entry and frees the cache, before closing db */
+void query_cache_close (Query_cache *cache);
+
+/* Copy of the rows cached for table from start_day to end_day, NULL on a miss.
+ * For CACHED_HISTORY last_date (11 chars), last_id and done get the state of
+ * the pager after its first page, pass NULL for CACHED_UPCOMING */
+GtkListStore *query_cache_lookup (Query_cache *cache, int table,
+                                  int start_day, int end_day,
+                                  char *last_date, int *last_id, int *done);
+
+/* Caches a copy of the rows in store (see query_cache_lookup) */
+void query_cache_store (Query_cache *cache, int table, int start_day,
+                        int end_day, GtkListStore *store,
+                        const char *last_date, int last_id, int done);
+
+/* Drops every entry of table, for writes the triggers of query_cache_init do
+ * not see (ie: to archive.history) */
+void query_cache_drop_table (Query_cache *cache, int table);
@@ -0,0 +1,234 @@
+/*******************************************************************************
+ * row_feed.c
+ * Fills a tree view that already shows its first screenful (see
+ * ROW_FEED_FIRST_ROWS) with the rest of its rows from an idle callback, a
+ * batch at a time, so that a long list never holds up the main loop.
+ *
+ * Each batch stops once it has used FRAME_BUDGET_US, so the view keeps
+ * redrawing and answering clicks while it fills. Before the first batch the
+ * columns are fixed at the widths they took for the first screenful and the
+ * view put in fixed height mode, so rows appended later are not measured one
+ * by one.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <gtk/gtk.h>
+
+#include "row_feed.h"
+#include "setup.h"
+
+/* time a batch may take, half a frame at 60 fps */
+#define FRAME_BUDGET_US 8000
+
+/* rows appended between looks at the clock */
+#define ROW_FEED_STEP 64
+
+typedef struct row_feed {
+    GtkTreeView *treeview;     /* weak pointers */
+    GtkWidget *progress;
+    GtkListStore *store;
+    Row_feed_load load;
+    gpointer source;
+    GDestroyNotify free_source;
+    guint idle_id;             /* 0 when no batch is scheduled */
+    int rows_loaded;
+    int sizes_fixed;
+} Row_feed;
+
+/* prototypes */
+void row_feed_start (GtkTreeView *treeview, GtkWidget *progress,
+                     Row_feed_load load, gpointer source,
+                     GDestroyNotify free_source);
+void row_feed_finish (GtkTreeModel *model);
+
+/* helpers */
+static gboolean load_batch (gpointer data);
+static int load_rows (Row_feed *feed, gint64 deadline);
+static void show_progress (Row_feed *feed);
+static void fix_column_sizes (Row_feed *feed);
+static void free_row_feed (Row_feed *feed);
+/* end prototypes */
+
+/*
+ * FUNC row_feed_start
+ *   Schedules load_batch until source runs out. The feed is kept as data of
+ * the store, so it goes away with the view.
+ */
+void row_feed_start (GtkTreeView *treeview, GtkWidget *progress,
+                     Row_feed_load load, gpointer source,
+                     GDestroyNotify free_source)
+{
+    Row_feed *feed = malloc (sizeof (Row_feed));
+    if (feed == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "row_feed.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+
+    feed->treeview    = treeview;
+    feed->progress    = progress;
+    feed->store       = GTK_LIST_STORE (gtk_tree_view_get_model (treeview));
+    feed->load        = load;
+    feed->source      = source;
+    feed->free_source = free_source;
+    feed->rows_loaded = gtk_tree_model_iter_n_children (
+                                        GTK_TREE_MODEL (feed->store), NULL);
+    feed->sizes_fixed = 0;
+
+    g_object_add_weak_pointer (G_OBJECT (treeview),
+                               (gpointer *) &feed->treeview);
+    g_object_add_weak_pointer (G_OBJECT (progress),
+                               (gpointer *) &feed->progress);
+
+    g_object_set_data_full (G_OBJECT (feed->store), "row_feed", feed,
+                            (GDestroyNotify) free_row_feed);
+
+    gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (progress), TRUE);
+    show_progress (feed);
+    gtk_widget_show (progress);
+
+    feed->idle_id = g_idle_add (load_batch, feed);
+}
+
+/*
+ * FUNC load_batch
+ *   Idle callback. Appends rows for one frame budget, drops the feed once
+ * the source has run out.
+ */
+static gboolean load_batch (gpointer data)
+{
+    Row_feed *feed = data;
+
+    if (!feed->sizes_fixed)
+        fix_column_sizes (feed);
+
+    if (load_rows (feed, g_get_monotonic_time () + FRAME_BUDGET_US) == 0) {
+        show_progress (feed);
+        return G_SOURCE_CONTINUE;
+    }
+
+    /* done, freeing the feed must not remove this source as well */
+    feed->idle_id = 0;
+    if (feed->progress != NULL)
+        gtk_widget_hide (feed->progress);
+    g_object_set_data (G_OBJECT (feed->store), "row_feed", NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * FUNC row_feed_finish
+ *   Loads the rest of the rows of model if it is being fed. Called before
+ * anything that writes to the db while the view is filling.
+ */
+void row_feed_finish (GtkTreeModel *model)
+{
+    Row_feed *feed = g_object_get_data (G_OBJECT (model), "row_feed");
+
+    if (feed == NULL)
+        return;
+
+    load_rows (feed, G_MAXINT64);
+
+    if (feed->progress != NULL)
+        gtk_widget_hide (feed->progress);
+    g_object_set_data (G_OBJECT (model), "row_feed", NULL);
+}
+
+/*
+ * FUNC load_rows
+ *   Helper function to load_batch and row_feed_finish
+ * Appends rows a step at a time until deadline (monotonic time) has passed
+ * Returns 1 once the source has run out, 0 if not
+ */
+static int load_rows (Row_feed *feed, gint64 deadline)
+{
+    int count;
+
+    do {
+        count = feed->load (feed->source, feed->store, ROW_FEED_STEP);
+        if (count < 0) {
+            fprintf(stderr, DATABASE_ERROR_FATAL);
+            exit(EXIT_FAILURE);
+        }
+        feed->rows_loaded += count;
+    } while (count == ROW_FEED_STEP && g_get_monotonic_time () < deadline);
+
+    return count < ROW_FEED_STEP;
+}
+
+/*
+ * FUNC show_progress
+ *   Pulses the progress bar of feed and shows how many rows are in so far,
+ * the total is not known until the source runs out
+ */
+static void show_progress (Row_feed *feed)
+{
+    char *text;
+
+    if (feed->progress == NULL)
+        return;
+
+    text = g_strdup_printf (ROWS_LOADED, feed->rows_loaded);
+    gtk_progress_bar_set_text (GTK_PROGRESS_BAR (feed->progress), text);
+    gtk_progress_bar_pulse (GTK_PROGRESS_BAR (feed->progress));
+    g_free (text);
+}
+
+/*
+ * FUNC fix_column_sizes
+ *   Helper function to load_batch
+ * Fixes every column at its current width and turns on fixed height mode.
+ * Left for the next batch if the view has not been laid out yet.
+ */
+static void fix_column_sizes (Row_feed *feed)
+{
+    GList *columns, *node;
+    int laid_out = 1;
+
+    if (feed->treeview == NULL)
+        return;
+
+    columns = gtk_tree_view_get_columns (feed->treeview);
+
+    for (node = columns; node != NULL; node = node->next)
+        if (gtk_tree_view_column_get_width (node->data) <= 0)
+            laid_out = 0;
+
+    if (laid_out) {
+        for (node = columns; node != NULL; node = node->next) {
+            GtkTreeViewColumn *column = node->data;
+
+            if (gtk_tree_view_column_get_sizing (column) !=
+                GTK_TREE_VIEW_COLUMN_FIXED) {
+                gtk_tree_view_column_set_fixed_width (column,
+                        gtk_tree_view_column_get_width (column));
+                gtk_tree_view_column_set_sizing (column,
+                        GTK_TREE_VIEW_COLUMN_FIXED);
+            }
+        }
+        gtk_tree_view_set_fixed_height_mode (feed->treeview, TRUE);
+        feed->sizes_fixed = 1;
+    }
+
+    g_list_free (columns);
+}
+
+/*
+ * FUNC free_row_feed
+ *   Stops feed and frees it along with its source
+ */
+static void free_row_feed (Row_feed *feed)
+{
+    if (feed->idle_id != 0)
+        g_source_remove (feed->idle_id);
+
+    if (feed->treeview != NULL)
+        g_object_remove_weak_pointer (G_OBJECT (feed->treeview),
+                                      (gpointer *) &feed->treeview);
+    if (feed->progress != NULL)
+        g_object_remove_weak_pointer (G_OBJECT (feed->progress),
+                                      (gpointer *) &feed->progress);
+
+    feed->free_source (feed->source);
+    free (feed);
+}
@@ -0,0 +1,26 @@
+/*******************************************************************************
+ * row_feed.h
+ * Header for filling a tree view with the rest of its rows a batch at a time
+ * while the main loop is idle.
+ *
+ ******************************************************************************/
+
+#include <gtk/gtk.h>
+
+/* Rows loaded before a view is first shown, about a screenful */
+#define ROW_FEED_FIRST_ROWS 40
+
+/* Appends up to limit rows from source to store, returns how many (less than
+ * limit once source has run out) or -1 on error */
+typedef int (*Row_feed_load) (gpointer source, GtkListStore *store, int limit);
+
+/* Loads the rest of the rows of the model of treeview (a GtkListStore) from
+ * source while idle, showing progress (hidden again when done). The feed
+ * belongs to the store, source is freed with free_source once done or once
+ * the store is */
+void row_feed_start (GtkTreeView *treeview, GtkWidget *progress,
+                     Row_feed_load load, gpointer source,
+                     GDestroyNotify free_source);
+
+/* Loads whatever is left of the feed of model right away, if it has one */
+void row_feed_finish (GtkTreeModel *model);
@@ -0,0 +1,455 @@
+/*******************************************************************************
+ * schema.c
+ * Upgrades the database schema made by create_db.c to the version this 
+ * program expects.
+ *
+ * Each entry in migrations[] moves the db up by one version. The version the
+ * db is at is kept in PRAGMA user_version, so an upgrade only ever runs once.
+ ******************************************************************************/
+#include <stdio.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h> /* needed because we make use of "sql_db.h" */
+
+#include "schema.h"
+#include "setup.h"
+#include "sql_db.h"
+
+/* Body of the triggers keeping category_tree (see version 7) in step with
+ * a new or renamed category: links it to the categories above and below */
+#define CATEGORY_TREE_LINK \
+    "    INSERT INTO category_tree (ancestor, descendant, depth) "\
+    "        SELECT a.id, NEW.id, " PATH_DEPTH ("NEW.name") " - "\
+    "            " PATH_DEPTH ("a.name") " "\
+    "        FROM categories a WHERE " PATH_UNDER ("NEW.name", "a.name") ";"\
+    "    INSERT INTO category_tree (ancestor, descendant, depth) "\
+    "        SELECT NEW.id, d.id, " PATH_DEPTH ("d.name") " - "\
+    "            " PATH_DEPTH ("NEW.name") " "\
+    "        FROM categories d WHERE " PATH_UNDER ("d.name", "NEW.name") ";"
+
+/* The tables create_db.c makes, version 0 */
+#define BASE_SCHEMA \
+    "PRAGMA auto_vacuum = INCREMENTAL;"\
+    "CREATE TABLE upcoming (description text, date text, category text);"\
+    "CREATE TABLE history (description text, date text, category text);"\
+    "CREATE TABLE attributes (description text, category text, freq int, "\
+    "    freq_type text, track_history int);"\
+    "CREATE TABLE notes (description text, note text);"
+
+static const char *migrations[] = {
+
+    /* version 1: give items an integer id and key upcoming and history on it.
+     * Tables are rebuilt (keeping column order) since an INTEGER PRIMARY KEY
+     * cannot be added with ALTER TABLE */
+    "CREATE TABLE attributes_v1 (description text, category text, freq int, "
+    "    freq_type text, track_history int, id INTEGER PRIMARY KEY);"
+    "INSERT INTO attributes_v1 (description, category, freq, freq_type, "
+    "    track_history) "
+    "    SELECT description, category, freq, freq_type, track_history "
+    "    FROM attributes ORDER BY rowid;"
+    "DROP TABLE attributes;"
+    "ALTER TABLE attributes_v1 RENAME TO attributes;"
+    "CREATE INDEX attributes_description ON attributes (description);"
+
+    "ALTER TABLE upcoming ADD COLUMN item_id integer;"
+    "UPDATE upcoming SET item_id = (SELECT a.id FROM attributes a "
+    "    WHERE a.description = upcoming.description);"
+    "CREATE INDEX upcoming_item ON upcoming (item_id);"
+
+    "CREATE TABLE history_v1 (description text, date text, category text, "
+    "    item_id integer, id INTEGER PRIMARY KEY);"
+    "INSERT INTO history_v1 (description, date, category, item_id) "
+    "    SELECT h.description, h.date, h.category, "
+    "    (SELECT a.id FROM attributes a WHERE a.description = h.description) "
+    "    FROM history h ORDER BY h.rowid;"
+    "DROP TABLE history;"
+    "ALTER TABLE history_v1 RENAME TO history;"
+    "CREATE INDEX history_item ON history (item_id, date);",
+
+    /* version 2: the look back pane pages through history by date */
+    "CREATE INDEX history_date ON history (date);",
+
+    /* version 3: per item completion summary, kept current by triggers on
+     * history so last completion and counts never need a history scan.
+     * first/last_date are NULL once an item has no completions left */
+    "CREATE TABLE item_stats (item_id INTEGER PRIMARY KEY, "
+    "    completions int NOT NULL DEFAULT 0, first_date text, last_date text);"
+    "INSERT INTO item_stats (item_id, completions, first_date, last_date) "
+    "    SELECT item_id, COUNT(*), MIN(date), MAX(date) FROM history "
+    "    WHERE item_id IS NOT NULL GROUP BY item_id;"
+    "CREATE TRIGGER item_stats_insert AFTER INSERT ON history "
+    "    WHEN NEW.item_id IS NOT NULL BEGIN "
+    "    INSERT OR IGNORE INTO item_stats (item_id) VALUES (NEW.item_id);"
+    "    UPDATE item_stats SET completions = completions + 1, "
+    "        first_date = MIN(IFNULL(first_date, NEW.date), NEW.date), "
+    "        last_date = MAX(IFNULL(last_date, NEW.date), NEW.date) "
+    "        WHERE item_id = NEW.item_id;"
+    "    END;"
+    "CREATE TRIGGER item_stats_delete AFTER DELETE ON history "
+    "    WHEN OLD.item_id IS NOT NULL BEGIN "
+    "    UPDATE item_stats SET completions = completions - 1, "
+    "        first_date = CASE WHEN OLD.date = first_date THEN "
+    "            (SELECT MIN(date) FROM history WHERE item_id = OLD.item_id) "
+    "            ELSE first_date END, "
+    "        last_date = CASE WHEN OLD.date = last_date THEN "
+    "            (SELECT MAX(date) FROM history WHERE item_id = OLD.item_id) "
+    "            ELSE last_date END "
+    "        WHERE item_id = OLD.item_id;"
+    "    END;"
+    "CREATE TRIGGER item_stats_update AFTER UPDATE OF date, item_id "
+    "    ON history BEGIN "
+    "    UPDATE item_stats SET completions = completions - 1, "
+    "        first_date = CASE WHEN OLD.date = first_date THEN "
+    "            (SELECT MIN(date) FROM history WHERE item_id = OLD.item_id) "
+    "            ELSE first_date END, "
+    "        last_date = CASE WHEN OLD.date = last_date THEN "
+    "            (SELECT MAX(date) FROM history WHERE item_id = OLD.item_id) "
+    "            ELSE last_date END "
+    "        WHERE item_id = OLD.item_id;"
+    "    INSERT OR IGNORE INTO item_stats (item_id) "
+    "        SELECT NEW.item_id WHERE NEW.item_id IS NOT NULL;"
+    "    UPDATE item_stats SET completions = completions + 1, "
+    "        first_date = MIN(IFNULL(first_date, NEW.date), NEW.date), "
+    "        last_date = MAX(IFNULL(last_date, NEW.date), NEW.date) "
+    "        WHERE item_id = NEW.item_id;"
+    "    END;"
+    "CREATE TRIGGER item_stats_purge AFTER DELETE ON attributes BEGIN "
+    "    DELETE FROM item_stats WHERE item_id = OLD.id;"
+    "    END;",
+
+    /* version 4: items whose latest completion was removed or moved are
+     * queued in due_dirty so their due date can be recomputed (see
+     * recompute_dirty_due_dates in sql_db.c). Adding a completion is handled
+     * by update_due_date and is not queued. */
+    "CREATE TABLE due_dirty (item_id INTEGER PRIMARY KEY);"
+    "CREATE TRIGGER due_dirty_delete AFTER DELETE ON history "
+    "    WHEN OLD.item_id IS NOT NULL "
+    "    AND OLD.date >= (SELECT IFNULL(MAX(date), '') FROM history "
+    "        WHERE item_id = OLD.item_id) BEGIN "
+    "    INSERT OR IGNORE INTO due_dirty (item_id) VALUES (OLD.item_id);"
+    "    END;"
+    "CREATE TRIGGER due_dirty_update AFTER UPDATE OF date, item_id "
+    "    ON history BEGIN "
+    "    INSERT OR IGNORE INTO due_dirty (item_id) "
+    "        SELECT OLD.item_id WHERE OLD.item_id IS NOT NULL AND OLD.date >= "
+    "        (SELECT IFNULL(MAX(date), '') FROM history "
+    "        WHERE item_id = OLD.item_id AND id <> OLD.id);"
+    "    INSERT OR IGNORE INTO due_dirty (item_id) "
+    "        SELECT NEW.item_id WHERE NEW.date >= (SELECT MAX(date) "
+    "        FROM history WHERE item_id = NEW.item_id);"
+    "    END;"
+    "CREATE TRIGGER due_dirty_purge AFTER DELETE ON attributes BEGIN "
+    "    DELETE FROM due_dirty WHERE item_id = OLD.id;"
+    "    END;",
+
+    /* version 5: upcoming keeps the urgency (see urgency in sql_funcs.c) of
+     * items due by the day it was computed on, NULL for the rest, so the
+     * main view can read them most urgent first off an index. Triggers
+     * compute it on every write, refresh_urgency in sql_db.c brings the
+     * items due up to date once a day. Needs the sql_funcs.c functions. */
+    "ALTER TABLE upcoming ADD COLUMN urgency real;"
+    "CREATE INDEX upcoming_date ON upcoming (date);"
+    "CREATE INDEX upcoming_urgency ON upcoming (urgency DESC, date);"
+    "UPDATE upcoming SET urgency = urgency(date, DATE('now', 'localtime'), "
+    "    (SELECT a.freq FROM attributes a WHERE a.id = upcoming.item_id), "
+    "    (SELECT a.freq_type FROM attributes a WHERE a.id = upcoming.item_id)) "
+    "    WHERE date <= DATE('now', 'localtime');"
+    "CREATE TRIGGER upcoming_urgency_insert AFTER INSERT ON upcoming BEGIN "
+    "    UPDATE upcoming SET urgency = urgency(NEW.date, "
+    "        DATE('now', 'localtime'), "
+    "        (SELECT a.freq FROM attributes a WHERE a.id = NEW.item_id), "
+    "        (SELECT a.freq_type FROM attributes a WHERE a.id = NEW.item_id)) "
+    "        WHERE rowid = NEW.rowid;"
+    "    END;"
+    "CREATE TRIGGER upcoming_urgency_update AFTER UPDATE OF date, item_id "
+    "    ON upcoming BEGIN "
+    "    UPDATE upcoming SET urgency = urgency(NEW.date, "
+    "        DATE('now', 'localtime'), "
+    "        (SELECT a.freq FROM attributes a WHERE a.id = NEW.item_id), "
+    "        (SELECT a.freq_type FROM attributes a WHERE a.id = NEW.item_id)) "
+    "        WHERE rowid = NEW.rowid;"
+    "    END;"
+    "CREATE TRIGGER upcoming_urgency_interval AFTER UPDATE OF freq, freq_type "
+    "    ON attributes BEGIN "
+    "    UPDATE upcoming SET urgency = urgency(date, DATE('now', 'localtime'), "
+    "        NEW.freq, NEW.freq_type) WHERE item_id = NEW.id;"
+    "    END;",
+
+    /* version 6: categories get a table of their own, attributes refers to
+     * it by id and upcoming and history reach it through their item, so a
+     * rename is one row. The old text columns cannot be dropped by this
+     * SQLite, they are emptied (space is reclaimed by the next VACUUM) and
+     * only read for rows without an item. */
+    "CREATE TABLE categories (id INTEGER PRIMARY KEY, name text NOT NULL "
+    "    UNIQUE);"
+    "INSERT OR IGNORE INTO categories (name) "
+    "    SELECT category FROM attributes WHERE category IS NOT NULL;"
+    "ALTER TABLE attributes ADD COLUMN category_id integer "
+    "    REFERENCES categories (id);"
+    "UPDATE attributes SET category_id = (SELECT c.id FROM categories c "
+    "    WHERE c.name = attributes.category), category = NULL;"
+    "CREATE INDEX attributes_category ON attributes (category_id);"
+    "UPDATE upcoming SET category = NULL WHERE item_id IN "
+    "    (SELECT id FROM attributes);"
+    "UPDATE history SET category = NULL WHERE item_id IN "
+    "    (SELECT id FROM attributes);",
+
+    /* version 7: categories are paths, Fleet/Truck 12/Engine is under
+     * Fleet/Truck 12 which is under Fleet. category_tree is their closure,
+     * a row for every (ancestor, descendant) pair and one for each category
+     * to itself, so everything under a category is one range of its
+     * primary key. The triggers keep it in step with the names, the parents
+     * of paths already in use are added as categories of their own. */
+    "CREATE TABLE category_tree (ancestor integer NOT NULL, "
+    "    descendant integer NOT NULL, depth integer NOT NULL, "
+    "    PRIMARY KEY (ancestor, descendant)) WITHOUT ROWID;"
+    "CREATE INDEX category_tree_descendant ON category_tree (descendant);"
+    "INSERT INTO category_tree (ancestor, descendant, depth) "
+    "    SELECT a.id, d.id, " PATH_DEPTH ("d.name") " - "
+    "        " PATH_DEPTH ("a.name") " "
+    "    FROM categories a JOIN categories d ON d.name = a.name "
+    "        OR " PATH_UNDER ("d.name", "a.name") ";"
+    "CREATE TRIGGER category_tree_insert AFTER INSERT ON categories BEGIN "
+    CATEGORY_TREE_LINK
+    "    INSERT INTO category_tree VALUES (NEW.id, NEW.id, 0);"
+    "    END;"
+    "CREATE TRIGGER category_tree_rename AFTER UPDATE OF name ON categories "
+    "    BEGIN "
+    "    DELETE FROM category_tree WHERE (ancestor = NEW.id "
+    "        OR descendant = NEW.id) AND ancestor <> descendant;"
+    CATEGORY_TREE_LINK
+    "    END;"
+    "CREATE TRIGGER category_tree_delete AFTER DELETE ON categories BEGIN "
+    "    DELETE FROM category_tree WHERE ancestor = OLD.id "
+    "        OR descendant = OLD.id;"
+    "    END;"
+    ADD_CATEGORY_PATHS ("SELECT name FROM categories") ";",
+
+    /* version 8: items carry any number of tags (crew A, quarterly,
+     * outdoor) besides their one category. item_tags is keyed by tag first,
+     * so the items of a tag are one range of it, read in id order when
+     * tag_index.c loads its sets. The tags of an item go with it. */
+    "CREATE TABLE tags (id INTEGER PRIMARY KEY, name text NOT NULL UNIQUE);"
+    "CREATE TABLE item_tags (tag_id integer NOT NULL REFERENCES tags (id), "
+    "    item_id integer NOT NULL REFERENCES attributes (id), "
+    "    PRIMARY KEY (tag_id, item_id)) WITHOUT ROWID;"
+    "CREATE INDEX item_tags_item ON item_tags (item_id);"
+    "CREATE TRIGGER item_tags_purge AFTER DELETE ON attributes BEGIN "
+    "    DELETE FROM item_tags WHERE item_id = OLD.id;"
+    "    END;",
+
+    /* version 9: deleting an item takes everything of it along, so a purge
+     * is one DELETE on attributes (see purge_items in sql_db.c). The rows
+     * go BEFORE the item, so the AFTER triggers of the earlier versions
+     * clear what deleting its history queued up. Notes are still keyed by
+     * description. */
+    "CREATE TABLE IF NOT EXISTS notes (description text, note text);"
+    "CREATE INDEX notes_description ON notes (description);"
+    "CREATE TRIGGER item_purge BEFORE DELETE ON attributes BEGIN "
+    "    DELETE FROM upcoming WHERE item_id = OLD.id;"
+    "    DELETE FROM history WHERE item_id = OLD.id;"
+    "    DELETE FROM notes WHERE description = OLD.description;"
+    "    END;",
+
+    /* version 10: the urgency triggers of version 5 call urgency, which
+     * only exists on connections that ran register_sql_funcs, so any other
+     * program writing upcoming failed on them. They are TEMP triggers of
+     * each connection of ours now, see create_urgency_triggers in
+     * sql_db.c. */
+    "DROP TRIGGER IF EXISTS upcoming_urgency_insert;"
+    "DROP TRIGGER IF EXISTS upcoming_urgency_update;"
+    "DROP TRIGGER IF EXISTS upcoming_urgency_interval;",
+};
+
+#define NUM_MIGRATIONS (sizeof(migrations) / sizeof(migrations[0]))
+
+/* prototypes */
+int migrate_db (sqlite3 *db);
+int schema_is_current (sqlite3 *db);
+
+static int get_schema_version (sqlite3 *db);
+static int create_base_tables (sqlite3 *db);
+int use_incremental_vacuum (sqlite3 *db);
+static gint64 file_size (sqlite3 *db);
+/* end prototypes */
+
+/*
+ * FUNC get_schema_version
+ *   Reads PRAGMA user_version of db
+ * Returns -1 on error
+ */
+static int get_schema_version (sqlite3 *db)
+{
+    int rc;
+    int version;
+    sqlite3_stmt *res;
+
+    rc = sqlite3_prepare_v2 (db, "PRAGMA user_version", -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    rc = sqlite3_step (res);
+    if (rc != SQLITE_ROW) {
+        log_db_error(rc);
+        sqlite3_finalize (res);
+        return -1;
+    }
+
+    version = sqlite3_column_int (res, 0);
+    sqlite3_finalize (res);
+
+    return version;
+}
+
+/*
+ * FUNC schema_is_current
+ *   For a db that is read but never upgraded (see federation.c)
+ * Returns 1 if db is at the version migrate_db brings it to, 0 if it is at
+ * another one, -1 on error
+ */
+int schema_is_current (sqlite3 *db)
+{
+    int version = get_schema_version (db);
+    if (version < 0)
+        return -1;
+
+    return version == (int) NUM_MIGRATIONS;
+}
+
+/*
+ * FUNC migrate_db
+ *   Runs every migration the db has not had yet. Each migration runs in its
+ * own transaction together with the bump of user_version, so a failure
+ * leaves the db at the last good version.
+ *
+ * Returns the sqlite3 status code of the operation
+ */
+int migrate_db (sqlite3 *db)
+{
+    int rc;
+    int version = get_schema_version (db);
+    if (version < 0)
+        return SQLITE_ERROR;
+
+    if (version == 0) {
+        rc = create_base_tables (db);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    for ( ; version < (int) NUM_MIGRATIONS; version++) {
+        char bump[40];
+        sprintf (bump, "PRAGMA user_version = %d", version + 1);
+
+        rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+        if (rc == SQLITE_OK)
+            rc = sqlite3_exec (db, migrations[version], NULL, NULL, NULL);
+        if (rc == SQLITE_OK)
+            rc = sqlite3_exec (db, bump, NULL, NULL, NULL);
+        if (rc == SQLITE_OK)
+            rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+
+        if (rc != SQLITE_OK) {
+            fprintf (stderr, DATABASE_MIGRATION_FAIL, version + 1);
+            log_db_error(rc);
+            sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+            return rc;
+        }
+    }
+
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC create_base_tables
+ *   Helper function to migrate_db
+ * Gives a db without any tables (ie: one in memory, see config.c) those of
+ * BASE_SCHEMA so the migrations can run on it as on one made by create_db
+ * Returns the sqlite3 status code of the operation
+ */
+static int create_base_tables (sqlite3 *db)
+{
+    sqlite3_stmt *res;
+    int tables = -1;
+
+    int rc = sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM sqlite_master", -1,
+                                 &res, 0);
+    if (rc == SQLITE_OK && (rc = sqlite3_step (res)) == SQLITE_ROW) {
+        tables = sqlite3_column_int (res, 0);
+        rc = SQLITE_OK;
+    }
+    sqlite3_finalize (res);
+
+    if (rc == SQLITE_OK && tables == 0)
+        rc = sqlite3_exec (db, BASE_SCHEMA, NULL, NULL, NULL);
+
+    if (rc != SQLITE_OK)
+        log_db_error(rc);
+
+    return rc;
+}
+
+/*
+ * FUNC use_incremental_vacuum
+ *   Lets purges give the pages they free back to the file system (see
+ * reclaim_space in sql_db.c). A db made without it is rebuilt with VACUUM,
+ * which rewrites the whole file and cannot run in a transaction, so it is no
+ * migration but a one-off step run with --incremental-vacuum (see init.c).
+ * The db works as before without it, it just does not shrink.
+ * Returns 1 on success (or if there was nothing to do) and -1 on error
+ */
+int use_incremental_vacuum (sqlite3 *db)
+{
+    sqlite3_stmt *res;
+    int mode = -1;
+    gint64 before;
+
+    int rc = sqlite3_prepare_v2 (db, "PRAGMA auto_vacuum", -1, &res, 0);
+    if (rc == SQLITE_OK && sqlite3_step (res) == SQLITE_ROW)
+        mode = sqlite3_column_int (res, 0);
+    sqlite3_finalize (res);
+
+    before = file_size (db);
+
+    /* 2 is INCREMENTAL */
+    if (mode == 2) {
+        g_message (DATABASE_VACUUM_DONE, before, before);
+        return 1;
+    }
+
+    rc = sqlite3_exec (db, "PRAGMA auto_vacuum = INCREMENTAL", NULL, NULL,
+                       NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec (db, "VACUUM", NULL, NULL, NULL);
+
+    if (rc != SQLITE_OK) {
+        fprintf (stderr, DATABASE_VACUUM_FAIL);
+        log_db_error(rc);
+        return -1;
+    }
+
+    g_message (DATABASE_VACUUM_DONE, before, file_size (db));
+
+    return 1;
+}
+
+/*
+ * FUNC file_size
+ *   Helper function to use_incremental_vacuum
+ * Returns the size in bytes of the main db of db, -1 on error
+ */
+static gint64 file_size (sqlite3 *db)
+{
+    sqlite3_stmt *res;
+    gint64 size = -1;
+
+    int rc = sqlite3_prepare_v2 (db, "SELECT page_count * page_size "
+                                 "FROM pragma_page_count, pragma_page_size",
+                                 -1, &res, 0);
+    if (rc == SQLITE_OK && sqlite3_step (res) == SQLITE_ROW)
+        size = sqlite3_column_int64 (res, 0);
+    sqlite3_finalize (res);
+
+    return size;
+}
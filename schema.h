@@ -0,0 +1,17 @@
+/*******************************************************************************
+ * schema.h
+ * Header for upgrading the database schema on start up.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+
+/* Brings db up to the newest schema version, returns a sqlite3 status code */
+int migrate_db (sqlite3 *db);
+
+/* 1 if db is at the newest schema version, 0 if not, -1 on error */
+int schema_is_current (sqlite3 *db);
+
+/* Rebuilds db so purges can shrink it, a full rewrite of the file. Returns 1
+ * on success and -1 on error */
+int use_incremental_vacuum (sqlite3 *db);
@@ -14,12 +14,14 @@
 #include "sql_db.h"
 
 typedef struct attributes_widgets {
+    int               id;
     char             *description;
     GtkTextBuffer    *completed_on;
     GtkTextBuffer    *next_due;
     GtkSpinButton    *freq;
     GtkComboBox      *freq_type;
     GtkEntry         *category;
+    GtkEntry         *tags;
 } Attributes_widgets;
 
 static Attributes_widgets attributes_selection; 
@@ -33,52 +35,28 @@ static GtkWidget *make_connected_mark_completed_row (char *description);
 static GtkWidget *make_connected_edit_attributes_box (char *description);
 static GtkWidget *make_purge_section (void);
 static GtkWidget *make_history_section (char *description);
+static GtkWidget *make_history_stats_label (char *description);
 
 /* helpers for make_history_section */
 static void add_hist_columns (GtkTreeView *treeview);
-static char *generate_hist_query (char *description);
 
 /* wrapper function to return to edit_select: frees description */
 static void back_to_edit_select (GtkWidget *button, char *description);
 
+/* wrappers to the history edits of sql_db.c, on the db of the views */
+static void remove_hist_entries (GtkWidget *button, GtkListStore *store);
+static void change_hist_entries (GtkWidget *button, GtkListStore *store);
+
 /* callbacks */
 static void complete (GtkWidget *button , Attributes_widgets *attributes);
 static void modify_due_date (GtkWidget *widget, Attributes_widgets *attributes);
 static void modify_frequency (GtkWidget *widget, Attributes_widgets *attributes);
 static void modify_category (GtkWidget *widget, Attributes_widgets *attributes);
+static void modify_tags (GtkWidget *widget, Attributes_widgets *attributes);
 static void remove_item_from_upcoming (GtkWidget *widget, Attributes_widgets *attributes);
 static void purge_item (GtkWidget *widget, Attributes_widgets *attributes);
 /* end prototypes */
 
-/* 
- * FUNC generate_hist_query
- *   Creates the SQL query for accessing completed items
- * NOTE: USES MALLOC NEEDS TO BE FREED
- */
-static char *generate_hist_query (char *description)
-{
-    char *frmt = "SELECT * FROM history WHERE description = '%s'"\
-                  "ORDER BY date DESC";
-
-    int len = strlen(frmt) + strlen(description) + 1;
-
-    char *query = malloc (sizeof(char) * len);
-    if (query == NULL) {
-        fprintf (stderr, MEM_FAIL_IN "selected_view.c 1\n");
-        exit (EXIT_FAILURE);
-    }
-
-    int stat = sprintf(query, frmt, description);
-    /* We check againast len - 3 because we are omiting '\0' and %s */
-    if (stat != (len - 3)) {
-        fprintf (stderr, MEM_FAIL_IN "selected_view.c 2\n");
-        exit (EXIT_FAILURE);
-    }
-
-    return query;
-}
-    
-
 /*
  * FUNC add_hist_columns 
  *   Adds the columns to the history TreeView
@@ -167,6 +145,24 @@ static void back_to_edit_select (GtkWidget *button, char *description)
     set_edit_select_view (button);
 }
 
+/*
+ * FUNC remove_hist_entries
+ *   Wrapper function to remove_selected_historical_entries, on app_db
+ */
+static void remove_hist_entries (GtkWidget *button, GtkListStore *store)
+{
+    remove_selected_historical_entries (app_db (), button, store);
+}
+
+/*
+ * FUNC change_hist_entries
+ *   Wrapper function to change_hist_on_selected, on app_db
+ */
+static void change_hist_entries (GtkWidget *button, GtkListStore *store)
+{
+    change_hist_on_selected (app_db (), button, store);
+}
+
 /*
  * FUNC make_history_section
  *   Makes the section that shows completion history of the selected item to the
@@ -193,21 +189,34 @@ static GtkWidget *make_history_section (char *description)
                         remove_button,
                         FALSE, FALSE, 5);
 
-    int count;
     GtkWidget *sw,
               *treeview;
     GtkTreeModel *model;
+    HistPager *pager;
 
-    /* Note: memory allocation error handling handled in function */
-    char *query = generate_hist_query (description);
+    int item_id = get_item_id (app_db (), description);
+    if (item_id < 0) {
+        fprintf(stderr, DATABASE_ERROR_FATAL);
+        exit(EXIT_FAILURE);
+    }
 
-    count = count_rows_from_query (query);
-    if (count < 0) {
+    /* only the newest page is loaded now, the rest as the user scrolls */
+    pager = hist_pager_new_for_item (app_db (), item_id);
+    if (pager == NULL) {
         fprintf(stderr, DATABASE_ERROR_FATAL);
         exit(EXIT_FAILURE);
     }
-    if (count == 0) {
+
+    model = create_main_model_from_pager (pager);
+    if (model == NULL) {
+        fprintf(stderr, FATAL_ERROR);
+        exit(EXIT_FAILURE);
+    }
+
+    if (gtk_tree_model_iter_n_children (model, NULL) == 0) {
         GtkWidget *no_hist_label;
+        hist_pager_free (pager);
+        g_object_unref (model);
         no_hist_label = gtk_label_new ("No history for item");
         return no_hist_label;
     }
@@ -223,13 +232,6 @@ static GtkWidget *make_history_section (char *description)
 
     gtk_box_pack_start (GTK_BOX (box), sw, TRUE, TRUE, 0);
 
-    model = create_main_model_from_db (query);
-
-    if (model == NULL) {
-        fprintf(stderr, FATAL_ERROR);
-        exit(EXIT_FAILURE);
-    }
-
     treeview = gtk_tree_view_new_with_model (model);
 
     g_object_unref (model);
@@ -238,6 +240,9 @@ static GtkWidget *make_history_section (char *description)
 
     gtk_container_add (GTK_CONTAINER (sw), treeview);
 
+    /* sw now owns the pager */
+    hist_pager_attach (sw, pager);
+
     add_hist_columns (GTK_TREE_VIEW (treeview));
 
     
@@ -249,10 +254,10 @@ static GtkWidget *make_history_section (char *description)
     tmodel = gtk_tree_view_get_model (GTK_TREE_VIEW (treeview));
 
     g_signal_connect (G_OBJECT (remove_button), "clicked", 
-            G_CALLBACK (remove_selected_historical_entries), tmodel);
+            G_CALLBACK (remove_hist_entries), tmodel);
 
     g_signal_connect (G_OBJECT (change_date_button), "clicked", 
-            G_CALLBACK (change_hist_on_selected), tmodel);
+            G_CALLBACK (change_hist_entries), tmodel);
 
     g_signal_connect (G_OBJECT (remove_button), "enter-notify-event",
             G_CALLBACK (mouse_over), NULL);
@@ -260,14 +265,58 @@ static GtkWidget *make_history_section (char *description)
     g_signal_connect (G_OBJECT (change_date_button), "enter-notify-event",
             G_CALLBACK (mouse_over), NULL);
 
-    free (query);
-                        
     return box;
 
 }
 
 
 
+/*
+ * FUNC make_history_stats_label
+ *   Makes a label summarizing how often the item has been completed.
+ * Returns NULL if the item has never been completed.
+ */
+static GtkWidget *make_history_stats_label (char *description)
+{
+    Item_stats stats;
+    int item_id = get_item_id (app_db (), description);
+
+    if (item_id < 0 || get_item_stats (app_db (), item_id, &stats) < 0) {
+        fprintf(stderr, DATABASE_ERROR_FATAL);
+        exit(EXIT_FAILURE);
+    }
+
+    if (stats.completions == 0)
+        return NULL;
+
+    char *last_date = convert_day_to_user_frmt (stats.last_day);
+    if (last_date == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "selected_view.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+
+    gchar *text;
+
+    /* n completions span n - 1 intervals */
+    if (stats.completions > 1) {
+        double mean = (double) (stats.last_day - stats.first_day) 
+                      / (stats.completions - 1);
+        text = g_strdup_printf (COMPLETED_TIMES ON_AVERAGE_EVERY, 
+                                stats.completions, last_date, mean);
+    }
+    else {
+        text = g_strdup_printf (COMPLETED_TIMES, stats.completions, last_date);
+    }
+
+    GtkWidget *label = gtk_label_new (text);
+    gtk_label_set_xalign (GTK_LABEL (label), 0);
+
+    g_free (text);
+    free (last_date);
+
+    return label;
+}
+
 /* 
  * FUNC make_selected_view_box
  */
@@ -380,6 +429,13 @@ static GtkWidget *make_selected_view_box (char *description)
                         hist_label,
                         FALSE, FALSE, 10);
 
+    GtkWidget *stats_label;
+    stats_label = make_history_stats_label (description);
+    if (stats_label != NULL)
+        gtk_box_pack_start (GTK_BOX (edit_box),
+                            stats_label,
+                            FALSE, FALSE, 0);
+
     GtkWidget *history_section;
     history_section = make_history_section (description);
     gtk_box_pack_start (GTK_BOX (edit_box),
@@ -530,12 +586,15 @@ static GtkWidget *make_connected_edit_attributes_box (char *description)
     attributes.description = description;
 
     int load_success;
-    load_success = load_rest_of_attributes_raw_from_desc (&attributes);
+    load_success = load_rest_of_attributes_raw_from_desc (app_db (),
+                                                          &attributes);
     if (load_success < 0) {
         fprintf(stderr, DATABASE_CANNOT_LOAD_ATTRIBUTES_FATAL);
         exit(EXIT_FAILURE);
     }
 
+    attributes_selection.id = attributes.id;
+
     due_buffer = gtk_text_buffer_new (NULL);
     attributes_selection.next_due= GTK_TEXT_BUFFER (due_buffer);
 
@@ -676,8 +735,10 @@ static GtkWidget *make_connected_edit_attributes_box (char *description)
 
     gtk_entry_set_text (GTK_ENTRY (category), attributes.category);
 
-    char *cat_query = "select distinct category from attributes";
-    GtkTreeModel * completion_model = create_completion_model_from_db (cat_query);
+    char *cat_query = "SELECT c.name FROM categories c WHERE EXISTS "\
+                      "(SELECT 1 FROM attributes a WHERE a.category_id = c.id)";
+    GtkTreeModel * completion_model =
+        create_completion_model_from_db (app_db (), cat_query);
     if (completion_model == NULL) {
         fprintf (stderr, MEM_FAIL_IN "selected_view.c 5\n");
         exit (EXIT_FAILURE);
@@ -715,6 +776,52 @@ static GtkWidget *make_connected_edit_attributes_box (char *description)
 
     free (attributes.category); // FREE!
 
+    /* CHANGE TAGS */
+    GtkWidget *tags_row,
+              *tags_label,
+              *tags,
+              *spacer_tags,
+              *change_tags_button;
+
+    char *item_tags = get_item_tags (app_db (), attributes.id);
+    if (item_tags == NULL) {
+        fprintf (stderr, DATABASE_GET_TAGS_FAIL);
+        exit (EXIT_FAILURE);
+    }
+
+    tags_row   = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+    tags_label = gtk_label_new (TAGS);
+
+    tags = gtk_entry_new ();
+    attributes_selection.tags = GTK_ENTRY (tags);
+    gtk_entry_set_text (GTK_ENTRY (tags), item_tags);
+    free (item_tags); // FREE!
+
+    change_tags_button = gtk_button_new_with_label (CHANGE_TAGS);
+    spacer_tags = gtk_label_new ("       ");
+
+    gtk_box_pack_start (GTK_BOX (tags_row),
+                        tags_label,
+                        FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (tags_row),
+                        tags,
+                        TRUE, TRUE, 10);
+
+    gtk_box_pack_start (GTK_BOX (tags_row),
+                        spacer_tags,
+                        FALSE, FALSE, 10);
+
+    gtk_box_pack_start (GTK_BOX (tags_row),
+                        change_tags_button,
+                        FALSE, FALSE, 10);
+
+    gtk_box_pack_start (GTK_BOX (box),
+                        tags_row,
+                        FALSE, FALSE, 10);
+
+    g_signal_connect (G_OBJECT (change_tags_button), "clicked",
+            G_CALLBACK (modify_tags), &attributes_selection);
+
     return box;
 }
 
@@ -760,29 +867,20 @@ static void complete (GtkWidget *button , Attributes_widgets *attributes)
 {
     char *description   = attributes->description;
     char *date_selected = get_text_from_buffer (attributes->completed_on);
-    char *category      = (char *) gtk_entry_get_text (attributes->category);
 
-    int m,d,y, rc;
-    rc = parse_and_validate_user_date_str (date_selected, &m, &d, &y);
-    if (rc == 0) {
+    int day = day_from_user_date_str (date_selected);
+    if (day == 0) {
         error_dialog (button, INVALID_DATE\
                                DATE_FRMT_EXPLAIN);
         g_free (date_selected);
         return;
     }
 
-    char *sql_date = make_date_str_sql_frmt (m,d,y);
-    if (sql_date == NULL) {
-        fprintf (stderr, MEM_FAIL_IN "selected_view.c 6\n");
-        exit (EXIT_FAILURE);
-    }
-
-    int is_tracked =  get_tracking_from_db (description);
+    int is_tracked =  get_tracking_from_db (app_db (), attributes->id);
     
     if (is_tracked < 0) {
         error_dialog (button, DATABASE_FAILED_TO_GET_TRACKING);
         g_free (date_selected);
-        free (sql_date);
         return;
     }
    
@@ -791,7 +889,7 @@ static void complete (GtkWidget *button , Attributes_widgets *attributes)
     int u_success = 1;
 
     if (is_tracked == 1)
-        h_success = add_history (description, sql_date, (char *) category);
+        h_success = add_history (app_db (), attributes->id, day);
 
     if (h_success < 0) {
         error_dialog (button, DATABASE_MARK_COMPLETE_FAIL);
@@ -799,7 +897,7 @@ static void complete (GtkWidget *button , Attributes_widgets *attributes)
 
     /* We only attempt to update due date if tracking was successful */
     if (h_success == 1) {
-        u_success = update_due_date (description, sql_date);
+        u_success = update_due_date (app_db (), attributes->id, day);
         if (u_success < 0)
             error_dialog (button, DATABASE_UPDATE_DUE_DATE_FAIL);
     }
@@ -807,7 +905,6 @@ static void complete (GtkWidget *button , Attributes_widgets *attributes)
     if (u_success == 1 && h_success == 1)
         success_dialog (button, SUCCESS);
 
-    free (sql_date);
     g_free (date_selected);
 
 
@@ -824,7 +921,6 @@ static void modify_due_date (GtkWidget *widget, Attributes_widgets *attributes)
 {
     char *description = attributes->description;
     char *due_date = get_text_from_buffer (attributes->next_due);
-    char *category = (char*) gtk_entry_get_text (attributes->category);
     int rc, m, d, y;
     rc = parse_and_validate_user_date_str (due_date, &m, &d, &y);
     if (rc == 0) {
@@ -840,7 +936,7 @@ static void modify_due_date (GtkWidget *widget, Attributes_widgets *attributes)
         exit (EXIT_FAILURE);
     }
 
-    int change_status = change_db_due_date (description, sql_date, category);
+    int change_status = change_db_due_date (app_db (), description, sql_date);
     if (change_status < 0 ) 
         error_dialog (widget, DATABASE_UPDATE_DUE_DATE_FAIL);
     else
@@ -862,7 +958,8 @@ static void modify_frequency (GtkWidget *widget, Attributes_widgets *attributes)
     int freq = gtk_spin_button_get_value (attributes->freq);
     const char *freq_type = gtk_combo_box_get_active_id (attributes->freq_type);
 
-    int change_status = change_frequency (description, freq, freq_type);
+    int change_status = change_frequency (app_db (), description, freq,
+                                          freq_type);
 
     if (change_status < 0)
         error_dialog (widget, DATABASE_FREQ_FAIL);
@@ -886,7 +983,8 @@ static void modify_category (GtkWidget *widget, Attributes_widgets *attributes)
     }
     else {
         int change_success = 1;
-        change_success = change_category (description, (char*) category);
+        change_success = change_category (app_db (), description,
+                                          (char*) category);
         if (change_success == 1)
             success_dialog (widget, SUCCESS);
         else
@@ -894,6 +992,23 @@ static void modify_category (GtkWidget *widget, Attributes_widgets *attributes)
     }
 }
 
+/*
+ * FUNC modify_tags
+ *   Sets the tags of the item to those typed, separated by commas
+ */
+static void modify_tags (GtkWidget *widget, Attributes_widgets *attributes)
+{
+    const char *tags = gtk_entry_get_text (attributes->tags);
+    int change_success = set_item_tags (app_db (), attributes->id, tags);
+
+    if (change_success == 1)
+        success_dialog (widget, SUCCESS);
+    else if (change_success == 0)
+        error_dialog (widget, TAGS_INVALID);
+    else
+        error_dialog (widget, DATABASE_TAGS_FAIL);
+}
+
 /* 
  * FUNC remove_item_from_upcoming
  *   Removes the item from the upcoming items
@@ -902,7 +1017,7 @@ static void remove_item_from_upcoming (GtkWidget *widget, Attributes_widgets *at
 {
     char *description = attributes->description;
     int remove_stat = 1;
-    remove_stat = remove_from_upcoming (description);
+    remove_stat = remove_from_upcoming (app_db (), description);
     if (remove_stat < 0)
         error_dialog (widget, DATABASE_REMOVE_UPCOMING_FAIL);
     else {
@@ -932,7 +1047,7 @@ static void purge_item (GtkWidget *widget, Attributes_widgets *attributes)
 
     if (response == GTK_RESPONSE_OK)
     {
-        int purge_stat = purge_permanently (description);
+        int purge_stat = purge_permanently (app_db (), description);
         if (purge_stat == 1) 
             success_dialog (widget, PURGE_SUCCESS);
         else {
@@ -10,9 +10,20 @@
 
 /* Functions to set up the various views*/
 void set_main (GtkWidget *widget);
+void set_main_from_snapshot (GtkWidget *widget, GtkTreeModel *model);
+void check_main_snapshot (void);
 void set_add (GtkWidget *button);
 void set_look_select (GtkWidget *widget);
-void set_ahead_back (GtkWidget *widget, char *ahead_query, char *back_query,
+void set_ahead_back (GtkWidget *widget, int start_day, int end_day,
         char* range_desc);
 void set_edit_select_view (GtkWidget *widget);
+void set_bulk_view (GtkWidget *widget);
 void set_selected_view (GtkWidget *widget, char *description);
+void set_sites_view (GtkWidget *widget, int start_day, int end_day,
+        char *range_desc);
+
+/* The db the views work on, see init.c */
+struct routine_db *app_db (void);
+
+/* The dbs of the other sites, NULL for none, see init.c */
+struct federation *app_federation (void);
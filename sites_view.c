@@ -0,0 +1,376 @@
+/*******************************************************************************
+ * sites_view.c
+ * Looks at the items of every site (see federation.c) at once: the items due,
+ * or those due and completed in a range, merged by date with the site of
+ * each. Read only, items are completed and snoozed at their own site.
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <gtk/gtk.h>
+
+#include "federation.h"
+#include "main_enum.h"
+#include "setup.h"
+
+/* The range the view is loaded with, range_desc is NULL for the items due */
+typedef struct sites_data {
+    char *range_desc;
+    GCancellable *loading;   /* set while the sites load, see load_sites */
+} Sites_data;
+
+static Sites_data capsule;
+
+/* prototypes */
+void set_sites_view (GtkWidget *widget, int start_day, int end_day,
+        char *range_desc);
+
+static GtkWidget *make_sites_view_box (char *range_desc, GtkWidget **panes);
+static GtkWidget *make_site_box (GtkTreeModel *model, const char *heading,
+        const char *date_title);
+
+/* load every site off the main thread, see federation_load_async */
+static void load_sites (GtkWidget *panes, int start_day, int end_day);
+static void sites_loaded (GObject *source_object, GAsyncResult *result,
+        gpointer user_data);
+static void fill_site_panes (GtkWidget *panes, GtkTreeModel *ahead,
+        GtkTreeModel *back);
+static void stop_loading (void);
+
+static void add_site_columns (GtkTreeView *treeview, const char *date_title);
+
+/* these functions are used to facilitate transitions back and to main */
+static void go_back (GtkWidget *button);
+static void go_main (GtkWidget *button);
+/* end prototypes */
+
+/*
+ * FUNC set_sites_view
+ *   Removes the current child of the toplevel window and sets the every site
+ * view in its place. With a range_desc it shows the items due and completed
+ * from start_day to end_day (inclusive), without one the items due up to
+ * end_day. The view is shown right away with a loading label, see
+ * load_sites.
+ */
+void set_sites_view (GtkWidget *widget, int start_day, int end_day,
+        char *range_desc)
+{
+    GtkWidget *window;
+    GtkWidget *child;
+    GtkWidget *box,
+              *panes;
+
+    stop_loading ();
+
+    window = gtk_widget_get_toplevel (widget);
+    child = gtk_bin_get_child (GTK_BIN (window));
+    if (child != NULL) {
+        gtk_widget_destroy (child);
+    }
+
+    capsule.range_desc = range_desc;
+
+    box = make_sites_view_box (range_desc, &panes);
+
+    gtk_container_add (GTK_CONTAINER (window), box);
+
+    gtk_widget_show_all (window);
+
+    load_sites (panes, start_day, end_day);
+}
+
+/*
+ * FUNC make_sites_view_box
+ *   Helper function to set_sites_view
+ * Creates the UI of the view, panes is set to the box the items of the
+ * sites go in once loaded
+ */
+static GtkWidget *make_sites_view_box (char *range_desc, GtkWidget **panes)
+{
+    GtkWidget *box,
+              *label,
+              *button_box,
+              *back,
+              *main;
+
+    box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+
+    label = gtk_label_new ((range_desc != NULL) ? range_desc
+                                                : DUE_AT_EVERY_SITE);
+    gtk_box_pack_start (GTK_BOX (box), label, FALSE, FALSE, 10);
+
+    *panes = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+    label = gtk_label_new (LOADING_ITEMS);
+    gtk_box_pack_start (GTK_BOX (*panes), label, FALSE, FALSE, 10);
+    gtk_box_pack_start (GTK_BOX (box), *panes, TRUE, TRUE, 0);
+
+    /* Buttons for the whole view, back only leads somewhere for a range */
+    button_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 10);
+    if (range_desc != NULL) {
+        back = gtk_button_new_with_label (BACK);
+        gtk_box_pack_start (GTK_BOX (button_box), back, TRUE, FALSE, 10);
+        g_signal_connect (G_OBJECT (back), "clicked",
+                G_CALLBACK (go_back), NULL);
+    }
+    main = gtk_button_new_with_label (MAIN);
+    gtk_box_pack_start (GTK_BOX (button_box), main, TRUE, FALSE, 10);
+    g_signal_connect (G_OBJECT (main), "clicked",
+            G_CALLBACK (go_main), NULL);
+
+    gtk_box_pack_start (GTK_BOX (box), button_box, FALSE, FALSE, 0);
+
+    return box;
+}
+
+/*
+ * FUNC load_sites
+ *   Helper function to set_sites_view
+ * Starts loading every site, each over a connection of its own, which
+ * capsule.loading can interrupt at any point. panes is passed on as a weak
+ * pointer so it turns NULL if the view is left before the sites are loaded.
+ */
+static void load_sites (GtkWidget *panes, int start_day, int end_day)
+{
+    Federation *fed = app_federation ();
+    GtkWidget **target;
+
+    if (fed == NULL) {
+        fill_site_panes (panes, NULL, NULL);
+        return;
+    }
+
+    target = malloc (sizeof (GtkWidget *));
+    if (target == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sites_view.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+    *target = panes;
+    g_object_add_weak_pointer (G_OBJECT (panes), (gpointer *) target);
+
+    capsule.loading = g_cancellable_new ();
+
+    federation_load_async (fed, start_day, end_day, capsule.range_desc != NULL,
+                           capsule.loading, sites_loaded, target);
+}
+
+/*
+ * FUNC sites_loaded
+ *   Called on the main thread once every site is loaded. Loads that were
+ * cancelled, or whose view is gone, are dropped.
+ */
+static void sites_loaded (GObject *source_object, GAsyncResult *result,
+        gpointer user_data)
+{
+    GtkWidget **target = user_data;
+    GtkTreeModel *ahead,
+                 *back;
+    int rc;
+
+    rc = federation_load_finish (result, &ahead, &back);
+
+    if (*target != NULL)
+        g_object_remove_weak_pointer (G_OBJECT (*target), (gpointer *) target);
+
+    /* cancelled, capsule.loading was already dropped */
+    if (rc == 0) {
+        free (target);
+        return;
+    }
+
+    if (capsule.loading == g_task_get_cancellable (G_TASK (result)))
+        g_clear_object (&capsule.loading);
+
+    if (*target == NULL) {
+        if (ahead != NULL)
+            g_object_unref (ahead);
+        if (back != NULL)
+            g_object_unref (back);
+        free (target);
+        return;
+    }
+
+    /* a site that failed to load was reported by federation.c */
+    fill_site_panes (*target, ahead, back);
+    free (target);
+}
+
+/*
+ * FUNC fill_site_panes
+ *   Replaces the loading label in panes with the items of ahead and back,
+ * which are handed over to the views. Both NULL means the sites could not
+ * be read.
+ */
+static void fill_site_panes (GtkWidget *panes, GtkTreeModel *ahead,
+        GtkTreeModel *back)
+{
+    GtkWidget *box_ahead = NULL,
+              *box_back = NULL,
+              *label;
+    GList *children, *child;
+
+    children = gtk_container_get_children (GTK_CONTAINER (panes));
+    for (child = children; child != NULL; child = child->next)
+        gtk_widget_destroy (GTK_WIDGET (child->data));
+    g_list_free (children);
+
+    if (ahead == NULL && back == NULL) {
+        label = gtk_label_new (SITES_FAIL);
+        gtk_box_pack_start (GTK_BOX (panes), label, FALSE, FALSE, 10);
+        gtk_widget_show_all (panes);
+        return;
+    }
+
+    if (ahead != NULL)
+        box_ahead = make_site_box (ahead,
+                (capsule.range_desc != NULL) ? ITEMS_DUE_IN_RANGE : NULL,
+                DUE);
+    if (back != NULL)
+        box_back = make_site_box (back, ITEMS_COMPLETED_IN_RANGE,
+                                  COMPLETED_ON);
+
+    if (box_ahead != NULL)
+        gtk_box_pack_start (GTK_BOX (panes), box_ahead, TRUE, TRUE, 10);
+    if (box_back != NULL)
+        gtk_box_pack_start (GTK_BOX (panes), box_back, TRUE, TRUE, 10);
+    if (box_ahead == NULL && box_back == NULL) {
+        label = gtk_label_new (NO_ITEMS_IN_RANGE);
+        gtk_box_pack_start (GTK_BOX (panes), label, FALSE, FALSE, 10);
+    }
+
+    gtk_widget_show_all (panes);
+}
+
+/*
+ * FUNC make_site_box
+ *   Helper function to fill_site_panes
+ * Creates the box that holds the items of model under heading (none if
+ * NULL), their date under date_title. Takes over the reference to model.
+ * Returns NULL if model is empty
+ */
+static GtkWidget *make_site_box (GtkTreeModel *model, const char *heading,
+        const char *date_title)
+{
+    GtkWidget *box,
+              *label,
+              *sw,
+              *treeview;
+
+    if (gtk_tree_model_iter_n_children (model, NULL) == 0) {
+        g_object_unref (model);
+        return NULL;
+    }
+
+    box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 10);
+
+    if (heading != NULL) {
+        label = gtk_label_new (heading);
+        gtk_box_pack_start (GTK_BOX (box), label, FALSE, FALSE, 0);
+    }
+
+    sw = gtk_scrolled_window_new (NULL, NULL);
+    gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (sw),
+            GTK_SHADOW_ETCHED_IN);
+    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (sw),
+            GTK_POLICY_NEVER,
+            GTK_POLICY_AUTOMATIC);
+    gtk_box_pack_start (GTK_BOX (box), sw, TRUE, TRUE, 0);
+
+    treeview = gtk_tree_view_new_with_model (model);
+    gtk_tree_view_set_search_column (GTK_TREE_VIEW (treeview),
+            COLUMN_DESCRIPTION);
+    g_object_unref (model);
+
+    gtk_container_add (GTK_CONTAINER (sw), treeview);
+
+    add_site_columns (GTK_TREE_VIEW (treeview), date_title);
+
+    return box;
+}
+
+/*
+ * FUNC stop_loading
+ *   Cancels the sites still loading, if any. The queries of every site are
+ * interrupted and everything they made is freed once they return.
+ */
+static void stop_loading (void)
+{
+    if (capsule.loading == NULL)
+        return;
+
+    g_cancellable_cancel (capsule.loading);
+    g_clear_object (&capsule.loading);
+}
+
+/*
+ * FUNC add_site_columns
+ *   Adds the columns of a merged model: the site, the description, the date
+ * (titled date_title) and the category
+ */
+static void add_site_columns (GtkTreeView *treeview, const char *date_title)
+{
+    GtkCellRenderer *renderer;
+    GtkTreeViewColumn *column;
+
+    /* column for site */
+    renderer = gtk_cell_renderer_text_new ();
+    column = gtk_tree_view_column_new_with_attributes (SITE,
+                                                     renderer,
+                                                     "text",
+                                                     COLUMN_SITE,
+                                                     NULL);
+    gtk_tree_view_column_set_sort_column_id (column, COLUMN_SITE);
+    gtk_tree_view_append_column (treeview, column);
+
+    /* column for description */
+    renderer = gtk_cell_renderer_text_new ();
+    column = gtk_tree_view_column_new_with_attributes (DESCRIPTION,
+                                                     renderer,
+                                                     "text",
+                                                     COLUMN_DESCRIPTION,
+                                                     NULL);
+    gtk_tree_view_column_set_sort_column_id (column, COLUMN_DESCRIPTION);
+    gtk_tree_view_append_column (treeview, column);
+
+    /* column for date, sorted by day number so any format sorts right */
+    renderer = gtk_cell_renderer_text_new ();
+    column = gtk_tree_view_column_new_with_attributes (date_title,
+                                                     renderer,
+                                                     "text",
+                                                     COLUMN_DATE_UNEDITABLE,
+                                                     NULL);
+    gtk_tree_view_column_set_sort_column_id (column, COLUMN_DAY_UNEDITABLE);
+    gtk_tree_view_append_column (treeview, column);
+
+    /* column for category */
+    renderer = gtk_cell_renderer_text_new ();
+    column = gtk_tree_view_column_new_with_attributes (CATEGORY,
+                                                     renderer,
+                                                     "text",
+                                                     COLUMN_CATEGORY,
+                                                     NULL);
+    gtk_tree_view_column_set_sort_column_id (column, COLUMN_CATEGORY);
+    gtk_tree_view_append_column (treeview, column);
+}
+
+/*
+ * FUNC go_back
+ *   Sends the user back to the look_select_view
+ */
+static void go_back (GtkWidget *button)
+{
+    stop_loading ();
+    free (capsule.range_desc);
+    capsule.range_desc = NULL;
+    set_look_select (button);
+}
+
+/*
+ * FUNC go_main
+ *   Sends the user back to the main_view
+ */
+static void go_main (GtkWidget *button)
+{
+    stop_loading ();
+    free (capsule.range_desc);
+    capsule.range_desc = NULL;
+    set_main (button);
+}
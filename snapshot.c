@@ -0,0 +1,347 @@
+/*******************************************************************************
+ * snapshot.c
+ * Keeps a copy of the first rows of the main view (a screenful,
+ * ROW_FEED_FIRST_ROWS) in a small binary file next to the db (snapshot_file,
+ * see config.c). On start up it is mapped and shown before the db is even
+ * opened, then checked against the db (see main_view.c) and patched where it
+ * differs, the rest of the rows are fed in after.
+ *
+ * Layout, integers in native byte order (the file never leaves the machine):
+ *   "RTNSNAP1"                            8 bytes, the 1 is the layout version
+ *   number of rows                        uint32
+ *   for each row:
+ *     item_id, due day                    int32 each
+ *     length of description, category     uint16 each
+ *     description, category               that many bytes, no '\0'
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "config.h"
+#include "dates.h"
+#include "main_enum.h"
+#include "row_feed.h"
+#include "setup.h"
+#include "snapshot.h"
+#include "sql_db.h"
+
+#define SNAPSHOT_TMP_SUFFIX ".tmp"
+#define SNAPSHOT_MAGIC "RTNSNAP1"
+#define SNAPSHOT_MAGIC_LEN 8
+
+/* fixed part of a row */
+typedef struct snapshot_row {
+    gint32  item_id;
+    gint32  day;
+    guint16 desc_len;
+    guint16 cat_len;
+} Snapshot_row;
+
+/* prototypes */
+GtkTreeModel *snapshot_load (void);
+int snapshot_save (GtkTreeModel *model);
+int snapshot_patch (GtkListStore *shown, GtkTreeModel *real);
+
+/* helpers */
+static int write_row (FILE *fp, const char *description, const char *category,
+                      int day, int item_id);
+static int row_matches (GtkTreeModel *model, GtkTreeIter *iter,
+                        const char *description, const char *category,
+                        int day, int item_id);
+/* end prototypes */
+
+/*
+ * FUNC snapshot_load
+ *   Maps the snapshot file and loads its rows into a new model.
+ * Anything that does not look like a snapshot we wrote is ignored.
+ *
+ * Returns NULL if there is no usable snapshot
+ */
+GtkTreeModel *snapshot_load (void)
+{
+    GMappedFile *file;
+    const char *data;
+    gsize len, pos;
+    guint32 n_rows, i;
+    GtkListStore *store;
+    GtkTreeIter iter;
+
+    /* none for a db in memory */
+    if (config_get ()->snapshot_file == NULL)
+        return NULL;
+
+    file = g_mapped_file_new (config_get ()->snapshot_file, FALSE, NULL);
+    if (file == NULL)
+        return NULL;
+
+    data = g_mapped_file_get_contents (file);
+    len  = g_mapped_file_get_length (file);
+
+    if (data == NULL || len < SNAPSHOT_MAGIC_LEN + sizeof (guint32) ||
+        memcmp (data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0) {
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    memcpy (&n_rows, data + SNAPSHOT_MAGIC_LEN, sizeof (guint32));
+    /* older snapshots held every row, a screenful is all that is shown */
+    if (n_rows > ROW_FEED_FIRST_ROWS)
+        n_rows = ROW_FEED_FIRST_ROWS;
+    pos = SNAPSHOT_MAGIC_LEN + sizeof (guint32);
+
+    char *today_str = get_current_date_str_in_user_frmt ();
+    if (today_str == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "snapshot.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+    int today = get_current_day ();
+
+    store = new_main_store ();
+
+    for (i = 0; i < n_rows; i++) {
+        Snapshot_row row;
+
+        if (len - pos < sizeof (Snapshot_row))
+            break;
+        memcpy (&row, data + pos, sizeof (Snapshot_row));
+        pos += sizeof (Snapshot_row);
+
+        if (len - pos < (gsize) row.desc_len + row.cat_len)
+            break;
+
+        char *description = g_strndup (data + pos, row.desc_len);
+        char *category = g_strndup (data + pos + row.desc_len, row.cat_len);
+        pos += row.desc_len + row.cat_len;
+
+        gtk_list_store_append (store, &iter);
+        int rc = set_main_row (store, &iter, description, category, row.day,
+                               row.item_id, 0, today_str, today);
+        g_free (description);
+        g_free (category);
+
+        if (rc < 0) {
+            fprintf (stderr, MEM_FAIL_IN "snapshot.c 2\n");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    free (today_str);
+    g_mapped_file_unref (file);
+
+    /* a cut short file is not worth showing */
+    if (i < n_rows) {
+        g_object_unref (store);
+        return NULL;
+    }
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC snapshot_save
+ *   Writes the first ROW_FEED_FIRST_ROWS rows of model (a main view model) to
+ * a temporary file and renames it over the snapshot, so a crash never leaves
+ * half a snapshot.
+ *
+ * Returns 1 on success and -1 on error
+ */
+int snapshot_save (GtkTreeModel *model)
+{
+    FILE *fp;
+    GtkTreeIter iter;
+    gboolean valid;
+    guint32 n_rows = gtk_tree_model_iter_n_children (model, NULL);
+    guint32 written = 0;
+    const char *path = config_get ()->snapshot_file;
+    char *tmp_path;
+    int ok = 1;
+
+    if (path == NULL)
+        return -1;
+
+    /* the first frame needs no more, the rest are fed in once the db is
+     * open */
+    if (n_rows > ROW_FEED_FIRST_ROWS)
+        n_rows = ROW_FEED_FIRST_ROWS;
+
+    tmp_path = g_strconcat (path, SNAPSHOT_TMP_SUFFIX, NULL);
+    fp = fopen (tmp_path, "wb");
+    if (fp == NULL) {
+        g_free (tmp_path);
+        return -1;
+    }
+
+    if (fwrite (SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LEN, fp) != SNAPSHOT_MAGIC_LEN ||
+        fwrite (&n_rows, sizeof (guint32), 1, fp) != 1)
+        ok = 0;
+
+    valid = gtk_tree_model_get_iter_first (model, &iter);
+    while (ok && valid && written < n_rows) {
+        gchar *description, *category;
+        gint day, item_id;
+
+        gtk_tree_model_get (model, &iter,
+                            COLUMN_DESCRIPTION,    &description,
+                            COLUMN_CATEGORY,       &category,
+                            COLUMN_DAY_UNEDITABLE, &day,
+                            COLUMN_ITEM_ID,        &item_id,
+                            -1);
+
+        if (write_row (fp, description, category, day, item_id) < 0)
+            ok = 0;
+
+        g_free (description);
+        g_free (category);
+        written++;
+        valid = gtk_tree_model_iter_next (model, &iter);
+    }
+
+    if (fclose (fp) != 0)
+        ok = 0;
+
+    if (!ok || rename (tmp_path, path) != 0) {
+        remove (tmp_path);
+        g_free (tmp_path);
+        return -1;
+    }
+
+    g_free (tmp_path);
+    return 1;
+}
+
+/*
+ * FUNC write_row
+ *   Helper function to snapshot_save, writes one row
+ * Returns 1 on success and -1 on error
+ */
+static int write_row (FILE *fp, const char *description, const char *category,
+                      int day, int item_id)
+{
+    Snapshot_row row;
+    size_t desc_len = (description != NULL) ? strlen (description) : 0;
+    size_t cat_len  = (category != NULL) ? strlen (category) : 0;
+
+    /* descriptions are typed in by hand, this is just a sanity check */
+    if (desc_len > G_MAXUINT16 || cat_len > G_MAXUINT16)
+        return -1;
+
+    memset (&row, 0, sizeof (row));
+    row.item_id  = item_id;
+    row.day      = day;
+    row.desc_len = desc_len;
+    row.cat_len  = cat_len;
+
+    if (fwrite (&row, sizeof (row), 1, fp) != 1 ||
+        fwrite (description, 1, desc_len, fp) != desc_len ||
+        fwrite (category, 1, cat_len, fp) != cat_len)
+        return -1;
+
+    return 1;
+}
+
+/*
+ * FUNC snapshot_patch
+ *   Walks shown (painted from the snapshot) and real (loaded from the db)
+ * side by side. Rows that differ are overwritten, missing rows are appended
+ * and extra rows removed. Since rows are only touched where they differ,
+ * a check that finds nothing to change does not redraw anything.
+ *
+ * Returns the number of rows changed, -1 on error
+ */
+int snapshot_patch (GtkListStore *shown, GtkTreeModel *real)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL (shown);
+    GtkTreeIter shown_iter, real_iter;
+    gboolean shown_valid, real_valid;
+    int changed = 0;
+
+    char *today_str = get_current_date_str_in_user_frmt ();
+    if (today_str == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "snapshot.c 3\n");
+        return -1;
+    }
+    int today = get_current_day ();
+
+    shown_valid = gtk_tree_model_get_iter_first (model, &shown_iter);
+    real_valid  = gtk_tree_model_get_iter_first (real, &real_iter);
+
+    while (real_valid) {
+        gchar *description, *category;
+        gint day, item_id;
+        int rc = 1;
+
+        gtk_tree_model_get (real, &real_iter,
+                            COLUMN_DESCRIPTION,    &description,
+                            COLUMN_CATEGORY,       &category,
+                            COLUMN_DAY_UNEDITABLE, &day,
+                            COLUMN_ITEM_ID,        &item_id,
+                            -1);
+
+        if (!shown_valid) {
+            gtk_list_store_append (shown, &shown_iter);
+            rc = set_main_row (shown, &shown_iter, description, category, day,
+                               item_id, 0, today_str, today);
+            changed++;
+        }
+        else {
+            if (!row_matches (model, &shown_iter, description, category, day,
+                              item_id)) {
+                rc = set_main_row (shown, &shown_iter, description, category,
+                                   day, item_id, 0, today_str, today);
+                changed++;
+            }
+            shown_valid = gtk_tree_model_iter_next (model, &shown_iter);
+        }
+
+        g_free (description);
+        g_free (category);
+
+        if (rc < 0) {
+            free (today_str);
+            fprintf (stderr, MEM_FAIL_IN "snapshot.c 4\n");
+            return -1;
+        }
+
+        real_valid = gtk_tree_model_iter_next (real, &real_iter);
+    }
+
+    while (shown_valid) {
+        shown_valid = gtk_list_store_remove (shown, &shown_iter);
+        changed++;
+    }
+
+    free (today_str);
+    return changed;
+}
+
+/*
+ * FUNC row_matches
+ *   Helper function to snapshot_patch
+ * Returns 1 if the row at iter shows the given item and due day, 0 if not
+ */
+static int row_matches (GtkTreeModel *model, GtkTreeIter *iter,
+                        const char *description, const char *category,
+                        int day, int item_id)
+{
+    gchar *shown_desc, *shown_cat;
+    gint shown_day, shown_id;
+    int matches;
+
+    gtk_tree_model_get (model, iter,
+                        COLUMN_DESCRIPTION,    &shown_desc,
+                        COLUMN_CATEGORY,       &shown_cat,
+                        COLUMN_DAY_UNEDITABLE, &shown_day,
+                        COLUMN_ITEM_ID,        &shown_id,
+                        -1);
+
+    matches = shown_day == day && shown_id == item_id &&
+              g_strcmp0 (shown_desc, description) == 0 &&
+              g_strcmp0 (shown_cat, category) == 0;
+
+    g_free (shown_desc);
+    g_free (shown_cat);
+
+    return matches;
+}
@@ -0,0 +1,20 @@
+/*******************************************************************************
+ * snapshot.h
+ * Header for the snapshot of the main view kept between runs so the first
+ * frame can be painted before the db is opened.
+ *
+ ******************************************************************************/
+
+#include <gtk/gtk.h>
+
+/* Model (columns of main_enum.h) with the rows of the last snapshot, NULL if
+ * there is none or it cannot be read */
+GtkTreeModel *snapshot_load (void);
+
+/* Writes the first screenful of rows of model as the snapshot, returns 1 on
+ * success -1 on error */
+int snapshot_save (GtkTreeModel *model);
+
+/* Makes the rows of shown match those of real, leaving rows that already
+ * match alone, returns the number of rows changed or -1 on error */
+int snapshot_patch (GtkListStore *shown, GtkTreeModel *real);
@@ -9,145 +9,933 @@
 #include <sqlite3.h>
 #include <gtk/gtk.h>
 
+#include "archive.h"
+#include "config.h"
 #include "dates.h"
+#include "due_index.h"
 #include "helpers.h"
 #include "main_enum.h"
+#include "maintenance.h"
+#include "query_cache.h"
+#include "schema.h"
 #include "setup.h" 
 #include "sql_db.h"
-
-#define DATABASE "db_routine"
-
-static sqlite3 *db = NULL;
+#include "sql_funcs.h"
+#include "tag_index.h"
+
+/* How long a statement waits on a lock held by another connection (the
+ * prefetch thread, see prefetch.c) before giving up with SQLITE_BUSY */
+#define BUSY_TIMEOUT_MS 2000
+
+/* Virtual machine instructions run between checks of whether the query of
+ * a View_db has been cancelled */
+#define CANCEL_CHECK_STEPS 1000
+
+/* Reader connections a RoutineDb keeps open between views, one for each
+ * pane of ahead_back_view.c, which load at the same time */
+#define MAX_IDLE_READERS 2
+
+/* Rows fetched per page by a HistPager */
+#define HIST_PAGE_SIZE 100
+
+/* Keyset queries for HistPager. ?1 (and ?5 for a range) are bound once when
+ * the pager is made, ?2 ?3 are the (date, id) of the last row loaded and ?4
+ * is the page size */
+#define HIST_PAGE_BY_ITEM_IN(tables) \
+    "SELECT " HISTORY_COLUMNS " FROM " tables " "\
+    "WHERE h.item_id = ?1 AND (h.date, h.id) < (?2, ?3) "\
+    "ORDER BY h.date DESC, h.id DESC LIMIT ?4"
+
+#define HIST_PAGE_BY_RANGE_WHERE(tables) \
+    "SELECT " HISTORY_COLUMNS " FROM " tables " "\
+    "WHERE h.date >= DATE(?1 + " JULIAN_DAY_0 ") "\
+    "AND h.date <= DATE(?5 + " JULIAN_DAY_0 ") "\
+    "AND (h.date, h.id) > (?2, ?3) "
+
+#define HIST_PAGE_BY_RANGE_IN(tables) \
+    HIST_PAGE_BY_RANGE_WHERE (tables) "ORDER BY h.date, h.id LIMIT ?4"
+
+#define HIST_PAGE_BY_ITEM HIST_PAGE_BY_ITEM_IN (HISTORY_TABLES)
+#define HIST_PAGE_BY_RANGE HIST_PAGE_BY_RANGE_IN (HISTORY_TABLES)
+
+/* Condition on the item id x being filed in the category bound to ?n or one
+ * under it. The categories are one range of the primary key of
+ * category_tree (see version 7 in schema.c), their items are read off
+ * attributes_category */
+#define UNDER_CATEGORY(x, n) \
+    x " IN (SELECT s.id FROM category_tree t JOIN attributes s "\
+    "    ON s.category_id = t.descendant WHERE t.ancestor = ?" n ")"
+
+/* HIST_PAGE_BY_RANGE for items under the category ?6 */
+#define HIST_PAGE_BY_RANGE_UNDER_IN(tables) \
+    HIST_PAGE_BY_RANGE_WHERE (tables) \
+    "AND " UNDER_CATEGORY ("h.item_id", "6") " "\
+    "ORDER BY h.date, h.id LIMIT ?4"
+
+#define HIST_PAGE_BY_RANGE_UNDER HIST_PAGE_BY_RANGE_UNDER_IN (HISTORY_TABLES)
+
+/* Completions moved out of history by archive.c, see HISTORY_TABLES */
+#define ARCHIVE_TABLES \
+    "archive.history h LEFT JOIN attributes a ON a.id = h.item_id "\
+    "LEFT JOIN categories c ON c.id = a.category_id"
+
+/* A page of the HIST_PAGE query hot, and the same query of the archive,
+ * merged by order (the column numbers of the date and id). Each side stops
+ * at a page, so the archive adds one index seek per page */
+#define UNION_PAGES(hot, cold, order) \
+    "SELECT * FROM (" hot ") UNION ALL SELECT * FROM (" cold ") "\
+    "ORDER BY " order " LIMIT ?4"
+
+/* The HIST_PAGE queries for when the archive has to be read too, see
+ * archive_end_day of RoutineDb */
+#define HIST_PAGE_BY_ITEM_ARCHIVED \
+    UNION_PAGES (HIST_PAGE_BY_ITEM, HIST_PAGE_BY_ITEM_IN (ARCHIVE_TABLES), \
+                 "2 DESC, 5 DESC")
+#define HIST_PAGE_BY_RANGE_ARCHIVED \
+    UNION_PAGES (HIST_PAGE_BY_RANGE, HIST_PAGE_BY_RANGE_IN (ARCHIVE_TABLES), \
+                 "2, 5")
+#define HIST_PAGE_BY_RANGE_UNDER_ARCHIVED \
+    UNION_PAGES (HIST_PAGE_BY_RANGE_UNDER, \
+                 HIST_PAGE_BY_RANGE_UNDER_IN (ARCHIVE_TABLES), "2, 5")
+
+/* Upcoming items due from ?1 to ?2 (inclusive day numbers) */
+#define UPCOMING_RANGE \
+    "SELECT " UPCOMING_COLUMNS " FROM " UPCOMING_TABLES " "\
+    "WHERE u.date >= DATE(?1 + " JULIAN_DAY_0 ") "\
+    "AND u.date <= DATE(?2 + " JULIAN_DAY_0 ")"
+
+/* UPCOMING_RANGE for items under the category ?3 */
+#define UPCOMING_RANGE_UNDER \
+    UPCOMING_RANGE " AND " UNDER_CATEGORY ("u.item_id", "3")
+
+/* UPCOMING_RANGE soonest due first, see create_upcoming_model_by_date_on */
+#define UPCOMING_RANGE_BY_DATE UPCOMING_RANGE " ORDER BY u.date, u.item_id"
+
+/* Condition on upcoming matching a Bulk_rule, see bind_bulk_rule. The
+ * checks of unset criteria keep it one statement for every rule. A
+ * category takes in the ones under it */
+#define BULK_RULE_WHERE \
+    "WHERE (?1 IS NULL OR item_id IN (SELECT a.id FROM categories c "\
+    "    JOIN category_tree t ON t.ancestor = c.id "\
+    "    JOIN attributes a ON a.category_id = t.descendant "\
+    "    WHERE c.name = ?1)) "\
+    "AND (?2 = 0 OR date >= DATE(?2 + " JULIAN_DAY_0 ")) "\
+    "AND (?3 = 0 OR date <= DATE(?3 + " JULIAN_DAY_0 ")) "\
+    "AND (?4 IS NULL OR item_id IN (SELECT id FROM attributes "\
+    "    WHERE freq_type = ?4 AND (freq = ?5 OR ?4 = 'no_repeat')))"
+
+/* New name of the category o when the category ?1 is renamed to ?2, see
+ * rename_category */
+#define RENAMED_PATH "?2 || substr (o.name, length (?1) + 1)"
+
+/* Items due, most urgent first, read in order off upcoming_urgency (see
+ * version 5 in schema.c) so LIMIT ?1 stops early. ?1 = -1 for all of them */
+#define URGENT_ITEMS \
+    "SELECT " UPCOMING_COLUMNS " FROM " UPCOMING_TABLES " "\
+    "WHERE u.urgency IS NOT NULL ORDER BY u.urgency DESC, u.date LIMIT ?1"
+
+/* URGENT_ITEMS for items under the category ?2. The few items of a
+ * category are found first and then sorted, rather than read in order off
+ * the whole of upcoming_urgency */
+#define URGENT_ITEMS_UNDER \
+    "SELECT " UPCOMING_COLUMNS " FROM " UPCOMING_TABLES " "\
+    "WHERE u.urgency IS NOT NULL AND " UNDER_CATEGORY ("u.item_id", "2") " "\
+    "ORDER BY u.urgency DESC, u.date LIMIT ?1"
+
+/* Items due by ?1 (a day number) under each category with items, counted
+ * in one pass over the closure of the categories. Sorted in tree order, a
+ * '/' sorting before anything else puts a category right above the ones
+ * under it */
+#define CATEGORY_DUE_COUNTS \
+    "SELECT c.id, c.name, " PATH_DEPTH ("c.name") ", COUNT(u.item_id) "\
+    "FROM categories c JOIN category_tree t ON t.ancestor = c.id "\
+    "JOIN attributes a ON a.category_id = t.descendant "\
+    "LEFT JOIN upcoming u ON u.item_id = a.id "\
+    "    AND u.date <= DATE(?1 + " JULIAN_DAY_0 ") "\
+    "GROUP BY c.id ORDER BY replace (c.name, '/', char (1))"
+
+/* Brings the urgency of items due by ?1 (a day number) up to that day */
+#define REFRESH_URGENCY \
+    "UPDATE upcoming SET urgency = urgency(date, DATE(?1 + " JULIAN_DAY_0 "), "\
+    "    (SELECT a.freq FROM attributes a WHERE a.id = upcoming.item_id), "\
+    "    (SELECT a.freq_type FROM attributes a WHERE a.id = upcoming.item_id)) "\
+    "WHERE date <= DATE(?1 + " JULIAN_DAY_0 ")"
+
+/* Keep the urgency of rows written through this connection up to date.
+ * TEMP, so the db itself never calls urgency (see version 10 in schema.c)
+ * and other programs can write upcoming without it */
+static const char *urgency_triggers[] = {
+    "CREATE TEMP TRIGGER IF NOT EXISTS upcoming_urgency_insert "\
+    "AFTER INSERT ON main.upcoming BEGIN "\
+    "    UPDATE upcoming SET urgency = urgency(new.date, "\
+    "        DATE('now', 'localtime'), "\
+    "        (SELECT a.freq FROM attributes a WHERE a.id = new.item_id), "\
+    "        (SELECT a.freq_type FROM attributes a WHERE a.id = new.item_id)) "\
+    "        WHERE rowid = new.rowid; "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS upcoming_urgency_update "\
+    "AFTER UPDATE OF date, item_id ON main.upcoming BEGIN "\
+    "    UPDATE upcoming SET urgency = urgency(new.date, "\
+    "        DATE('now', 'localtime'), "\
+    "        (SELECT a.freq FROM attributes a WHERE a.id = new.item_id), "\
+    "        (SELECT a.freq_type FROM attributes a WHERE a.id = new.item_id)) "\
+    "        WHERE rowid = new.rowid; "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS upcoming_urgency_interval "\
+    "AFTER UPDATE OF freq, freq_type ON main.attributes BEGIN "\
+    "    UPDATE upcoming SET urgency = urgency(date, "\
+    "        DATE('now', 'localtime'), new.freq, new.freq_type) "\
+    "        WHERE item_id = new.id; "\
+    "END"
+};
+
+/* Statements prepared once and kept for the life of the connection. Views
+ * only bind day numbers (or an item id) to them, see take_cached_stmt */
+enum {
+    STMT_UPCOMING_RANGE,
+    STMT_HIST_PAGE_BY_ITEM,
+    STMT_HIST_PAGE_BY_RANGE,
+    STMT_URGENT_ITEMS,
+    STMT_UPCOMING_RANGE_UNDER,
+    STMT_HIST_PAGE_BY_RANGE_UNDER,
+    STMT_URGENT_ITEMS_UNDER,
+    STMT_HIST_PAGE_BY_ITEM_ARCHIVED,
+    STMT_HIST_PAGE_BY_RANGE_ARCHIVED,
+    STMT_HIST_PAGE_BY_RANGE_UNDER_ARCHIVED,
+    NUM_CACHED_STMTS
+};
+
+static const char *cached_sql[NUM_CACHED_STMTS] = {
+    UPCOMING_RANGE,
+    HIST_PAGE_BY_ITEM,
+    HIST_PAGE_BY_RANGE,
+    URGENT_ITEMS,
+    UPCOMING_RANGE_UNDER,
+    HIST_PAGE_BY_RANGE_UNDER,
+    URGENT_ITEMS_UNDER,
+    HIST_PAGE_BY_ITEM_ARCHIVED,
+    HIST_PAGE_BY_RANGE_ARCHIVED,
+    HIST_PAGE_BY_RANGE_UNDER_ARCHIVED
+};
+
+/* Set based recomputation of due dates from the latest completion, the
+ * FROM clause of the subquery selecting which items to update goes between
+ * RECOMPUTE_DUE_DATES_OF and RECOMPUTE_DUE_DATES_WHERE. next_due is
+ * registered by register_sql_funcs (sql_funcs.c) */
+#define RECOMPUTE_DUE_DATES_OF \
+    "UPDATE upcoming SET date = (SELECT "\
+    "    next_due(s.last_date, a.freq, a.freq_type) "\
+    "    FROM item_stats s JOIN attributes a ON a.id = s.item_id "\
+    "    WHERE s.item_id = upcoming.item_id) "\
+    "WHERE item_id IN (SELECT s.item_id FROM "
+
+#define RECOMPUTE_DUE_DATES_WHERE \
+    "WHERE s.last_date IS NOT NULL AND a.track_history = 1 "\
+    "AND a.freq_type <> 'no_repeat')"
+
+/* A db opened by routine_db_open and everything kept for its connection.
+ * Nothing in here is shared with another RoutineDb, so several can be open
+ * at once, each used by one thread at a time (the in memory indexes are
+ * kept current by triggers firing on conn) */
+struct routine_db {
+    sqlite3 *conn;
+    char *path;         /* the db, as config_open takes it */
+    char *archive_path; /* attached as "archive", see archive.c */
+
+    /* statements kept prepared, see take_cached_stmt */
+    sqlite3_stmt *cached_stmts[NUM_CACHED_STMTS];
+    int cached_in_use[NUM_CACHED_STMTS];
+
+    Query_cache *query_cache;
+    Due_index *due_index;
+    Tag_index *tag_index;
+    Maintenance *maintenance;
+
+    /* day of the newest completion in the archive, 0 if it is empty. A
+     * range starting after it is all in history */
+    int archive_end_day;
+    int archive_attached;   /* 1 once the archive is attached to conn */
+
+    /* day refresh_urgency last brought urgencies up to, 0 for never */
+    int urgency_day;
+
+    /* connections of closed View_dbs kept for the next ones, and the
+     * View_dbs still open, see open_view_db. Used from any thread */
+    GMutex readers_lock;
+    GCond readers_idle;
+    sqlite3 *idle_readers[MAX_IDLE_READERS];
+    int n_idle_readers;
+    int readers_out;
+};
 
 /* prototypes */
 
 /* open close and access db */
-int init_db ();
-int close_db ();
-sqlite3 *access_db (); 
+int routine_db_open (const char *path, RoutineDb **rdb);
+RoutineDb *routine_db_open_readonly (const char *path);
+static RoutineDb *new_routine_db (const char *path);
+void routine_db_start_upkeep (RoutineDb *rdb);
+int routine_db_close (RoutineDb *rdb);
+sqlite3 *routine_db_conn (RoutineDb *rdb);
+Query_cache *routine_db_query_cache (RoutineDb *rdb);
+Tag_index *routine_db_tag_index (RoutineDb *rdb);
+sqlite3 *open_reader_db (RoutineDb *rdb);
+int db_write_generation (RoutineDb *rdb);
+static void drop_indexes (void *rdb);
+
+/* cancellable connections for loading views */
+View_db *open_view_db (RoutineDb *rdb, GCancellable *cancellable);
+void close_view_db (View_db *vdb);
+static int view_query_cancelled (void *cancellable);
+static void interrupt_view_db (GCancellable *cancellable, sqlite3 *conn);
+static sqlite3 *take_idle_reader (RoutineDb *rdb);
+static void give_back_reader (RoutineDb *rdb, sqlite3 *conn);
+
+/* statements kept prepared between reloads */
+static sqlite3_stmt *take_cached_stmt (RoutineDb *rdb, int which);
+static void give_back_stmt (RoutineDb *rdb, sqlite3_stmt *stmt);
+static void finalize_cached_stmts (RoutineDb *rdb);
 
 /* Grab one attribute */
-char *get_last_completion(char *description); /* ALLOCATES MEMORY NEEDS TO BE FREED BY CALLER */
-int get_tracking_from_db (char *description);
+int get_item_id (RoutineDb *rdb, const char *description);
+int get_last_completion (RoutineDb *rdb, int item_id);
+int get_tracking_from_db (RoutineDb *rdb, int item_id);
+int get_item_stats (RoutineDb *rdb, int item_id, Item_stats *stats);
 
 /* utilities */
 int count_rows_of_res(sqlite3 *db, sqlite3_stmt *res);
-int count_rows_from_query (char *query);
-int desc_already_in_use (const gchar *desc);
-char *make_sql_date_modifier(int freq, const char* freq_type); /* ALLOCATES MEMORY NEEDS TO BE FREED BY CALLER */
+int count_rows_from_query (RoutineDb *rdb, char *query);
+int desc_already_in_use (RoutineDb *rdb, const gchar *desc);
 void log_db_error (int rc);
 
-int add_history(char *desc, char *sql_date_str, char *category);
-int update_due_date (char *description, char *sql_date);
-int push_back_upcoming (const char *desc, char *sql_date_str);
-
-int add_attributes(const char* desc, const char* category, int freq, const gchar* freq_type, const gchar* track_history);
-
-int add_upcoming(const char *desc, char *sql_date_str, const char *category);
-
-int load_rest_of_attributes_raw_from_desc (Attributes_raw *attributes);
-
-int change_category (char *description, char *new_category);
-int change_db_due_date (char *description, char *sql_date, char *category);
-int change_frequency (char *description, int freq, const char *freq_type);
-int change_hist_date (gchar* description, 
-                       gchar* completion_date, 
-                       char *new_date);
-
-int remove_entry_from_history (gchar* description, gchar* completion_date);
-int remove_from_upcoming (char *description);
-int purge_permanently (char *description);
+int add_history (RoutineDb *rdb, int item_id, int day);
+int update_due_date (RoutineDb *rdb, int item_id, int day);
+int push_back_upcoming (RoutineDb *rdb, int item_id, int day);
+int recompute_dirty_due_dates (RoutineDb *rdb);
+int rebuild_due_dates (RoutineDb *rdb);
+int refresh_urgency (RoutineDb *rdb);
+static int create_urgency_triggers (sqlite3 *db);
+static int run_due_date_recompute (RoutineDb *rdb, const char *query);
+
+int add_attributes(RoutineDb *rdb, const char* desc, const char* category,
+                   int freq, const gchar* freq_type,
+                   const gchar* track_history);
+
+int add_upcoming(RoutineDb *rdb, const char *desc, char *sql_date_str);
+
+int load_rest_of_attributes_raw_from_desc (RoutineDb *rdb,
+                                           Attributes_raw *attributes);
+
+int get_category_id (RoutineDb *rdb, const char *name);
+int change_category (RoutineDb *rdb, char *description, char *new_category);
+int rename_category (RoutineDb *rdb, const char *name, const char *new_name);
+static int run_category_edit (RoutineDb *rdb, const char *query,
+                              const char *name, const char *new_name,
+                              int *changed);
+static int path_is_under (const char *path, const char *above);
+char *get_item_tags (RoutineDb *rdb, int item_id);
+int set_item_tags (RoutineDb *rdb, int item_id, const char *tags);
+static int run_tag_edit (RoutineDb *rdb, const char *query, int item_id,
+                         const char *name);
+int change_db_due_date (RoutineDb *rdb, char *description, char *sql_date);
+int change_frequency (RoutineDb *rdb, char *description, int freq,
+                      const char *freq_type);
+int change_hist_date (RoutineDb *rdb, int entry_id, int new_day);
+
+int count_by_rule (RoutineDb *rdb, const Bulk_rule *rule);
+int shift_by_rule (RoutineDb *rdb, const Bulk_rule *rule, int days);
+int change_frequency_by_rule (RoutineDb *rdb, const Bulk_rule *rule, int freq,
+                              const char *freq_type);
+int purge_by_rule (RoutineDb *rdb, const Bulk_rule *rule);
+static int bind_bulk_rule (sqlite3_stmt *res, const Bulk_rule *rule);
+static int run_bulk_edit (RoutineDb *rdb, sqlite3_stmt *res);
+
+int remove_entry_from_history (RoutineDb *rdb, int entry_id);
+static int unarchive_entry (RoutineDb *rdb, int entry_id);
+int remove_from_upcoming (RoutineDb *rdb, char *description);
+int purge_permanently (RoutineDb *rdb, char *description);
+int purge_items (RoutineDb *rdb, const int *item_ids, int count);
+static void reclaim_space (RoutineDb *rdb);
 
 
 /* Walks GtkListStore and acts on selected */
-void complete_selected_items (GtkWidget *button, GtkListStore *store);
-void snooze_selected_items (GtkWidget *button, GtkListStore *store);
-void change_hist_on_selected (GtkWidget *button, GtkListStore *store);
-void remove_selected_historical_entries (GtkWidget *button, GtkListStore *store);
+void complete_selected_items (RoutineDb *rdb, GtkWidget *button,
+                              GtkListStore *store);
+void snooze_selected_items (RoutineDb *rdb, GtkWidget *button,
+                            GtkListStore *store);
+void change_hist_on_selected (RoutineDb *rdb, GtkWidget *button,
+                              GtkListStore *store);
+void remove_selected_historical_entries (RoutineDb *rdb, GtkWidget *button,
+                                         GtkListStore *store);
 
 /* Gtk models loaded from db */
-GtkTreeModel * create_main_model_from_db (char *query);
-GtkTreeModel *create_completion_model_from_db (char* query);
+GtkTreeModel * create_main_model_from_db (RoutineDb *rdb, char *query);
+GtkTreeModel *create_main_model_from_pager (HistPager *pager);
+GtkTreeModel *create_upcoming_model_for_range (RoutineDb *rdb, int start_day,
+                                               int end_day);
+GtkTreeModel *create_upcoming_model_on (sqlite3 *conn, int start_day,
+                                        int end_day, int category_id,
+                                        const Tag_set *tags);
+GtkTreeModel *create_upcoming_model_indexed (RoutineDb *rdb, int start_day,
+                                             int end_day, const Tag_set *tags);
+GtkTreeModel *create_urgent_model (RoutineDb *rdb, int limit);
+GtkTreeModel *create_urgent_model_head (RoutineDb *rdb, int head_rows,
+                                        int category_id, const Tag_set *tags,
+                                        UpcomingCursor **rest);
+int upcoming_cursor_load (UpcomingCursor *cursor, GtkListStore *store,
+                          int limit);
+void upcoming_cursor_free (UpcomingCursor *cursor);
+GtkTreeModel *create_hist_range_model_on (RoutineDb *rdb, sqlite3 *conn,
+                                          int start_day, int end_day,
+                                          int category_id, const Tag_set *tags,
+                                          char *last_date, int *last_id,
+                                          int *done);
+GtkTreeModel *create_upcoming_model_by_date_on (sqlite3 *conn, int start_day,
+                                                int end_day);
+GtkTreeModel *create_hist_range_model_all_on (RoutineDb *rdb, sqlite3 *conn,
+                                              int start_day, int end_day);
+static sqlite3_stmt *prepare_hist_range_on (RoutineDb *rdb, sqlite3 *conn,
+                                            int start_day, int end_day,
+                                            int category_id);
+GtkTreeModel *create_category_counts_model (RoutineDb *rdb);
+GtkTreeModel *create_completion_model_from_db (RoutineDb *rdb, char* query);
+
+/* helpers for the Gtk models */
+GtkListStore *new_main_store (void);
+int set_main_row (GtkListStore *store, GtkTreeIter *iter,
+                  const char *description, const char *category, int day,
+                  int item_id, int entry_id, const char *today_str, int today);
+static GtkListStore *load_upcoming_range (sqlite3_stmt *res, int start_day,
+                                          int end_day, int category_id,
+                                          const Tag_set *tags);
+static int append_main_rows (GtkListStore *store, sqlite3_stmt *res, int limit,
+                             const Tag_set *tags, char *last_date,
+                             int *last_id);
+static int append_due_rows (RoutineDb *rdb, GtkListStore *store,
+                            const Due_entry *first, int count,
+                            const Tag_set *tags);
+
+/* history pagers */
+HistPager *hist_pager_new_for_item (RoutineDb *rdb, int item_id);
+HistPager *hist_pager_new_for_range (RoutineDb *rdb, int start_day, int end_day,
+                                     int category_id, const Tag_set *tags);
+HistPager *hist_pager_new_for_range_from (RoutineDb *rdb, int start_day,
+                                          int end_day, int category_id,
+                                          const Tag_set *tags,
+                                          const char *last_date, int last_id,
+                                          int done);
+int hist_pager_load_page (HistPager *pager, GtkListStore *store);
+void hist_pager_attach (GtkWidget *sw, HistPager *pager);
+void hist_pager_free (HistPager *pager);
+static HistPager *hist_pager_new (RoutineDb *rdb, int which,
+                                  const char *first_date);
+static int hist_range_stmt (RoutineDb *rdb, int start_day, int category_id);
+static int load_hist_pages (sqlite3_stmt *res, GtkListStore *store,
+                            const Tag_set *tags, char *last_date,
+                            int *last_id, int *done);
+static void load_next_hist_page (GtkScrolledWindow *sw, GtkPositionType pos,
+                                 HistPager *pager);
 
 /* end of prototypes */
 
 
 
 /* 
- * FUNC init_db
- *   Opens the db connection
- * Returns the sqlite3 status code of the operation
+ * FUNC routine_db_open
+ *   Opens the db at path (the database of the config if NULL), brings the
+ * schema up to date and sets up what is kept for the connection: the
+ * archive, the cache of ranges and the in memory indexes
+ * Returns the sqlite3 status code of the operation. *rdb is set even on
+ * error, close it with routine_db_close
+ * Can run on a worker thread (see open_db_in_thread in init.c), as long as
+ * nothing else uses *rdb until it is handed over
+ * NOTE: USES MALLOC
  */
-int init_db ()
+int routine_db_open (const char *path, RoutineDb **rdb)
 {
-    int rc = sqlite3_open_v2(DATABASE, &db, SQLITE_OPEN_READWRITE, NULL);
+    RoutineDb *new_rdb = new_routine_db (path);
+    *rdb = new_rdb;
+
+    /* how SQLite is tuned, see config.c */
+    int rc = config_open (new_rdb->path, &new_rdb->conn,
+                          SQLITE_OPEN_READWRITE);
     if (rc != SQLITE_OK) {
         log_db_error(rc);
+        return rc;
     }
-    return rc;
+
+    sqlite3 *db = new_rdb->conn;
+
+    sqlite3_busy_timeout (db, BUSY_TIMEOUT_MS);
+
+    /* next_due and friends, used by queries below and in migrations */
+    rc = register_sql_funcs (db);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return rc;
+    }
+
+    /* databases made by older versions of create_db get upgraded here */
+    rc = migrate_db (db);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    /* urgency of what this connection writes, see refresh_urgency */
+    rc = create_urgency_triggers (db);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return rc;
+    }
+
+    /* completions past history_hot_days go to the archive, see archive.c.
+     * The upkeep moves them (see routine_db_start_upkeep), without it history
+     * just keeps growing */
+    if (archive_attach (db, new_rdb->archive_path,
+                        &new_rdb->archive_end_day) == SQLITE_OK)
+        new_rdb->archive_attached = 1;
+    else
+        fprintf (stderr, DATABASE_ARCHIVE_FAIL);
+
+    /* catch up on due dates left queued if the program was interrupted */
+    if (recompute_dirty_due_dates (new_rdb) < 0)
+        return SQLITE_ERROR;
+
+    /* the main view ranks items due by urgency as of today */
+    if (refresh_urgency (new_rdb) < 0)
+        return SQLITE_ERROR;
+
+    /* results of range queries are cached, see query_cache.c */
+    rc = query_cache_init (db, &new_rdb->query_cache);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return rc;
+    }
+
+    /* upcoming by date is answered from memory, see due_index.c */
+    rc = due_index_init (db, &new_rdb->due_index);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return rc;
+    }
+
+    /* and so are tag filters, see tag_index.c */
+    rc = tag_index_init (db, &new_rdb->tag_index);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return rc;
+    }
+
+    sqlite3_rollback_hook (db, drop_indexes, new_rdb);
+
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC routine_db_open_readonly
+ *   Sets up a RoutineDb for the db at path that is only ever read through
+ * View_dbs (see open_view_db), ie: the db of another site, kept up to date
+ * by the copy of the program running there. Nothing is opened or read here:
+ * there is no main connection, cache, index or upkeep, and the schema is
+ * left as it is (see schema_is_current). If there is an archive next to
+ * path the readers attach it and read it for every range, its end day is
+ * not known.
+ * NOTE: USES MALLOC, CLOSE WITH routine_db_close
+ */
+RoutineDb *routine_db_open_readonly (const char *path)
+{
+    RoutineDb *new_rdb = new_routine_db (path);
+
+    if (g_file_test (new_rdb->archive_path, G_FILE_TEST_EXISTS)) {
+        new_rdb->archive_attached = 1;
+        new_rdb->archive_end_day = G_MAXINT;
+    }
+
+    return new_rdb;
+}
+
+/*
+ * FUNC new_routine_db
+ *   Helper function to routine_db_open and routine_db_open_readonly
+ * Returns a RoutineDb for path (the database of the config if NULL) with
+ * nothing opened yet
+ * NOTE: USES MALLOC
+ */
+static RoutineDb *new_routine_db (const char *path)
+{
+    RoutineDb *new_rdb = calloc (1, sizeof (RoutineDb));
+    if (new_rdb == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 12\n");
+        exit (EXIT_FAILURE);
+    }
+
+    g_mutex_init (&new_rdb->readers_lock);
+    g_cond_init (&new_rdb->readers_idle);
+
+    new_rdb->path = g_strdup ((path != NULL) ? path : config_get ()->database);
+    new_rdb->archive_path = config_archive_path (new_rdb->path);
+
+    return new_rdb;
+}
+
+/*
+ * FUNC routine_db_start_upkeep
+ *   Has the statistics and free pages of rdb seen to when the program is
+ * idle, and old completions moved to the archive (see maintenance.c). The
+ * steps run on the thread of the default main context, so only for a
+ * RoutineDb used on the main thread.
+ */
+void routine_db_start_upkeep (RoutineDb *rdb)
+{
+    if (rdb->maintenance == NULL)
+        rdb->maintenance = maintenance_start (rdb->conn, BUSY_TIMEOUT_MS,
+                                              rdb->archive_attached ?
+                                              &rdb->archive_end_day : NULL);
 }
 
 /* 
- * FUNC close_db
- *   Closes the db connection
+ * FUNC routine_db_close
+ *   Closes the connection of rdb and frees it along with everything kept
+ * for it, once the View_dbs open on it are closed. A NULL rdb is ignored.
  * Returns the sqlite3 status code of the operation
  */
-int close_db ()
+int routine_db_close (RoutineDb *rdb)
 {
-    int rc = sqlite3_close(db);
+    int rc;
+
+    if (rdb == NULL)
+        return SQLITE_OK;
+
+    /* a view still loading on another thread gives its connection back */
+    g_mutex_lock (&rdb->readers_lock);
+    while (rdb->readers_out > 0)
+        g_cond_wait (&rdb->readers_idle, &rdb->readers_lock);
+    g_mutex_unlock (&rdb->readers_lock);
+
+    maintenance_stop (rdb->maintenance);
+    if (rdb->conn != NULL)
+        sqlite3_rollback_hook (rdb->conn, NULL, NULL);
+    tag_index_close (rdb->tag_index);
+    due_index_close (rdb->due_index);
+    query_cache_close (rdb->query_cache);
+    finalize_cached_stmts (rdb);
+
+    for (int i = 0; i < rdb->n_idle_readers; i++)
+        sqlite3_close (rdb->idle_readers[i]);
+    g_mutex_clear (&rdb->readers_lock);
+    g_cond_clear (&rdb->readers_idle);
+
+    rc = sqlite3_close (rdb->conn);
     if (rc != SQLITE_OK) {
         log_db_error(rc);
     }
+
+    g_free (rdb->path);
+    g_free (rdb->archive_path);
+    free (rdb);
+
     return rc;
 }
 
 /* 
- * FUNC access_db
- *   Provides access to database
- * Defunct, not currently in use
+ * FUNC routine_db_conn
+ *   The connection of rdb, for the functions of other files taking one (see
+ * create_attributes_model). Only the thread using rdb may use it.
  */
-sqlite3 *access_db ()
+sqlite3 *routine_db_conn (RoutineDb *rdb)
 {
-    return db;
+    return rdb->conn;
 }
 
 /* 
- * FUNC make_sql_date_modifier
- *   Helper function to update_due_date
- * Converts int freq and const char *freq_type to something like: "+3 days" 
- * Returns NULL if memory allocation fails
- *
- * ALLOCATES MEMORY NEEDS TO BE FREED BY CALLER
+ * FUNC routine_db_query_cache
+ *   The cache of ranges kept for rdb, see query_cache.c
+ */
+Query_cache *routine_db_query_cache (RoutineDb *rdb)
+{
+    return rdb->query_cache;
+}
+
+/* 
+ * FUNC routine_db_tag_index
+ *   The tag index kept for rdb, see tag_index.c
+ */
+Tag_index *routine_db_tag_index (RoutineDb *rdb)
+{
+    return rdb->tag_index;
+}
+
+/*
+ * FUNC open_reader_db
+ *   Opens a second, read only connection to the db of rdb for use on
+ * another thread (see prefetch.c). Close it with sqlite3_close.
+ * Returns NULL on error
  */
-char * make_sql_date_modifier(int freq, const char* freq_type)
+sqlite3 *open_reader_db (RoutineDb *rdb)
 {
-    /* calculate number of days if using "weeks" as freq_type */
-    int actual_freq;
-    const char *actual_type;
-    if (strcmp (freq_type, "weeks") == 0) {
-        actual_freq = 7 * freq;
-        actual_type = "days";
+    sqlite3 *conn;
+    int rc = config_open (rdb->path, &conn, SQLITE_OPEN_READONLY);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_close (conn);
+        return NULL;
     }
-    else {
-        actual_freq = freq;
-        actual_type = freq_type;
+
+    sqlite3_busy_timeout (conn, BUSY_TIMEOUT_MS);
+
+    rc = register_sql_funcs (conn);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_close (conn);
+        return NULL;
+    }
+
+    /* the look back reads it once ranges reach that far */
+    if (rdb->archive_attached &&
+        archive_attach_reader (conn, rdb->archive_path) != SQLITE_OK) {
+        sqlite3_close (conn);
+        return NULL;
     }
 
-    int num_digits = 0;
-    int k = actual_freq;
-    while (k != 0) {
-        k /= 10;
-        num_digits++;
+    return conn;
+}
+
+/*
+ * FUNC db_write_generation
+ *   Number of rows inserted, updated or deleted through the connection of
+ * rdb so far. Anything read before it last moved may be out of date.
+ */
+int db_write_generation (RoutineDb *rdb)
+{
+    return sqlite3_total_changes (rdb->conn);
+}
+
+/*
+ * FUNC drop_indexes
+ *   Rollback hook of the connection of a RoutineDb. The triggers keeping
+ * the in memory indexes current may have fired for rows that are no longer
+ * there.
+ */
+static void drop_indexes (void *rdb)
+{
+    due_index_invalidate (((RoutineDb *) rdb)->due_index);
+    tag_index_invalidate (((RoutineDb *) rdb)->tag_index);
+}
+
+/*
+ * FUNC open_view_db
+ *   Opens a connection like open_reader_db whose queries stop with
+ * SQLITE_INTERRUPT once cancellable is cancelled: a running statement is
+ * interrupted right away, and a progress handler catches anything stepped
+ * after. Meant for loading a view on a worker thread, so that leaving the
+ * view never waits on its queries.
+ * The connection is one a closed View_db left with rdb if there is one,
+ * see take_idle_reader, so loading a view seldom opens a connection. Several
+ * View_dbs read at the same time (in WAL mode the writer carries on too).
+ *
+ * Returns NULL on error
+ * NOTE: USES MALLOC, CLOSE WITH close_view_db
+ */
+View_db *open_view_db (RoutineDb *rdb, GCancellable *cancellable)
+{
+    View_db *vdb = malloc (sizeof (View_db));
+    if (vdb == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 7\n");
+        exit (EXIT_FAILURE);
     }
-    /* the 3 extra bytes are for ' ', '+' and '\0' in the parameter */
-    int num_bytes = 3 + strlen(actual_type) + num_digits;
-    char *interval = malloc (sizeof(char) * num_bytes);
-    if (interval != NULL) {
-        sprintf(interval, "+%d %s", actual_freq, actual_type);
-        return interval;
+
+    vdb->conn = take_idle_reader (rdb);
+    if (vdb->conn == NULL)
+        vdb->conn = open_reader_db (rdb);
+    if (vdb->conn == NULL) {
+        free (vdb);
+        return NULL;
     }
+
+    g_mutex_lock (&rdb->readers_lock);
+    rdb->readers_out++;
+    g_mutex_unlock (&rdb->readers_lock);
+
+    vdb->rdb = rdb;
+    vdb->cancellable = g_object_ref (cancellable);
+    sqlite3_progress_handler (vdb->conn, CANCEL_CHECK_STEPS,
+                              view_query_cancelled, cancellable);
+    /* 0 if already cancelled, the progress handler takes care of that */
+    vdb->handler_id = g_cancellable_connect (cancellable,
+                                             G_CALLBACK (interrupt_view_db),
+                                             vdb->conn, NULL);
+
+    return vdb;
+}
+
+/*
+ * FUNC close_view_db
+ *   Disconnects vdb from its cancellable (waiting out an interrupt_view_db
+ * that is running) and closes it, its connection goes back to the db of
+ * vdb (see give_back_reader)
+ */
+void close_view_db (View_db *vdb)
+{
+    RoutineDb *rdb;
+
+    if (vdb == NULL)
+        return;
+
+    rdb = vdb->rdb;
+
+    g_cancellable_disconnect (vdb->cancellable, vdb->handler_id);
+    sqlite3_progress_handler (vdb->conn, 0, NULL, NULL);
+
+    /* an interrupted connection is not worth keeping */
+    if (g_cancellable_is_cancelled (vdb->cancellable))
+        sqlite3_close (vdb->conn);
     else
+        give_back_reader (rdb, vdb->conn);
+
+    g_object_unref (vdb->cancellable);
+    free (vdb);
+
+    g_mutex_lock (&rdb->readers_lock);
+    rdb->readers_out--;
+    g_cond_broadcast (&rdb->readers_idle);
+    g_mutex_unlock (&rdb->readers_lock);
+}
+
+/*
+ * FUNC take_idle_reader
+ *   Helper function to open_view_db
+ * Returns a connection a closed View_db left with rdb, NULL if there is none
+ */
+static sqlite3 *take_idle_reader (RoutineDb *rdb)
+{
+    sqlite3 *conn = NULL;
+
+    g_mutex_lock (&rdb->readers_lock);
+    if (rdb->n_idle_readers > 0)
+        conn = rdb->idle_readers[--rdb->n_idle_readers];
+    g_mutex_unlock (&rdb->readers_lock);
+
+    return conn;
+}
+
+/*
+ * FUNC give_back_reader
+ *   Helper function to close_view_db
+ * Keeps conn for the next View_db of rdb, or closes it if MAX_IDLE_READERS
+ * are kept already or it was left with a statement or transaction open
+ */
+static void give_back_reader (RoutineDb *rdb, sqlite3 *conn)
+{
+    if (sqlite3_next_stmt (conn, NULL) == NULL &&
+        sqlite3_get_autocommit (conn)) {
+        g_mutex_lock (&rdb->readers_lock);
+        if (rdb->n_idle_readers < MAX_IDLE_READERS) {
+            rdb->idle_readers[rdb->n_idle_readers++] = conn;
+            conn = NULL;
+        }
+        g_mutex_unlock (&rdb->readers_lock);
+    }
+
+    if (conn != NULL)
+        sqlite3_close (conn);
+}
+
+/*
+ * FUNC view_query_cancelled
+ *   Progress handler of a View_db, a non zero return stops the statement
+ */
+static int view_query_cancelled (void *cancellable)
+{
+    return g_cancellable_is_cancelled (cancellable);
+}
+
+/*
+ * FUNC interrupt_view_db
+ *   Called (on the thread that cancels) when the cancellable of a View_db is
+ * cancelled. sqlite3_interrupt is safe to call from any thread.
+ */
+static void interrupt_view_db (GCancellable *cancellable, sqlite3 *conn)
+{
+    sqlite3_interrupt (conn);
+}
+
+/*
+ * FUNC take_cached_stmt
+ *   Hands out the statement for which (see the enum of cached statements),
+ * preparing it on first use. Callers bind, step and hand it back with
+ * give_back_stmt instead of finalizing it, so it is not compiled again the
+ * next time the view reloads.
+ * If the cached statement is already out (e.g. two pagers over the same query)
+ * a fresh one is prepared, give_back_stmt finalizes that one.
+ *
+ * Returns NULL on error
+ */
+static sqlite3_stmt *take_cached_stmt (RoutineDb *rdb, int which)
+{
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *stmt;
+    int rc;
+
+    if (rdb->cached_stmts[which] != NULL && !rdb->cached_in_use[which]) {
+        rdb->cached_in_use[which] = 1;
+        return rdb->cached_stmts[which];
+    }
+
+    rc = sqlite3_prepare_v3 (db, cached_sql[which], -1,
+                             SQLITE_PREPARE_PERSISTENT, &stmt, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
         return NULL;
+    }
+
+    if (rdb->cached_stmts[which] == NULL) {
+        rdb->cached_stmts[which] = stmt;
+        rdb->cached_in_use[which] = 1;
+    }
+
+    return stmt;
+}
+
+/*
+ * FUNC give_back_stmt
+ *   Returns a statement from take_cached_stmt. Cached statements are reset and
+ * their bindings cleared, any other statement is finalized.
+ */
+static void give_back_stmt (RoutineDb *rdb, sqlite3_stmt *stmt)
+{
+    int i;
+
+    if (stmt == NULL)
+        return;
+
+    for (i = 0; i < NUM_CACHED_STMTS; i++) {
+        if (rdb->cached_stmts[i] == stmt) {
+            sqlite3_reset (stmt);
+            sqlite3_clear_bindings (stmt);
+            rdb->cached_in_use[i] = 0;
+            return;
+        }
+    }
+
+    sqlite3_finalize (stmt);
+}
+
+/*
+ * FUNC finalize_cached_stmts
+ *   Finalizes the cached statements that are not handed out, called before
+ * the connection is closed
+ */
+static void finalize_cached_stmts (RoutineDb *rdb)
+{
+    int i;
+
+    for (i = 0; i < NUM_CACHED_STMTS; i++) {
+        if (rdb->cached_stmts[i] != NULL && !rdb->cached_in_use[i]) {
+            sqlite3_finalize (rdb->cached_stmts[i]);
+            rdb->cached_stmts[i] = NULL;
+        }
+    }
 }
 
 /* 
@@ -155,8 +943,9 @@ char * make_sql_date_modifier(int freq, const char* freq_type)
  *   Check if description is already in use
  * Returns 1 if it is, 0 if not, -1 if there was a db error
  */
-int desc_already_in_use (const gchar *desc)
+int desc_already_in_use (RoutineDb *rdb, const gchar *desc)
 {
+    sqlite3 *db = rdb->conn;
     int rc;
     sqlite3_stmt *res;
 
@@ -194,12 +983,18 @@ int desc_already_in_use (const gchar *desc)
  *   Adds attributes of item to db
  * Returns 1 on success and -1 on error
  */
-int add_attributes(const char* desc, const char* category, int freq, const gchar* freq_type, const gchar* track_history)
+int add_attributes(RoutineDb *rdb, const char* desc, const char* category,
+                   int freq, const gchar* freq_type, const gchar* track_history)
 {
+    sqlite3 *db = rdb->conn;
     sqlite3_stmt *res;
     int rc;
-    char* query = "INSERT INTO ATTRIBUTES VALUES "\
-                  "( ?, ?, ?, ?, ? )";
+    char* query = "INSERT INTO attributes (description, category_id, freq, "\
+                  "freq_type, track_history) VALUES ( ?, ?, ?, ?, ? )";
+
+    int category_id = get_category_id (rdb, category);
+    if (category_id < 0)
+        return -1;
                    
     rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
     if (rc != SQLITE_OK) {
@@ -210,7 +1005,7 @@ int add_attributes(const char* desc, const char* category, int freq, const gchar
     int track = ( strcmp(track_history,"y") == 0 ) ? 1 : 0;
 
     sqlite3_bind_text(res, 1, desc, strlen(desc), SQLITE_STATIC);
-    sqlite3_bind_text(res, 2, category, strlen(category), SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, category_id);
     sqlite3_bind_int(res, 3, freq);
     sqlite3_bind_text(res, 4, freq_type, strlen(freq_type), SQLITE_STATIC);
     sqlite3_bind_int(res, 5, track);
@@ -230,16 +1025,18 @@ int add_attributes(const char* desc, const char* category, int freq, const gchar
 
 /*
  * FUNC add_history
- *   Adds completion history for item matching desc to the db
+ *   Adds a completion on day for the item matching item_id to the db
  * Returns 1 upon success and -1 upon error
  */
-int add_history(char *desc, char *sql_date_str, char *category)
+int add_history (RoutineDb *rdb, int item_id, int day)
 {
+    sqlite3 *db = rdb->conn;
     sqlite3_stmt *res;
     int rc;
 
-    char* query = "INSERT INTO HISTORY VALUES "\
-                   "( ? , ?, ? )";
+    char* query = "INSERT INTO history (description, date, item_id) "\
+                  "SELECT description, DATE(? + " JULIAN_DAY_0 "), id "\
+                  "FROM attributes WHERE id = ?";
 
     rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
 
@@ -248,14 +1045,14 @@ int add_history(char *desc, char *sql_date_str, char *category)
         return -1;
     }
 
-    sqlite3_bind_text(res, 1, desc, strlen(desc), SQLITE_STATIC);
-    sqlite3_bind_text(res, 2, sql_date_str, strlen(sql_date_str), SQLITE_STATIC);
-    sqlite3_bind_text(res, 3, category, strlen(category), SQLITE_STATIC);
+    sqlite3_bind_int(res, 1, day);
+    sqlite3_bind_int(res, 2, item_id);
 
     rc = sqlite3_step(res);
     
     if (rc != SQLITE_DONE) {
         log_db_error(rc);
+        sqlite3_finalize(res);
         return -1;
     }
 
@@ -266,14 +1063,16 @@ int add_history(char *desc, char *sql_date_str, char *category)
 
 /*
  * FUNC push_back_upcoming
- *   Changes the upcoming due date for the item matching desc in the db
+ *   Changes the upcoming due date for the item matching item_id to day
  * Returns 1 on success, -1 on error
  */
-int push_back_upcoming (const char *desc, char *sql_date_str)
+int push_back_upcoming (RoutineDb *rdb, int item_id, int day)
 {
+    sqlite3 *db = rdb->conn;
     int rc;
     sqlite3_stmt *res;
-    char * query = "UPDATE upcoming SET date = ? where description = ?";
+    char * query = "UPDATE upcoming SET date = DATE(? + " JULIAN_DAY_0 ") "\
+                   "WHERE item_id = ?";
 
     rc = sqlite3_prepare_v2(db, query, -1, &res, NULL);
 
@@ -282,8 +1081,8 @@ int push_back_upcoming (const char *desc, char *sql_date_str)
         return -1; 
     }
 
-    sqlite3_bind_text(res, 1, sql_date_str, strlen(sql_date_str), SQLITE_STATIC);
-    rc = sqlite3_bind_text(res,2,desc,strlen(desc), SQLITE_STATIC);
+    sqlite3_bind_int(res, 1, day);
+    sqlite3_bind_int(res, 2, item_id);
 
     rc = sqlite3_step(res);
 
@@ -303,13 +1102,15 @@ int push_back_upcoming (const char *desc, char *sql_date_str)
  *   Adds entry to upcoming due dates in db
  * Returns 1 on success -1 on error
  */
-int add_upcoming(const char *desc, char *sql_date_str, const char *category)
+int add_upcoming(RoutineDb *rdb, const char *desc, char *sql_date_str)
 {
+    sqlite3 *db = rdb->conn;
     sqlite3_stmt *res;
     int rc;
 
-    char* query = "INSERT INTO UPCOMING VALUES "\
-                   "( ? , ?, ? )";
+    char* query = "INSERT INTO upcoming (description, date, item_id) "\
+                  "VALUES ( ?1, ?2, "\
+                  "(SELECT id FROM attributes WHERE description = ?1) )";
 
     rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
 
@@ -320,7 +1121,6 @@ int add_upcoming(const char *desc, char *sql_date_str, const char *category)
 
     sqlite3_bind_text(res, 1, desc, strlen(desc), SQLITE_STATIC);
     sqlite3_bind_text(res, 2, sql_date_str, strlen(sql_date_str), SQLITE_STATIC);
-    sqlite3_bind_text(res, 3, category, strlen(category), SQLITE_STATIC);
 
     rc = sqlite3_step(res);
 
@@ -335,7 +1135,6 @@ int add_upcoming(const char *desc, char *sql_date_str, const char *category)
     return 1;
 }
 
-
 /* 
  * FUNC count_rows_of_res
  *   Counts the number of rows returned by a statement query; 
@@ -373,8 +1172,9 @@ int count_rows_of_res(sqlite3 *db, sqlite3_stmt *res)
  * Uses the helper function count_rows_of_res
  * Returns -1 if there is a db error.
  */
-int count_rows_from_query (char *query)
+int count_rows_from_query (RoutineDb *rdb, char *query)
 {
+    sqlite3 *db = rdb->conn;
     int rc;
     sqlite3_stmt *res;
     rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
@@ -391,20 +1191,22 @@ int count_rows_from_query (char *query)
 /*
  * FUNC update_due_date
  *   Updates the due date in the db based on the frequency attributes
- * for the item
+ * for the item, given that it was completed on day
  *
  * Returns 1 on success and -1 on error
  */
-int update_due_date (char *description, char *sql_date)
+int update_due_date (RoutineDb *rdb, int item_id, int day)
 {
-
+    sqlite3 *db = rdb->conn;
     int rc;
     sqlite3_stmt *res;
     const char * freq_type;
     int freq;
+    int is_tracked;
  
-    /* extract freq and freq_type from db */
-    char * query = "select freq,freq_type from attributes where description = ?";
+    /* extract freq, freq_type and tracking from db */
+    char * query = "SELECT freq, freq_type, track_history FROM attributes "\
+                   "WHERE id = ?";
     rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
 
     if (rc != SQLITE_OK) {
@@ -412,7 +1214,7 @@ int update_due_date (char *description, char *sql_date)
         return -1;
     }
 
-    rc = sqlite3_bind_text(res, 1, description, strlen(description), SQLITE_TRANSIENT);
+    sqlite3_bind_int(res, 1, item_id);
 
     rc = sqlite3_step (res);
 
@@ -422,237 +1224,1641 @@ int update_due_date (char *description, char *sql_date)
         return -1;
     }
 
-    freq      = sqlite3_column_int(res, 0);
-    freq_type = sqlite3_column_text(res, 1);
+    freq       = sqlite3_column_int(res, 0);
+    freq_type  = sqlite3_column_text(res, 1);
+    is_tracked = sqlite3_column_int(res, 2);
 
+    int last_completed = get_last_completion (rdb, item_id);
 
-    int is_tracked = get_tracking_from_db (description);
-    char *last_completed = get_last_completion (description);
-
-    if (is_tracked < 0) {
-        fprintf(stderr, DATABASE_FAILED_TO_GET_TRACKING);
-        return -1;
-    }
-    if (last_completed == NULL) {
+    if (last_completed < 0) {
         fprintf(stderr, DATABASE_FAILED_TO_GET_LAST_COMPLETED);
+        sqlite3_finalize(res);
         return -1;
     }
-     
 
     /* if no repeat remove from upcoming */
     if (strcmp(freq_type, "no_repeat") == 0) {
         sqlite3_stmt *res2;
-        char * delete_query = "delete from upcoming where description = ?";
+        char * delete_query = "DELETE FROM upcoming WHERE item_id = ?";
         rc = sqlite3_prepare_v2 (db, delete_query, -1, &res2, 0);
         if (rc != SQLITE_OK) {
             log_db_error(rc);
+            sqlite3_finalize(res);
             return -1;
         }
-        sqlite3_bind_text(res2,1,description,strlen(description), SQLITE_TRANSIENT);
+        sqlite3_bind_int(res2, 1, item_id);
         rc = sqlite3_step(res2);
 
         if (rc != SQLITE_DONE) {
             log_db_error(rc);
             sqlite3_finalize(res2);
+            sqlite3_finalize(res);
             return -1;
         }
         sqlite3_finalize(res2);
     }
 
-    /* if sql_date is after last_completed OR if there is no tracking, update upcoming */
-    else if ( ((last_completed == "") || (strcmp(last_completed , sql_date) <= 0) ) ||
-           (is_tracked == 0) ) {
-
-        printf("Description: %s\n", description);
-        printf("Last completion: %s\n", last_completed);
-        printf("New date: %s\n", sql_date);
-        printf("strcmp(last_completed , sql_date) = %d\n", strcmp(last_completed , sql_date));
+    /* if day is not before last_completed OR if there is no tracking, update upcoming */
+    else if (last_completed <= day || is_tracked == 0) {
 
         sqlite3_stmt *res2;
 
-        char * update_query = "UPDATE upcoming SET date = DATE(?, ?) WHERE description = ?";
+        char * update_query = "UPDATE upcoming SET date = "\
+                              "next_due(DATE(? + " JULIAN_DAY_0 "), ?, ?) "\
+                              "WHERE item_id = ?";
         
         rc = sqlite3_prepare_v2 (db, update_query, -1, &res2, 0);
         if (rc != SQLITE_OK) {
             log_db_error(rc);
+            sqlite3_finalize(res);
             return -1;
         }
-        /* get parameters for update */
-        char *interval = make_sql_date_modifier (freq, freq_type); 
-        if (interval == NULL) {
-            fprintf (stderr, MEM_FAIL_IN "sql_db.c 1\n");
-            exit (EXIT_FAILURE);
-        }
-        sqlite3_bind_text(res2,1, sql_date, strlen(sql_date), SQLITE_TRANSIENT);
-        sqlite3_bind_text(res2,2, interval, strlen(interval), SQLITE_TRANSIENT);
-        sqlite3_bind_text(res2,3,description,strlen(description), SQLITE_TRANSIENT);
+        sqlite3_bind_int(res2, 1, day);
+        sqlite3_bind_int(res2, 2, freq);
+        sqlite3_bind_text(res2, 3, freq_type, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(res2, 4, item_id);
         rc = sqlite3_step(res2);
         if (rc != SQLITE_DONE) {
             log_db_error(rc);
             sqlite3_finalize (res2);
+            sqlite3_finalize (res);
             return -1;
         }
         sqlite3_finalize (res2);
-        free (interval);
     }
 
-
-    if (last_completed && last_completed != "")
-        free (last_completed);
-
-
     sqlite3_finalize(res);
 
     return 1;
 }
 
-/* 
- * FUNC get_tracking_from_db
- *   Gets the tracking status of the item matching description in the db
+/*
+ * FUNC refresh_urgency
+ *   Once a day, recomputes the urgency of every item due by today. Items
+ * written since were already computed by urgency_triggers, the rest need
+ * it since being overdue a day more raises it (and other programs writing
+ * the db leave it unset).
+ * Returns 1 on success, -1 on error
  */
-int get_tracking_from_db (char *description)
+int refresh_urgency (RoutineDb *rdb)
 {
-    int is_tracked;
-    int rc;
+    sqlite3 *db = rdb->conn;
     sqlite3_stmt *res;
-    char *query = "SELECT track_history FROM attributes\
-                   WHERE description = ?"; 
+    int today = get_current_day ();
+    int rc;
 
-    rc = sqlite3_prepare_v2 (db, query, -1 , &res, 0);
+    if (rdb->urgency_day == today)
+        return 1;
 
+    rc = sqlite3_prepare_v2 (db, REFRESH_URGENCY, -1, &res, 0);
     if (rc != SQLITE_OK) {
         log_db_error(rc);
         return -1;
     }
 
-    rc = sqlite3_bind_text (res, 1, description, strlen(description), 
-            SQLITE_STATIC);
+    sqlite3_bind_int (res, 1, today);
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
 
-    if (rc != SQLITE_OK) {
+    if (rc != SQLITE_DONE) {
         log_db_error(rc);
-        sqlite3_finalize(res);
         return -1;
     }
 
+    rdb->urgency_day = today;
+    return 1;
+}
 
-    rc = sqlite3_step (res);
-    
-    if (rc != SQLITE_ROW) {
-        log_db_error(rc);
-        sqlite3_finalize(res);
-        return -1;
-    }
-
-    is_tracked = sqlite3_column_int (res, 0);
+/*
+ * FUNC create_urgency_triggers
+ *   Helper function to routine_db_open
+ * Creates urgency_triggers on db, which needs the functions of
+ * register_sql_funcs
+ * Returns the sqlite3 status code of the operation
+ */
+static int create_urgency_triggers (sqlite3 *db)
+{
+    size_t i;
+    int rc;
 
-    sqlite3_finalize (res);
+    for (i = 0; i < sizeof (urgency_triggers) / sizeof (char *); i++) {
+        rc = sqlite3_exec (db, urgency_triggers[i], NULL, NULL, NULL);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
 
-    return is_tracked;
+    return SQLITE_OK;
 }
 
 /*
- * FUNC create_main_model_from_db
- *   Creates the data mode for the main view
+ * FUNC run_due_date_recompute
+ *   Helper function to recompute_dirty_due_dates and rebuild_due_dates
+ * Runs the set based update query, then empties the due_dirty queue
+ *
+ * Returns 1 on success and -1 on error
  */
-GtkTreeModel * create_main_model_from_db (char *query)
+static int run_due_date_recompute (RoutineDb *rdb, const char *query)
 {
-    int count;
-    int status_code;
-
-    const char *tail;
+    sqlite3 *db = rdb->conn;
+    int rc;
     sqlite3_stmt *res;
+    char *clear_query = "DELETE FROM due_dirty";
 
-    const char *description;
-    const char *cat;
-    char *date_db_user_frmt;
-    const char *date_db_sql_frmt;
-
-    status_code = sqlite3_prepare(db, query, -1, &res, 0);
-
-    if (status_code != SQLITE_OK) {
-        log_db_error(status_code);
-        return NULL;
+    rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
     }
 
-    count = count_rows_of_res(db, res); 
-    if (count < 0 ) {
-        fprintf(stderr, DATABASE_ERROR_FATAL); 
-        return NULL;
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        return -1;
     }
 
-        
-    GtkListStore *store;
-    GtkTreeIter iter;
+    rc = sqlite3_exec (db, clear_query, NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * FUNC recompute_dirty_due_dates
+ *   Recomputes the due date of every item queued in due_dirty (items whose
+ * latest completion was removed or moved, see schema.c) from its latest
+ * completion and frequency, in one statement. CROSS JOIN keeps SQLite
+ * driving the query from the (short) queue.
+ * Items that are untracked, do not repeat, or have no completions left keep
+ * the due date they have.
+ *
+ * Meant to be called once at the end of a transaction that edits history.
+ * Returns 1 on success and -1 on error
+ */
+int recompute_dirty_due_dates (RoutineDb *rdb)
+{
+    return run_due_date_recompute (rdb, RECOMPUTE_DUE_DATES_OF
+                                   "due_dirty d CROSS JOIN item_stats s "\
+                                   "ON s.item_id = d.item_id "\
+                                   "CROSS JOIN attributes a "\
+                                   "ON a.id = s.item_id "\
+                                   RECOMPUTE_DUE_DATES_WHERE);
+}
+
+/*
+ * FUNC rebuild_due_dates
+ *   Like recompute_dirty_due_dates but re-derives the due date of every
+ * tracked item. Since it reads item_stats it does not scan history.
+ *
+ * Returns 1 on success and -1 on error
+ */
+int rebuild_due_dates (RoutineDb *rdb)
+{
+    sqlite3 *db = rdb->conn;
+    int rc;
+
+    rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    if (run_due_date_recompute (rdb, RECOMPUTE_DUE_DATES_OF
+                                "item_stats s "\
+                                "JOIN attributes a ON a.id = s.item_id "\
+                                RECOMPUTE_DUE_DATES_WHERE) < 0) {
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+        return -1;
+    }
+
+    rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+        return -1;
+    }
+
+    return 1;
+}
+
+/* 
+ * FUNC get_tracking_from_db
+ *   Gets the tracking status of the item matching item_id in the db
+ */
+int get_tracking_from_db (RoutineDb *rdb, int item_id)
+{
+    sqlite3 *db = rdb->conn;
+    int is_tracked;
+    int rc;
+    sqlite3_stmt *res;
+    char *query = "SELECT track_history FROM attributes WHERE id = ?"; 
+
+    rc = sqlite3_prepare_v2 (db, query, -1 , &res, 0);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    rc = sqlite3_bind_int (res, 1, item_id);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_finalize(res);
+        return -1;
+    }
+
+
+    rc = sqlite3_step (res);
+    
+    if (rc != SQLITE_ROW) {
+        log_db_error(rc);
+        sqlite3_finalize(res);
+        return -1;
+    }
+
+    is_tracked = sqlite3_column_int (res, 0);
+
+    sqlite3_finalize (res);
+
+    return is_tracked;
+}
+
+/* 
+ * FUNC get_item_id
+ *   Gets the id of the item matching description in the db
+ * Returns -1 if there is no such item or on error
+ */
+int get_item_id (RoutineDb *rdb, const char *description)
+{
+    sqlite3 *db = rdb->conn;
+    int item_id;
+    int rc;
+    sqlite3_stmt *res;
+    char *query = "SELECT id FROM attributes WHERE description = ?"; 
+
+    rc = sqlite3_prepare_v2 (db, query, -1 , &res, 0);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    sqlite3_bind_text (res, 1, description, strlen(description), SQLITE_STATIC);
+
+    rc = sqlite3_step (res);
+    
+    if (rc != SQLITE_ROW) {
+        if (rc != SQLITE_DONE)
+            log_db_error(rc);
+        sqlite3_finalize(res);
+        return -1;
+    }
+
+    item_id = sqlite3_column_int (res, 0);
+
+    sqlite3_finalize (res);
+
+    return item_id;
+}
 
-    // create list store 
-    store = gtk_list_store_new (NUM_COLUMNS,
+/*
+ * FUNC new_main_store
+ *   Creates an empty GtkListStore with the columns of main_enum.h
+ */
+GtkListStore *new_main_store (void)
+{
+    return gtk_list_store_new (NUM_COLUMNS,
                               G_TYPE_BOOLEAN,
                               G_TYPE_STRING,
                               G_TYPE_STRING,
                               G_TYPE_STRING,
-                              G_TYPE_STRING);
+                              G_TYPE_STRING,
+                              G_TYPE_INT,
+                              G_TYPE_INT,
+                              G_TYPE_INT,
+                              G_TYPE_INT);
+}
+
+/*
+ * FUNC set_main_row
+ *   Fills the row at iter of store (see new_main_store) with an item due, or
+ * completed, on day. today_str (today in user format) and today are what the
+ * date the user can edit starts out as.
+ *
+ * Returns 1 on success and -1 if memory allocation fails
+ */
+int set_main_row (GtkListStore *store, GtkTreeIter *iter,
+                  const char *description, const char *category, int day,
+                  int item_id, int entry_id, const char *today_str, int today)
+{
+    char *date_user_frmt = convert_day_to_user_frmt (day);
+    if (date_user_frmt == NULL)
+        return -1;
+
+    gtk_list_store_set (store, iter,
+                       COLUMN_SELECTED,            FALSE,
+                       COLUMN_DESCRIPTION,         description,
+                       COLUMN_DATE_ENTRY,          today_str,
+                       COLUMN_CATEGORY,            category,
+                       COLUMN_DATE_UNEDITABLE,     date_user_frmt,
+                       COLUMN_ITEM_ID,             item_id,
+                       COLUMN_ENTRY_ID,            entry_id,
+                       COLUMN_DAY_ENTRY,           today,
+                       COLUMN_DAY_UNEDITABLE,      day,
+                       -1);
+    free (date_user_frmt);
+
+    return 1;
+}
+
+/*
+ * FUNC append_main_rows
+ *   Steps res and appends a row to store for each row it returns, unless
+ * tags is NULL only those of the items in tags (see tag_filter.c).
+ * res has to return the columns in UPCOMING_COLUMNS or HISTORY_COLUMNS
+ * Stops after limit rows if limit > 0, does not reset or finalize res.
+ *
+ * If last_date and last_id are not NULL they are set to the date and id of
+ * the last row read, appended or not (last_date must hold 11 chars)
+ *
+ * Returns the number of rows read, -1 on error
+ */
+static int append_main_rows (GtkListStore *store, sqlite3_stmt *res, int limit,
+                             const Tag_set *tags, char *last_date,
+                             int *last_id)
+{
+    int status_code = SQLITE_DONE;
+    int count = 0;
+
+    const char *description;
+    const char *cat;
+    const char *date_db_sql_frmt;
+    int item_id;
+    int entry_id;
 
+    GtkTreeIter iter;
 
     // MAKE CALL TO GET DATE STR
     char * date_str = get_current_date_str_in_user_frmt ();
     if (date_str == NULL) {
         fprintf (stderr, MEM_FAIL_IN "sql_db.c 2\n");
-        return NULL;
+        return -1;
     }
-    
-    status_code = sqlite3_step(res);
+    int today = get_current_day ();
 
-    for (int i = 0; i < count; i++)
+    while ((limit <= 0 || count < limit) &&
+           (status_code = sqlite3_step(res)) == SQLITE_ROW)
     {
       description      = sqlite3_column_text(res,0);
       date_db_sql_frmt = sqlite3_column_text(res,1);
       cat              = sqlite3_column_text(res,2);
+      item_id          = sqlite3_column_int(res,3);
+      entry_id         = sqlite3_column_int(res,4);
+
+      if (last_date != NULL && date_db_sql_frmt != NULL)
+          snprintf (last_date, 11, "%s", date_db_sql_frmt);
+      if (last_id != NULL)
+          *last_id = entry_id;
+
+      count++;
+
+      if (tags != NULL && !tag_set_has (tags, item_id))
+          continue;
+
+      gtk_list_store_append (store, &iter);
+      if (set_main_row (store, &iter, description, cat,
+                        day_from_sql_date_str (date_db_sql_frmt),
+                        item_id, entry_id, date_str, today) < 0) {
+          free(date_str);
+          fprintf(stderr, MEM_FAIL_IN "sql_db.c 3\n");
+          return -1;
+      }
+    }
+
+    /* We need date_str in the loop so we do not free it until after */
+    free(date_str);
+
+    /* SQLITE_ROW if it stopped at limit */
+    if (status_code != SQLITE_ROW && status_code != SQLITE_DONE) {
+        log_db_error(status_code);
+        return -1;
+    }
+
+    return count;
+}
+
+/*
+ * FUNC append_due_rows
+ *   Appends a row to store for each of the count entries of the due index
+ * from first on, unless tags is NULL only those of the items in tags
+ *
+ * Returns 1 on success, -1 on error
+ */
+static int append_due_rows (RoutineDb *rdb, GtkListStore *store,
+                            const Due_entry *first, int count,
+                            const Tag_set *tags)
+{
+    GtkTreeIter iter;
+    int i;
+
+    char *date_str = get_current_date_str_in_user_frmt ();
+    if (date_str == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 9\n");
+        return -1;
+    }
+    int today = get_current_day ();
+
+    for (i = 0; i < count; i++) {
+        if (tags != NULL && !tag_set_has (tags, first[i].item_id))
+            continue;
+
+        gtk_list_store_append (store, &iter);
+        if (set_main_row (store, &iter, first[i].description,
+                          due_index_category (rdb->due_index,
+                                              first[i].category_id),
+                          first[i].day, first[i].item_id,
+                          0, date_str, today) < 0) {
+            free (date_str);
+            fprintf (stderr, MEM_FAIL_IN "sql_db.c 10\n");
+            return -1;
+        }
+    }
+
+    free (date_str);
+
+    return 1;
+}
+
+/*
+ * FUNC create_main_model_from_db
+ *   Creates the data mode for the main view
+ * query has to return the columns in UPCOMING_COLUMNS or HISTORY_COLUMNS
+ */
+GtkTreeModel * create_main_model_from_db (RoutineDb *rdb, char *query)
+{
+    sqlite3 *db = rdb->conn;
+    int status_code;
+    sqlite3_stmt *res;
+
+    status_code = sqlite3_prepare_v2(db, query, -1, &res, 0);
+
+    if (status_code != SQLITE_OK) {
+        log_db_error(status_code);
+        return NULL;
+    }
+
+    GtkListStore *store;
+
+    // create list store
+    store = new_main_store ();
+
+    if (append_main_rows (store, res, 0, NULL, NULL, NULL) < 0) {
+        fprintf(stderr, DATABASE_ERROR_FATAL);
+        sqlite3_finalize(res);
+        g_object_unref (store);
+        return NULL;
+    }
+
+    sqlite3_finalize(res);
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_main_model_from_pager
+ *   Creates a data model for a history pane holding the first page of pager,
+ * which must not have loaded a page yet
+ * Returns NULL on error
+ */
+GtkTreeModel *create_main_model_from_pager (HistPager *pager)
+{
+    GtkListStore *store;
+
+    /* the first page of a range may be cached, it comes with the key to
+     * carry on from. Only every item is cached */
+    int cached = pager->end_day > 0 && pager->category_id == 0 &&
+                 pager->tags == NULL;
+
+    if (cached) {
+        store = query_cache_lookup (pager->rdb->query_cache, CACHED_HISTORY,
+                                    pager->start_day,
+                                    pager->end_day, pager->last_date,
+                                    &pager->last_id, &pager->done);
+        if (store != NULL)
+            return GTK_TREE_MODEL (store);
+    }
+
+    store = new_main_store ();
+
+    if (hist_pager_load_page (pager, store) < 0) {
+        g_object_unref (store);
+        return NULL;
+    }
+
+    if (cached)
+        query_cache_store (pager->rdb->query_cache, CACHED_HISTORY,
+                           pager->start_day, pager->end_day,
+                           store, pager->last_date, pager->last_id,
+                           pager->done);
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_upcoming_model_for_range
+ *   Creates a data model holding the upcoming items due from start_day to
+ * end_day (inclusive day numbers, see dates.c), sorted by due date.
+ * See create_upcoming_model_indexed, the db is only read if that fails.
+ * Returns NULL on error
+ */
+GtkTreeModel *create_upcoming_model_for_range (RoutineDb *rdb, int start_day,
+                                               int end_day)
+{
+    sqlite3_stmt *res;
+    GtkListStore *store;
+    GtkTreeModel *model;
+
+    model = create_upcoming_model_indexed (rdb, start_day, end_day, NULL);
+    if (model != NULL)
+        return model;
+
+    res = take_cached_stmt (rdb, STMT_UPCOMING_RANGE);
+    if (res == NULL)
+        return NULL;
+
+    store = load_upcoming_range (res, start_day, end_day, 0, NULL);
+    give_back_stmt (rdb, res);
+    if (store == NULL)
+        return NULL;
+
+    query_cache_store (rdb->query_cache, CACHED_UPCOMING, start_day, end_day,
+                       store,
+                       NULL, 0, 1);
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_upcoming_model_indexed
+ *   Like create_upcoming_model_for_range without going to the db: served
+ * from query_cache.c when the range has not been written to since,
+ * otherwise from the due index (due_index.c). Cheap enough for the main
+ * thread. Unless tags is NULL only the items in tags are loaded, and the
+ * cache is left alone.
+ * Returns NULL if the due index cannot be used, or on error
+ */
+GtkTreeModel *create_upcoming_model_indexed (RoutineDb *rdb, int start_day,
+                                             int end_day, const Tag_set *tags)
+{
+    GtkListStore *store;
+    const Due_entry *first;
+    int count;
+
+    if (tags == NULL) {
+        store = query_cache_lookup (rdb->query_cache, CACHED_UPCOMING,
+                                    start_day, end_day,
+                                    NULL, NULL, NULL);
+        if (store != NULL)
+            return GTK_TREE_MODEL (store);
+    }
+
+    count = due_index_slice (rdb->due_index, start_day, 0, end_day, &first);
+    if (count < 0)
+        return NULL;
+
+    store = new_main_store ();
+    if (append_due_rows (rdb, store, first, count, tags) < 0) {
+        g_object_unref (store);
+        return NULL;
+    }
+
+    if (tags == NULL)
+        query_cache_store (rdb->query_cache, CACHED_UPCOMING, start_day,
+                           end_day, store,
+                           NULL, 0, 1);
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_urgent_model
+ *   Creates a data model holding the limit most urgent items due (-1 for all
+ * of them), most urgent first. Only limit rows of upcoming_urgency are read.
+ * Returns NULL on error
+ */
+GtkTreeModel *create_urgent_model (RoutineDb *rdb, int limit)
+{
+    sqlite3_stmt *res;
+    GtkListStore *store;
+    int rc;
+
+    if (refresh_urgency (rdb) < 0)
+        return NULL;
+
+    res = take_cached_stmt (rdb, STMT_URGENT_ITEMS);
+    if (res == NULL)
+        return NULL;
+
+    rc = sqlite3_bind_int (res, 1, limit);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        give_back_stmt (rdb, res);
+        return NULL;
+    }
+
+    store = new_main_store ();
+
+    if (append_main_rows (store, res, 0, NULL, NULL, NULL) < 0) {
+        give_back_stmt (rdb, res);
+        g_object_unref (store);
+        return NULL;
+    }
+
+    give_back_stmt (rdb, res);
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_urgent_model_head
+ *   Loads the head_rows most urgent items due (all of them if head_rows is
+ * 0) after refreshing urgencies if the day changed, only those under the
+ * category category_id unless it is 0 and those in tags unless it is NULL
+ * (head_rows counts the rows read, not those shown). If there are more, rest
+ * is set to a cursor the caller loads them with (upcoming_cursor_load) and
+ * frees, otherwise to NULL. The cursor reads on down upcoming_urgency, so
+ * nothing is ever sorted.
+ *
+ * The cursor keeps a statement open on the main connection. Load the rest
+ * before writing to the db, or the rows still to come may reflect the write.
+ *
+ * Returns NULL on error
+ */
+GtkTreeModel *create_urgent_model_head (RoutineDb *rdb, int head_rows,
+                                        int category_id, const Tag_set *tags,
+                                        UpcomingCursor **rest)
+{
+    UpcomingCursor *cursor;
+    GtkListStore *store;
+    int rc;
+
+    *rest = NULL;
+
+    if (refresh_urgency (rdb) < 0)
+        return NULL;
+
+    cursor = malloc (sizeof (UpcomingCursor));
+    if (cursor == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 8\n");
+        exit (EXIT_FAILURE);
+    }
+    cursor->rdb = rdb;
+    cursor->done = 0;
+    cursor->tags = (tags != NULL) ? tag_set_copy (tags) : NULL;
+
+    cursor->stmt = take_cached_stmt (rdb, (category_id > 0) ?
+                                     STMT_URGENT_ITEMS_UNDER :
+                                     STMT_URGENT_ITEMS);
+    if (cursor->stmt == NULL) {
+        tag_set_free (cursor->tags);
+        free (cursor);
+        return NULL;
+    }
+
+    rc = sqlite3_bind_int (cursor->stmt, 1, -1);
+    if (rc == SQLITE_OK && category_id > 0)
+        rc = sqlite3_bind_int (cursor->stmt, 2, category_id);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        upcoming_cursor_free (cursor);
+        return NULL;
+    }
+
+    store = new_main_store ();
+
+    if (upcoming_cursor_load (cursor, store, head_rows) < 0) {
+        upcoming_cursor_free (cursor);
+        g_object_unref (store);
+        return NULL;
+    }
+
+    if (cursor->done)
+        upcoming_cursor_free (cursor);
+    else
+        *rest = cursor;
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC upcoming_cursor_load
+ *   Appends up to limit more rows of cursor to store, all of them if limit
+ * is 0. Rows of items not in the tags of cursor are read and skipped.
+ * Returns the number of rows read, less than limit once there are no
+ * more, -1 on error
+ */
+int upcoming_cursor_load (UpcomingCursor *cursor, GtkListStore *store,
+                          int limit)
+{
+    int count;
+
+    if (cursor->done)
+        return 0;
+
+    count = append_main_rows (store, cursor->stmt, limit, cursor->tags,
+                              NULL, NULL);
+    if (count < 0)
+        return -1;
+
+    if (limit <= 0 || count < limit) {
+        cursor->done = 1;
+        /* release the read lock */
+        sqlite3_reset (cursor->stmt);
+    }
+
+    return count;
+}
+
+/*
+ * FUNC upcoming_cursor_free
+ *   Hands the statement of cursor back to the cache and frees it
+ */
+void upcoming_cursor_free (UpcomingCursor *cursor)
+{
+    if (cursor == NULL)
+        return;
+    give_back_stmt (cursor->rdb, cursor->stmt);
+    tag_set_free (cursor->tags);
+    free (cursor);
+}
+
+/*
+ * FUNC create_upcoming_model_on
+ *   Like create_upcoming_model_for_range but reads through conn (a connection
+ * from open_reader_db) and skips query_cache.c, so it can run on a thread
+ * other than the main one. Unless category_id is 0 only the items under
+ * that category are loaded, unless tags is NULL only those in tags.
+ * Returns NULL on error
+ */
+GtkTreeModel *create_upcoming_model_on (sqlite3 *conn, int start_day,
+                                        int end_day, int category_id,
+                                        const Tag_set *tags)
+{
+    sqlite3_stmt *res;
+    GtkListStore *store;
+
+    int rc = sqlite3_prepare_v2 (conn, (category_id > 0) ?
+                                 UPCOMING_RANGE_UNDER : UPCOMING_RANGE,
+                                 -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return NULL;
+    }
+
+    store = load_upcoming_range (res, start_day, end_day, category_id, tags);
+    sqlite3_finalize (res);
+    if (store == NULL)
+        return NULL;
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_hist_range_model_on
+ *   Loads the first page of the items completed from start_day to end_day,
+ * like hist_pager_new_for_range and create_main_model_from_pager would, but
+ * through conn (see create_upcoming_model_on). last_date (11 chars), last_id
+ * and done get the key to carry on from, see hist_pager_new_for_range_from.
+ * Unless category_id is 0 only the items under that category are loaded,
+ * unless tags is NULL only those in tags. conn has to be a reader of rdb
+ * (see open_reader_db), only where the archive of rdb ends is read from it
+ * and that is set once rdb is open.
+ *
+ * Returns NULL on error
+ */
+GtkTreeModel *create_hist_range_model_on (RoutineDb *rdb, sqlite3 *conn,
+                                          int start_day, int end_day,
+                                          int category_id, const Tag_set *tags,
+                                          char *last_date, int *last_id,
+                                          int *done)
+{
+    sqlite3_stmt *res;
+    GtkListStore *store;
+    int count;
+
+    res = prepare_hist_range_on (rdb, conn, start_day, end_day, category_id);
+    if (res == NULL)
+        return NULL;
+
+    /* "" sorts before every sql date so the page starts at the oldest */
+    last_date[0] = '\0';
+    *last_id = 0;
+    *done = 0;
+
+    store = new_main_store ();
+    count = load_hist_pages (res, store, tags, last_date, last_id, done);
+    sqlite3_finalize (res);
+
+    if (count < 0) {
+        g_object_unref (store);
+        return NULL;
+    }
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_upcoming_model_by_date_on
+ *   Loads every item due from start_day to end_day through conn (see
+ * create_upcoming_model_on), soonest due first and by item id within a day,
+ * for the models merged by due date in federation.c
+ * Returns NULL on error
+ */
+GtkTreeModel *create_upcoming_model_by_date_on (sqlite3 *conn, int start_day,
+                                                int end_day)
+{
+    sqlite3_stmt *res;
+    GtkListStore *store;
+
+    int rc = sqlite3_prepare_v2 (conn, UPCOMING_RANGE_BY_DATE, -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return NULL;
+    }
+
+    store = load_upcoming_range (res, start_day, end_day, 0, NULL);
+    sqlite3_finalize (res);
+    if (store == NULL)
+        return NULL;
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC create_hist_range_model_all_on
+ *   Like create_hist_range_model_on for every item, but loads every page:
+ * all the items completed from start_day to end_day, oldest first
+ * Returns NULL on error
+ */
+GtkTreeModel *create_hist_range_model_all_on (RoutineDb *rdb, sqlite3 *conn,
+                                              int start_day, int end_day)
+{
+    sqlite3_stmt *res;
+    GtkListStore *store;
+    char last_date[11] = "";
+    int last_id = 0;
+    int done = 0;
+
+    res = prepare_hist_range_on (rdb, conn, start_day, end_day, 0);
+    if (res == NULL)
+        return NULL;
+
+    store = new_main_store ();
+    while (!done) {
+        if (load_hist_pages (res, store, NULL, last_date, &last_id,
+                             &done) < 0) {
+            sqlite3_finalize (res);
+            g_object_unref (store);
+            return NULL;
+        }
+    }
+    sqlite3_finalize (res);
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC prepare_hist_range_on
+ *   Helper function to create_hist_range_model_on and
+ * create_hist_range_model_all_on
+ * Prepares the HIST_PAGE_BY_RANGE query hist_range_stmt picks on conn, with
+ * the range and category_id (unless 0) bound
+ * Returns NULL on error
+ */
+static sqlite3_stmt *prepare_hist_range_on (RoutineDb *rdb, sqlite3 *conn,
+                                            int start_day, int end_day,
+                                            int category_id)
+{
+    sqlite3_stmt *res;
+
+    int rc = sqlite3_prepare_v2 (conn,
+                                 cached_sql[hist_range_stmt (rdb, start_day,
+                                                             category_id)],
+                                 -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return NULL;
+    }
+
+    rc = sqlite3_bind_int (res, 1, start_day);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (res, 5, end_day);
+    if (rc == SQLITE_OK && category_id > 0)
+        rc = sqlite3_bind_int (res, 6, category_id);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_finalize (res);
+        return NULL;
+    }
+
+    return res;
+}
+
+/*
+ * FUNC create_category_counts_model
+ *   Creates a model of every category holding items, directly or in one
+ * under it, with the number of items due by today in it and under it
+ * (columns CATEGORY_COLUMN_ID...). All the counts come from one query.
+ * Returns NULL on error
+ */
+GtkTreeModel *create_category_counts_model (RoutineDb *rdb)
+{
+    sqlite3 *db = rdb->conn;
+    GtkListStore *store;
+    GtkTreeIter iter;
+    sqlite3_stmt *res;
+
+    int rc = sqlite3_prepare_v2 (db, CATEGORY_DUE_COUNTS, -1, &res, 0);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (res, 1, get_current_day ());
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_finalize (res);
+        return NULL;
+    }
+
+    store = gtk_list_store_new (NUM_CATEGORY_COLUMNS,
+                                G_TYPE_INT,     // id
+                                G_TYPE_STRING,  // name
+                                G_TYPE_INT,     // depth
+                                G_TYPE_INT);    // due
+
+    while ((rc = sqlite3_step (res)) == SQLITE_ROW) {
+        gtk_list_store_append (store, &iter);
+        gtk_list_store_set (store, &iter,
+                CATEGORY_COLUMN_ID,    sqlite3_column_int (res, 0),
+                CATEGORY_COLUMN_NAME,  sqlite3_column_text (res, 1),
+                CATEGORY_COLUMN_DEPTH, sqlite3_column_int (res, 2),
+                CATEGORY_COLUMN_DUE,   sqlite3_column_int (res, 3),
+                -1);
+    }
+
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        g_object_unref (store);
+        return NULL;
+    }
+
+    return GTK_TREE_MODEL (store);
+}
+
+/*
+ * FUNC load_upcoming_range
+ *   Helper function to create_upcoming_model_for_range and
+ * create_upcoming_model_on. Binds the range to res (prepared from
+ * UPCOMING_RANGE, or UPCOMING_RANGE_UNDER if category_id is not 0) and
+ * loads the rows of the items in tags (all of them if it is NULL) into a
+ * new store.
+ * Does not reset or finalize res.
+ * Returns NULL on error
+ */
+static GtkListStore *load_upcoming_range (sqlite3_stmt *res, int start_day,
+                                          int end_day, int category_id,
+                                          const Tag_set *tags)
+{
+    GtkListStore *store;
+
+    int rc = sqlite3_bind_int (res, 1, start_day);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (res, 2, end_day);
+    if (rc == SQLITE_OK && category_id > 0)
+        rc = sqlite3_bind_int (res, 3, category_id);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return NULL;
+    }
+
+    store = new_main_store ();
+
+    if (append_main_rows (store, res, 0, tags, NULL, NULL) < 0) {
+        g_object_unref (store);
+        return NULL;
+    }
+
+    return store;
+}
+
+/*
+ * FUNC hist_pager_new
+ *   Helper function to hist_pager_new_for_item and hist_pager_new_for_range
+ * Takes the cached statement which (see HIST_PAGE_BY_ITEM) and sets the key
+ * before the first row
+ *
+ * Returns NULL on error
+ * NOTE: USES MALLOC, FREE WITH hist_pager_free
+ */
+static HistPager *hist_pager_new (RoutineDb *rdb, int which,
+                                  const char *first_date)
+{
+    HistPager *pager = malloc (sizeof (HistPager));
+    if (pager == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 6\n");
+        exit (EXIT_FAILURE);
+    }
+
+    pager->rdb = rdb;
+    pager->stmt = take_cached_stmt (rdb, which);
+    if (pager->stmt == NULL) {
+        free (pager);
+        return NULL;
+    }
+
+    snprintf (pager->last_date, sizeof (pager->last_date), "%s", first_date);
+    pager->last_id = 0;
+    pager->done = 0;
+    pager->start_day = 0;
+    pager->end_day = 0;
+    pager->category_id = 0;
+    pager->tags = NULL;
+
+    return pager;
+}
+
+/*
+ * FUNC hist_pager_new_for_item
+ *   Pages through the completion history of item_id, newest entries first
+ * Returns NULL on error
+ */
+HistPager *hist_pager_new_for_item (RoutineDb *rdb, int item_id)
+{
+    /* "~" sorts after every sql date so the first page starts at the newest */
+    HistPager *pager = hist_pager_new (rdb, (rdb->archive_end_day > 0) ?
+                                       STMT_HIST_PAGE_BY_ITEM_ARCHIVED :
+                                       STMT_HIST_PAGE_BY_ITEM, "~");
+    if (pager == NULL)
+        return NULL;
+
+    int rc = sqlite3_bind_int (pager->stmt, 1, item_id);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        hist_pager_free (pager);
+        return NULL;
+    }
+
+    return pager;
+}
+
+/*
+ * FUNC hist_pager_new_for_range
+ *   Pages through the items completed from start_day to end_day (inclusive),
+ * oldest entries first, only those under the category category_id unless
+ * it is 0 and those in tags unless it is NULL. The pager keeps a copy of
+ * tags.
+ * Returns NULL on error
+ */
+HistPager *hist_pager_new_for_range (RoutineDb *rdb, int start_day, int end_day,
+                                     int category_id, const Tag_set *tags)
+{
+    /* "" sorts before every sql date so the first page starts at the oldest */
+    HistPager *pager = hist_pager_new (rdb, hist_range_stmt (rdb, start_day,
+                                                        category_id), "");
+    if (pager == NULL)
+        return NULL;
+
+    int rc = sqlite3_bind_int (pager->stmt, 1, start_day);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (pager->stmt, 5, end_day);
+    if (rc == SQLITE_OK && category_id > 0)
+        rc = sqlite3_bind_int (pager->stmt, 6, category_id);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        hist_pager_free (pager);
+        return NULL;
+    }
+
+    pager->start_day   = start_day;
+    pager->end_day     = end_day;
+    pager->category_id = category_id;
+    pager->tags        = (tags != NULL) ? tag_set_copy (tags) : NULL;
+
+    return pager;
+}
+
+/*
+ * FUNC hist_pager_new_for_range_from
+ *   Like hist_pager_new_for_range, for a range whose first page was already
+ * loaded some other way (see create_hist_range_model_on). The next page
+ * starts after (last_date, last_id).
+ * Returns NULL on error
+ */
+HistPager *hist_pager_new_for_range_from (RoutineDb *rdb, int start_day,
+                                          int end_day, int category_id,
+                                          const Tag_set *tags,
+                                          const char *last_date, int last_id,
+                                          int done)
+{
+    HistPager *pager = hist_pager_new_for_range (rdb, start_day, end_day,
+                                                 category_id, tags);
+    if (pager == NULL)
+        return NULL;
+
+    snprintf (pager->last_date, sizeof (pager->last_date), "%s", last_date);
+    pager->last_id = last_id;
+    pager->done = done;
+
+    return pager;
+}
+
+/*
+ * FUNC hist_range_stmt
+ *   Helper function to the history range loaders
+ * Picks the HIST_PAGE_BY_RANGE statement (see the enum of cached statements)
+ * for a range starting on start_day under category_id, one reading the
+ * archive only if the range reaches into it
+ */
+static int hist_range_stmt (RoutineDb *rdb, int start_day, int category_id)
+{
+    int archived = start_day <= rdb->archive_end_day;
+
+    if (category_id > 0)
+        return archived ? STMT_HIST_PAGE_BY_RANGE_UNDER_ARCHIVED :
+                          STMT_HIST_PAGE_BY_RANGE_UNDER;
+
+    return archived ? STMT_HIST_PAGE_BY_RANGE_ARCHIVED :
+                      STMT_HIST_PAGE_BY_RANGE;
+}
+
+/*
+ * FUNC hist_pager_load_page
+ *   Appends the next HIST_PAGE_SIZE rows of pager to store.
+ * Bindings for the filter (item or range) stay on the statement between
+ * pages, only the key and page size are re-bound.
+ *
+ * Returns the number of rows appended (0 once there are no more), -1 on error
+ */
+int hist_pager_load_page (HistPager *pager, GtkListStore *store)
+{
+    if (pager->done)
+        return 0;
+
+    return load_hist_pages (pager->stmt, store, pager->tags,
+                            pager->last_date, &pager->last_id, &pager->done);
+}
+
+/*
+ * FUNC load_hist_pages
+ *   Helper function to hist_pager_load_page and create_hist_range_model_on
+ * Appends the page of res (a HIST_PAGE query with its filter bound) after
+ * (last_date, last_id) to store and moves the key on past it, setting done
+ * once the last page has been read. Unless tags is NULL a page may hold
+ * few of the items in it, so pages are read until a page worth has been
+ * appended: a pane that cannot scroll never loads its next page.
+ *
+ * Returns the number of rows appended, -1 on error
+ */
+static int load_hist_pages (sqlite3_stmt *res, GtkListStore *store,
+                            const Tag_set *tags, char *last_date,
+                            int *last_id, int *done)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL (store);
+    int rows_before = gtk_tree_model_iter_n_children (model, NULL);
+    int rc;
+    int count;
+
+    while (!*done &&
+           gtk_tree_model_iter_n_children (model, NULL) - rows_before <
+           HIST_PAGE_SIZE) {
+        sqlite3_reset (res);
+
+        rc = sqlite3_bind_text (res, 2, last_date, -1, SQLITE_TRANSIENT);
+        if (rc == SQLITE_OK)
+            rc = sqlite3_bind_int (res, 3, *last_id);
+        if (rc == SQLITE_OK)
+            rc = sqlite3_bind_int (res, 4, HIST_PAGE_SIZE);
+        if (rc != SQLITE_OK) {
+            log_db_error(rc);
+            return -1;
+        }
+
+        count = append_main_rows (store, res, HIST_PAGE_SIZE, tags,
+                                  last_date, last_id);
+
+        /* release the read lock until the next page is wanted */
+        sqlite3_reset (res);
+
+        if (count < 0)
+            return -1;
+        if (count < HIST_PAGE_SIZE)
+            *done = 1;
+    }
+
+    return gtk_tree_model_iter_n_children (model, NULL) - rows_before;
+}
+
+/*
+ * FUNC load_next_hist_page
+ *   Callback for the "edge-reached" signal of a history pane. Loads the next
+ * page once the user scrolls to the bottom.
+ */
+static void load_next_hist_page (GtkScrolledWindow *sw, GtkPositionType pos,
+                                 HistPager *pager)
+{
+    if (pos != GTK_POS_BOTTOM || pager->done)
+        return;
+
+    GtkWidget *treeview = gtk_bin_get_child (GTK_BIN (sw));
+    GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW (treeview));
+
+    if (hist_pager_load_page (pager, GTK_LIST_STORE (model)) < 0)
+        error_dialog (GTK_WIDGET (sw), DATABASE_LOAD_HIST_PAGE_FAIL);
+}
+
+/*
+ * FUNC hist_pager_attach
+ *   Makes the scrolled window sw (holding the treeview of the pane) load the
+ * next page of pager when scrolled to the bottom.
+ * sw takes ownership of pager, it is freed when sw is destroyed.
+ */
+void hist_pager_attach (GtkWidget *sw, HistPager *pager)
+{
+    g_object_set_data_full (G_OBJECT (sw), "hist_pager", pager,
+                            (GDestroyNotify) hist_pager_free);
+
+    g_signal_connect (G_OBJECT (sw), "edge-reached",
+            G_CALLBACK (load_next_hist_page), pager);
+}
+
+/*
+ * FUNC hist_pager_free
+ *   Hands the statement of pager back to the cache and frees it
+ */
+void hist_pager_free (HistPager *pager)
+{
+    if (pager == NULL)
+        return;
+    give_back_stmt (pager->rdb, pager->stmt);
+    tag_set_free (pager->tags);
+    free (pager);
+}
+
+/*
+ * FUNC change_hist_date
+ *   Edits the completion date of an item.
+ * Moves the history entry matching entry_id to new_day
+ *
+ * Returns 1 on success, -1 on error
+ */
+int change_hist_date (RoutineDb *rdb, int entry_id, int new_day) 
+{
+    sqlite3 *db = rdb->conn;
+    char *query = "UPDATE history SET date = DATE(? + " JULIAN_DAY_0 ") "\
+                  "WHERE id = ?"; 
+
+    int rc;
+    sqlite3_stmt *res;
+
+    if (unarchive_entry (rdb, entry_id) < 0)
+        return -1;
+
+    rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    sqlite3_bind_int (res, 1, new_day);
+    sqlite3_bind_int (res, 2, entry_id);
+
+    rc = sqlite3_step (res);
+
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        sqlite3_finalize(res);
+        return -1;
+    }
+
+    sqlite3_finalize (res);
+
+    return 1;
+}
+
+/*
+ * FUNC unarchive_entry
+ *   Helper function to change_hist_date and remove_entry_from_history
+ * Moves the history entry matching entry_id back from the archive (see
+ * archive.c) if it is there, so the edit goes through the triggers on
+ * history like any other. It goes back with the next archive_old_history
+ * if it is still old enough.
+ * Returns 1 on success, -1 on error
+ */
+static int unarchive_entry (RoutineDb *rdb, int entry_id)
+{
+    sqlite3 *db = rdb->conn;
+    char *queries[] = {"INSERT INTO history "
+                       "(description, date, category, item_id, id) "
+                       "SELECT description, date, category, item_id, id "
+                       "FROM archive.history WHERE id = ?",
+                       "DELETE FROM archive.history WHERE id = ?"
+    };
+    sqlite3_stmt *res;
+    int rc;
+
+    if (rdb->archive_end_day == 0)
+        return 1;
+
+    for (int i = 0; i < 2; i++) {
+        rc = sqlite3_prepare_v2 (db, queries[i], -1, &res, 0);
+        if (rc != SQLITE_OK) {
+            log_db_error(rc);
+            return -1;
+        }
+
+        sqlite3_bind_int (res, 1, entry_id);
+        rc = sqlite3_step (res);
+        sqlite3_finalize (res);
+
+        if (rc != SQLITE_DONE) {
+            log_db_error(rc);
+            return -1;
+        }
+
+        /* not archived */
+        if (i == 0 && sqlite3_changes (db) == 0)
+            break;
+    }
+
+    return 1;
+}
+
+/*
+ * FUNC remove_entry_from_history
+ *   Removes the history entry matching entry_id from history table of db
+ *
+ * Returns 1 on success, -1 on error
+ */
+int remove_entry_from_history (RoutineDb *rdb, int entry_id) 
+{
+    sqlite3 *db = rdb->conn;
+    char *query = "DELETE FROM history WHERE id = ?"; 
+
+    int rc;
+    sqlite3_stmt *res;
+
+    if (unarchive_entry (rdb, entry_id) < 0)
+        return -1;
+
+    rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    sqlite3_bind_int (res, 1, entry_id);
+
+    rc = sqlite3_step (res);
+
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        sqlite3_finalize(res);
+        return -1;
+    }
+
+    sqlite3_finalize (res);
+
+    return 1;
+}
+
+/*
+ * FUNC load_rest_of_attributes_raw_from_desc
+ *   Gets attributes information from db and loads them into an Attributes_raw
+ * struct provided by the caller. 
+ *
+ * Returns 1 on success -1 on error 
+ *
+ * ASSERTION: Assumes that the Attributes_raw struct has already had the 
+ * description added to it. 
+ */
+int load_rest_of_attributes_raw_from_desc (RoutineDb *rdb,
+                                           Attributes_raw *attributes)
+{
+    sqlite3 *db = rdb->conn;
+    const char *desc = attributes->description;
+    int rc;
+    sqlite3_stmt *res;
+    char *query1 = "SELECT a.description, c.name, a.freq, a.freq_type, "\
+                   "a.track_history, a.id FROM attributes a "\
+                   "LEFT JOIN categories c ON c.id = a.category_id "\
+                   "WHERE a.description = ?";
+    rc = sqlite3_prepare_v2 (db, query1, -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+    sqlite3_bind_text (res, 1, desc, strlen(desc), SQLITE_STATIC);
+
+    rc = sqlite3_step(res);
+    if (rc != SQLITE_ROW) {
+        log_db_error(rc);
+        sqlite3_finalize(res);
+        return -1;
+    }
+
+    const char *category  = sqlite3_column_text (res, 1);
+    const char *freq_type = sqlite3_column_text (res, 3);
+
+    int freq = sqlite3_column_int (res, 2);
+    int is_tracked = sqlite3_column_int (res, 4);
+
+    attributes->category = strdup ((category != NULL) ? category : "");
+    attributes->freq_type = strdup (freq_type);
+
+    if (attributes->category == NULL || attributes->freq_type == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 4\n");
+        return -1;
+    }
+
+    attributes->id = sqlite3_column_int (res, 5);
+    attributes->freq = freq;
+    attributes->track_history = is_tracked;
+
+    sqlite3_finalize (res);
+
+    sqlite3_stmt *res2;
+    char *query2 = "SELECT date FROM upcoming WHERE item_id = ?";
+    rc = sqlite3_prepare_v2 (db, query2, -1, &res2, 0);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+    sqlite3_bind_int (res2, 1, attributes->id);
+
+    rc = sqlite3_step (res2);
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    const char *due;
+    due = sqlite3_column_text (res2, 0);
+    
+    if (due != NULL)
+        attributes->due_date = strdup(due);
+    else
+        attributes->due_date = strdup(NOT_DUE);
+
+    if (attributes->due_date == NULL) {
+        free (attributes->category);
+        free (attributes->freq_type);
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 5\n");
+        return -1;
+    }
+
+    sqlite3_finalize (res2);
+
+    return 1;
+}
+
+/* 
+ * FUNC create_completion_model_from_db
+ *   Creates a completion model from the db using query
+ * Returns NULL on error
+ *
+ * Note: Using NULL for a completion in GTK does not cause a fatal error
+ *       therefore the program does not crash out when this happens 
+ */
+GtkTreeModel *
+create_completion_model_from_db (RoutineDb *rdb, char* query)
+{
+    sqlite3 *db = rdb->conn;
+    GtkListStore *store;
+    GtkTreeIter iter;
+
+    int rc;
+    int count;
+
+    sqlite3_stmt *res;
+    const char *string;
+
+    rc = sqlite3_prepare(db, query, -1,
+            &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, COMPLETION_ERROR);
+        log_db_error(rc);
+        return NULL;
+    }
+
+    store = gtk_list_store_new (1, G_TYPE_STRING);
+
+    rc = sqlite3_step(res);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        fprintf(stderr, COMPLETION_ERROR);
+        log_db_error(rc);
+        return NULL;
+    }
+
+    while (rc == SQLITE_ROW) {
+        string = sqlite3_column_text(res,0);
+        gtk_list_store_append (store, &iter);
+        gtk_list_store_set (store, &iter, 0, string, -1);
+        rc = sqlite3_step(res);
+    }
+
+    sqlite3_finalize(res);
+
+    return GTK_TREE_MODEL (store);
+
+}
+
+/* 
+ * FUNC change_db_due_date
+ *   Changes the due date of an item in the db
+ * Returns 1 on success, -1 on error
+ */
+int change_db_due_date (RoutineDb *rdb, char *description, char *sql_date)
+{
+    sqlite3 *db = rdb->conn;
+    int rc;
+
+    sqlite3_stmt *res0;
+    char *query_if_in_upcoming = "SELECT * FROM UPCOMING WHERE description = ?";
+    rc = sqlite3_prepare_v2 (db, query_if_in_upcoming, -1, &res0, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
+    sqlite3_bind_text (res0, 1, description, strlen(description), SQLITE_TRANSIENT);
+
+    int is_in_upcoming = count_rows_of_res (db, res0);
+    if (is_in_upcoming < 0) {
+        fprintf(stderr, DATABASE_FAIL_TO_CHANGE_DUE_DATE);
+        sqlite3_finalize(res0);
+        return -1;
+    }
+
+    sqlite3_finalize (res0);
+
+    if (is_in_upcoming == 1) {
 
-      date_db_user_frmt = convert_date_str_from_sql_to_user_frmt (date_db_sql_frmt);
-      if (date_db_user_frmt == NULL) {
-          free(date_str);
-          fprintf(stderr, MEM_FAIL_IN "sql_db.c 3\n");
-          return NULL;
-      }
+        sqlite3_stmt *res;
 
-      gtk_list_store_append (store, &iter);
-      gtk_list_store_set (store, &iter,
-                         COLUMN_SELECTED,            FALSE,
-                         COLUMN_DESCRIPTION,         description,
-                         COLUMN_DATE_ENTRY, date_str,
-                         COLUMN_CATEGORY,            cat,
-                         COLUMN_DATE_UNEDITABLE,                date_db_user_frmt,
-                         -1);
-      free (date_db_user_frmt);
-      status_code = sqlite3_step(res);
+        char *query = "UPDATE upcoming SET date = ? WHERE description = ?";
 
+        rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
 
-    }
+        if (rc != SQLITE_OK) {
+            log_db_error(rc);
+            return -1;
+        }
 
-    sqlite3_finalize(res);
-    /* We need date_str in the loop so we do not free it until after */
-    free(date_str);
+        sqlite3_bind_text (res, 1, sql_date, strlen(sql_date), SQLITE_STATIC);
+        sqlite3_bind_text (res, 2, description, strlen(description), SQLITE_STATIC);
 
-    return GTK_TREE_MODEL (store);
+        rc = sqlite3_step (res);
+
+        if (rc != SQLITE_DONE) {
+            log_db_error(rc);
+            sqlite3_finalize(res);
+            return -1;
+        }
+
+        sqlite3_finalize (res);
+    }
+    /* If no due date, give it a new due date entry */
+    else {
+        int add_success = add_upcoming (rdb, description, sql_date);
+        if (add_success < 0) {
+            fprintf(stderr, DATABASE_FAIL_TO_CHANGE_DUE_DATE);
+            return -1;
+        }
+    }
 }
 
 /*
- * FUNC change_hist_date
- *   Edits the completion date of an item.
- * Replaces completion_date with new_date in history table of db
- *
- * Returns 1 on success, -1 on error
+ * FUNC change_frequency
+ *   Changes the frequency used to calculate due dates for an item
+ * Returns 1 on success and -1 on error
  */
-int change_hist_date (gchar* description, 
-                       gchar* completion_date, 
-                       char *new_date) 
+int change_frequency (RoutineDb *rdb, char *description, int freq,
+                      const char *freq_type)
 {
-    char *query = "UPDATE history SET date = ? WHERE description = ? AND "\
-                  "date = ?"; 
-
+    sqlite3 *db = rdb->conn;
     int rc;
     sqlite3_stmt *res;
 
+    char *query = "UPDATE attributes SET freq = ?, freq_type = ? WHERE "\
+                   "description = ?";
+
     rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
 
     if (rc != SQLITE_OK) {
@@ -660,11 +2866,9 @@ int change_hist_date (gchar* description,
         return -1;
     }
 
-    sqlite3_bind_text (res, 1, new_date, strlen(new_date), SQLITE_TRANSIENT);
-
-    sqlite3_bind_text (res, 2, description, strlen(description), SQLITE_TRANSIENT);
-    sqlite3_bind_text (res, 3, completion_date, strlen(completion_date), SQLITE_TRANSIENT);
-
+    rc = sqlite3_bind_int (res, 1, freq); 
+    rc = sqlite3_bind_text (res, 2, freq_type, strlen(freq_type), SQLITE_TRANSIENT);
+    rc = sqlite3_bind_text (res, 3, description , strlen(description), SQLITE_TRANSIENT);
 
     rc = sqlite3_step (res);
 
@@ -680,319 +2884,559 @@ int change_hist_date (gchar* description,
 }
 
 /*
- * FUNC remove_entry_from_history
- *   Removes the item matching from history table of db
- * Item removed matches description and completion_date
- *
- * Returns 1 on success, -1 on error
+ * FUNC count_by_rule
+ *   Counts the upcoming items matching rule, ie: how many a bulk edit with
+ * it would change. Nothing is written.
+ * Returns the count, -1 on error
  */
-int remove_entry_from_history (gchar* description, gchar* completion_date) 
+int count_by_rule (RoutineDb *rdb, const Bulk_rule *rule)
 {
-    char *query = "DELETE FROM history WHERE description = ? AND "\
-                  "date = ?"; 
-
-    int rc;
+    sqlite3 *db = rdb->conn;
     sqlite3_stmt *res;
+    int count = -1;
 
-    rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    int rc = sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM upcoming "
+                                     BULK_RULE_WHERE, -1, &res, 0);
     if (rc != SQLITE_OK) {
         log_db_error(rc);
         return -1;
     }
 
-    sqlite3_bind_text (res, 1, description, strlen(description), SQLITE_TRANSIENT);
-    sqlite3_bind_text (res, 2, completion_date, strlen(completion_date), SQLITE_TRANSIENT);
+    if (bind_bulk_rule (res, rule) < 0) {
+        sqlite3_finalize (res);
+        return -1;
+    }
 
     rc = sqlite3_step (res);
-
-    if (rc != SQLITE_DONE) {
+    if (rc == SQLITE_ROW)
+        count = sqlite3_column_int (res, 0);
+    else
         log_db_error(rc);
-        sqlite3_finalize(res);
-        return -1;
-    }
 
     sqlite3_finalize (res);
 
-    return 1;
+    return count;
 }
-    
- 
+
 /*
- * FUNC load_rest_of_attributes_raw_from_desc
- *   Gets attributes information from db and loads them into an Attributes_raw
- * struct provided by the caller. 
- *
- * Returns 1 on success -1 on error 
- *
- * ASSERTION: Assumes that the Attributes_raw struct has already had the 
- * description added to it. 
+ * FUNC shift_by_rule
+ *   Moves the due date of every upcoming item matching rule by days (back
+ * into the past if negative), in one UPDATE
+ * Returns the number of items moved, -1 on error
  */
-int load_rest_of_attributes_raw_from_desc (Attributes_raw *attributes)
+int shift_by_rule (RoutineDb *rdb, const Bulk_rule *rule, int days)
 {
-    const char *desc = attributes->description;
-    int rc;
+    sqlite3 *db = rdb->conn;
     sqlite3_stmt *res;
-    char *query1 = "SELECT * FROM attributes WHERE description = ?";
-    rc = sqlite3_prepare_v2 (db, query1, -1, &res, 0);
 
+    int rc = sqlite3_prepare_v2 (db, "UPDATE upcoming "
+                                     "SET date = DATE(date, ?6 || ' days') "
+                                     BULK_RULE_WHERE, -1, &res, 0);
     if (rc != SQLITE_OK) {
         log_db_error(rc);
         return -1;
     }
-    sqlite3_bind_text (res, 1, desc, strlen(desc), SQLITE_STATIC);
 
-    rc = sqlite3_step(res);
-    if (rc != SQLITE_ROW) {
-        log_db_error(rc);
-        sqlite3_finalize(res);
+    if (bind_bulk_rule (res, rule) < 0 ||
+        (rc = sqlite3_bind_int (res, 6, days)) != SQLITE_OK) {
+        sqlite3_finalize (res);
         return -1;
     }
 
-    const char *category  = sqlite3_column_text (res, 1);
-    const char *freq_type = sqlite3_column_text (res, 3);
-
-    int freq = sqlite3_column_int (res, 2);
-    int is_tracked = sqlite3_column_int (res, 4);
+    return run_bulk_edit (rdb, res);
+}
 
-    attributes->category = strdup (category);
-    attributes->freq_type = strdup (freq_type);
+/*
+ * FUNC change_frequency_by_rule
+ *   change_frequency for every item with an upcoming due date matching rule,
+ * in one UPDATE. As with change_frequency the due dates stay as they are,
+ * the new frequency is used from the next completion on.
+ * Returns the number of items changed, -1 on error
+ */
+int change_frequency_by_rule (RoutineDb *rdb, const Bulk_rule *rule, int freq,
+                              const char *freq_type)
+{
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *res;
 
-    if (attributes->category == NULL || attributes->freq_type == NULL) {
-        fprintf (stderr, MEM_FAIL_IN "sql_db.c 4\n");
+    int rc = sqlite3_prepare_v2 (db, "UPDATE attributes "
+                                     "SET freq = ?6, freq_type = ?7 "
+                                     "WHERE id IN (SELECT item_id "
+                                     "FROM upcoming " BULK_RULE_WHERE ")",
+                                 -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
         return -1;
     }
 
-    attributes->freq = freq;
-    attributes->track_history = is_tracked;
+    if (bind_bulk_rule (res, rule) < 0 ||
+        (rc = sqlite3_bind_int (res, 6, freq)) != SQLITE_OK ||
+        (rc = sqlite3_bind_text (res, 7, freq_type, -1,
+                                 SQLITE_TRANSIENT)) != SQLITE_OK) {
+        sqlite3_finalize (res);
+        return -1;
+    }
 
-    sqlite3_finalize (res);
+    return run_bulk_edit (rdb, res);
+}
 
-    sqlite3_stmt *res2;
-    char *query2 = "SELECT date FROM upcoming WHERE description = ?";
-    rc = sqlite3_prepare_v2 (db, query2, -1, &res2, 0);
+/*
+ * FUNC purge_by_rule
+ *   purge_items for every item with an upcoming due date matching rule,
+ * ie: every task of a vehicle taken out of service
+ * Returns the number of items removed, -1 on error
+ */
+int purge_by_rule (RoutineDb *rdb, const Bulk_rule *rule)
+{
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *res;
+    GArray *item_ids;
+    int purged;
 
+    int rc = sqlite3_prepare_v2 (db, "SELECT item_id FROM upcoming "
+                                     BULK_RULE_WHERE, -1, &res, 0);
     if (rc != SQLITE_OK) {
         log_db_error(rc);
         return -1;
     }
-    sqlite3_bind_text (res2, 1, desc, strlen(desc), SQLITE_STATIC);
 
-    rc = sqlite3_step (res2);
+    if (bind_bulk_rule (res, rule) < 0) {
+        sqlite3_finalize (res);
+        return -1;
+    }
 
-    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+    item_ids = g_array_new (FALSE, FALSE, sizeof (int));
+    while ((rc = sqlite3_step (res)) == SQLITE_ROW) {
+        int item_id = sqlite3_column_int (res, 0);
+        g_array_append_val (item_ids, item_id);
+    }
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_DONE) {
         log_db_error(rc);
+        g_array_free (item_ids, TRUE);
         return -1;
     }
 
-    const char *due;
-    due = sqlite3_column_text (res2, 0);
-    
-    if (due != NULL)
-        attributes->due_date = strdup(due);
-    else
-        attributes->due_date = strdup(NOT_DUE);
+    purged = purge_items (rdb, (const int *) item_ids->data, item_ids->len);
+    g_array_free (item_ids, TRUE);
 
-    if (attributes->due_date == NULL) {
-        free (attributes->category);
-        free (attributes->freq_type);
-        fprintf (stderr, MEM_FAIL_IN "sql_db.c 5\n");
+    return purged;
+}
+
+/*
+ * FUNC bind_bulk_rule
+ *   Helper function to the bulk edits
+ * Binds rule to ?1 - ?5 of BULK_RULE_WHERE
+ * Returns 1 on success, -1 on error
+ */
+static int bind_bulk_rule (sqlite3_stmt *res, const Bulk_rule *rule)
+{
+    int rc = sqlite3_bind_text (res, 1, rule->category, -1, SQLITE_TRANSIENT);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (res, 2, rule->from_day);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (res, 3, rule->to_day);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_text (res, 4, rule->freq_type, -1, SQLITE_TRANSIENT);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (res, 5, rule->freq);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
         return -1;
     }
 
-    sqlite3_finalize (res2);
-
     return 1;
 }
 
-/* 
- * FUNC create_completion_model_from_db
- *   Creates a completion model from the db using query
- * Returns NULL on error
- *
- * Note: Using NULL for a completion in GTK does not cause a fatal error
- *       therefore the program does not crash out when this happens 
+/*
+ * FUNC run_bulk_edit
+ *   Helper function to the bulk edits
+ * Steps res in a transaction of its own and finalizes it. The due index
+ * (see due_index.c) is dropped first and loaded again when next used,
+ * which beats patching it a row at a time for a large edit.
+ * Returns the number of rows changed, -1 on error
  */
-GtkTreeModel *
-create_completion_model_from_db (char* query)
+static int run_bulk_edit (RoutineDb *rdb, sqlite3_stmt *res)
 {
-    GtkListStore *store;
-    GtkTreeIter iter;
+    sqlite3 *db = rdb->conn;
+    int changed;
 
-    int rc;
-    int count;
+    int rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_finalize (res);
+        return -1;
+    }
 
-    sqlite3_stmt *res;
-    const char *string;
+    due_index_invalidate (rdb->due_index);
 
-    rc = sqlite3_prepare(db, query, -1,
-            &res, 0);
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+        return -1;
+    }
+
+    /* read before COMMIT, which resets it */
+    changed = sqlite3_changes (db);
 
+    rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, COMPLETION_ERROR);
         log_db_error(rc);
-        return NULL;
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+        return -1;
     }
 
-    store = gtk_list_store_new (1, G_TYPE_STRING);
+    return changed;
+}
 
-    rc = sqlite3_step(res);
-    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
-        fprintf(stderr, COMPLETION_ERROR);
+/*
+ * FUNC get_category_id
+ *   Finds the id of the category called name, adding it if there is none
+ * along with any of the categories it is under that are missing
+ * Returns the id, -1 on error
+ */
+int get_category_id (RoutineDb *rdb, const char *name)
+{
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *res;
+    int id = -1;
+
+    int rc = sqlite3_prepare_v2 (db, ADD_CATEGORY_PATHS ("SELECT ?1"),
+                                 -1, &res, 0);
+    if (rc != SQLITE_OK) {
         log_db_error(rc);
-        return NULL;
+        return -1;
     }
 
-    while (rc == SQLITE_ROW) {
-        string = sqlite3_column_text(res,0);
-        gtk_list_store_append (store, &iter);
-        gtk_list_store_set (store, &iter, 0, string, -1);
-        rc = sqlite3_step(res);
+    sqlite3_bind_text (res, 1, name, -1, SQLITE_TRANSIENT);
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        return -1;
     }
 
-    sqlite3_finalize(res);
+    rc = sqlite3_prepare_v2 (db, "SELECT id FROM categories WHERE name = ?",
+                             -1, &res, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        return -1;
+    }
 
-    return GTK_TREE_MODEL (store);
+    sqlite3_bind_text (res, 1, name, -1, SQLITE_TRANSIENT);
+    rc = sqlite3_step (res);
+    if (rc == SQLITE_ROW)
+        id = sqlite3_column_int (res, 0);
+    else
+        log_db_error(rc);
+
+    sqlite3_finalize (res);
 
+    return id;
 }
 
-/* 
- * FUNC change_db_due_date
- *   Changes the due date of an item in the db
+/*
+ * FUNC change_category
+ *   Changes the category of the item matching description to new_category.
+ * Only the item's row of attributes is written, upcoming and history reach
+ * the category through it.
  * Returns 1 on success, -1 on error
  */
-int change_db_due_date (char *description, char *sql_date, char *category)
+int change_category (RoutineDb *rdb, char *description, char *new_category)
 {
+    sqlite3 *db = rdb->conn;
     int rc;
+    sqlite3_stmt *res;
 
-    sqlite3_stmt *res0;
-    char *query_if_in_upcoming = "SELECT * FROM UPCOMING WHERE description = ?";
-    rc = sqlite3_prepare_v2 (db, query_if_in_upcoming, -1, &res0, 0);
+    int category_id = get_category_id (rdb, new_category);
+    if (category_id < 0)
+        return -1;
+
+    rc = sqlite3_prepare_v2 (db, "UPDATE attributes SET category_id = ? "
+                                 "WHERE description = ?", -1, &res, 0);
     if (rc != SQLITE_OK) {
         log_db_error(rc);
         return -1;
     }
-    sqlite3_bind_text (res0, 1, description, strlen(description), SQLITE_TRANSIENT);
 
-    int is_in_upcoming = count_rows_of_res (db, res0);
-    if (is_in_upcoming < 0) {
-        fprintf(stderr, DATABASE_FAIL_TO_CHANGE_DUE_DATE);
-        sqlite3_finalize(res0);
+    sqlite3_bind_int (res, 1, category_id);
+    sqlite3_bind_text (res, 2, description, strlen(description), SQLITE_TRANSIENT);
+
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
+
+    if (rc != SQLITE_DONE) {
+        log_db_error(rc);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * FUNC rename_category
+ *   Renames the category called name to new_name, for every item in it,
+ * along with the categories under it (name/x becomes new_name/x). Where the
+ * new name of one is already a category the two are merged into that one.
+ * A rename writes one row of categories per category. A merge moves the
+ * items over through the attributes_category index and drops the old one.
+ * Returns 1 on success, 0 if there is no category called name or new_name
+ * is above or under it, -1 on error
+ */
+int rename_category (RoutineDb *rdb, const char *name, const char *new_name)
+{
+    sqlite3 *db = rdb->conn;
+    int changed = 0;
+    int merged = 0;
+
+    if (strcmp (name, new_name) == 0)
+        return 1;
+    if (path_is_under (new_name, name) || path_is_under (name, new_name))
+        return 0;
+
+    int rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+
+    /* every category being renamed, and the one it goes into if merged */
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec (db, "CREATE TEMP TABLE renaming (id INTEGER "
+                               "PRIMARY KEY, new_name text, into_id integer)",
+                           NULL, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = run_category_edit (rdb, "INSERT INTO renaming "
+                                "SELECT o.id, " RENAMED_PATH ", e.id "
+                                "FROM category_tree t "
+                                "JOIN categories o ON o.id = t.descendant "
+                                "LEFT JOIN categories e "
+                                "    ON e.name = " RENAMED_PATH " "
+                                "WHERE t.ancestor = (SELECT id "
+                                "    FROM categories WHERE name = ?1)",
+                                name, new_name, &changed);
+
+    if (rc == SQLITE_OK && changed > 0)
+        rc = run_category_edit (rdb, ADD_CATEGORY_PATHS ("SELECT "
+                                    PATH_PARENT ("?2") " "
+                                    "WHERE instr (?2, '/') > 1"),
+                                name, new_name, NULL);
+    if (rc == SQLITE_OK && changed > 0) {
+        merged = count_rows_from_query (rdb, "SELECT id FROM renaming "
+                                        "WHERE into_id IS NOT NULL");
+        if (merged < 0)
+            rc = SQLITE_ERROR;
+    }
+
+    /* the items move before the categories they leave are dropped, so none
+     * points at a category that is gone. That moves more items than the due
+     * index patches one at a time */
+    if (rc == SQLITE_OK && merged > 0) {
+        due_index_invalidate (rdb->due_index);
+        rc = run_category_edit (rdb, "UPDATE attributes SET category_id = "
+                                "    (SELECT r.into_id FROM renaming r "
+                                "    WHERE r.id = attributes.category_id) "
+                                "WHERE category_id IN (SELECT id "
+                                "    FROM renaming WHERE into_id IS NOT NULL)",
+                                name, new_name, NULL);
+    }
+    if (rc == SQLITE_OK && merged > 0)
+        rc = run_category_edit (rdb, "DELETE FROM categories WHERE id IN "
+                                "    (SELECT id FROM renaming "
+                                "    WHERE into_id IS NOT NULL)",
+                                name, new_name, NULL);
+
+    if (rc == SQLITE_OK && changed > merged)
+        rc = run_category_edit (rdb, "UPDATE categories SET name = "
+                                "    (SELECT r.new_name FROM renaming r "
+                                "    WHERE r.id = categories.id) "
+                                "WHERE id IN (SELECT id FROM renaming "
+                                "    WHERE into_id IS NULL)",
+                                name, new_name, NULL);
+
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec (db, "DROP TABLE temp.renaming", NULL, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
         return -1;
     }
 
-    sqlite3_finalize (res0);
+    return (changed > 0) ? 1 : 0;
+}
 
-    if (is_in_upcoming == 1) {
+/*
+ * FUNC run_category_edit
+ *   Helper function to rename_category
+ * Runs query with name bound to ?1 and new_name to ?2, if changed is not
+ * NULL it is set to the number of rows changed
+ * Returns a sqlite3 status code
+ */
+static int run_category_edit (RoutineDb *rdb, const char *query,
+                              const char *name, const char *new_name,
+                              int *changed)
+{
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *res;
 
-        sqlite3_stmt *res;
+    int rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return rc;
 
-        char *query = "UPDATE upcoming SET date = ? WHERE description = ?";
+    sqlite3_bind_text (res, 1, name, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text (res, 2, new_name, -1, SQLITE_TRANSIENT);
 
-        rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
+    if (rc != SQLITE_DONE)
+        return rc;
 
-        if (rc != SQLITE_OK) {
-            log_db_error(rc);
-            return -1;
-        }
+    if (changed != NULL)
+        *changed = sqlite3_changes (db);
 
-        sqlite3_bind_text (res, 1, sql_date, strlen(sql_date), SQLITE_STATIC);
-        sqlite3_bind_text (res, 2, description, strlen(description), SQLITE_STATIC);
+    return SQLITE_OK;
+}
 
-        rc = sqlite3_step (res);
+/*
+ * FUNC path_is_under
+ *   Helper function to rename_category
+ * Returns 1 if the category path is somewhere under the category above, 0
+ * if not (see PATH_UNDER in sql_db.h)
+ */
+static int path_is_under (const char *path, const char *above)
+{
+    size_t len = strlen (above);
 
-        if (rc != SQLITE_DONE) {
-            log_db_error(rc);
-            sqlite3_finalize(res);
-            return -1;
-        }
+    return strncmp (path, above, len) == 0 && path[len] == CATEGORY_SEPARATOR;
+}
+
+/*
+ * FUNC get_item_tags
+ *   Reads the tags of item_id (see version 8 in schema.c) in alphabetical
+ * order, separated by ", ". An item without tags gets ""
+ * Returns NULL on error
+ * NOTE: USES MALLOC
+ */
+char *get_item_tags (RoutineDb *rdb, int item_id)
+{
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *res;
+    const char *tags;
+    char *copy;
 
+    char *query = "SELECT group_concat (name, ', ') FROM (SELECT t.name "\
+                  "FROM item_tags i JOIN tags t ON t.id = i.tag_id "\
+                  "WHERE i.item_id = ? ORDER BY t.name)";
+
+    int rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int (res, 1, item_id);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_step (res);
+    if (rc != SQLITE_ROW) {
+        log_db_error(rc);
         sqlite3_finalize (res);
+        return NULL;
     }
-    /* If no due date, give it a new due date entry */
-    else {
-        int add_success = add_upcoming (description, sql_date, category);
-        if (add_success < 0) {
-            fprintf(stderr, DATABASE_FAIL_TO_CHANGE_DUE_DATE);
-            return -1;
-        }
+
+    tags = (const char *) sqlite3_column_text (res, 0);
+    copy = strdup (tags != NULL ? tags : "");
+    sqlite3_finalize (res);
+
+    if (copy == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "sql_db.c 11\n");
+        exit (EXIT_FAILURE);
     }
+
+    return copy;
 }
 
 /*
- * FUNC change_frequency
- *   Changes the frequency used to calculate due dates for an item
- * Returns 1 on success and -1 on error
+ * FUNC set_item_tags
+ *   Sets the tags of item_id to those in tags, separated by commas, adding
+ * the ones not used before. Names are stored as tag_index_clean_name
+ * leaves them, the in memory index follows through its triggers.
+ *
+ * Returns 1 on success, 0 if a name could not be picked by a tag filter
+ * (nothing is changed), -1 on error
  */
-int change_frequency (char *description, int freq, const char *freq_type)
+int set_item_tags (RoutineDb *rdb, int item_id, const char *tags)
 {
+    sqlite3 *db = rdb->conn;
+    char **names = g_strsplit (tags, ",", -1);
+    int i;
     int rc;
-    sqlite3_stmt *res;
 
-    char *query = "UPDATE attributes SET freq = ?, freq_type = ? WHERE "\
-                   "description = ?";
-
-    rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    for (i = 0; names[i] != NULL; i++) {
+        char *clean = tag_index_clean_name (names[i]);
+        if (clean == NULL) {
+            g_strfreev (names);
+            return 0;
+        }
+        g_free (names[i]);
+        names[i] = g_strdup (clean);
+        free (clean);
+    }
 
-    if (rc != SQLITE_OK) {
-        log_db_error(rc);
-        return -1;
+    rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = run_tag_edit (rdb, "DELETE FROM item_tags WHERE item_id = ?1",
+                           item_id, NULL);
+
+    for (i = 0; rc == SQLITE_OK && names[i] != NULL; i++) {
+        if (names[i][0] == '\0')
+            continue;
+
+        rc = run_tag_edit (rdb, "INSERT OR IGNORE INTO tags (name) VALUES (?2)",
+                           item_id, names[i]);
+        if (rc == SQLITE_OK)
+            rc = run_tag_edit (rdb, "INSERT OR IGNORE INTO item_tags "
+                               "(tag_id, item_id) SELECT id, ?1 FROM tags "
+                               "WHERE name = ?2",
+                               item_id, names[i]);
     }
 
-    rc = sqlite3_bind_int (res, 1, freq); 
-    rc = sqlite3_bind_text (res, 2, freq_type, strlen(freq_type), SQLITE_TRANSIENT);
-    rc = sqlite3_bind_text (res, 3, description , strlen(description), SQLITE_TRANSIENT);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
 
-    rc = sqlite3_step (res);
+    g_strfreev (names);
 
-    if (rc != SQLITE_DONE) {
+    if (rc != SQLITE_OK) {
         log_db_error(rc);
-        sqlite3_finalize(res);
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
         return -1;
     }
 
-    sqlite3_finalize (res);
-
     return 1;
 }
 
 /*
- * FUNC change_category
- *   Changes the category of the item matching description to new_category 
- * Returns 1 on success, -1 on error
+ * FUNC run_tag_edit
+ *   Helper function to set_item_tags
+ * Runs query with item_id bound to ?1 and name (if not NULL) to ?2
+ * Returns a sqlite3 status code
  */
-int change_category (char *description, char *new_category)
+static int run_tag_edit (RoutineDb *rdb, const char *query, int item_id,
+                         const char *name)
 {
-    char *queries[]={"UPDATE history SET category = ? WHERE description = ?",
-                     "UPDATE attributes SET category = ? WHERE description = ?",
-                     "UPDATE upcoming SET category = ? WHERE description = ?"
-                    };
-
-    int num_queries = 3;
-    int rc;
-    for (int i = 0; i < num_queries; i++)
-    {
-        sqlite3_stmt *res;
-        rc = sqlite3_prepare_v2 (db, queries[i], -1, &res, 0);
-        if (rc != SQLITE_OK) {
-            log_db_error(rc);
-            return -1;
-        }
-
-        sqlite3_bind_text (res, 1, new_category, strlen(new_category), SQLITE_TRANSIENT);
-        sqlite3_bind_text (res, 2, description, strlen(description), SQLITE_TRANSIENT);
-
-        rc = sqlite3_step (res);
-        if (rc != SQLITE_DONE) {
-            log_db_error(rc);
-            return -1;
-        }
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *res;
 
-        sqlite3_finalize (res);
+    int rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return rc;
 
-    }
+    sqlite3_bind_int (res, 1, item_id);
+    if (name != NULL)
+        sqlite3_bind_text (res, 2, name, -1, SQLITE_TRANSIENT);
 
-    return 1;
+    rc = sqlite3_step (res);
+    sqlite3_finalize (res);
 
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
 }
 
 /*
@@ -1000,8 +3444,9 @@ int change_category (char *description, char *new_category)
  *   Removes the item matching description from the upcoming table in the db
  * Returns 1 on success, -1 on error
  */
-int remove_from_upcoming (char *description)
+int remove_from_upcoming (RoutineDb *rdb, char *description)
 {
+    sqlite3 *db = rdb->conn;
     int rc;
     sqlite3_stmt *res;
 
@@ -1030,62 +3475,140 @@ int remove_from_upcoming (char *description)
 
 /*
  * FUNC purge_permanently
- *   Removes the item matching description from the db
+ *   Removes the item matching description from the db, see purge_items
+ * Returns 1 on success, -1 on error
  */
-int purge_permanently (char *description)
+int purge_permanently (RoutineDb *rdb, char *description)
 {
-    char *queries[] = {"DELETE FROM upcoming WHERE description = ?",
-                       "DELETE FROM history WHERE description = ?",
-                       "DELETE FROM attributes WHERE description = ?"
-    };
+    int item_id = get_item_id (rdb, description);
+    if (item_id < 0)
+        return -1;
 
-    int num_queries = 3;
-    int rc;
-    for (int i = 0; i < num_queries; i++)
-    {
-        sqlite3_stmt *res;
-        rc = sqlite3_prepare_v2 (db, queries[i], -1, &res, 0);
-        
-        if (rc != SQLITE_OK) {
-            log_db_error(rc);
-            return -1;
-        }
+    return (purge_items (rdb, &item_id, 1) < 0) ? -1 : 1;
+}
 
-        sqlite3_bind_text (res, 1, description, strlen(description), SQLITE_TRANSIENT);
+/*
+ * FUNC purge_items
+ *   Removes count items, by id, from the db along with their due dates,
+ * history, stats, tags and notes, all in one transaction. Deleting an item
+ * takes the rest with it (see version 9 in schema.c). The space freed is
+ * then given back to the file system.
+ * Returns the number of items removed (ids of items that are gone already
+ * do not count), -1 on error with nothing removed
+ */
+int purge_items (RoutineDb *rdb, const int *item_ids, int count)
+{
+    sqlite3 *db = rdb->conn;
+    sqlite3_stmt *res;
+    sqlite3_stmt *archived = NULL;
+    int purged = 0;
+
+    int rc = sqlite3_prepare_v2 (db, "DELETE FROM attributes WHERE id = ?",
+                                 -1, &res, 0);
+    /* triggers cannot reach the archive (see archive.c) */
+    if (rc == SQLITE_OK && rdb->archive_end_day > 0)
+        rc = sqlite3_prepare_v2 (db, "DELETE FROM archive.history "
+                                     "WHERE item_id = ?", -1, &archived, 0);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_finalize (res);
+        return -1;
+    }
 
-        rc = sqlite3_step (res);
+    rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_finalize (res);
+        sqlite3_finalize (archived);
+        return -1;
+    }
 
-        if (rc != SQLITE_DONE) {
-            log_db_error(rc);
-            sqlite3_finalize(res);
-            return 1;
+    /* as with the bulk edits, loaded again once rather than patched */
+    due_index_invalidate (rdb->due_index);
+
+    rc = SQLITE_DONE;
+    for (int i = 0; i < count && rc == SQLITE_DONE; i++) {
+        sqlite3_bind_int (res, 1, item_ids[i]);
+        rc = sqlite3_step (res);
+        sqlite3_reset (res);
+        if (rc == SQLITE_DONE)
+            purged += sqlite3_changes (db);
+
+        if (rc == SQLITE_DONE && archived != NULL) {
+            sqlite3_bind_int (archived, 1, item_ids[i]);
+            rc = sqlite3_step (archived);
+            sqlite3_reset (archived);
         }
+    }
+    sqlite3_finalize (res);
+    sqlite3_finalize (archived);
 
-        sqlite3_finalize (res);
+    if (rc == SQLITE_DONE)
+        rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
 
+    if (rc != SQLITE_OK) {
+        log_db_error(rc);
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+        return -1;
     }
-    return 1;
+
+    /* the cache triggers only watch main.history, a back pane reaching into
+     * the archive would still show the items purged */
+    if (archived != NULL)
+        query_cache_drop_table (rdb->query_cache, CACHED_HISTORY);
+
+    if (purged > 0)
+        reclaim_space (rdb);
+
+    return purged;
+}
+
+/*
+ * FUNC reclaim_space
+ *   Helper function to the purges
+ * Gives the pages on the freelist back to the file system (see
+ * use_incremental_vacuum in schema.c). Done after the purge has committed,
+ * a failure here loses nothing and is only logged.
+ */
+static void reclaim_space (RoutineDb *rdb)
+{
+    sqlite3 *db = rdb->conn;
+    int rc = sqlite3_exec (db, "PRAGMA incremental_vacuum", NULL, NULL, NULL);
+    if (rc != SQLITE_OK)
+        log_db_error(rc);
 }
 
 /*
  * FUNC remove_selected_historical_entries
  *   Walks through a GtkListStore of the completion data for an item, aggregates
  * selected items. Then removes the corresponding entries from the db
+ * The removals and the due date recomputation share one transaction: if any
+ * of them fails none is kept and the store is left as is.
  */
-void remove_selected_historical_entries (GtkWidget *button, GtkListStore *store)
+void remove_selected_historical_entries (RoutineDb *rdb, GtkWidget *button,
+                                         GtkListStore *store)
 {
+  sqlite3 *db = rdb->conn;
   GList *rr_list = NULL;    /* list of GtkTreeRowReferences to remove */
   GList *node;
-  gchar *description;
-  gchar *date_completed; 
+  gint entry_id;
+  char *failure = NULL;     /* shown once the transaction is over */
 
   /* Gather up selected items */
   gtk_tree_model_foreach (GTK_TREE_MODEL(store),
                           (GtkTreeModelForeachFunc) collect_selected,
                           &rr_list);
 
-  /* Walk through list of selected items and process them */
-  for (node = rr_list;  node != NULL;  node = node->next) {
+  int rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+  if (rc != SQLITE_OK) {
+      log_db_error(rc);
+      error_dialog (button, DATABASE_FAIL_REMOVE_HIST);
+      g_list_free_full(rr_list, (GDestroyNotify)gtk_tree_row_reference_free);
+      return;
+  }
+
+  /* Walk through list of selected items and remove them from the db */
+  for (node = rr_list;  node != NULL && failure == NULL;  node = node->next) {
       GtkTreePath *path;
 
       path = gtk_tree_row_reference_get_path((GtkTreeRowReference*)node->data);
@@ -1096,60 +3619,87 @@ void remove_selected_historical_entries (GtkWidget *button, GtkListStore *store)
           if (gtk_tree_model_get_iter(GTK_TREE_MODEL(store), &iter, path)) {
               gtk_tree_model_get (GTK_TREE_MODEL (store),
                                   &iter,
-                                  COLUMN_DESCRIPTION, &description,
-                                  COLUMN_DATE_UNEDITABLE , &date_completed,
+                                  COLUMN_ENTRY_ID, &entry_id,
                                   -1);
 
-              /* The date should be valid so we will not check stat */
-              int stat,m,d,y;
-              stat = parse_and_validate_user_date_str 
-                  (date_completed, &m, &d, &y);
-
               /* remove entry from history table */
-              char *completion_date = make_date_str_sql_frmt (m,d,y);
-              if (completion_date == NULL) {
-                  fprintf (stderr, MEM_FAIL_IN "sql_db.c 6\n");
-                  exit (EXIT_FAILURE);
-              }
+              if (remove_entry_from_history (rdb, entry_id) < 0)
+                  failure = DATABASE_FAIL_REMOVE_HIST;
+          }
+          gtk_tree_path_free(path);
+      }
+  }
 
-              int h_stat = 1;
-              h_stat = remove_entry_from_history (description, completion_date);
-              if (h_stat < 0)
-                  error_dialog (button, DATABASE_FAIL_REMOVE_HIST);
-              else 
-                  gtk_list_store_remove(store, &iter);
+  if (failure == NULL && recompute_dirty_due_dates (rdb) < 0)
+      failure = DATABASE_UPDATE_DUE_DATE_FAIL;
 
-              free (completion_date);
-              free (description);
-              free (date_completed);
-          }
+  if (failure == NULL) {
+      rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+      if (rc != SQLITE_OK) {
+          log_db_error(rc);
+          failure = DATABASE_FAIL_REMOVE_HIST;
+      }
+  }
+
+  if (failure != NULL) {
+      sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+      error_dialog (button, failure);
+      g_list_free_full(rr_list, (GDestroyNotify)gtk_tree_row_reference_free);
+      return;
+  }
+
+  /* only now that they are gone from the db */
+  for (node = rr_list;  node != NULL;  node = node->next) {
+      GtkTreePath *path;
+
+      path = gtk_tree_row_reference_get_path((GtkTreeRowReference*)node->data);
+
+      if (path) {
+          GtkTreeIter iter;
+
+          if (gtk_tree_model_get_iter(GTK_TREE_MODEL(store), &iter, path))
+              gtk_list_store_remove(store, &iter);
           gtk_tree_path_free(path);
       }
   }
+
   g_list_free_full(rr_list, (GDestroyNotify)gtk_tree_row_reference_free);
 }
 
-
 /*
  * FUNC change_hist_on_selected
  *   Walks through the GtkListStore containing the completion histroy of an item
  * and modifes the completion date based on user input of selected items.
+ * The changes and the due date recomputation share one transaction: if any
+ * of them fails (or a new date is not valid) none is kept and the store is
+ * left as is.
  */
-void change_hist_on_selected (GtkWidget *button, GtkListStore *store)
+void change_hist_on_selected (RoutineDb *rdb, GtkWidget *button,
+                              GtkListStore *store)
 {
+  sqlite3 *db = rdb->conn;
   GList *rr_list = NULL;    /* list of GtkTreeRowReferences to remove */
   GList *node;
-  gchar *description;
-  gchar *old_date; 
+  gint entry_id;
+  gint new_day;             /* validated by cell_edited, 0 if invalid */
   gchar *new_date;
+  char *failure = NULL;     /* shown once the transaction is over */
 
   /* Gather up selected items */
   gtk_tree_model_foreach (GTK_TREE_MODEL(store),
                           (GtkTreeModelForeachFunc) collect_selected,
                           &rr_list);
 
-  /* Walk through list of selected items and process them */
-  for (node = rr_list;  node != NULL;  node = node->next) {
+  int rc = sqlite3_exec (db, "BEGIN", NULL, NULL, NULL);
+  if (rc != SQLITE_OK) {
+      log_db_error(rc);
+      error_dialog (button, DATABASE_EDIT_HIST_FAIL);
+      g_list_free_full(rr_list, (GDestroyNotify)gtk_tree_row_reference_free);
+      return;
+  }
+
+  /* Walk through list of selected items and change them in the db */
+  for (node = rr_list;  node != NULL && failure == NULL;  node = node->next) {
       GtkTreePath *path;
 
       path = gtk_tree_row_reference_get_path((GtkTreeRowReference*)node->data);
@@ -1160,77 +3710,62 @@ void change_hist_on_selected (GtkWidget *button, GtkListStore *store)
           if (gtk_tree_model_get_iter(GTK_TREE_MODEL(store), &iter, path)) {
               gtk_tree_model_get (GTK_TREE_MODEL (store),
                                   &iter,
-                                  COLUMN_DESCRIPTION, &description,
-                                  COLUMN_DATE_ENTRY, &new_date,
-                                  COLUMN_DATE_UNEDITABLE , &old_date,
+                                  COLUMN_ENTRY_ID, &entry_id,
+                                  COLUMN_DAY_ENTRY, &new_day,
                                   -1);
 
-              /* Check user input */
-              int stat,m,d,y;
-              stat = parse_and_validate_user_date_str (
-                      (char*) new_date, &m, &d, &y);
-
-              if ( stat == 0 ) {
-                  error_dialog (button, INVALID_DATE\
-                                         DATE_FRMT_EXPLAIN);
-
-                  free (description);
-                  free (new_date);
-                  free (old_date);
-                  gtk_tree_path_free(path);
-
-                  continue;
-              }
-
-              /* Convert user input new_date to SQL format */
-              char *new_date_sql = make_date_str_sql_frmt (m, d, y);
-              if (new_date_sql == NULL) {
-                  fprintf (stderr, MEM_FAIL_IN "sql_db.c 7\n");
-                  exit (EXIT_FAILURE);
-              }
+              /* Change histroical entry */
+              if (new_day == 0)
+                  failure = INVALID_DATE DATE_FRMT_EXPLAIN;
+              else if (change_hist_date (rdb, entry_id, new_day) < 0)
+                  failure = DATABASE_EDIT_HIST_FAIL;
+          }
+          gtk_tree_path_free(path);
+      }
+  }
 
-              /* Convert old_date to SQL format */
-              int m2, d2, y2;
-              stat = parse_and_validate_user_date_str (old_date, 
-                      &m2, &d2, &y2);
-              char *old_date_sql = make_date_str_sql_frmt (m2, d2, y2);
-              if (old_date_sql == NULL) {
-                  fprintf (stderr, MEM_FAIL_IN "sql_db.c 8\n");
-                  exit (EXIT_FAILURE);
-              }
+  if (failure == NULL && recompute_dirty_due_dates (rdb) < 0)
+      failure = DATABASE_UPDATE_DUE_DATE_FAIL;
 
-              /* Change histroical entry */
-              int change_status = 1;
-              change_status = change_hist_date (description, old_date_sql, new_date_sql);
-              if (change_status < 0) {
-                  error_dialog (button, DATABASE_EDIT_HIST_FAIL);
+  if (failure == NULL) {
+      rc = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+      if (rc != SQLITE_OK) {
+          log_db_error(rc);
+          failure = DATABASE_EDIT_HIST_FAIL;
+      }
+  }
 
-                  free (new_date_sql);
-                  free (old_date_sql);
+  if (failure != NULL) {
+      sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+      error_dialog (button, failure);
+      g_list_free_full(rr_list, (GDestroyNotify)gtk_tree_row_reference_free);
+      return;
+  }
 
-                  free (description);
-                  free (new_date);
-                  free (old_date);
+  /* only now that they are changed in the db */
+  for (node = rr_list;  node != NULL;  node = node->next) {
+      GtkTreePath *path;
 
-                  gtk_tree_path_free(path);
+      path = gtk_tree_row_reference_get_path((GtkTreeRowReference*)node->data);
 
-                  continue;
-              }
+      if (path) {
+          GtkTreeIter iter;
 
+          if (gtk_tree_model_get_iter(GTK_TREE_MODEL(store), &iter, path)) {
+              gtk_tree_model_get (GTK_TREE_MODEL (store), &iter,
+                                  COLUMN_DATE_ENTRY, &new_date,
+                                  COLUMN_DAY_ENTRY, &new_day,
+                                  -1);
               gtk_list_store_set (store, &iter, 
                                   COLUMN_DATE_UNEDITABLE, new_date, 
+                                  COLUMN_DAY_UNEDITABLE, new_day,
                                   -1);
-
-              free (new_date_sql);
-              free (old_date_sql);
-              free (description);
               free (new_date);
-              free (old_date);
-
           }
           gtk_tree_path_free(path);
       }
   }
+
   g_list_free_full(rr_list, (GDestroyNotify)gtk_tree_row_reference_free);
 }
 
@@ -1239,13 +3774,14 @@ void change_hist_on_selected (GtkWidget *button, GtkListStore *store)
  *   Walks through a GtkListStore of items, pushes the due dates of items 
  * selected by user back to the date speicified by the user.
  */
-void snooze_selected_items (GtkWidget *button, GtkListStore *store)
+void snooze_selected_items (RoutineDb *rdb, GtkWidget *button,
+                            GtkListStore *store)
 {
   GList *rr_list = NULL;    /* list of GtkTreeRowReferences to remove */
   GList *node;
 
-  gchar *description;
-  gchar *date;
+  gint item_id;
+  gint day;                 /* validated by cell_edited, 0 if invalid */
 
   /* Gather up selected items */
   gtk_tree_model_foreach (GTK_TREE_MODEL(store),
@@ -1264,43 +3800,25 @@ void snooze_selected_items (GtkWidget *button, GtkListStore *store)
           if (gtk_tree_model_get_iter(GTK_TREE_MODEL(store), &iter, path)) {
               gtk_tree_model_get (GTK_TREE_MODEL (store),
                                   &iter,
-                                  COLUMN_DESCRIPTION, &description,
-                                  COLUMN_DATE_ENTRY, &date,
+                                  COLUMN_ITEM_ID, &item_id,
+                                  COLUMN_DAY_ENTRY, &day,
                                   -1);
 
-              /* Check user input */
-              int stat,m,d,y;
-              stat = parse_and_validate_user_date_str (
-                      (char*) date, &m, &d, &y);
-
-              if ( stat == 0 ) {
+              if (day == 0) {
                   error_dialog (button, INVALID_DATE\
                                          DATE_FRMT_EXPLAIN);
-                  free (date);
-                  free (description);
                   gtk_tree_path_free(path);
 
                   continue;
               }
 
-              /* Convert user input new_date to SQL format */
-              char *date_sql_frmt = make_date_str_sql_frmt (m, d, y);
-              if (date_sql_frmt == NULL) {
-                  fprintf (stderr, MEM_FAIL_IN "sql_db.c 9\n");
-                  exit (EXIT_FAILURE);
-              }
-              
               /* Snooze the item */
               int pb_success = 1;
-              pb_success = push_back_upcoming (description, date_sql_frmt);
+              pb_success = push_back_upcoming (rdb, item_id, day);
               if (pb_success < 0)
                   error_dialog (button, DATABASE_SNOOZE_FAIL);
               else
                   gtk_list_store_remove (store, &iter);
-                                  
-              free (date);
-              free (description);
-              free (date_sql_frmt);
 
           }
           gtk_tree_path_free(path);
@@ -1309,20 +3827,19 @@ void snooze_selected_items (GtkWidget *button, GtkListStore *store)
   g_list_free_full(rr_list, (GDestroyNotify)gtk_tree_row_reference_free);
 }
 
-
 /*
  * FUNC complete_selected_items
  *   Walks through a GtkListStore of items, marks the items selected by user
  * with completion dates also provided by the user.
  */
-void complete_selected_items (GtkWidget *button, GtkListStore *store)
+void complete_selected_items (RoutineDb *rdb, GtkWidget *button,
+                              GtkListStore *store)
 {
   GList *rr_list = NULL;    /* list of GtkTreeRowReferences to remove */
   GList *node;
 
-  gchar *description;
-  gchar *date;
-  gchar *category;
+  gint item_id;
+  gint day;                 /* validated by cell_edited, 0 if invalid */
 
   /* Gather up selected items */
   gtk_tree_model_foreach (GTK_TREE_MODEL(store),
@@ -1341,82 +3858,46 @@ void complete_selected_items (GtkWidget *button, GtkListStore *store)
           if (gtk_tree_model_get_iter(GTK_TREE_MODEL(store), &iter, path)) {
               gtk_tree_model_get (GTK_TREE_MODEL (store),
                                   &iter,
-                                  COLUMN_DESCRIPTION, &description,
-                                  COLUMN_DATE_ENTRY, &date,
-                                  COLUMN_CATEGORY , &category,
+                                  COLUMN_ITEM_ID, &item_id,
+                                  COLUMN_DAY_ENTRY, &day,
                                   -1);
 
-              /* Check user input */
-              int stat,m,d,y;
-              stat = parse_and_validate_user_date_str (
-                      (char*) date, &m, &d, &y);
-
-              if ( stat == 0 ) {
+              if (day == 0) {
                   error_dialog (button, INVALID_DATE\
                                          DATE_FRMT_EXPLAIN);
-                  free (date);
-                  free (description);
-                  free (category);
                   gtk_tree_path_free(path);
 
                   continue;
               }
 
-              /* Convert user input new_date to SQL format */
-              char *date_sql_frmt = make_date_str_sql_frmt (m, d, y);
-              if (date_sql_frmt == NULL) {
-                  fprintf (stderr, MEM_FAIL_IN "sql_db.c 10\n");
-                  exit (EXIT_FAILURE);
-              }
-
               /* Update completion on item */
-              int is_tracked = get_tracking_from_db (description);
+              int is_tracked = get_tracking_from_db (rdb, item_id);
               if (is_tracked < 0) {
                   error_dialog (button, DATABASE_FAILED_TO_GET_TRACKING);
-
                   gtk_tree_path_free (path);
-                  free (date_sql_frmt);
-                  free (description);
-                  free (date);
-                  free (category);
 
                   continue;
               }
 
               int h_success = 1;
               if (is_tracked == 1)
-                  h_success = add_history (description, date_sql_frmt, category);
+                  h_success = add_history (rdb, item_id, day);
               if (h_success < 0) {
                   error_dialog (button, DATABASE_MARK_COMPLETE_FAIL);
-
-                  free (date);
-                  free (description);
-                  free (category);
                   gtk_tree_path_free (path);
-                  free (date_sql_frmt);
 
                   continue;
               }
 
               int u_success = 1;
-              u_success = update_due_date (description, date_sql_frmt);
+              u_success = update_due_date (rdb, item_id, day);
               if (u_success < 0) {
                   error_dialog (button, DATABASE_UPDATE_DUE_DATE_FAIL);
-
-                  free (date);
-                  free (description);
-                  free (category);
                   gtk_tree_path_free (path);
-                  free (date_sql_frmt);
 
                   continue;
               }
 
-              free (date_sql_frmt);
-              free (date);
-              free (description);
-              free (category);
-
           }
           gtk_tree_path_free(path);
       }
@@ -1426,62 +3907,91 @@ void complete_selected_items (GtkWidget *button, GtkListStore *store)
 
 /*
  * FUNC get_last_completion
- *   Returns the SQL formatted date string of the date an item was last 
- * completed that matches description or returns "" is no such item was 
- * found; returns NULL on error 
+ *   Returns the day number of the date the item matching item_id was last
+ * completed, 0 if it was never completed, or -1 on error 
  *
  * Helper function to update_due_date, adding a completion record for an item
  * that pre-dates the most recent completion date should NOT change the next 
  * due date for the item.
+ */
+int get_last_completion (RoutineDb *rdb, int item_id)
+{
+    Item_stats stats;
+
+    if (get_item_stats (rdb, item_id, &stats) < 0)
+        return -1;
+
+    return stats.last_day;
+}
+
+/*
+ * FUNC get_item_stats
+ *   Loads the completion summary of the item matching item_id into stats.
+ * item_stats is kept up to date by triggers on history (see schema.c) so
+ * this is a single primary key lookup, and one index range of the archive
+ * (see archive.c) for what it does not count once there is one.
+ * An item that was never completed gets all zeros.
  *
- * ALLOCATES MEMORY NEEDS TO BE FREED BY CALLER
+ * Returns 1 on success, -1 on error
  */
-char *get_last_completion(char *description)
+int get_item_stats (RoutineDb *rdb, int item_id, Item_stats *stats)
 {
+    sqlite3 *db = rdb->conn;
     int rc;
     sqlite3_stmt *res;
-    char *query = "select MAX(date) from history where description = ?";
-
-    rc = sqlite3_prepare_v2 (db, query, -1, &res, 0);
+    char *query = "SELECT completions, first_date, last_date FROM item_stats "\
+                  "WHERE item_id = ?1";
+    /* the archive only has completions older than those of history */
+    char *archived_query =
+        "SELECT s.completions + a.n, IFNULL(a.first_date, s.first_date), "\
+        "IFNULL(s.last_date, a.last_date) FROM item_stats s, "\
+        "(SELECT COUNT(*) AS n, MIN(date) AS first_date, "\
+        "MAX(date) AS last_date FROM archive.history WHERE item_id = ?1) a "\
+        "WHERE s.item_id = ?1";
+
+    rc = sqlite3_prepare_v2 (db, (rdb->archive_end_day > 0) ?
+                             archived_query : query, -1, &res, 0);
 
     if (rc != SQLITE_OK) {
         log_db_error(rc);
-        return NULL;
+        return -1;
     }
 
-    rc = sqlite3_bind_text (res, 1, description, strlen(description), 
-            SQLITE_STATIC);
-    
-    if (rc != SQLITE_OK) {
-        log_db_error(rc);
-        return NULL;
-    }
+    sqlite3_bind_int (res, 1, item_id);
 
     rc = sqlite3_step (res);
+
+    if (rc == SQLITE_DONE) {
+        stats->completions = 0;
+        stats->first_day   = 0;
+        stats->last_day    = 0;
+        sqlite3_finalize (res);
+        return 1;
+    }
     
     if (rc != SQLITE_ROW) {
         log_db_error(rc);
         sqlite3_finalize(res);
-        return NULL;
+        return -1;
     }
 
-    const char *date = sqlite3_column_text(res , 0);
-    if (date != NULL) {
-        char *last_completed = strdup(date);
-        sqlite3_finalize (res);
-        return last_completed;
-    }
-    else {
-        sqlite3_finalize (res);
-        return "";
-    }
+    /* day_from_sql_date_str gives 0 for NULL, ie never completed */
+    stats->completions = sqlite3_column_int (res, 0);
+    stats->first_day   = day_from_sql_date_str (sqlite3_column_text (res, 1));
+    stats->last_day    = day_from_sql_date_str (sqlite3_column_text (res, 2));
+
+    sqlite3_finalize (res);
 
+    return 1;
 }
 
 void log_db_error (int status_code)
 {
+    /* only a View_db is ever interrupted, and on purpose (see open_view_db) */
+    if (status_code == SQLITE_INTERRUPT)
+        return;
+
     const char *err_msg = sqlite3_errstr(status_code);
     /* Note that we do not need to free err_msg with sqlite3_free */
     fprintf(stderr, "Error: %s\n", err_msg);
 }
-
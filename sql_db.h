@@ -7,8 +7,51 @@
 #include <sqlite3.h>
 #include <gtk/gtk.h>
 
+#include "tag_set.h"
+
+/* Columns create_main_model_from_db expects a query to return, in order,
+ * and the tables to select them from. The category is the item's (see
+ * version 6 in schema.c), the row's own only for rows without an item */
+#define UPCOMING_COLUMNS \
+    "u.description, u.date, IFNULL(c.name, u.category), u.item_id, 0"
+#define UPCOMING_TABLES \
+    "upcoming u LEFT JOIN attributes a ON a.id = u.item_id "\
+    "LEFT JOIN categories c ON c.id = a.category_id"
+#define HISTORY_COLUMNS \
+    "h.description, h.date, IFNULL(c.name, h.category), h.item_id, h.id"
+#define HISTORY_TABLES \
+    "history h LEFT JOIN attributes a ON a.id = h.item_id "\
+    "LEFT JOIN categories c ON c.id = a.category_id"
+
+/* Categories are paths (Fleet/Truck 12/Engine), see version 7 in schema.c.
+ * SQL for the number of levels below the top of path x, for whether path x
+ * is somewhere under path a, and for the path x is directly under */
+#define CATEGORY_SEPARATOR '/'
+#define PATH_DEPTH(x) \
+    "(length (" x ") - length (replace (" x ", '/', '')))"
+#define PATH_UNDER(x, a) \
+    "substr (" x ", 1, length (" a ") + 1) = " a " || '/'"
+#define PATH_PARENT(x) \
+    "substr (" x ", 1, length (rtrim (" x ", replace (" x ", '/', ''))) - 1)"
+
+/* Adds the categories named by the query seed, and every one they are
+ * under, that are not there yet */
+#define ADD_CATEGORY_PATHS(seed) \
+    "WITH RECURSIVE path (name) AS (" seed " "\
+    "    UNION SELECT " PATH_PARENT ("name") " FROM path "\
+    "    WHERE instr (name, '/') > 1) "\
+    "INSERT OR IGNORE INTO categories (name) SELECT name FROM path "\
+    "    WHERE name <> ''"
+
+/* A db and what is kept for its connection (statements, in memory indexes,
+ * the archive), see routine_db_open. Every function below taking one works
+ * on that db alone, so several can be open at once, each used by one thread
+ * at a time */
+typedef struct routine_db RoutineDb;
+
 /* Gets attributes for selected_view.c and ferries them off... */
 typedef struct attributes_raw {
+    int      id;
     char    *description; 
     char    *due_date; 
     int      freq;
@@ -18,55 +61,207 @@ typedef struct attributes_raw {
 } Attributes_raw;
 
 
+/* Completion summary of an item, read from the item_stats table */
+typedef struct item_stats {
+    int completions;
+    int first_day;      /* day number of first completion, 0 if none */
+    int last_day;       /* day number of last completion, 0 if none */
+} Item_stats;
+
+/* Pages through history a few rows at a time (keyset pagination). The same
+ * prepared statement is re-bound with the (date, id) of the last row loaded
+ * to fetch each following page. */
+typedef struct hist_pager {
+    RoutineDb *rdb;     /* the statement is one of its */
+    sqlite3_stmt *stmt;
+    char last_date[11]; /* sql date of the last row loaded */
+    int  last_id;       /* history id of the last row loaded */
+    int  done;          /* 1 once the last page has been loaded */
+    int  start_day;     /* range paged by hist_pager_new_for_range, */
+    int  end_day;       /* 0 for a pager over an item */
+    int  category_id;   /* only items under this category, 0 for all */
+    Tag_set *tags;      /* only items in it (a copy), NULL for all */
+} HistPager;
+
+/* Picks the upcoming items a bulk edit (see shift_by_rule) applies to, an
+ * unset criterion matches every item */
+typedef struct bulk_rule {
+    const char *category;   /* and those under it, NULL for any category */
+    int from_day;           /* due on or after, 0 for no bound */
+    int to_day;             /* due on or before, 0 for no bound */
+    const char *freq_type;  /* repeating every freq freq_type, NULL for any */
+    int freq;
+} Bulk_rule;
+
+/* Columns of create_category_counts_model, a row for every category with
+ * items, in tree order */
+enum {
+    CATEGORY_COLUMN_ID = 0,
+    CATEGORY_COLUMN_NAME,   /* full path */
+    CATEGORY_COLUMN_DEPTH,  /* 0 for a category at the top */
+    CATEGORY_COLUMN_DUE,    /* items due by today in it and under it */
+    NUM_CATEGORY_COLUMNS
+};
+
+/* Steps through the items due, most urgent first, a batch at a time for
+ * views that show the first rows before the rest are loaded (see
+ * row_feed.c) */
+typedef struct upcoming_cursor {
+    RoutineDb *rdb;     /* the statement is one of its */
+    sqlite3_stmt *stmt;
+    int done;           /* 1 once the last row has been loaded */
+    Tag_set *tags;      /* only items in it (a copy), NULL for all */
+} UpcomingCursor;
+
+
 /* prototypes */
 
-/* open close and access db */
-int init_db ();
-int close_db ();
-sqlite3 *access_db (); 
+/* open close and access db. A path of NULL opens the database of the
+ * config (see config.c), upkeep is for a RoutineDb of the main thread. A
+ * RoutineDb opened read only has no connection of its own, it is only read
+ * through View_dbs */
+int routine_db_open (const char *path, RoutineDb **rdb);
+RoutineDb *routine_db_open_readonly (const char *path);
+void routine_db_start_upkeep (RoutineDb *rdb);
+int routine_db_close (RoutineDb *rdb);
+sqlite3 *routine_db_conn (RoutineDb *rdb);
+struct query_cache *routine_db_query_cache (RoutineDb *rdb);
+struct tag_index *routine_db_tag_index (RoutineDb *rdb);
+
+/* read only connection for another thread, and a counter of writes made
+ * through the connection of rdb (see prefetch.c) */
+sqlite3 *open_reader_db (RoutineDb *rdb);
+int db_write_generation (RoutineDb *rdb);
+
+/* A reader connection whose queries can be cancelled from another thread,
+ * see open_view_db */
+typedef struct view_db {
+    sqlite3 *conn;
+    GCancellable *cancellable;
+    gulong handler_id;
+    RoutineDb *rdb;     /* takes the connection back, see close_view_db */
+} View_db;
+
+View_db *open_view_db (RoutineDb *rdb, GCancellable *cancellable);
+void close_view_db (View_db *vdb);
 
 /* Grab one attribute */
-char *get_last_completion(char *description); /* ALLOCATES MEMORY NEEDS TO BE FREED BY CALLER */
-int get_tracking_from_db (char *description);
+int get_item_id (RoutineDb *rdb, const char *description);
+int get_last_completion (RoutineDb *rdb, int item_id);
+int get_tracking_from_db (RoutineDb *rdb, int item_id);
+int get_item_stats (RoutineDb *rdb, int item_id, Item_stats *stats);
 
 /* utilities */
 int count_rows_of_res(sqlite3 *db, sqlite3_stmt *res);
-int count_rows_from_query (char *query);
-int desc_already_in_use (const gchar *desc);
-char *make_sql_date_modifier(int freq, const char* freq_type); /* ALLOCATES MEMORY NEEDS TO BE FREED BY CALLER */
+int count_rows_from_query (RoutineDb *rdb, char *query);
+int desc_already_in_use (RoutineDb *rdb, const gchar *desc);
 void log_db_error (int rc);
 
-int add_history(char *desc, char *sql_date_str, char *category);
-int update_due_date (char *description, char *sql_date);
-int push_back_upcoming (const char *desc, char *sql_date_str);
+int add_history (RoutineDb *rdb, int item_id, int day);
+int update_due_date (RoutineDb *rdb, int item_id, int day);
+int push_back_upcoming (RoutineDb *rdb, int item_id, int day);
+
+/* due dates derived from the latest completion (see schema.c version 4) */
+int recompute_dirty_due_dates (RoutineDb *rdb);
+int rebuild_due_dates (RoutineDb *rdb);
 
-int add_attributes(const char* desc, const char* category, int freq, const gchar* freq_type, const gchar* track_history);
+int add_attributes(RoutineDb *rdb, const char* desc, const char* category,
+                   int freq, const gchar* freq_type,
+                   const gchar* track_history);
 
-int add_upcoming(const char *desc, char *sql_date_str, const char *category);
+int add_upcoming(RoutineDb *rdb, const char *desc, char *sql_date_str);
 
-int load_rest_of_attributes_raw_from_desc (Attributes_raw *attributes);
+int load_rest_of_attributes_raw_from_desc (RoutineDb *rdb,
+                                           Attributes_raw *attributes);
 
-int change_category (char *description, char *new_category);
-int change_db_due_date (char *description, char *sql_date, char *category);
-int change_frequency (char *description, int freq, const char *freq_type);
-int change_hist_date (gchar* description, 
-                       gchar* completion_date, 
-                       char *new_date);
+int get_category_id (RoutineDb *rdb, const char *name);
+int change_category (RoutineDb *rdb, char *description, char *new_category);
+int rename_category (RoutineDb *rdb, const char *name, const char *new_name);
+char *get_item_tags (RoutineDb *rdb, int item_id);
+int set_item_tags (RoutineDb *rdb, int item_id, const char *tags);
+int change_db_due_date (RoutineDb *rdb, char *description, char *sql_date);
+int change_frequency (RoutineDb *rdb, char *description, int freq,
+                      const char *freq_type);
+int change_hist_date (RoutineDb *rdb, int entry_id, int new_day);
 
-int remove_entry_from_history (gchar* description, gchar* completion_date);
-int remove_from_upcoming (char *description);
-int purge_permanently (char *description);
+/* bulk edits, one statement for every item matching rule */
+int count_by_rule (RoutineDb *rdb, const Bulk_rule *rule);
+int shift_by_rule (RoutineDb *rdb, const Bulk_rule *rule, int days);
+int change_frequency_by_rule (RoutineDb *rdb, const Bulk_rule *rule, int freq,
+                              const char *freq_type);
+int purge_by_rule (RoutineDb *rdb, const Bulk_rule *rule);
 
+int remove_entry_from_history (RoutineDb *rdb, int entry_id);
+int remove_from_upcoming (RoutineDb *rdb, char *description);
+int purge_permanently (RoutineDb *rdb, char *description);
+/* removes the items and everything of them in one transaction, returns the
+ * number removed, -1 on error */
+int purge_items (RoutineDb *rdb, const int *item_ids, int count);
+
+
+/* history pagers, newest first for an item, oldest first for a range.
+ * A category_id of 0 is every category here and below, tags of NULL every
+ * item here and below (see tag_filter.c) */
+HistPager *hist_pager_new_for_item (RoutineDb *rdb, int item_id);
+HistPager *hist_pager_new_for_range (RoutineDb *rdb, int start_day, int end_day,
+                                     int category_id, const Tag_set *tags);
+HistPager *hist_pager_new_for_range_from (RoutineDb *rdb, int start_day,
+                                          int end_day, int category_id,
+                                          const Tag_set *tags,
+                                          const char *last_date, int last_id,
+                                          int done);
+int hist_pager_load_page (HistPager *pager, GtkListStore *store);
+void hist_pager_attach (GtkWidget *sw, HistPager *pager);
+void hist_pager_free (HistPager *pager);
 
 /* Walks GtkListStore and acts on selected */
-void change_hist_on_selected (GtkWidget *button, GtkListStore *store);
-void snooze_selected_items (GtkWidget *button, GtkListStore *store);
-void complete_selected_items (GtkWidget *button, GtkListStore *store);
-void remove_selected_historical_entries (GtkWidget *button, GtkListStore *store);
+void change_hist_on_selected (RoutineDb *rdb, GtkWidget *button,
+                              GtkListStore *store);
+void snooze_selected_items (RoutineDb *rdb, GtkWidget *button,
+                            GtkListStore *store);
+void complete_selected_items (RoutineDb *rdb, GtkWidget *button,
+                              GtkListStore *store);
+void remove_selected_historical_entries (RoutineDb *rdb, GtkWidget *button,
+                                         GtkListStore *store);
 
 /* Gtk models loaded from db */
-GtkTreeModel * create_main_model_from_db (char *query);
-GtkTreeModel *create_completion_model_from_db (char* query);
+GtkTreeModel * create_main_model_from_db (RoutineDb *rdb, char *query);
+GtkTreeModel *create_main_model_from_pager (HistPager *pager);
+GtkTreeModel *create_upcoming_model_for_range (RoutineDb *rdb, int start_day,
+                                               int end_day);
+GtkTreeModel *create_upcoming_model_on (sqlite3 *conn, int start_day,
+                                        int end_day, int category_id,
+                                        const Tag_set *tags);
+GtkTreeModel *create_upcoming_model_indexed (RoutineDb *rdb, int start_day,
+                                             int end_day, const Tag_set *tags);
+GtkTreeModel *create_urgent_model (RoutineDb *rdb, int limit);
+GtkTreeModel *create_urgent_model_head (RoutineDb *rdb, int head_rows,
+                                        int category_id, const Tag_set *tags,
+                                        UpcomingCursor **rest);
+int upcoming_cursor_load (UpcomingCursor *cursor, GtkListStore *store,
+                          int limit);
+void upcoming_cursor_free (UpcomingCursor *cursor);
+GtkTreeModel *create_hist_range_model_on (RoutineDb *rdb, sqlite3 *conn,
+                                          int start_day, int end_day,
+                                          int category_id, const Tag_set *tags,
+                                          char *last_date, int *last_id,
+                                          int *done);
+GtkTreeModel *create_upcoming_model_by_date_on (sqlite3 *conn, int start_day,
+                                                int end_day);
+GtkTreeModel *create_hist_range_model_all_on (RoutineDb *rdb, sqlite3 *conn,
+                                              int start_day, int end_day);
+GtkTreeModel *create_category_counts_model (RoutineDb *rdb);
+
+/* rows of the models above (columns of main_enum.h) */
+GtkListStore *new_main_store (void);
+int set_main_row (GtkListStore *store, GtkTreeIter *iter,
+                  const char *description, const char *category, int day,
+                  int item_id, int entry_id, const char *today_str, int today);
+GtkTreeModel *create_completion_model_from_db (RoutineDb *rdb, char* query);
+
+/* model of edit_select_view (defined there), also built by prefetch.c */
+GtkTreeModel *create_attributes_model (sqlite3 *db, int category_id,
+                                       const Tag_set *tags);
 
 /* end of prototypes */
 
@@ -0,0 +1,662 @@
+/*******************************************************************************
+ * sql_funcs.c
+ * Date and recurrence functions registered on the db connection so that they
+ * can be used from SQL, ie: in set based UPDATEs over every item.
+ *
+ *   next_due(date, freq, freq_type)  date the item is due next if it was
+ *                                    completed on date, NULL for no_repeat
+ *   days_between(from, to)           number of days from "from" to "to"
+ *   urgency(date, today, freq,       days overdue on today over the length
+ *           freq_type)               of the repeat interval, NULL if not due
+ *   user_date(date)                  date rendered in user format
+ *   parse_user_date(text)            user format text as a sql date
+ *   occurrences(start, end)          table of every due date of every item
+ *                                    from start to end (see below)
+ *
+ * Dates are sql formatted text (YYYY-MM-DD). Every function returns NULL if
+ * an argument is NULL or not a valid date (urgency takes a NULL freq and
+ * freq_type as not repeating). All of them are flagged
+ * SQLITE_DETERMINISTIC. NOTE: user_date and parse_user_date depend on the
+ * language file compiled in, so do not use them in an index.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h> /* needed because we make use of "setup.h" */
+
+#include "dates.h"
+#include "setup.h"
+#include "sql_funcs.h"
+
+/*
+ * The occurrences table valued function
+ *
+ *   SELECT * FROM occurrences('2024-01-01', '2033-12-31')
+ *
+ * gives one row (item_id, description, category, date) for every day an item
+ * in upcoming is due between start and end (inclusive), assuming it gets
+ * completed on its due date each time. Rows are generated as the cursor
+ * advances, item by item, nothing is materialized. Constraints on category
+ * (=) and on date (<, <=, >, >=) are pushed down into the generator.
+ */
+
+/* columns of the occurrences table */
+enum {
+    OCC_ITEM_ID = 0,
+    OCC_DESCRIPTION,
+    OCC_CATEGORY,
+    OCC_DATE,
+    OCC_START,    /* hidden, first argument */
+    OCC_END       /* hidden, second argument */
+};
+
+/* bits of idxNum telling occ_filter which constraints were pushed down,
+ * the arguments come in this order */
+#define OCC_HAS_START    1
+#define OCC_HAS_END      2
+#define OCC_HAS_CATEGORY 4
+#define OCC_DATE_GE      8
+#define OCC_DATE_GT      16
+#define OCC_DATE_LE      32
+#define OCC_DATE_LT      64
+
+/* items to generate occurrences for, ?1 is the last day wanted as a date */
+#define OCC_ITEMS_QUERY \
+    "SELECT u.item_id, u.description, c.name, u.date, a.freq, "\
+    "a.freq_type FROM upcoming u JOIN attributes a ON a.id = u.item_id "\
+    "LEFT JOIN categories c ON c.id = a.category_id "\
+    "WHERE u.date <= ?1 AND (?2 IS NULL OR c.name = ?2)"
+
+typedef struct occ_vtab {
+    sqlite3_vtab base;
+    sqlite3 *db;
+} Occ_vtab;
+
+typedef struct occ_cursor {
+    sqlite3_vtab_cursor base;
+    sqlite3_stmt *items;  /* current row is the item being generated */
+    int start_day;        /* arguments, for the hidden columns */
+    int end_day;
+    int lo;               /* first and last day wanted after push down */
+    int hi;
+    int day;              /* day of the current occurrence */
+    sqlite3_int64 rowid;
+    int eof;
+} Occ_cursor;
+
+/* prototypes */
+int register_sql_funcs (sqlite3 *db);
+
+static int day_from_value (sqlite3_value *value);
+static void result_day (sqlite3_context *context, int day);
+
+/* the functions themselves */
+static void next_due_func (sqlite3_context *context, int argc,
+                           sqlite3_value **argv);
+static void days_between_func (sqlite3_context *context, int argc,
+                               sqlite3_value **argv);
+static void urgency_func (sqlite3_context *context, int argc,
+                          sqlite3_value **argv);
+static void user_date_func (sqlite3_context *context, int argc,
+                            sqlite3_value **argv);
+static void parse_user_date_func (sqlite3_context *context, int argc,
+                                  sqlite3_value **argv);
+
+/* the occurrences virtual table module */
+static int occ_connect (sqlite3 *db, void *aux, int argc,
+                        const char *const *argv, sqlite3_vtab **vtab,
+                        char **err);
+static int occ_disconnect (sqlite3_vtab *vtab);
+static int occ_best_index (sqlite3_vtab *vtab, sqlite3_index_info *info);
+static int occ_open (sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor);
+static int occ_close (sqlite3_vtab_cursor *cursor);
+static int occ_next_item (Occ_cursor *cur);
+static int occ_filter (sqlite3_vtab_cursor *cursor, int idx_num,
+                       const char *idx_str, int argc, sqlite3_value **argv);
+static int occ_next (sqlite3_vtab_cursor *cursor);
+static int occ_eof (sqlite3_vtab_cursor *cursor);
+static int occ_column (sqlite3_vtab_cursor *cursor, sqlite3_context *context,
+                       int column);
+static int occ_rowid (sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid);
+/* end prototypes */
+
+/*
+ * FUNC day_from_value
+ *   Reads a sql formatted date out of value as a day number
+ * Returns 0 if value is NULL or not a valid date
+ */
+static int day_from_value (sqlite3_value *value)
+{
+    int m,d,y;
+    int m2,d2,y2;
+
+    if (sqlite3_value_type (value) == SQLITE_NULL)
+        return 0;
+
+    const char *date_str = (const char *) sqlite3_value_text (value);
+    if (date_str == NULL)
+        return 0;
+    if (sscanf (date_str, "%d-%d-%d", &y, &m, &d) != 3)
+        return 0;
+    if (y < 1 || m < 1 || m > 12 || d < 1 || d > 31)
+        return 0;
+
+    /* dates such as 2023-02-30 do not survive the round trip */
+    int day = day_from_mdy (m, d, y);
+    mdy_from_day (day, &m2, &d2, &y2);
+    if (m != m2 || d != d2 || y != y2)
+        return 0;
+
+    return day;
+}
+
+/*
+ * FUNC result_day
+ *   Sets the result of context to day as a sql formatted date
+ */
+static void result_day (sqlite3_context *context, int day)
+{
+    int m,d,y;
+    mdy_from_day (day, &m, &d, &y);
+
+    char *date_str = make_date_str_sql_frmt (m, d, y);
+    if (date_str == NULL) {
+        sqlite3_result_error_nomem (context);
+        return;
+    }
+
+    sqlite3_result_text (context, date_str, -1, free);
+}
+
+/*
+ * FUNC next_due_func
+ *   next_due(date, freq, freq_type)
+ * Same arithmetic as DATE(date, '+freq freq_type') where weeks are 7 days and
+ * a day of month past the end of the new month rolls over into the next.
+ */
+static void next_due_func (sqlite3_context *context, int argc,
+                           sqlite3_value **argv)
+{
+    int day = day_from_value (argv[0]);
+    const char *freq_type = (const char *) sqlite3_value_text (argv[2]);
+
+    if (day == 0 || freq_type == NULL ||
+            sqlite3_value_type (argv[1]) == SQLITE_NULL) {
+        sqlite3_result_null (context);
+        return;
+    }
+
+    int next = next_due_day (day, sqlite3_value_int (argv[1]), freq_type);
+
+    if (next == 0) /* no_repeat */
+        sqlite3_result_null (context);
+    else
+        result_day (context, next);
+}
+
+/*
+ * FUNC days_between_func
+ *   days_between(from, to), negative if to is before from
+ */
+static void days_between_func (sqlite3_context *context, int argc,
+                               sqlite3_value **argv)
+{
+    int from = day_from_value (argv[0]);
+    int to   = day_from_value (argv[1]);
+
+    if (from == 0 || to == 0) {
+        sqlite3_result_null (context);
+        return;
+    }
+
+    sqlite3_result_int (context, to - from);
+}
+
+/*
+ * FUNC urgency_func
+ *   urgency(date, today, freq, freq_type)
+ * For an item due on date: the days it is overdue on today divided by the
+ * days between due dates, so a weekly item a week late ranks with a yearly
+ * item a year late. Items that do not repeat count a day as their interval.
+ * NULL if date is after today.
+ */
+static void urgency_func (sqlite3_context *context, int argc,
+                          sqlite3_value **argv)
+{
+    int day   = day_from_value (argv[0]);
+    int today = day_from_value (argv[1]);
+    const char *freq_type = (const char *) sqlite3_value_text (argv[3]);
+    int interval = 0;
+
+    if (day == 0 || today == 0 || day > today) {
+        sqlite3_result_null (context);
+        return;
+    }
+
+    if (freq_type != NULL && sqlite3_value_type (argv[2]) != SQLITE_NULL)
+        interval = next_due_day (day, sqlite3_value_int (argv[2]),
+                                 freq_type) - day;
+    if (interval < 1)
+        interval = 1;
+
+    sqlite3_result_double (context, (double) (today - day) / interval);
+}
+
+/*
+ * FUNC user_date_func
+ *   user_date(date), see DATE_FRMT_STR in the language file
+ */
+static void user_date_func (sqlite3_context *context, int argc,
+                            sqlite3_value **argv)
+{
+    int day = day_from_value (argv[0]);
+
+    if (day == 0) {
+        sqlite3_result_null (context);
+        return;
+    }
+
+    char *date_str = convert_day_to_user_frmt (day);
+    if (date_str == NULL) {
+        sqlite3_result_error_nomem (context);
+        return;
+    }
+
+    sqlite3_result_text (context, date_str, -1, free);
+}
+
+/*
+ * FUNC parse_user_date_func
+ *   parse_user_date(text), the inverse of user_date
+ */
+static void parse_user_date_func (sqlite3_context *context, int argc,
+                                  sqlite3_value **argv)
+{
+    const char *date_str = (const char *) sqlite3_value_text (argv[0]);
+    int day = 0;
+
+    if (date_str != NULL)
+        day = day_from_user_date_str (date_str);
+
+    if (day == 0) {
+        sqlite3_result_null (context);
+        return;
+    }
+
+    result_day (context, day);
+}
+
+/*
+ * FUNC occ_connect
+ *   xConnect of the occurrences module, declares the columns
+ */
+static int occ_connect (sqlite3 *db, void *aux, int argc,
+                        const char *const *argv, sqlite3_vtab **vtab,
+                        char **err)
+{
+    int rc = sqlite3_declare_vtab (db, "CREATE TABLE x (item_id, "
+            "description, category, date, start_date HIDDEN, "
+            "end_date HIDDEN)");
+    if (rc != SQLITE_OK)
+        return rc;
+
+    Occ_vtab *occ = sqlite3_malloc (sizeof (Occ_vtab));
+    if (occ == NULL)
+        return SQLITE_NOMEM;
+    memset (occ, 0, sizeof (Occ_vtab));
+    occ->db = db;
+
+    *vtab = &occ->base;
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC occ_disconnect
+ *   xDisconnect of the occurrences module
+ */
+static int occ_disconnect (sqlite3_vtab *vtab)
+{
+    sqlite3_free (vtab);
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC occ_best_index
+ *   xBestIndex of the occurrences module. Takes every usable constraint on
+ * start, end, category and date and hands them to occ_filter. Without an
+ * end the function would never stop, so that plan is made very expensive.
+ */
+static int occ_best_index (sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+    /* index of the constraint to use for each bit, in argument order */
+    int bits[] = {OCC_HAS_START, OCC_HAS_END, OCC_HAS_CATEGORY,
+                  OCC_DATE_GE, OCC_DATE_GT, OCC_DATE_LE, OCC_DATE_LT};
+    int which[7] = {-1, -1, -1, -1, -1, -1, -1};
+    int idx_num = 0;
+
+    for (int i = 0; i < info->nConstraint; i++) {
+        const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+        int k = -1;
+
+        if (!c->usable)
+            continue;
+
+        if (c->iColumn == OCC_START && c->op == SQLITE_INDEX_CONSTRAINT_EQ)
+            k = 0;
+        else if (c->iColumn == OCC_END && c->op == SQLITE_INDEX_CONSTRAINT_EQ)
+            k = 1;
+        else if (c->iColumn == OCC_CATEGORY &&
+                 c->op == SQLITE_INDEX_CONSTRAINT_EQ)
+            k = 2;
+        else if (c->iColumn == OCC_DATE) {
+            switch (c->op) {
+                case SQLITE_INDEX_CONSTRAINT_GE: k = 3; break;
+                case SQLITE_INDEX_CONSTRAINT_GT: k = 4; break;
+                case SQLITE_INDEX_CONSTRAINT_LE: k = 5; break;
+                case SQLITE_INDEX_CONSTRAINT_LT: k = 6; break;
+            }
+        }
+
+        if (k >= 0 && which[k] < 0)
+            which[k] = i;
+    }
+
+    int arg = 0;
+    for (int k = 0; k < 7; k++) {
+        if (which[k] < 0)
+            continue;
+        idx_num |= bits[k];
+        info->aConstraintUsage[which[k]].argvIndex = ++arg;
+        info->aConstraintUsage[which[k]].omit = 1;
+    }
+
+    info->idxNum = idx_num;
+    info->estimatedCost = (idx_num & OCC_HAS_END) ? 1000.0 : 1e12;
+
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC occ_open
+ *   xOpen of the occurrences module
+ */
+static int occ_open (sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+    Occ_cursor *cur = sqlite3_malloc (sizeof (Occ_cursor));
+    if (cur == NULL)
+        return SQLITE_NOMEM;
+    memset (cur, 0, sizeof (Occ_cursor));
+    cur->eof = 1;
+
+    *cursor = &cur->base;
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC occ_close
+ *   xClose of the occurrences module
+ */
+static int occ_close (sqlite3_vtab_cursor *cursor)
+{
+    Occ_cursor *cur = (Occ_cursor *) cursor;
+    sqlite3_finalize (cur->items);
+    sqlite3_free (cur);
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC occ_next_item
+ *   Steps to the next item that has an occurrence in [lo, hi] and sets
+ * cur->day to the first one. Sets cur->eof when there are no items left.
+ */
+static int occ_next_item (Occ_cursor *cur)
+{
+    int rc;
+
+    while ((rc = sqlite3_step (cur->items)) == SQLITE_ROW) {
+        const char *freq_type;
+        int freq;
+        int day = day_from_sql_date_str (
+                (const char *) sqlite3_column_text (cur->items, 3));
+
+        freq      = sqlite3_column_int (cur->items, 4);
+        freq_type = (const char *) sqlite3_column_text (cur->items, 5);
+        if (freq_type == NULL)
+            freq_type = "no_repeat";
+
+        /* catch up to the start of the range */
+        while (day != 0 && day < cur->lo)
+            day = next_due_day (day, freq, freq_type);
+
+        if (day != 0 && day <= cur->hi) {
+            cur->day = day;
+            return SQLITE_OK;
+        }
+    }
+
+    cur->eof = 1;
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+/*
+ * FUNC occ_filter
+ *   xFilter of the occurrences module, reads the constraints handed over by
+ * occ_best_index and starts on the first item
+ */
+static int occ_filter (sqlite3_vtab_cursor *cursor, int idx_num,
+                       const char *idx_str, int argc, sqlite3_value **argv)
+{
+    Occ_cursor *cur = (Occ_cursor *) cursor;
+    Occ_vtab *occ = (Occ_vtab *) cursor->pVtab;
+    int arg = 0;
+    int rc;
+    sqlite3_value *category = NULL;
+
+    cur->eof = 1;
+    cur->rowid = 0;
+    cur->start_day = 0;
+    cur->end_day = 0;
+    cur->lo = 1;
+    cur->hi = 0;
+
+    if (idx_num & OCC_HAS_START)
+        cur->start_day = day_from_value (argv[arg++]);
+    if (idx_num & OCC_HAS_END)
+        cur->end_day = day_from_value (argv[arg++]);
+    if (idx_num & OCC_HAS_CATEGORY)
+        category = argv[arg++];
+
+    if (!(idx_num & OCC_HAS_END)) {
+        sqlite3_free (occ->base.zErrMsg);
+        occ->base.zErrMsg = sqlite3_mprintf ("occurrences: end date required");
+        return SQLITE_ERROR;
+    }
+
+    /* a NULL or invalid bound leaves the result empty */
+    if ((idx_num & OCC_HAS_START) && cur->start_day == 0)
+        return SQLITE_OK;
+    if (cur->end_day == 0)
+        return SQLITE_OK;
+
+    cur->lo = (cur->start_day > 0) ? cur->start_day : 1;
+    cur->hi = cur->end_day;
+
+    /* pushed down date constraints narrow the range further */
+    int bound;
+    if (idx_num & OCC_DATE_GE) {
+        bound = day_from_value (argv[arg++]);
+        if (bound == 0) return SQLITE_OK;
+        if (bound > cur->lo) cur->lo = bound;
+    }
+    if (idx_num & OCC_DATE_GT) {
+        bound = day_from_value (argv[arg++]);
+        if (bound == 0) return SQLITE_OK;
+        if (bound + 1 > cur->lo) cur->lo = bound + 1;
+    }
+    if (idx_num & OCC_DATE_LE) {
+        bound = day_from_value (argv[arg++]);
+        if (bound == 0) return SQLITE_OK;
+        if (bound < cur->hi) cur->hi = bound;
+    }
+    if (idx_num & OCC_DATE_LT) {
+        bound = day_from_value (argv[arg++]);
+        if (bound == 0) return SQLITE_OK;
+        if (bound - 1 < cur->hi) cur->hi = bound - 1;
+    }
+
+    if (cur->lo > cur->hi)
+        return SQLITE_OK;
+
+    if (cur->items == NULL) {
+        rc = sqlite3_prepare_v2 (occ->db, OCC_ITEMS_QUERY, -1, &cur->items, 0);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+    else {
+        sqlite3_reset (cur->items);
+    }
+
+    int m,d,y;
+    mdy_from_day (cur->hi, &m, &d, &y);
+    char *hi_str = make_date_str_sql_frmt (m, d, y);
+    if (hi_str == NULL)
+        return SQLITE_NOMEM;
+    sqlite3_bind_text (cur->items, 1, hi_str, -1, free);
+
+    if (category != NULL)
+        sqlite3_bind_value (cur->items, 2, category);
+    else
+        sqlite3_bind_null (cur->items, 2);
+
+    cur->eof = 0;
+    return occ_next_item (cur);
+}
+
+/*
+ * FUNC occ_next
+ *   xNext of the occurrences module, moves to the following occurrence of
+ * the current item or on to the next item
+ */
+static int occ_next (sqlite3_vtab_cursor *cursor)
+{
+    Occ_cursor *cur = (Occ_cursor *) cursor;
+    const char *freq_type;
+    int freq;
+
+    cur->rowid++;
+
+    freq      = sqlite3_column_int (cur->items, 4);
+    freq_type = (const char *) sqlite3_column_text (cur->items, 5);
+    if (freq_type != NULL)
+        cur->day = next_due_day (cur->day, freq, freq_type);
+    else
+        cur->day = 0;
+
+    if (cur->day != 0 && cur->day <= cur->hi)
+        return SQLITE_OK;
+
+    return occ_next_item (cur);
+}
+
+/*
+ * FUNC occ_eof
+ *   xEof of the occurrences module
+ */
+static int occ_eof (sqlite3_vtab_cursor *cursor)
+{
+    return ((Occ_cursor *) cursor)->eof;
+}
+
+/*
+ * FUNC occ_column
+ *   xColumn of the occurrences module
+ */
+static int occ_column (sqlite3_vtab_cursor *cursor, sqlite3_context *context,
+                       int column)
+{
+    Occ_cursor *cur = (Occ_cursor *) cursor;
+
+    switch (column) {
+        case OCC_ITEM_ID:
+            sqlite3_result_value (context, sqlite3_column_value (cur->items, 0));
+            break;
+        case OCC_DESCRIPTION:
+            sqlite3_result_value (context, sqlite3_column_value (cur->items, 1));
+            break;
+        case OCC_CATEGORY:
+            sqlite3_result_value (context, sqlite3_column_value (cur->items, 2));
+            break;
+        case OCC_DATE:
+            result_day (context, cur->day);
+            break;
+        case OCC_START:
+            if (cur->start_day > 0)
+                result_day (context, cur->start_day);
+            break;
+        case OCC_END:
+            result_day (context, cur->end_day);
+            break;
+    }
+
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC occ_rowid
+ *   xRowid of the occurrences module, rows are simply counted
+ */
+static int occ_rowid (sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+    *rowid = ((Occ_cursor *) cursor)->rowid;
+    return SQLITE_OK;
+}
+
+/* eponymous only: xCreate is NULL so occurrences cannot be used in a
+ * CREATE VIRTUAL TABLE statement, only as a table valued function */
+static sqlite3_module occurrences_module = {
+    0,                  /* iVersion */
+    NULL,               /* xCreate */
+    occ_connect,
+    occ_best_index,
+    occ_disconnect,
+    NULL,               /* xDestroy */
+    occ_open,
+    occ_close,
+    occ_filter,
+    occ_next,
+    occ_eof,
+    occ_column,
+    occ_rowid,
+};
+
+/*
+ * FUNC register_sql_funcs
+ *   Registers the functions and the occurrences module of this file on db
+ * Returns the sqlite3 status code of the operation
+ */
+int register_sql_funcs (sqlite3 *db)
+{
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    int rc;
+
+    rc = sqlite3_create_function (db, "next_due", 3, flags, NULL,
+                                  next_due_func, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "days_between", 2, flags, NULL,
+                                      days_between_func, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "urgency", 4, flags, NULL,
+                                      urgency_func, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "user_date", 1, flags, NULL,
+                                      user_date_func, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "parse_user_date", 1, flags, NULL,
+                                      parse_user_date_func, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_module (db, "occurrences", &occurrences_module,
+                                    NULL);
+
+    return rc;
+}
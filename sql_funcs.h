@@ -0,0 +1,12 @@
+/*******************************************************************************
+ * sql_funcs.h
+ * Header for the date and recurrence functions made available to SQL.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+
+/* Registers next_due, days_between, urgency, user_date, parse_user_date and
+ * the occurrences table valued function on db, returns a sqlite3 status
+ * code */
+int register_sql_funcs (sqlite3 *db);
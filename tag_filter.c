@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * tag_filter.c
+ * Keeps the tag expression (see tag_index.c) the main, ahead/back and
+ * edit/search views are narrowed down to, and makes the entry each of them
+ * types it in.
+ *
+ * The expression is kept rather than the items it picked, and worked out
+ * again from the index each time a view loads, so items tagged since are
+ * picked up. Like the category filter it lasts while the program runs.
+ ******************************************************************************/
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "setup.h"
+#include "sql_db.h"
+#include "tag_filter.h"
+#include "tag_index.h"
+
+/* NULL for every item */
+static char *filter_expression = NULL;
+
+/* prototypes */
+Tag_set *tag_filter_eval (void);
+GtkWidget *make_tag_filter (Tag_filter_reload reload);
+
+static void pick_tags (GtkEntry *entry, gpointer reload);
+/* end prototypes */
+
+/*
+ * FUNC tag_filter_eval
+ *   Works out the items the tag filter picks. The filter is dropped once it
+ * names a tag that is gone, and not applied if the index cannot be loaded.
+ * Returns NULL for every item
+ * NOTE: free with tag_set_free
+ */
+Tag_set *tag_filter_eval (void)
+{
+    Tag_set *matching;
+    int rc;
+
+    if (filter_expression == NULL)
+        return NULL;
+
+    rc = tag_index_eval (routine_db_tag_index (app_db ()), filter_expression,
+                         &matching);
+    if (rc == 1)
+        return matching;
+
+    if (rc == -2)
+        fprintf (stderr, DATABASE_TAG_INDEX_FAIL);
+    else {
+        g_free (filter_expression);
+        filter_expression = NULL;
+    }
+
+    return NULL;
+}
+
+/*
+ * FUNC make_tag_filter
+ *   Makes the entry of the tag filter, holding the current expression
+ */
+GtkWidget *make_tag_filter (Tag_filter_reload reload)
+{
+    GtkWidget *entry = gtk_entry_new ();
+
+    gtk_entry_set_placeholder_text (GTK_ENTRY (entry), TAG_FILTER_HINT);
+    gtk_widget_set_tooltip_text (entry, TAG_FILTER_TOOLTIP);
+    if (filter_expression != NULL)
+        gtk_entry_set_text (GTK_ENTRY (entry), filter_expression);
+
+    g_signal_connect (G_OBJECT (entry), "activate",
+            G_CALLBACK (pick_tags), reload);
+
+    return entry;
+}
+
+/*
+ * FUNC pick_tags
+ *   Callback for the "activate" signal of the entry. Sets the filter to the
+ * expression typed, if the index can answer it, and sets the view up again.
+ */
+static void pick_tags (GtkEntry *entry, gpointer reload)
+{
+    char *typed = g_strstrip (g_strdup (gtk_entry_get_text (entry)));
+    Tag_set *matching;
+    int rc;
+
+    if (typed[0] == '\0') {
+        g_free (typed);
+        if (filter_expression == NULL)
+            return;
+
+        g_free (filter_expression);
+        filter_expression = NULL;
+        ((Tag_filter_reload) reload) (GTK_WIDGET (entry));
+        return;
+    }
+
+    rc = tag_index_eval (routine_db_tag_index (app_db ()), typed, &matching);
+    tag_set_free (matching);
+
+    if (rc != 1) {
+        if (rc == 0)
+            error_dialog (GTK_WIDGET (entry), NO_SUCH_TAG);
+        else if (rc == -1)
+            error_dialog (GTK_WIDGET (entry), TAG_FILTER_INVALID);
+        else
+            error_dialog (GTK_WIDGET (entry), DATABASE_TAG_INDEX_FAIL);
+        g_free (typed);
+        return;
+    }
+
+    g_free (filter_expression);
+    filter_expression = typed;
+    ((Tag_filter_reload) reload) (GTK_WIDGET (entry));
+}
@@ -0,0 +1,21 @@
+/*******************************************************************************
+ * tag_filter.h
+ * Header for the tag expression the main, ahead/back and edit/search views
+ * are narrowed down to, and the entry typing it.
+ *
+ ******************************************************************************/
+
+#include <gtk/gtk.h>
+
+#include "tag_set.h"
+
+/* Sets up a view again, called with the entry once the filter changed */
+typedef void (*Tag_filter_reload) (GtkWidget *widget);
+
+/* The items the tag filter picks as of now, a new set (free it with
+ * tag_set_free), NULL for every item */
+Tag_set *tag_filter_eval (void);
+
+/* An entry showing the current tag filter. Enter checks what was typed,
+ * sets the filter and calls reload; an empty entry drops the filter */
+GtkWidget *make_tag_filter (Tag_filter_reload reload);
@@ -0,0 +1,764 @@
+/*******************************************************************************
+ * tag_index.c
+ * Keeps the items of every tag (see version 8 in schema.c) as a compressed
+ * set of item ids (see tag_set.c), so a filter like
+ *     crew A AND quarterly AND NOT outdoor
+ * is a few passes over those sets instead of a query, and the views check
+ * each row they load against the result.
+ *
+ * The sets are loaded once by tag_index_init and then kept current by temp
+ * triggers on the connection, like due_index.c, each connection with an
+ * index of its own. They are marked stale, and loaded again the next time
+ * they are used, when:
+ *   - a transaction is rolled back (see tag_index_invalidate)
+ *   - PRAGMA data_version moves, ie: another connection committed
+ *
+ * NOT takes the ids out of the set of every item, which the triggers keep
+ * too. "a AND NOT b" takes b out of a directly.
+ *
+ * Only the thread using the connection may use its index (the triggers fire
+ * on that connection).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <gtk/gtk.h>
+
+#include "setup.h"
+#include "tag_index.h"
+
+/* tags allocated on the first load */
+#define TAG_INDEX_MIN_TAGS 16
+
+/* One tag, the name is NULL where there is no tag with that id */
+typedef struct tag_entry {
+    char    *name;
+    Tag_set *items;
+} Tag_entry;
+
+/* Tokens of a filter expression */
+enum {
+    TOKEN_END = 0,
+    TOKEN_NAME,
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_NOT,
+    TOKEN_OPEN,
+    TOKEN_CLOSE
+};
+
+/* Where parsing a filter expression is at */
+typedef struct tag_parse {
+    Tag_index *index;
+    const char *at;
+    int status;     /* as tag_index_eval returns, 1 until something fails */
+} Tag_parse;
+
+struct tag_index {
+    /* tags by id */
+    Tag_entry *tags;
+    int n_tags;
+
+    /* every item id in attributes */
+    Tag_set *all_items;
+
+    int stale;
+    sqlite3 *db;
+    sqlite3_stmt *data_version_stmt;
+    sqlite3_int64 loaded_version;
+};
+
+/* Every write to item_tags calls tag_index_tagged with the tag id, the item
+ * id and 1 for a tag added or 0 for one taken off, every write to tags
+ * tag_index_named and every item added or purged tag_index_item */
+static const char *index_triggers[] = {
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_insert "\
+    "AFTER INSERT ON main.item_tags BEGIN "\
+    "    SELECT tag_index_tagged(new.tag_id, new.item_id, 1); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_update "\
+    "AFTER UPDATE ON main.item_tags BEGIN "\
+    "    SELECT tag_index_tagged(old.tag_id, old.item_id, 0); "\
+    "    SELECT tag_index_tagged(new.tag_id, new.item_id, 1); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_delete "\
+    "AFTER DELETE ON main.item_tags BEGIN "\
+    "    SELECT tag_index_tagged(old.tag_id, old.item_id, 0); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_tag_insert "\
+    "AFTER INSERT ON main.tags BEGIN "\
+    "    SELECT tag_index_named(new.id, new.name); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_tag_update "\
+    "AFTER UPDATE OF name ON main.tags BEGIN "\
+    "    SELECT tag_index_named(new.id, new.name); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_tag_delete "\
+    "AFTER DELETE ON main.tags BEGIN "\
+    "    SELECT tag_index_named(old.id, NULL); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_item_insert "\
+    "AFTER INSERT ON main.attributes BEGIN "\
+    "    SELECT tag_index_item(new.id, 1); "\
+    "END",
+
+    "CREATE TEMP TRIGGER IF NOT EXISTS tag_index_item_delete "\
+    "AFTER DELETE ON main.attributes BEGIN "\
+    "    SELECT tag_index_item(old.id, 0); "\
+    "END"
+};
+
+/* prototypes */
+int tag_index_init (sqlite3 *db, Tag_index **index);
+void tag_index_close (Tag_index *index);
+void tag_index_invalidate (Tag_index *index);
+int tag_index_eval (Tag_index *index, const char *expression,
+                    Tag_set **matching);
+char *tag_index_clean_name (const char *name);
+
+/* helpers */
+static int load_index (Tag_index *index);
+static int load_query (Tag_index *index, const char *query, int kind);
+static void clear_index (Tag_index *index);
+static Tag_entry *tag_with_id (Tag_index *index, int tag_id);
+static const Tag_entry *find_tag (Tag_index *index, const char *name);
+static int is_keyword (const char *word, int length);
+
+/* parsing filters, lowest precedence first */
+static Tag_set *parse_or (Tag_parse *p);
+static Tag_set *parse_and (Tag_parse *p);
+static Tag_set *parse_not (Tag_parse *p);
+static int peek_token (Tag_parse *p, const char **end);
+static int word_length (const char *at);
+
+static void tag_index_tagged (sqlite3_context *ctx, int argc,
+                              sqlite3_value **argv);
+static void tag_index_named (sqlite3_context *ctx, int argc,
+                             sqlite3_value **argv);
+static void tag_index_item (sqlite3_context *ctx, int argc,
+                            sqlite3_value **argv);
+static sqlite3_int64 current_data_version (Tag_index *index);
+/* end prototypes */
+
+/*
+ * FUNC tag_index_init
+ *   Makes the index of db: registers tag_index_tagged, tag_index_named and
+ * tag_index_item on db, creates the temp triggers that call them and loads
+ * the index.
+ *
+ * Returns a sqlite3 status code. *index is set even on error, free it with
+ * tag_index_close
+ */
+int tag_index_init (sqlite3 *db, Tag_index **index)
+{
+    Tag_index *new_index;
+    int rc;
+    size_t i;
+
+    new_index = calloc (1, sizeof (Tag_index));
+    if (new_index == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "tag_index.c 5\n");
+        exit (EXIT_FAILURE);
+    }
+    new_index->db = db;
+    new_index->stale = 1;
+    new_index->loaded_version = -1;
+    *index = new_index;
+
+    rc = sqlite3_create_function (db, "tag_index_tagged", 3, SQLITE_UTF8,
+                                  new_index, tag_index_tagged, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "tag_index_named", 2, SQLITE_UTF8,
+                                      new_index, tag_index_named, NULL, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function (db, "tag_index_item", 2, SQLITE_UTF8,
+                                      new_index, tag_index_item, NULL, NULL);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    for (i = 0; i < sizeof (index_triggers) / sizeof (char *); i++) {
+        rc = sqlite3_exec (db, index_triggers[i], NULL, NULL, NULL);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    rc = sqlite3_prepare_v3 (db, "PRAGMA data_version", -1,
+                             SQLITE_PREPARE_PERSISTENT,
+                             &new_index->data_version_stmt, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    return load_index (new_index);
+}
+
+/*
+ * FUNC tag_index_close
+ *   Frees the index and finalizes its statement. The connection has to be
+ * closed next, its triggers would call into the freed index.
+ */
+void tag_index_close (Tag_index *index)
+{
+    if (index == NULL)
+        return;
+
+    clear_index (index);
+    free (index->tags);
+
+    sqlite3_finalize (index->data_version_stmt);
+    free (index);
+}
+
+/*
+ * FUNC tag_index_invalidate
+ *   Marks the index stale, so the triggers leave it alone and it is loaded
+ * whole the next time it is used
+ */
+void tag_index_invalidate (Tag_index *index)
+{
+    if (index != NULL)
+        index->stale = 1;
+}
+
+/*
+ * FUNC tag_index_eval
+ *   Works out the set of items expression picks, loading the index again
+ * first if it went stale:
+ *     or  := and { OR and }
+ *     and := not { AND not }
+ *     not := NOT not | ( or ) | tag name
+ * A tag name is one or more words that are not keywords.
+ *
+ * Returns 1 on success, 0 for a tag name not known, -1 if expression
+ * cannot be read, -2 if the index cannot be loaded
+ */
+int tag_index_eval (Tag_index *index, const char *expression,
+                    Tag_set **matching)
+{
+    Tag_parse p;
+    const char *end;
+    Tag_set *result;
+
+    *matching = NULL;
+
+    if (index == NULL)
+        return -2;
+
+    if ((index->stale ||
+         current_data_version (index) != index->loaded_version) &&
+        load_index (index) != SQLITE_OK)
+        return -2;
+
+    p.index = index;
+    p.at = expression;
+    p.status = 1;
+
+    result = parse_or (&p);
+    if (p.status == 1 && peek_token (&p, &end) != TOKEN_END)
+        p.status = -1;
+
+    if (p.status != 1) {
+        tag_set_free (result);
+        return p.status;
+    }
+
+    *matching = result;
+    return 1;
+}
+
+/*
+ * FUNC tag_index_clean_name
+ *   Copies name trimmed and with runs of spaces squeezed to one
+ * Returns NULL if a filter could not name it
+ * NOTE: USES MALLOC
+ */
+char *tag_index_clean_name (const char *name)
+{
+    char *clean = malloc (strlen (name) + 1);
+    char *out = clean;
+    const char *at = name;
+
+    if (clean == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "tag_index.c 1\n");
+        exit (EXIT_FAILURE);
+    }
+
+    while (*at != '\0') {
+        int length;
+
+        while (g_ascii_isspace (*at))
+            at++;
+        if (*at == '\0')
+            break;
+
+        length = word_length (at);
+        if (length == 0 || is_keyword (at, length)) {
+            free (clean);
+            return NULL;
+        }
+
+        if (out != clean)
+            *out++ = ' ';
+        memcpy (out, at, length);
+        out += length;
+        at += length;
+    }
+
+    *out = '\0';
+    return clean;
+}
+
+/*
+ * FUNC load_index
+ *   Reads tags, item_tags and the ids of attributes into the sets
+ * Returns a sqlite3 status code, the index stays stale on error
+ */
+static int load_index (Tag_index *index)
+{
+    int rc;
+
+    clear_index (index);
+    index->stale = 1;
+
+    index->loaded_version = current_data_version (index);
+
+    index->all_items = tag_set_new ();
+
+    rc = load_query (index, "SELECT id, name FROM tags", 0);
+    if (rc == SQLITE_OK)
+        rc = load_query (index, "SELECT tag_id, item_id FROM item_tags "\
+                         "ORDER BY tag_id, item_id", 1);
+    if (rc == SQLITE_OK)
+        rc = load_query (index, "SELECT id, NULL FROM attributes "\
+                         "ORDER BY id", 2);
+
+    if (rc != SQLITE_OK) {
+        clear_index (index);
+        return rc;
+    }
+
+    index->stale = 0;
+    return SQLITE_OK;
+}
+
+/*
+ * FUNC load_query
+ *   Helper function to load_index
+ * Steps query and hands each row to tag_index_named (kind 0),
+ * tag_index_tagged (kind 1) or the set of every item (kind 2)
+ * Returns a sqlite3 status code
+ */
+static int load_query (Tag_index *index, const char *query, int kind)
+{
+    sqlite3_stmt *res;
+    int rc;
+
+    rc = sqlite3_prepare_v2 (index->db, query, -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    while ((rc = sqlite3_step (res)) == SQLITE_ROW) {
+        int id = sqlite3_column_int (res, 0);
+
+        if (kind == 0) {
+            Tag_entry *tag = tag_with_id (index, id);
+
+            free (tag->name);
+            tag->name = strdup ((const char *) sqlite3_column_text (res, 1));
+            if (tag->name == NULL) {
+                fprintf (stderr, MEM_FAIL_IN "tag_index.c 2\n");
+                exit (EXIT_FAILURE);
+            }
+        }
+        else if (kind == 1) {
+            Tag_entry *tag = tag_with_id (index, id);
+
+            if (tag->items == NULL)
+                tag->items = tag_set_new ();
+            tag_set_add (tag->items, sqlite3_column_int (res, 1));
+        }
+        else
+            tag_set_add (index->all_items, id);
+    }
+
+    sqlite3_finalize (res);
+
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+/*
+ * FUNC clear_index
+ *   Frees every name and set, keeps the array of tags for the next load
+ */
+static void clear_index (Tag_index *index)
+{
+    int i;
+
+    for (i = 0; i < index->n_tags; i++) {
+        free (index->tags[i].name);
+        tag_set_free (index->tags[i].items);
+        index->tags[i].name = NULL;
+        index->tags[i].items = NULL;
+    }
+
+    tag_set_free (index->all_items);
+    index->all_items = NULL;
+}
+
+/*
+ * FUNC tag_with_id
+ *   Returns the entry of tag_id, growing tags to fit. Tag ids are rowids
+ * handed out in order, so tags stays small.
+ */
+static Tag_entry *tag_with_id (Tag_index *index, int tag_id)
+{
+    if (tag_id < 0)
+        tag_id = 0;
+
+    if (tag_id >= index->n_tags) {
+        int old_size = index->n_tags;
+        int new_size = (old_size > 0) ? old_size : TAG_INDEX_MIN_TAGS;
+        Tag_entry *grown;
+
+        while (new_size <= tag_id)
+            new_size *= 2;
+
+        grown = realloc (index->tags, new_size * sizeof (Tag_entry));
+        if (grown == NULL) {
+            fprintf (stderr, MEM_FAIL_IN "tag_index.c 3\n");
+            exit (EXIT_FAILURE);
+        }
+        memset (grown + old_size, 0,
+                (new_size - old_size) * sizeof (Tag_entry));
+
+        index->tags = grown;
+        index->n_tags = new_size;
+    }
+
+    return &index->tags[tag_id];
+}
+
+/*
+ * FUNC find_tag
+ *   Looks up the tag called name (as tag_index_clean_name leaves it). There
+ * are few tags, they are not sorted.
+ * Returns NULL if there is no such tag
+ */
+static const Tag_entry *find_tag (Tag_index *index, const char *name)
+{
+    int i;
+
+    for (i = 0; i < index->n_tags; i++)
+        if (index->tags[i].name != NULL &&
+            strcmp (index->tags[i].name, name) == 0)
+            return &index->tags[i];
+
+    return NULL;
+}
+
+/*
+ * FUNC is_keyword
+ *   Returns 1 if the length chars at word are AND, OR or NOT
+ */
+static int is_keyword (const char *word, int length)
+{
+    return (length == 3 && strncmp (word, "AND", 3) == 0) ||
+           (length == 2 && strncmp (word, "OR", 2) == 0) ||
+           (length == 3 && strncmp (word, "NOT", 3) == 0);
+}
+
+/*
+ * FUNC parse_or
+ *   Parses and { OR and }
+ * Returns NULL once p->status is not 1
+ */
+static Tag_set *parse_or (Tag_parse *p)
+{
+    const char *end;
+    Tag_set *left = parse_and (p);
+
+    while (p->status == 1 && peek_token (p, &end) == TOKEN_OR) {
+        Tag_set *right, *both;
+
+        p->at = end;
+        right = parse_and (p);
+        if (p->status != 1) {
+            tag_set_free (left);
+            return NULL;
+        }
+
+        both = tag_set_or (left, right);
+        tag_set_free (left);
+        tag_set_free (right);
+        left = both;
+    }
+
+    return left;
+}
+
+/*
+ * FUNC parse_and
+ *   Parses not { AND not }, "AND NOT x" takes x out of what is on its left
+ * rather than going through the set of every item
+ * Returns NULL once p->status is not 1
+ */
+static Tag_set *parse_and (Tag_parse *p)
+{
+    const char *end;
+    Tag_set *left = parse_not (p);
+
+    while (p->status == 1 && peek_token (p, &end) == TOKEN_AND) {
+        Tag_set *right, *both;
+        int negated = 0;
+
+        p->at = end;
+        if (peek_token (p, &end) == TOKEN_NOT) {
+            p->at = end;
+            negated = 1;
+        }
+
+        right = parse_not (p);
+        if (p->status != 1) {
+            tag_set_free (left);
+            return NULL;
+        }
+
+        both = negated ? tag_set_and_not (left, right)
+                       : tag_set_and (left, right);
+        tag_set_free (left);
+        tag_set_free (right);
+        left = both;
+    }
+
+    return left;
+}
+
+/*
+ * FUNC parse_not
+ *   Parses NOT not, ( or ) or a tag name
+ * Returns NULL once p->status is not 1
+ */
+static Tag_set *parse_not (Tag_parse *p)
+{
+    const char *end;
+    const char *start;
+    const Tag_entry *tag;
+    Tag_set *inner, *result;
+    char *name, *clean;
+    int token = peek_token (p, &end);
+
+    if (token == TOKEN_NOT) {
+        p->at = end;
+        inner = parse_not (p);
+        if (p->status != 1)
+            return NULL;
+
+        result = tag_set_and_not (p->index->all_items, inner);
+        tag_set_free (inner);
+        return result;
+    }
+
+    if (token == TOKEN_OPEN) {
+        p->at = end;
+        inner = parse_or (p);
+        if (p->status != 1)
+            return NULL;
+
+        if (peek_token (p, &end) != TOKEN_CLOSE) {
+            tag_set_free (inner);
+            p->status = -1;
+            return NULL;
+        }
+        p->at = end;
+        return inner;
+    }
+
+    if (token != TOKEN_NAME) {
+        p->status = -1;
+        return NULL;
+    }
+
+    /* the name runs on over every word up to a keyword or parenthesis */
+    start = p->at;
+    while (peek_token (p, &end) == TOKEN_NAME)
+        p->at = end;
+
+    name = g_strndup (start, p->at - start);
+    clean = tag_index_clean_name (name);
+    g_free (name);
+
+    tag = (clean != NULL) ? find_tag (p->index, clean) : NULL;
+    free (clean);
+
+    if (tag == NULL) {
+        p->status = 0;
+        return NULL;
+    }
+
+    /* a tag no item has any more */
+    if (tag->items == NULL)
+        return tag_set_new ();
+
+    return tag_set_copy (tag->items);
+}
+
+/*
+ * FUNC peek_token
+ *   Finds the token at p->at, skipping spaces, and sets end to just after it
+ * without moving p->at
+ * Returns the kind of token
+ */
+static int peek_token (Tag_parse *p, const char **end)
+{
+    const char *at = p->at;
+    int length;
+
+    while (g_ascii_isspace (*at))
+        at++;
+
+    *end = at + 1;
+
+    if (*at == '\0') {
+        *end = at;
+        return TOKEN_END;
+    }
+    if (*at == '(')
+        return TOKEN_OPEN;
+    if (*at == ')')
+        return TOKEN_CLOSE;
+
+    length = word_length (at);
+    *end = at + length;
+
+    if (length == 3 && strncmp (at, "AND", 3) == 0)
+        return TOKEN_AND;
+    if (length == 2 && strncmp (at, "OR", 2) == 0)
+        return TOKEN_OR;
+    if (length == 3 && strncmp (at, "NOT", 3) == 0)
+        return TOKEN_NOT;
+
+    return TOKEN_NAME;
+}
+
+/*
+ * FUNC word_length
+ *   Returns the number of chars at at up to a space, a parenthesis or the
+ * end, 0 if at starts with a parenthesis
+ */
+static int word_length (const char *at)
+{
+    int length = 0;
+
+    while (at[length] != '\0' && !g_ascii_isspace (at[length]) &&
+           at[length] != '(' && at[length] != ')')
+        length++;
+
+    return length;
+}
+
+/*
+ * FUNC tag_index_tagged
+ *   SQL function tag_index_tagged(tag_id, item_id, on) called by the temp
+ * triggers, on is 1 for a tag added to an item and 0 for one taken off.
+ * Does nothing while the index is stale.
+ */
+static void tag_index_tagged (sqlite3_context *ctx, int argc,
+                              sqlite3_value **argv)
+{
+    Tag_index *index = sqlite3_user_data (ctx);
+    Tag_entry *tag;
+
+    sqlite3_result_null (ctx);
+
+    if (index->stale)
+        return;
+
+    tag = tag_with_id (index, sqlite3_value_int (argv[0]));
+    if (tag->items == NULL)
+        tag->items = tag_set_new ();
+
+    if (sqlite3_value_int (argv[2]))
+        tag_set_add (tag->items, sqlite3_value_int (argv[1]));
+    else
+        tag_set_remove (tag->items, sqlite3_value_int (argv[1]));
+}
+
+/*
+ * FUNC tag_index_named
+ *   SQL function tag_index_named(tag_id, name) called by the temp triggers,
+ * name is NULL for a tag deleted
+ */
+static void tag_index_named (sqlite3_context *ctx, int argc,
+                             sqlite3_value **argv)
+{
+    Tag_index *index = sqlite3_user_data (ctx);
+    Tag_entry *tag;
+    const char *name = (const char *) sqlite3_value_text (argv[1]);
+
+    sqlite3_result_null (ctx);
+
+    if (index->stale)
+        return;
+
+    tag = tag_with_id (index, sqlite3_value_int (argv[0]));
+    free (tag->name);
+    tag->name = NULL;
+
+    if (name == NULL) {
+        tag_set_free (tag->items);
+        tag->items = NULL;
+        return;
+    }
+
+    tag->name = strdup (name);
+    if (tag->name == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "tag_index.c 4\n");
+        exit (EXIT_FAILURE);
+    }
+}
+
+/*
+ * FUNC tag_index_item
+ *   SQL function tag_index_item(item_id, on) called by the temp triggers,
+ * on is 1 for an item added and 0 for one purged
+ */
+static void tag_index_item (sqlite3_context *ctx, int argc,
+                            sqlite3_value **argv)
+{
+    Tag_index *index = sqlite3_user_data (ctx);
+
+    sqlite3_result_null (ctx);
+
+    if (index->stale)
+        return;
+
+    if (sqlite3_value_int (argv[1]))
+        tag_set_add (index->all_items, sqlite3_value_int (argv[0]));
+    else
+        tag_set_remove (index->all_items, sqlite3_value_int (argv[0]));
+}
+
+/*
+ * FUNC current_data_version
+ *   Reads PRAGMA data_version, see query_cache.c
+ * Returns -1 on error
+ */
+static sqlite3_int64 current_data_version (Tag_index *index)
+{
+    sqlite3_int64 version = -1;
+
+    if (index->data_version_stmt == NULL)
+        return -1;
+
+    if (sqlite3_step (index->data_version_stmt) == SQLITE_ROW)
+        version = sqlite3_column_int64 (index->data_version_stmt, 0);
+    sqlite3_reset (index->data_version_stmt);
+
+    return version;
+}
@@ -0,0 +1,38 @@
+/*******************************************************************************
+ * tag_index.h
+ * Header for the in memory index of item tags, a compressed set of item ids
+ * for every tag, that answers boolean tag filters ("crew A AND quarterly AND
+ * NOT outdoor") without going to the db.
+ *
+ ******************************************************************************/
+
+#include <sqlite3.h>
+
+#include "tag_set.h"
+
+/* The index of one connection */
+typedef struct tag_index Tag_index;
+
+/* Loads an index of db into *index and keeps it current through temp
+ * triggers on db, returns a sqlite3 status code. *index is set even on
+ * error */
+int tag_index_init (sqlite3 *db, Tag_index **index);
+
+/* Frees the index, before db is closed */
+void tag_index_close (Tag_index *index);
+
+/* Drops the index until it is next used, after a rollback */
+void tag_index_invalidate (Tag_index *index);
+
+/* Sets matching to a new set of the items expression picks (free it with
+ * tag_set_free). Tag names are combined with AND, OR, NOT and parentheses,
+ * the keywords in capitals. Returns 1 on success, 0 if it names a tag no
+ * item has ever had, -1 if it cannot be read, -2 if the index cannot be
+ * loaded */
+int tag_index_eval (Tag_index *index, const char *expression,
+                    Tag_set **matching);
+
+/* Copies name with the spaces around it trimmed and those in it squeezed to
+ * one, the form tags are stored in (free it). Returns NULL for a name a
+ * filter could not pick: one with a keyword for a word, or a parenthesis */
+char *tag_index_clean_name (const char *name);
@@ -0,0 +1,711 @@
+/*******************************************************************************
+ * tag_set.c
+ * Compressed sets of item ids, laid out the way roaring bitmaps are: ids are
+ * split on their high 16 bits into containers, and each container holds the
+ * low 16 bits either as a sorted array (up to TAG_SET_ARRAY_MAX of them) or
+ * as a bitmap of all 65536. A tag on a few items costs a few bytes per item,
+ * a tag on most of a million costs 8K per 65536 ids, and both are combined
+ * a container at a time: sorted merges for arrays, 64 ids to a word for
+ * bitmaps.
+ *
+ * Sets are not shared between threads, take a copy (tag_set_copy) for a
+ * worker.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "setup.h"
+#include "tag_set.h"
+
+/* An array container is turned into a bitmap past this many ids, where the
+ * bitmap (1024 words) gets smaller than the array */
+#define TAG_SET_ARRAY_MAX 4096
+
+/* words of a bitmap container */
+#define TAG_SET_WORDS 1024
+
+/* room allocated for a new array container and a new set */
+#define TAG_SET_MIN_ARRAY 4
+#define TAG_SET_MIN_CONTAINERS 4
+
+/* The ids sharing their high 16 bits */
+typedef struct tag_container {
+    uint16_t  key;      /* high 16 bits of every id in it */
+    int       count;    /* ids in it, 0 only while it is being made */
+    int       room;     /* entries array has room for */
+    uint16_t *array;    /* low bits in order, NULL for a bitmap */
+    uint64_t *bits;     /* TAG_SET_WORDS words, NULL for an array */
+} Tag_container;
+
+struct tag_set {
+    Tag_container *containers;  /* sorted by key */
+    int            n_containers;
+    int            capacity;
+};
+
+/* prototypes */
+Tag_set *tag_set_new (void);
+Tag_set *tag_set_copy (const Tag_set *set);
+void tag_set_free (Tag_set *set);
+void tag_set_add (Tag_set *set, int item_id);
+void tag_set_remove (Tag_set *set, int item_id);
+int tag_set_has (const Tag_set *set, int item_id);
+int tag_set_count (const Tag_set *set);
+Tag_set *tag_set_and (const Tag_set *a, const Tag_set *b);
+Tag_set *tag_set_or (const Tag_set *a, const Tag_set *b);
+Tag_set *tag_set_and_not (const Tag_set *a, const Tag_set *b);
+
+/* helpers */
+static int find_container (const Tag_set *set, uint16_t key);
+static void insert_container (Tag_set *set, int pos, Tag_container c);
+static void append_container (Tag_set *set, Tag_container c);
+static void free_container (Tag_container *c);
+static Tag_container new_array (uint16_t key, int room);
+static Tag_container copy_container (const Tag_container *c);
+static int array_position (const Tag_container *c, uint16_t low);
+static int container_has (const Tag_container *c, uint16_t low);
+static int container_add (Tag_container *c, uint16_t low);
+static int container_remove (Tag_container *c, uint16_t low);
+static uint64_t *new_words (void);
+static void fill_words (const Tag_container *c, uint64_t *words);
+static Tag_container from_words (uint16_t key, uint64_t *words);
+static Tag_container and_containers (const Tag_container *a,
+                                     const Tag_container *b);
+static Tag_container or_containers (const Tag_container *a,
+                                    const Tag_container *b);
+static Tag_container and_not_containers (const Tag_container *a,
+                                         const Tag_container *b);
+static void *alloc_or_die (void *grown, const char *where);
+/* end prototypes */
+
+/*
+ * FUNC tag_set_new
+ *   Makes an empty set
+ * NOTE: USES MALLOC, free with tag_set_free
+ */
+Tag_set *tag_set_new (void)
+{
+    Tag_set *set = alloc_or_die (malloc (sizeof (Tag_set)), "tag_set.c 1");
+
+    set->containers = NULL;
+    set->n_containers = 0;
+    set->capacity = 0;
+
+    return set;
+}
+
+/*
+ * FUNC tag_set_copy
+ *   Makes a set of the ids in set
+ * NOTE: USES MALLOC, free with tag_set_free
+ */
+Tag_set *tag_set_copy (const Tag_set *set)
+{
+    Tag_set *copy = tag_set_new ();
+    int i;
+
+    for (i = 0; i < set->n_containers; i++)
+        append_container (copy, copy_container (&set->containers[i]));
+
+    return copy;
+}
+
+/*
+ * FUNC tag_set_free
+ *   Frees set and its containers, NULL is ignored
+ */
+void tag_set_free (Tag_set *set)
+{
+    int i;
+
+    if (set == NULL)
+        return;
+
+    for (i = 0; i < set->n_containers; i++)
+        free_container (&set->containers[i]);
+    free (set->containers);
+    free (set);
+}
+
+/*
+ * FUNC tag_set_add
+ *   Adds item_id to set, an id already in it is left alone
+ */
+void tag_set_add (Tag_set *set, int item_id)
+{
+    uint16_t key = (uint32_t) item_id >> 16;
+    int pos = find_container (set, key);
+
+    if (pos == set->n_containers || set->containers[pos].key != key)
+        insert_container (set, pos, new_array (key, TAG_SET_MIN_ARRAY));
+
+    container_add (&set->containers[pos], (uint16_t) item_id);
+}
+
+/*
+ * FUNC tag_set_remove
+ *   Removes item_id from set, dropping its container once it is empty
+ */
+void tag_set_remove (Tag_set *set, int item_id)
+{
+    uint16_t key = (uint32_t) item_id >> 16;
+    int pos = find_container (set, key);
+    Tag_container *c;
+
+    if (pos == set->n_containers || set->containers[pos].key != key)
+        return;
+
+    c = &set->containers[pos];
+    if (container_remove (c, (uint16_t) item_id) && c->count == 0) {
+        free_container (c);
+        memmove (c, c + 1,
+                 (set->n_containers - pos - 1) * sizeof (Tag_container));
+        set->n_containers--;
+    }
+}
+
+/*
+ * FUNC tag_set_has
+ *   Returns 1 if item_id is in set, 0 if not
+ */
+int tag_set_has (const Tag_set *set, int item_id)
+{
+    uint16_t key = (uint32_t) item_id >> 16;
+    int pos = find_container (set, key);
+
+    if (pos == set->n_containers || set->containers[pos].key != key)
+        return 0;
+
+    return container_has (&set->containers[pos], (uint16_t) item_id);
+}
+
+/*
+ * FUNC tag_set_count
+ *   Returns the number of ids in set
+ */
+int tag_set_count (const Tag_set *set)
+{
+    int count = 0;
+    int i;
+
+    for (i = 0; i < set->n_containers; i++)
+        count += set->containers[i].count;
+
+    return count;
+}
+
+/*
+ * FUNC tag_set_and
+ *   Makes the set of the ids in both a and b, walking their containers in
+ * key order and combining those with the same key
+ * NOTE: USES MALLOC, free with tag_set_free
+ */
+Tag_set *tag_set_and (const Tag_set *a, const Tag_set *b)
+{
+    Tag_set *result = tag_set_new ();
+    int i = 0,
+        j = 0;
+
+    while (i < a->n_containers && j < b->n_containers) {
+        uint16_t ka = a->containers[i].key,
+                 kb = b->containers[j].key;
+
+        if (ka < kb)
+            i++;
+        else if (kb < ka)
+            j++;
+        else
+            append_container (result, and_containers (&a->containers[i++],
+                                                      &b->containers[j++]));
+    }
+
+    return result;
+}
+
+/*
+ * FUNC tag_set_or
+ *   Makes the set of the ids in a or b
+ * NOTE: USES MALLOC, free with tag_set_free
+ */
+Tag_set *tag_set_or (const Tag_set *a, const Tag_set *b)
+{
+    Tag_set *result = tag_set_new ();
+    int i = 0,
+        j = 0;
+
+    while (i < a->n_containers || j < b->n_containers) {
+        if (j == b->n_containers ||
+            (i < a->n_containers &&
+             a->containers[i].key < b->containers[j].key))
+            append_container (result, copy_container (&a->containers[i++]));
+        else if (i == a->n_containers ||
+                 b->containers[j].key < a->containers[i].key)
+            append_container (result, copy_container (&b->containers[j++]));
+        else
+            append_container (result, or_containers (&a->containers[i++],
+                                                     &b->containers[j++]));
+    }
+
+    return result;
+}
+
+/*
+ * FUNC tag_set_and_not
+ *   Makes the set of the ids in a that are not in b
+ * NOTE: USES MALLOC, free with tag_set_free
+ */
+Tag_set *tag_set_and_not (const Tag_set *a, const Tag_set *b)
+{
+    Tag_set *result = tag_set_new ();
+    int i,
+        j = 0;
+
+    for (i = 0; i < a->n_containers; i++) {
+        uint16_t key = a->containers[i].key;
+
+        while (j < b->n_containers && b->containers[j].key < key)
+            j++;
+
+        if (j < b->n_containers && b->containers[j].key == key)
+            append_container (result,
+                              and_not_containers (&a->containers[i],
+                                                  &b->containers[j]));
+        else
+            append_container (result, copy_container (&a->containers[i]));
+    }
+
+    return result;
+}
+
+/*
+ * FUNC find_container
+ *   Returns the position of the first container with a key at or after
+ * key, n_containers if there is none
+ */
+static int find_container (const Tag_set *set, uint16_t key)
+{
+    int lo = 0,
+        hi = set->n_containers;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (set->containers[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * FUNC insert_container
+ *   Inserts c at pos, set takes it over
+ */
+static void insert_container (Tag_set *set, int pos, Tag_container c)
+{
+    if (set->n_containers == set->capacity) {
+        set->capacity = (set->capacity > 0) ? set->capacity * 2
+                                            : TAG_SET_MIN_CONTAINERS;
+        set->containers = alloc_or_die (realloc (set->containers,
+                                        set->capacity * sizeof (Tag_container)),
+                                        "tag_set.c 2");
+    }
+
+    memmove (&set->containers[pos + 1], &set->containers[pos],
+             (set->n_containers - pos) * sizeof (Tag_container));
+    set->containers[pos] = c;
+    set->n_containers++;
+}
+
+/*
+ * FUNC append_container
+ *   Adds c after the containers of set, c must have the highest key. An
+ * empty c is freed instead.
+ */
+static void append_container (Tag_set *set, Tag_container c)
+{
+    if (c.count == 0) {
+        free_container (&c);
+        return;
+    }
+
+    insert_container (set, set->n_containers, c);
+}
+
+/*
+ * FUNC free_container
+ *   Frees the array or bitmap of c
+ */
+static void free_container (Tag_container *c)
+{
+    free (c->array);
+    free (c->bits);
+    c->array = NULL;
+    c->bits = NULL;
+}
+
+/*
+ * FUNC new_array
+ *   Makes an empty array container with room for room ids
+ */
+static Tag_container new_array (uint16_t key, int room)
+{
+    Tag_container c;
+
+    if (room < TAG_SET_MIN_ARRAY)
+        room = TAG_SET_MIN_ARRAY;
+
+    c.key   = key;
+    c.count = 0;
+    c.room  = room;
+    c.array = alloc_or_die (malloc (room * sizeof (uint16_t)), "tag_set.c 3");
+    c.bits  = NULL;
+
+    return c;
+}
+
+/*
+ * FUNC copy_container
+ *   Makes a container holding what c holds
+ */
+static Tag_container copy_container (const Tag_container *c)
+{
+    Tag_container copy;
+
+    if (c->bits != NULL) {
+        copy = *c;
+        copy.bits = new_words ();
+        memcpy (copy.bits, c->bits, TAG_SET_WORDS * sizeof (uint64_t));
+        return copy;
+    }
+
+    copy = new_array (c->key, c->count);
+    memcpy (copy.array, c->array, c->count * sizeof (uint16_t));
+    copy.count = c->count;
+
+    return copy;
+}
+
+/*
+ * FUNC array_position
+ *   Returns the position of the first low bits at or after low in the array
+ * container c
+ */
+static int array_position (const Tag_container *c, uint16_t low)
+{
+    int lo = 0,
+        hi = c->count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (c->array[mid] < low)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * FUNC container_has
+ *   Returns 1 if c holds the low bits low, 0 if not
+ */
+static int container_has (const Tag_container *c, uint16_t low)
+{
+    int pos;
+
+    if (c->bits != NULL)
+        return (c->bits[low >> 6] >> (low & 63)) & 1;
+
+    pos = array_position (c, low);
+    return pos < c->count && c->array[pos] == low;
+}
+
+/*
+ * FUNC container_add
+ *   Adds low to c, turning a full array into a bitmap
+ * Returns 1 if it was added, 0 if it was there already
+ */
+static int container_add (Tag_container *c, uint16_t low)
+{
+    int pos;
+
+    if (c->bits == NULL && c->count == TAG_SET_ARRAY_MAX) {
+        uint64_t *words;
+
+        if (container_has (c, low))
+            return 0;
+
+        words = new_words ();
+        fill_words (c, words);
+        free (c->array);
+        c->array = NULL;
+        c->bits = words;
+    }
+
+    if (c->bits != NULL) {
+        uint64_t bit = (uint64_t) 1 << (low & 63);
+
+        if (c->bits[low >> 6] & bit)
+            return 0;
+        c->bits[low >> 6] |= bit;
+        c->count++;
+        return 1;
+    }
+
+    pos = array_position (c, low);
+    if (pos < c->count && c->array[pos] == low)
+        return 0;
+
+    if (c->count == c->room) {
+        c->room *= 2;
+        c->array = alloc_or_die (realloc (c->array,
+                                          c->room * sizeof (uint16_t)),
+                                 "tag_set.c 4");
+    }
+
+    memmove (&c->array[pos + 1], &c->array[pos],
+             (c->count - pos) * sizeof (uint16_t));
+    c->array[pos] = low;
+    c->count++;
+
+    return 1;
+}
+
+/*
+ * FUNC container_remove
+ *   Removes low from c, turning a bitmap that got small back into an array
+ * Returns 1 if it was removed, 0 if it was not there
+ */
+static int container_remove (Tag_container *c, uint16_t low)
+{
+    int pos;
+
+    if (c->bits != NULL) {
+        uint64_t bit = (uint64_t) 1 << (low & 63);
+
+        if (!(c->bits[low >> 6] & bit))
+            return 0;
+        c->bits[low >> 6] &= ~bit;
+        c->count--;
+
+        if (c->count <= TAG_SET_ARRAY_MAX / 2)
+            *c = from_words (c->key, c->bits);
+        return 1;
+    }
+
+    pos = array_position (c, low);
+    if (pos == c->count || c->array[pos] != low)
+        return 0;
+
+    memmove (&c->array[pos], &c->array[pos + 1],
+             (c->count - pos - 1) * sizeof (uint16_t));
+    c->count--;
+
+    return 1;
+}
+
+/*
+ * FUNC new_words
+ *   Allocates a cleared bitmap
+ */
+static uint64_t *new_words (void)
+{
+    return alloc_or_die (calloc (TAG_SET_WORDS, sizeof (uint64_t)),
+                         "tag_set.c 5");
+}
+
+/*
+ * FUNC fill_words
+ *   Sets the bits of the ids in c in words
+ */
+static void fill_words (const Tag_container *c, uint64_t *words)
+{
+    int i;
+
+    if (c->bits != NULL) {
+        for (i = 0; i < TAG_SET_WORDS; i++)
+            words[i] |= c->bits[i];
+        return;
+    }
+
+    for (i = 0; i < c->count; i++)
+        words[c->array[i] >> 6] |= (uint64_t) 1 << (c->array[i] & 63);
+}
+
+/*
+ * FUNC from_words
+ *   Makes a container of the ids set in words, taking words over. Few ids
+ * go into an array and words is freed, many keep the bitmap.
+ */
+static Tag_container from_words (uint16_t key, uint64_t *words)
+{
+    Tag_container c;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < TAG_SET_WORDS; i++)
+        count += __builtin_popcountll (words[i]);
+
+    if (count > TAG_SET_ARRAY_MAX) {
+        c.key   = key;
+        c.count = count;
+        c.room  = 0;
+        c.array = NULL;
+        c.bits  = words;
+        return c;
+    }
+
+    c = new_array (key, count);
+    for (i = 0; i < TAG_SET_WORDS; i++) {
+        uint64_t word = words[i];
+
+        while (word != 0) {
+            c.array[c.count++] = i * 64 + __builtin_ctzll (word);
+            word &= word - 1;
+        }
+    }
+    free (words);
+
+    return c;
+}
+
+/*
+ * FUNC and_containers
+ *   Makes the container of the ids in both a and b (same key). An array is
+ * merged with an array and looked up in a bitmap, two bitmaps are combined
+ * word by word.
+ */
+static Tag_container and_containers (const Tag_container *a,
+                                     const Tag_container *b)
+{
+    Tag_container c;
+    int i, j;
+
+    if (a->bits != NULL && b->bits != NULL) {
+        uint64_t *words = new_words ();
+
+        for (i = 0; i < TAG_SET_WORDS; i++)
+            words[i] = a->bits[i] & b->bits[i];
+        return from_words (a->key, words);
+    }
+
+    /* keep the array in a */
+    if (a->bits != NULL) {
+        const Tag_container *swap = a;
+        a = b;
+        b = swap;
+    }
+
+    c = new_array (a->key, a->count);
+
+    if (b->bits != NULL) {
+        for (i = 0; i < a->count; i++)
+            if (container_has (b, a->array[i]))
+                c.array[c.count++] = a->array[i];
+        return c;
+    }
+
+    for (i = 0, j = 0; i < a->count && j < b->count; ) {
+        if (a->array[i] < b->array[j])
+            i++;
+        else if (b->array[j] < a->array[i])
+            j++;
+        else {
+            c.array[c.count++] = a->array[i];
+            i++;
+            j++;
+        }
+    }
+
+    return c;
+}
+
+/*
+ * FUNC or_containers
+ *   Makes the container of the ids in a or b (same key). Two arrays that
+ * fit in one are merged, anything bigger goes through a bitmap.
+ */
+static Tag_container or_containers (const Tag_container *a,
+                                    const Tag_container *b)
+{
+    Tag_container c;
+    uint64_t *words;
+    int i, j;
+
+    if (a->bits == NULL && b->bits == NULL &&
+        a->count + b->count <= TAG_SET_ARRAY_MAX) {
+        c = new_array (a->key, a->count + b->count);
+
+        for (i = 0, j = 0; i < a->count || j < b->count; ) {
+            if (j == b->count ||
+                (i < a->count && a->array[i] < b->array[j]))
+                c.array[c.count++] = a->array[i++];
+            else if (i == a->count || b->array[j] < a->array[i])
+                c.array[c.count++] = b->array[j++];
+            else {
+                c.array[c.count++] = a->array[i++];
+                j++;
+            }
+        }
+        return c;
+    }
+
+    words = new_words ();
+    fill_words (a, words);
+    fill_words (b, words);
+
+    return from_words (a->key, words);
+}
+
+/*
+ * FUNC and_not_containers
+ *   Makes the container of the ids in a that are not in b (same key)
+ */
+static Tag_container and_not_containers (const Tag_container *a,
+                                         const Tag_container *b)
+{
+    Tag_container c;
+    uint64_t *words;
+    int i;
+
+    if (a->bits == NULL) {
+        c = new_array (a->key, a->count);
+        for (i = 0; i < a->count; i++)
+            if (!container_has (b, a->array[i]))
+                c.array[c.count++] = a->array[i];
+        return c;
+    }
+
+    words = new_words ();
+    memcpy (words, a->bits, TAG_SET_WORDS * sizeof (uint64_t));
+
+    if (b->bits != NULL)
+        for (i = 0; i < TAG_SET_WORDS; i++)
+            words[i] &= ~b->bits[i];
+    else
+        for (i = 0; i < b->count; i++)
+            words[b->array[i] >> 6] &= ~((uint64_t) 1 << (b->array[i] & 63));
+
+    return from_words (a->key, words);
+}
+
+/*
+ * FUNC alloc_or_die
+ *   Returns grown, the result of an allocation, or exits if it failed
+ */
+static void *alloc_or_die (void *grown, const char *where)
+{
+    if (grown == NULL) {
+        fprintf (stderr, MEM_FAIL_IN "%s\n", where);
+        exit (EXIT_FAILURE);
+    }
+    return grown;
+}
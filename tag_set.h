@@ -0,0 +1,27 @@
+/*******************************************************************************
+ * tag_set.h
+ * Header for the compressed sets of item ids the tag index (see
+ * tag_index.c) keeps for every tag and combines to answer tag filters.
+ *
+ ******************************************************************************/
+
+/* Item ids, see tag_set.c */
+typedef struct tag_set Tag_set;
+
+/* A new empty set, free it with tag_set_free */
+Tag_set *tag_set_new (void);
+Tag_set *tag_set_copy (const Tag_set *set);
+void tag_set_free (Tag_set *set);
+
+/* Adds or removes one item id (ids are positive) */
+void tag_set_add (Tag_set *set, int item_id);
+void tag_set_remove (Tag_set *set, int item_id);
+
+/* Returns 1 if item_id is in set, 0 if not */
+int tag_set_has (const Tag_set *set, int item_id);
+int tag_set_count (const Tag_set *set);
+
+/* New sets of the ids in both a and b, in either, in a but not in b */
+Tag_set *tag_set_and (const Tag_set *a, const Tag_set *b);
+Tag_set *tag_set_or (const Tag_set *a, const Tag_set *b);
+Tag_set *tag_set_and_not (const Tag_set *a, const Tag_set *b);
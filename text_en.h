@@ -31,7 +31,7 @@
 // NOTE: these are not currently being used 
 #define DESC_LIMIT 101
 #define FREQ_TYPE_LIMIT 7
-#define CATEGORY_LIMIT 21
+#define CATEGORY_LIMIT 61
 
 /******* For init.c *******/
 #define FATAL_DB_ERROR_NO_ACCESS "Fatal error: cannot access database\n"
@@ -39,6 +39,12 @@
 /******* For main_view.c *******/
 
 #define TODAY_VIEW_HEADING "Today's Items"
+#define ROWS_LOADED "%d items loaded..."
+#define ALL_CATEGORIES "All categories"
+#define TAG_FILTER_HINT "Filter by tags"
+#define TAG_FILTER_TOOLTIP "Tag names joined by AND, OR and NOT, for example\ncrew A AND quarterly AND NOT outdoor\nPress enter to filter, clear it to see every item."
+#define NO_SUCH_TAG "No item has ever had one of those tags."
+#define TAG_FILTER_INVALID "Join tag names with AND, OR and NOT (in capitals)\nand close every parenthesis."
 
 #define DESCRIPTION "Description"
 
@@ -56,6 +62,8 @@
 
 #define LOOK_AHEAD_OR_BACK "look ahead / back"
 
+#define EVERY_SITE "every site"
+
 #define SNOOZE "snooze"
 
 #define MARK_COMPLETED "mark completed"
@@ -112,6 +120,7 @@
 #define DAY "day"
 #define WEEK "week"
 #define MONTH "month"
+#define AT_EVERY_SITE "at every site"
 // Uses BACK
 // Uses MONTHS
 // Uses INVALID_DATE
@@ -129,12 +138,37 @@
 #define NO_ITEMS_IN_RANGE "No items to display in selected range" 
 #define ITEMS_DUE_IN_RANGE  "Items due in range selected"
 #define ITEMS_COMPLETED_IN_RANGE "Items completed in range selected"
+#define LOADING_ITEMS "Loading items..."
+
+/******* For use in sites_view.c *******/
+#define SITE "Site"
+#define DUE_AT_EVERY_SITE "Due at every site"
+#define SITES_FAIL "Unable to open the db of every site."
+// Uses ITEMS_DUE_IN_RANGE, ITEMS_COMPLETED_IN_RANGE
 
 /******* For use in edit_select_view *******/
 #define SELECT "select"
 #define REPEAT_EVERY "Repeat every"
+#define BULK_EDIT "bulk edit"
 // Uses TRACK_HISTORY
 
+/******* For use in bulk_view.c *******/
+#define BULK_EDIT_HEADING "Change every upcoming item that matches:"
+#define ANY "any"
+#define DUE_FROM "Due from"
+#define MOVE_DUE_DATES_BY "Move their due dates by"
+#define MOVE "move"
+#define NO_ITEMS_MATCH "No upcoming items match."
+#define BULK_EDIT_CONFIRM "This will change %d items. Go ahead?"
+#define RENAME_CATEGORY_TO "Rename the category to"
+#define RENAME "rename"
+#define NO_SUCH_CATEGORY "Type the name of an existing category and a new name\nthat is neither above nor under it."
+#define PURGE_MATCHING "Remove them and all their history"
+#define PURGE "purge"
+#define BULK_PURGE_CONFIRM "This will permanently remove %d items and all their history. Go ahead?"
+// Uses CATEGORY, TO, REPEAT_EVERY, EVERY, CHANGE_FREQ, START_BEFORE_END
+// Uses CANNOT_HAVE_APOSTROPHES, DATABASE_PURGE_ITEM_FAIL
+
 
 /******* For use in selected_view.c *******/
 #define UPDATE_COMPLETED "Update completed"
@@ -145,11 +179,16 @@
 #define EVERY "Every"
 #define CHANGE_FREQ "change frequency"
 #define CHANGE_CATEGORY "change category"
+#define TAGS "Tags"
+#define CHANGE_TAGS "change tags"
+#define TAGS_INVALID "Separate tags with commas. A tag cannot have parentheses\nor AND, OR or NOT as a word."
 #define REMOVE_FROM_UPCOMING "remove from upcoming"
 #define REMOVE_AND_DELETE_HIST "Remove item and delete history"
 #define PURGE_WARN "Are you sure you want to remove all item data?" 
 #define PERMANENTLY_REMOVE "Permanently delete item and history"
 #define PURGE_ITEM "purge item"
+#define COMPLETED_TIMES "Completed %d times, last on %s"
+#define ON_AVERAGE_EVERY ", about every %.1f days"
 
 /******* For database error handling and success *******/
 #define FATAL_ERROR "Error: Fatal error encountred."
@@ -175,6 +214,23 @@
 #define DATABASE_PURGE_ITEM_FAIL "ERROR: Something went wrong when purging the item\nThe database may be seriously corrupted.\nPlease correct it before proceeding."
 #define DATABASE_ATTRIBUTES_MODEL_FAIL "Fatal Error: Unable to load attrubutes model"
 #define DATABASE_MARK_COMPLETE_FAIL "Failed to mark item as complete."
+#define DATABASE_MIGRATION_FAIL "Error: Failed to upgrade database to schema version %d.\n"
+#define DATABASE_LOAD_HIST_PAGE_FAIL "Error: Unable to load more history."
+#define DATABASE_CATEGORY_COUNTS_FAIL "Error: Unable to count the items due in each category.\n"
+#define DATABASE_TAGS_FAIL "Error: Unable to change the tags of the item."
+#define DATABASE_GET_TAGS_FAIL "Error: Unable to load the tags of the item.\n"
+#define DATABASE_TAG_INDEX_FAIL "Error: Unable to load the tag index, tag filters are off.\n"
+#define DATABASE_VACUUM_FAIL "Error: Unable to set the database up to shrink after purges.\n"
+#define DATABASE_VACUUM_DONE "Database: %" G_GINT64_FORMAT " bytes before, %" G_GINT64_FORMAT " after, shrinks after purges"
+#define DATABASE_ARCHIVE_FAIL "Error: Unable to archive old completions, history is kept as is.\n"
+#define FEDERATION_SITE_OLD "Error: The db of site %s is at another schema version than this program, it is left out until the program there is updated.\n"
+#define FEDERATION_LOAD_FAIL "Error: Unable to load the items of site %s.\n"
+#define PREFETCH_STATS "Prefetch: %d hits, %d misses"
+#define MAINTENANCE_STATS "Maintenance: %d -> %d pages (%d -> %d free), %d completions archived, main view query %.2f -> %.2f ms, longest step %.2f ms"
+#define MAINTENANCE_GAVE_UP "Maintenance: stopped at step %d, %s"
+#define CONFIG_FILE_FAIL "Error: Unable to read the config file %s (%s), using the defaults.\n"
+#define CONFIG_BAD_VALUE "Error: Ignoring \"%s\" for %s (from %s), it is not a valid value.\n"
+#define CONFIG_REPORT "Settings: database %s, archive %s, snapshot %s, history kept %d days, cache_size %" G_GINT64_FORMAT ", mmap_size %" G_GINT64_FORMAT ", synchronous %s, journal_mode %s, soft heap limit %" G_GINT64_FORMAT ", sites %s"
 
 
 /******* For memory allocation error handling *******/